@@ -0,0 +1,245 @@
+#include "bench_common.h"
+
+#include "allocator.h"
+#include "allocator_trace.h"
+#include "mmap_allocator.h"
+#include "page_allocator.h"
+#include "thread_cache_allocator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+ * Replays an allocation trace (see allocator_trace.h) against each allocator backend and
+ * reports throughput, peak RSS and fragmentation, where fragmentation is the peak RSS
+ * growth over the peak of live requested bytes. Each backend runs in its own forked
+ * process so that RSS high-water marks don't carry over.
+ *
+ * Usage: allocator_replay [trace]. Without a trace file, a synthetic multi-threaded
+ * workload is recorded first and replayed.
+ *
+ * Events are replayed on one thread, in timestamp order; cross-thread frees in the
+ * trace become same-thread frees in the replay.
+ * */
+
+namespace {
+
+	std::vector<rstl::allocation_trace_record> load_trace(const char* pPath)
+	{
+		std::vector<rstl::allocation_trace_record> records;
+
+		FILE* const pFile = std::fopen(pPath, "rb");
+		if(!pFile)
+		{
+			return records;
+		}
+
+		char magic[sizeof(rstl::kAllocationTraceMagic)];
+		if((std::fread(magic, 1, sizeof(magic), pFile) == sizeof(magic)) && (std::memcmp(magic, rstl::kAllocationTraceMagic, sizeof(magic)) == 0))
+		{
+			rstl::allocation_trace_record record;
+			while(std::fread(&record, sizeof(record), 1, pFile) == 1)
+			{
+				records.push_back(record);
+			}
+		}
+		std::fclose(pFile);
+
+		std::stable_sort(records.begin(), records.end(), [](const rstl::allocation_trace_record& a, const rstl::allocation_trace_record& b)
+		{
+			return a.mTimestamp < b.mTimestamp;
+		});
+		return records;
+	}
+
+	// A request-shaped workload: per-request scratch buffers, some long-lived objects and the occasional large table.
+	void record_synthetic_trace(const char* pPath)
+	{
+		rstl::start_allocation_trace(pPath);
+
+		std::vector<std::thread> threads;
+		for(uint32_t t = 0; t < 4; ++t)
+		{
+			threads.emplace_back([t]
+			{
+				rstl::traced_allocator<rstl::allocator> allocator;
+				std::vector<std::pair<void*, size_t>> longLived;
+				uint32_t seed = 12345 + t;
+
+				for(size_t request = 0; request < 2000; ++request)
+				{
+					std::pair<void*, size_t> scratch[32];
+					for(std::pair<void*, size_t>& s : scratch)
+					{
+						seed = (seed * 1103515245) + 12345;
+						s.second = 16 + ((seed >> 8) % 480);
+						s.first = allocator.allocate(s.second);
+					}
+
+					seed = (seed * 1103515245) + 12345;
+					const size_t size = ((seed >> 8) % 64 == 0) ? (2 * 1024 * 1024) : (32 + ((seed >> 8) % 96));
+					longLived.emplace_back(allocator.allocate(size), size);
+					if(longLived.size() > 512)
+					{
+						allocator.deallocate(longLived.front().first, longLived.front().second);
+						longLived.erase(longLived.begin());
+					}
+
+					for(std::pair<void*, size_t>& s : scratch)
+					{
+						allocator.deallocate(s.first, s.second);
+					}
+				}
+
+				for(std::pair<void*, size_t>& l : longLived)
+				{
+					allocator.deallocate(l.first, l.second);
+				}
+				rstl::flush_allocation_trace();
+			});
+		}
+		for(std::thread& thread : threads)
+		{
+			thread.join();
+		}
+
+		rstl::stop_allocation_trace();
+	}
+
+	size_t read_status_kb(const char* pField)
+	{
+		FILE* const pFile = std::fopen("/proc/self/status", "r");
+		if(!pFile)
+		{
+			return 0;
+		}
+
+		size_t value = 0;
+		char line[256];
+		const size_t fieldLength = std::strlen(pField);
+		while(std::fgets(line, sizeof(line), pFile))
+		{
+			if(std::strncmp(line, pField, fieldLength) == 0)
+			{
+				value = (size_t)std::strtoull(line + fieldLength, nullptr, 10);
+				break;
+			}
+		}
+		std::fclose(pFile);
+		return value;
+	}
+
+	template <typename Allocator>
+	void replay(const char* pName, const std::vector<rstl::allocation_trace_record>& records, Allocator allocator)
+	{
+		std::unordered_map<uint64_t, std::pair<void*, size_t>> live;
+		live.reserve(records.size());
+
+		const size_t baselineKb = read_status_kb("VmRSS:");
+		size_t liveBytes = 0;
+		size_t peakLiveBytes = 0;
+		size_t failures = 0;
+
+		const auto begin = std::chrono::steady_clock::now();
+		for(const rstl::allocation_trace_record& r : records)
+		{
+			if(r.mKind == rstl::TRACE_ALLOCATE)
+			{
+				char* const p = static_cast<char*>((r.mAlignmentLog2 == rstl::kTraceAlignmentUnspecified)
+					? allocator.allocate((size_t)r.mSize, r.mFlags)
+					: allocator.allocate((size_t)r.mSize, (size_t)1 << r.mAlignmentLog2, 0, r.mFlags));
+				if(!p)
+				{
+					++failures;
+					continue;
+				}
+
+				// Touch every page so the block counts towards RSS, as it would in real use.
+				for(size_t offset = 0; offset < r.mSize; offset += 4096)
+				{
+					p[offset] = 1;
+				}
+
+				live[r.mAddress] = std::make_pair((void*)p, (size_t)r.mSize);
+				liveBytes += r.mSize;
+				peakLiveBytes = std::max(peakLiveBytes, liveBytes);
+			}
+			else
+			{
+				auto it = live.find(r.mAddress);
+				if(it != live.end()) // Blocks allocated before the trace started have no entry.
+				{
+					allocator.deallocate(it->second.first, it->second.second);
+					liveBytes -= it->second.second;
+					live.erase(it);
+				}
+			}
+		}
+		const auto end = std::chrono::steady_clock::now();
+
+		const double seconds = std::chrono::duration<double>(end - begin).count();
+		const size_t peakKb = read_status_kb("VmHWM:");
+		const double growthBytes = (peakKb > baselineKb) ? (double)(peakKb - baselineKb) * 1024.0 : 0.0;
+
+		std::printf("%-28s %10.2f Mev/s %10.1f MB peak RSS %8.2f frag %8zu failed\n",
+		            pName,
+		            (double)records.size() / seconds / 1e6,
+		            (double)peakKb / 1024.0,
+		            peakLiveBytes ? (growthBytes / (double)peakLiveBytes) : 0.0,
+		            failures);
+	}
+
+	template <typename Allocator>
+	void replay_in_child(const char* pName, const std::vector<rstl::allocation_trace_record>& records, const Allocator& allocator)
+	{
+		std::fflush(stdout);
+		const pid_t pid = ::fork();
+		if(pid == 0)
+		{
+			replay(pName, records, allocator);
+			std::fflush(stdout);
+			::_exit(0);
+		}
+		else if(pid > 0)
+		{
+			int status = 0;
+			::waitpid(pid, &status, 0);
+		}
+		else
+		{
+			replay(pName, records, allocator);
+		}
+	}
+
+}
+
+int main(int argc, char* argv[])
+{
+	const char* pPath = (argc > 1) ? argv[1] : "allocator_replay.trace";
+	if(argc <= 1)
+	{
+		record_synthetic_trace(pPath);
+	}
+
+	const std::vector<rstl::allocation_trace_record> records = load_trace(pPath);
+	if(records.empty())
+	{
+		std::fprintf(stderr, "%s: no trace records in %s\n", argv[0], pPath);
+		return 1;
+	}
+	std::printf("%zu events from %s\n", records.size(), pPath);
+
+	replay_in_child("rstl::allocator", records, rstl::allocator());
+	replay_in_child("rstl::pool_allocator", records, rstl::pool_allocator());
+	replay_in_child("rstl::thread_cache_allocator", records, rstl::thread_cache_allocator());
+	replay_in_child("rstl::page_allocator", records, rstl::page_allocator());
+	replay_in_child("rstl::mmap_allocator", records, rstl::mmap_allocator());
+	return 0;
+}
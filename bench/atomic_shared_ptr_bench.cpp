@@ -0,0 +1,96 @@
+#include "bench_common.h"
+
+#include "atomic_shared_ptr.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+/*
+ * Config-snapshot reads: reader threads load the current snapshot in a loop while one
+ * writer publishes a new one every 100us. Compares the mutex-based free atomic_load
+ * with atomic_shared_ptr::load; times are per load per reader thread.
+ * */
+
+namespace {
+
+	const size_t kIterations = 1000000;
+
+	struct config
+	{
+		int mVersion;
+		int mLimits[15];
+
+		explicit config(int version) : mVersion(version), mLimits() { }
+	};
+
+	template <typename Load, typename Store>
+	double run_readers(size_t threadCount, Load load, Store store)
+	{
+		std::atomic<bool> go(false);
+		std::atomic<bool> done(false);
+
+		std::thread writer([&]
+		{
+			while(!go.load())
+			{
+				std::this_thread::yield();
+			}
+			for(int version = 1; !done.load(); ++version)
+			{
+				store(rstl::make_shared<config>(version));
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+			}
+		});
+
+		std::vector<std::thread> readers;
+		for(size_t t = 0; t < threadCount; ++t)
+		{
+			readers.emplace_back([&]
+			{
+				while(!go.load())
+				{
+					std::this_thread::yield();
+				}
+				for(size_t i = 0; i < kIterations; ++i)
+				{
+					rstl::shared_ptr<config> snapshot = load();
+					rstl_bench::do_not_optimize(snapshot->mVersion);
+				}
+			});
+		}
+
+		const auto begin = std::chrono::steady_clock::now();
+		go.store(true);
+		for(std::thread& reader : readers)
+		{
+			reader.join();
+		}
+		const auto end = std::chrono::steady_clock::now();
+		done.store(true);
+		writer.join();
+		return std::chrono::duration<double, std::nano>(end - begin).count() / (double)kIterations;
+	}
+
+}
+
+int main()
+{
+	std::printf("%8s %16s %20s\n", "readers", "atomic_load", "atomic_shared_ptr");
+	for(size_t threadCount = 1; threadCount <= 16; threadCount *= 2)
+	{
+		rstl::shared_ptr<config> plain = rstl::make_shared<config>(0);
+		const double locked = run_readers(threadCount,
+			[&] { return rstl::atomic_load(&plain); },
+			[&](rstl::shared_ptr<config> p) { rstl::atomic_store(&plain, std::move(p)); });
+
+		rstl::atomic_shared_ptr<config> slot(rstl::make_shared<config>(0));
+		const double lockFree = run_readers(threadCount,
+			[&] { return slot.load(); },
+			[&](rstl::shared_ptr<config> p) { slot.store(std::move(p)); });
+
+		std::printf("%8zu %13.2f ns %17.2f ns\n", threadCount, locked, lockFree);
+	}
+	return 0;
+}
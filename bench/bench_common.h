@@ -0,0 +1,43 @@
+#ifndef RSTL_BENCH_COMMON_H
+#define RSTL_BENCH_COMMON_H
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+
+namespace rstl_bench {
+
+	/*
+	 * Runs f(i) for i in [0, iterations) and returns the average time per iteration in nanoseconds.
+	 * */
+	template <typename F>
+	double time_per_op_ns(size_t iterations, F&& f)
+	{
+		const auto begin = std::chrono::steady_clock::now();
+		for(size_t i = 0; i < iterations; ++i)
+		{
+			f(i);
+		}
+		const auto end = std::chrono::steady_clock::now();
+		return std::chrono::duration<double, std::nano>(end - begin).count() / (double)iterations;
+	}
+
+	inline void report(const char* pName, double nsPerOp)
+	{
+		std::printf("%-48s %10.2f ns/op\n", pName, nsPerOp);
+	}
+
+	/*
+	 * Prevents the compiler from optimising away a value computed by a benchmark loop.
+	 * */
+	template <typename T>
+	inline void do_not_optimize(const T& value)
+	{
+		asm volatile("" : : "r,m"(value) : "memory");
+	}
+
+}
+
+#endif //RSTL_BENCH_COMMON_H
@@ -0,0 +1,48 @@
+#include "bench_common.h"
+
+#include "biased_shared_ptr.h"
+
+#include <thread>
+
+/*
+ * Copy/destroy of a shared_ptr from make_shared and from make_biased_shared:
+ *  - owner:     on the creating thread, where the biased block avoids atomics.
+ *  - non-owner: on another thread, where the biased block takes its slower path.
+ * */
+
+namespace {
+
+	const size_t kIterations = 20000000;
+
+	template <typename Ptr>
+	double copy_loop(const Ptr& source)
+	{
+		return rstl_bench::time_per_op_ns(kIterations, [&](size_t)
+		{
+			Ptr copy(source);
+			rstl_bench::do_not_optimize(copy.get());
+		});
+	}
+
+}
+
+int main()
+{
+	const rstl::shared_ptr<int> shared = rstl::make_shared<int>(1);
+	const rstl::shared_ptr<int> biased = rstl::make_biased_shared<int>(1);
+
+	rstl_bench::report("owner      make_shared", copy_loop(shared));
+	rstl_bench::report("owner      make_biased_shared", copy_loop(biased));
+
+	double sharedOther = 0.0;
+	double biasedOther = 0.0;
+	std::thread other([&]
+	{
+		sharedOther = copy_loop(shared);
+		biasedOther = copy_loop(biased);
+	});
+	other.join();
+	rstl_bench::report("non-owner  make_shared", sharedOther);
+	rstl_bench::report("non-owner  make_biased_shared", biasedOther);
+	return 0;
+}
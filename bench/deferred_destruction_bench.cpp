@@ -0,0 +1,81 @@
+#include "bench_common.h"
+
+#include "shared_ptr.h"
+
+#include <vector>
+
+/*
+ * Time taken by the thread that drops the last reference to a tree of shared_ptrs,
+ * with the tree's nodes destroyed inline and on the default reclaimer:
+ *  - release: the reset() itself, which is what a latency-critical thread pays.
+ *  - flush:   the time until the reclaimer has destroyed everything queued.
+ * */
+
+namespace {
+
+	template <bool Deferred>
+	struct tree_node
+	{
+		std::vector<rstl::shared_ptr<tree_node>> mChildren;
+		char mPayload[64];
+	};
+
+	const size_t kTrees = 200;
+	const size_t kFanOut = 8;
+	const size_t kDepth = 4;
+
+	template <bool Deferred>
+	rstl::shared_ptr<tree_node<Deferred>> build(size_t depth)
+	{
+		rstl::shared_ptr<tree_node<Deferred>> pNode = rstl::make_shared<tree_node<Deferred>>();
+		if(depth > 0)
+		{
+			for(size_t i = 0; i < kFanOut; ++i)
+			{
+				pNode->mChildren.push_back(build<Deferred>(depth - 1));
+			}
+		}
+		return pNode;
+	}
+
+	template <bool Deferred>
+	void run(const char* pName)
+	{
+		std::vector<rstl::shared_ptr<tree_node<Deferred>>> trees;
+		for(size_t i = 0; i < kTrees; ++i)
+		{
+			trees.push_back(build<Deferred>(kDepth));
+		}
+
+		char name[64];
+		std::snprintf(name, sizeof(name), "release  %s", pName);
+		rstl_bench::report(name, rstl_bench::time_per_op_ns(kTrees, [&](size_t i)
+		{
+			trees[i].reset();
+		}));
+
+		std::snprintf(name, sizeof(name), "flush    %s", pName);
+		rstl_bench::report(name, rstl_bench::time_per_op_ns(1, [](size_t)
+		{
+			// Each flush can expose the children of the nodes it destroyed.
+			while(rstl::get_default_reclaimer().pending() != 0)
+			{
+				rstl::flush_deferred_destruction();
+			}
+		}) / (double)kTrees);
+	}
+
+}
+
+template <>
+struct rstl::defer_destruction<tree_node<true>> : std::true_type
+{
+};
+
+int main()
+{
+	run<false>("inline");
+	run<true>("deferred");
+	rstl::drain_deferred_destruction();
+	return 0;
+}
@@ -0,0 +1,132 @@
+#include "bench_common.h"
+
+#include "atomic_shared_ptr.h"
+#include "epoch_reclaimer.h"
+#include "shared_ptr.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+/*
+ * Read-side cost of a read-mostly configuration object, from 1 to 64 threads:
+ *  - copy:   each read copies one shared_ptr that never changes, so every reader
+ *            increments and decrements the same count.
+ *  - atomic: each read loads an atomic_shared_ptr to the current config.
+ *  - epoch:  each read pins the default epoch domain and loads a raw pointer.
+ * For atomic and epoch one extra thread replaces the config every 100us, retiring
+ * the old one through the epoch domain in the second case.
+ * */
+
+namespace {
+
+	const size_t kIterations = 2000000;
+
+	struct config
+	{
+		uint64_t mVersion;
+		uint64_t mLimits[7];
+
+		explicit config(uint64_t version) : mVersion(version), mLimits() { }
+	};
+
+	// Runs body(threadIndex) on threadCount threads plus writer(stop) on one more; returns nanoseconds per iteration per thread.
+	template <typename Body, typename Writer>
+	double run_threads(size_t threadCount, Body body, Writer writer)
+	{
+		std::atomic<bool> go(false);
+		std::atomic<bool> stop(false);
+		std::vector<std::thread> threads;
+		for(size_t t = 0; t < threadCount; ++t)
+		{
+			threads.emplace_back([&, t]
+			{
+				while(!go.load())
+				{
+					std::this_thread::yield();
+				}
+				body(t);
+			});
+		}
+		std::thread writerThread([&] { writer(stop); });
+
+		const auto begin = std::chrono::steady_clock::now();
+		go.store(true);
+		for(std::thread& thread : threads)
+		{
+			thread.join();
+		}
+		const auto end = std::chrono::steady_clock::now();
+		stop.store(true);
+		writerThread.join();
+		return std::chrono::duration<double, std::nano>(end - begin).count() / (double)kIterations;
+	}
+
+}
+
+int main()
+{
+	std::printf("%8s %14s %14s %14s\n", "threads", "copy", "atomic", "epoch");
+	for(size_t threadCount = 1; threadCount <= 64; threadCount *= 2)
+	{
+		const rstl::shared_ptr<config> stableConfig = rstl::make_shared<config>(0);
+		const double copy = run_threads(threadCount, [&](size_t)
+		{
+			uint64_t sum = 0;
+			for(size_t i = 0; i < kIterations; ++i)
+			{
+				const rstl::shared_ptr<config> current(stableConfig);
+				sum += current->mVersion;
+			}
+			rstl_bench::do_not_optimize(sum);
+		},
+		[](std::atomic<bool>&) { });
+
+		rstl::atomic_shared_ptr<config> atomicConfig(rstl::make_shared<config>(0));
+		const double atomic = run_threads(threadCount, [&](size_t)
+		{
+			uint64_t sum = 0;
+			for(size_t i = 0; i < kIterations; ++i)
+			{
+				const rstl::shared_ptr<config> current = atomicConfig.load();
+				sum += current->mVersion;
+			}
+			rstl_bench::do_not_optimize(sum);
+		},
+		[&](std::atomic<bool>& stop)
+		{
+			for(uint64_t version = 1; !stop.load(); ++version)
+			{
+				atomicConfig.store(rstl::make_shared<config>(version));
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+			}
+		});
+
+		std::atomic<config*> epochConfig(new config(0));
+		rstl::epoch_domain& domain = rstl::get_default_epoch_domain();
+		const double epoch = run_threads(threadCount, [&](size_t)
+		{
+			uint64_t sum = 0;
+			for(size_t i = 0; i < kIterations; ++i)
+			{
+				rstl::epoch_guard guard(domain);
+				sum += epochConfig.load(std::memory_order_acquire)->mVersion;
+			}
+			rstl_bench::do_not_optimize(sum);
+		},
+		[&](std::atomic<bool>& stop)
+		{
+			for(uint64_t version = 1; !stop.load(); ++version)
+			{
+				domain.retire(epochConfig.exchange(new config(version), std::memory_order_acq_rel));
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+			}
+		});
+		domain.retire(epochConfig.exchange(nullptr));
+		domain.reclaim();
+
+		std::printf("%8zu %11.2f ns %11.2f ns %11.2f ns\n", threadCount, copy, atomic, epoch);
+	}
+	return 0;
+}
@@ -0,0 +1,158 @@
+#include "bench_common.h"
+
+#include "hazard_pointer.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+/*
+ * A Treiber stack whose popped nodes are retired through the default hazard pointer
+ * domain, which is the minimal correct way to free them while other threads may
+ * still be reading their mpNext. Each thread pushes and pops in a loop:
+ *  - ns/op:    time per push/pop pair per thread.
+ *  - latency:  average and worst time from a node's retire to its reclamation.
+ *  - pending:  retired nodes still waiting when the threads finish.
+ * */
+
+namespace {
+
+	using clock_type = std::chrono::steady_clock;
+
+	const size_t kIterations = 200000;
+
+	struct stack_node
+	{
+		uint64_t mValue;
+		stack_node* mpNext;
+		clock_type::time_point mRetired;
+	};
+
+	class lock_free_stack
+	{
+	public:
+		lock_free_stack() : mpHead(nullptr) { }
+
+		~lock_free_stack()
+		{
+			while(stack_node* const pNode = mpHead.load(std::memory_order_relaxed))
+			{
+				mpHead.store(pNode->mpNext, std::memory_order_relaxed);
+				delete pNode;
+			}
+		}
+
+		void push(uint64_t value)
+		{
+			stack_node* const pNode = new stack_node{ value, mpHead.load(std::memory_order_relaxed), {} };
+			while(!mpHead.compare_exchange_weak(pNode->mpNext, pNode, std::memory_order_release, std::memory_order_relaxed))
+			{
+			}
+		}
+
+		template <typename Deleter>
+		bool pop(uint64_t& value, rstl::hazard_pointer& hazard, Deleter deleter)
+		{
+			for(;;)
+			{
+				stack_node* pNode = hazard.protect(mpHead);
+				if(!pNode)
+				{
+					return false;
+				}
+
+				// Safe to read: pNode cannot be reclaimed while the hazard pointer holds it.
+				if(mpHead.compare_exchange_weak(pNode, pNode->mpNext, std::memory_order_acquire, std::memory_order_relaxed))
+				{
+					hazard.reset_protection();
+					value = pNode->mValue;
+					pNode->mRetired = clock_type::now();
+					rstl::hazard_retire(pNode, deleter);
+					return true;
+				}
+			}
+		}
+
+	protected:
+		std::atomic<stack_node*> mpHead;
+	};
+
+	struct latency_stats
+	{
+		std::atomic<uint64_t> mTotalNs{ 0 };
+		std::atomic<uint64_t> mMaxNs{ 0 };
+		std::atomic<uint64_t> mCount{ 0 };
+	};
+
+	struct timing_delete
+	{
+		latency_stats* mpStats;
+
+		void operator()(stack_node* pNode) const
+		{
+			const uint64_t ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - pNode->mRetired).count();
+			mpStats->mTotalNs.fetch_add(ns, std::memory_order_relaxed);
+			mpStats->mCount.fetch_add(1, std::memory_order_relaxed);
+			uint64_t maxNs = mpStats->mMaxNs.load(std::memory_order_relaxed);
+			while((ns > maxNs) && !mpStats->mMaxNs.compare_exchange_weak(maxNs, ns, std::memory_order_relaxed))
+			{
+			}
+			delete pNode;
+		}
+	};
+
+}
+
+int main()
+{
+	std::printf("%8s %12s %14s %14s %10s\n", "threads", "ns/op", "avg latency", "max latency", "pending");
+	for(size_t threadCount = 1; threadCount <= 16; threadCount *= 2)
+	{
+		lock_free_stack stack;
+		latency_stats stats;
+		const timing_delete deleter{ &stats };
+
+		std::atomic<bool> go(false);
+		std::vector<std::thread> threads;
+		for(size_t t = 0; t < threadCount; ++t)
+		{
+			threads.emplace_back([&]
+			{
+				rstl::hazard_pointer hazard = rstl::make_hazard_pointer();
+				while(!go.load())
+				{
+					std::this_thread::yield();
+				}
+				uint64_t sum = 0;
+				for(size_t i = 0; i < kIterations; ++i)
+				{
+					stack.push(i);
+					uint64_t value;
+					if(stack.pop(value, hazard, deleter))
+					{
+						sum += value;
+					}
+				}
+				rstl_bench::do_not_optimize(sum);
+			});
+		}
+
+		const auto begin = clock_type::now();
+		go.store(true);
+		for(std::thread& thread : threads)
+		{
+			thread.join();
+		}
+		const auto end = clock_type::now();
+		const double nsPerOp = std::chrono::duration<double, std::nano>(end - begin).count() / (double)kIterations;
+
+		const size_t pending = rstl::get_default_hazard_pointer_domain().retired_count();
+		rstl::get_default_hazard_pointer_domain().reclaim();
+
+		const uint64_t count = stats.mCount.load();
+		std::printf("%8zu %9.2f ns %11.2f us %11.2f us %10zu\n", threadCount, nsPerOp,
+			count ? ((double)stats.mTotalNs.load() / (double)count / 1000.0) : 0.0, (double)stats.mMaxNs.load() / 1000.0, pending);
+	}
+	return 0;
+}
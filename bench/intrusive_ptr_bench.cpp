@@ -0,0 +1,79 @@
+#include "bench_common.h"
+
+#include "intrusive_ptr.h"
+#include "shared_ptr.h"
+
+#include <vector>
+
+/*
+ * Create/copy/destroy cycles of a small message object through make_shared and
+ * through intrusive_ptr with the atomic and non-atomic counter policies:
+ *  - cycle: create a message, copy the pointer a few times, drop everything.
+ *  - deref: read a field through a window of live pointers, which shows the cost
+ *           of the extra cache line between a shared_ptr and its object.
+ * */
+
+namespace {
+
+	struct message_data
+	{
+		uint64_t mId;
+		uint32_t mKind;
+		char mPayload[44];
+
+		explicit message_data(uint64_t id) : mId(id), mKind(0), mPayload() { }
+	};
+
+	struct shared_message : message_data
+	{
+		explicit shared_message(uint64_t id) : message_data(id) { }
+	};
+
+	struct intrusive_message : message_data, rstl::intrusive_ref_counter<intrusive_message>
+	{
+		explicit intrusive_message(uint64_t id) : message_data(id) { }
+	};
+
+	struct local_intrusive_message : message_data, rstl::intrusive_ref_counter<local_intrusive_message, rstl::intrusive_thread_unsafe_counter>
+	{
+		explicit local_intrusive_message(uint64_t id) : message_data(id) { }
+	};
+
+	const size_t kIterations = 5000000;
+	const size_t kWindow = 65536;
+
+	template <typename Ptr, typename Make>
+	void run(const char* pName, Make make)
+	{
+		char name[64];
+		std::snprintf(name, sizeof(name), "cycle    %s", pName);
+		rstl_bench::report(name, rstl_bench::time_per_op_ns(kIterations, [&](size_t i)
+		{
+			Ptr p = make(i);
+			Ptr copies[4] = { p, p, p, p };
+			rstl_bench::do_not_optimize(copies[3].get());
+		}));
+
+		std::vector<Ptr> window;
+		for(size_t i = 0; i < kWindow; ++i)
+		{
+			window.push_back(make(i));
+		}
+		uint64_t sum = 0;
+		std::snprintf(name, sizeof(name), "deref    %s", pName);
+		rstl_bench::report(name, rstl_bench::time_per_op_ns(kIterations, [&](size_t i)
+		{
+			sum += window[(i * 7919) % kWindow]->mId;
+		}));
+		rstl_bench::do_not_optimize(sum);
+	}
+
+}
+
+int main()
+{
+	run<rstl::shared_ptr<shared_message>>("make_shared", [](size_t i) { return rstl::make_shared<shared_message>(i); });
+	run<rstl::intrusive_ptr<intrusive_message>>("intrusive_ptr", [](size_t i) { return rstl::make_intrusive<intrusive_message>(i); });
+	run<rstl::intrusive_ptr<local_intrusive_message>>("intrusive_ptr unsafe counter", [](size_t i) { return rstl::make_intrusive<local_intrusive_message>(i); });
+	return 0;
+}
@@ -0,0 +1,74 @@
+#include "bench_common.h"
+
+#include "local_shared_ptr.h"
+#include "shared_ptr.h"
+
+#include <algorithm>
+#include <vector>
+
+/*
+ * Copy-heavy container work on shared_ptr and local_shared_ptr:
+ *  - copy:   copy a vector of pointers and destroy the copy.
+ *  - sort:   sort a copy of the vector by pointee (swaps move, the copy increments).
+ *  - fanout: push every element into several vectors, as when indexing one set of
+ *            objects several ways, then clear them.
+ * */
+
+namespace {
+
+	const size_t kElements = 1024;
+	const size_t kRounds = 2000;
+
+	template <typename Ptr, typename Make>
+	void run(const char* pName, Make make)
+	{
+		std::vector<Ptr> source;
+		for(size_t i = 0; i < kElements; ++i)
+		{
+			source.push_back(make((int)((i * 7919) % kElements)));
+		}
+
+		char name[64];
+		std::snprintf(name, sizeof(name), "copy     %s", pName);
+		rstl_bench::report(name, rstl_bench::time_per_op_ns(kRounds, [&](size_t)
+		{
+			std::vector<Ptr> copy(source);
+			rstl_bench::do_not_optimize(copy.data());
+		}) / (double)kElements);
+
+		std::snprintf(name, sizeof(name), "sort     %s", pName);
+		rstl_bench::report(name, rstl_bench::time_per_op_ns(kRounds, [&](size_t)
+		{
+			std::vector<Ptr> copy(source);
+			std::sort(copy.begin(), copy.end(), [](const Ptr& a, const Ptr& b) { return *a < *b; });
+			rstl_bench::do_not_optimize(copy.data());
+		}) / (double)kElements);
+
+		std::vector<Ptr> indices[4];
+		std::snprintf(name, sizeof(name), "fanout   %s", pName);
+		rstl_bench::report(name, rstl_bench::time_per_op_ns(kRounds, [&](size_t)
+		{
+			for(const Ptr& p : source)
+			{
+				for(std::vector<Ptr>& index : indices)
+				{
+					index.push_back(p);
+				}
+			}
+			for(std::vector<Ptr>& index : indices)
+			{
+				rstl_bench::do_not_optimize(index.data());
+				index.clear();
+			}
+		}) / (double)kElements);
+	}
+
+}
+
+int main()
+{
+	std::printf("times are per element\n");
+	run<rstl::shared_ptr<int>>("shared_ptr", [](int value) { return rstl::make_shared<int>(value); });
+	run<rstl::local_shared_ptr<int>>("local_shared_ptr", [](int value) { return rstl::make_local_shared<int>(value); });
+	return 0;
+}
@@ -0,0 +1,85 @@
+#include "bench_common.h"
+
+#include "object_pool.h"
+#include "shared_ptr.h"
+
+#include <vector>
+
+/*
+ * object_pool<T>::create/destroy against new/delete, both for a tight
+ * create-then-destroy loop and for a window of live objects recycled out of order.
+ * */
+
+namespace {
+
+	struct message
+	{
+		uint64_t mId;
+		uint32_t mKind;
+		char mPayload[44];
+
+		explicit message(uint64_t id) : mId(id), mKind(0), mPayload() { }
+	};
+
+	const size_t kWindow = 4096;
+
+}
+
+int main()
+{
+	const size_t iterations = 10000000;
+
+	rstl_bench::report("loop     new/delete", rstl_bench::time_per_op_ns(iterations, [](size_t i)
+	{
+		message* const p = new message(i);
+		rstl_bench::do_not_optimize(p);
+		delete p;
+	}));
+
+	rstl::object_pool<message> pool;
+	rstl_bench::report("loop     object_pool", rstl_bench::time_per_op_ns(iterations, [&](size_t i)
+	{
+		message* const p = pool.create(i);
+		rstl_bench::do_not_optimize(p);
+		pool.destroy(p);
+	}));
+
+	std::vector<message*> window(kWindow, nullptr);
+	rstl_bench::report("window   new/delete", rstl_bench::time_per_op_ns(iterations, [&](size_t i)
+	{
+		message*& slot = window[(i * 7919) % kWindow];
+		delete slot;
+		slot = new message(i);
+	}));
+	for(message*& p : window)
+	{
+		delete p;
+		p = nullptr;
+	}
+
+	rstl_bench::report("window   object_pool", rstl_bench::time_per_op_ns(iterations, [&](size_t i)
+	{
+		message*& slot = window[(i * 7919) % kWindow];
+		pool.destroy(slot);
+		slot = pool.create(i);
+	}));
+	for(message*& p : window)
+	{
+		pool.destroy(p);
+	}
+
+	// Both the object and its shared_ptr control block come from pools.
+	rstl::slab_pool<64, 16> controlBlocks;
+	rstl_bench::report("shared   new + rstl::allocator", rstl_bench::time_per_op_ns(iterations / 4, [](size_t i)
+	{
+		rstl::shared_ptr<message> p(new message(i));
+		rstl_bench::do_not_optimize(p.get());
+	}));
+	rstl_bench::report("shared   object_pool + slab_pool_allocator", rstl_bench::time_per_op_ns(iterations / 4, [&](size_t i)
+	{
+		rstl::shared_ptr<message> p(pool.create(i), pool.get_deleter(), rstl::slab_pool_allocator<64, 16>(controlBlocks));
+		rstl_bench::do_not_optimize(p.get());
+	}));
+
+	return 0;
+}
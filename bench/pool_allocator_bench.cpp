@@ -0,0 +1,60 @@
+#include "bench_common.h"
+
+#include "shared_ptr.h"
+
+#include <vector>
+
+/*
+ * Measures shared_ptr control block churn: every iteration builds a shared_ptr from a
+ * raw pointer, which allocates a ref_count_sp_t through the given allocator, and
+ * then drops it again.
+ * */
+
+namespace {
+
+	struct payload
+	{
+		int mValue;
+	};
+
+	// The payload itself is not what we measure, so it lives on the stack.
+	struct null_deleter
+	{
+		void operator()(payload*) const noexcept { }
+	};
+
+	template <typename Allocator>
+	double control_block_churn(size_t iterations, const Allocator& allocator)
+	{
+		payload value{1};
+		return rstl_bench::time_per_op_ns(iterations, [&](size_t)
+		{
+			rstl::shared_ptr<payload> p(&value, null_deleter(), allocator);
+			rstl_bench::do_not_optimize(p.get());
+		});
+	}
+
+	// Keeps a window of live control blocks, so frees and allocations interleave like a real workload.
+	template <typename Allocator>
+	double control_block_window(size_t iterations, const Allocator& allocator)
+	{
+		payload value{1};
+		std::vector<rstl::shared_ptr<payload>> window(1024);
+		return rstl_bench::time_per_op_ns(iterations, [&](size_t i)
+		{
+			window[(i * 7919) % window.size()] = rstl::shared_ptr<payload>(&value, null_deleter(), allocator);
+		});
+	}
+
+}
+
+int main()
+{
+	const size_t iterations = 5000000;
+
+	rstl_bench::report("churn    rstl::allocator", control_block_churn(iterations, rstl::allocator()));
+	rstl_bench::report("churn    rstl::pool_allocator", control_block_churn(iterations, rstl::pool_allocator()));
+	rstl_bench::report("window   rstl::allocator", control_block_window(iterations, rstl::allocator()));
+	rstl_bench::report("window   rstl::pool_allocator", control_block_window(iterations, rstl::pool_allocator()));
+	return 0;
+}
@@ -0,0 +1,111 @@
+#include "bench_common.h"
+
+#include "rcu_ptr.h"
+#include "shared_ptr.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+/*
+ * Reading a routing table published to 1 to 64 threads while one writer replaces it
+ * every 100us:
+ *  - atomic_load: shared_ptr<const T> read with rstl::atomic_load, which takes the
+ *                 striped shared_ptr mutex and copies the pointer.
+ *  - rcu_ptr:     rcu_ptr<T>::read(), an epoch pin and a load.
+ * */
+
+namespace {
+
+	const size_t kIterations = 1000000;
+
+	struct routing_table
+	{
+		uint64_t mVersion;
+		uint32_t mRoutes[30];
+
+		explicit routing_table(uint64_t version) : mVersion(version), mRoutes() { }
+	};
+
+	// Runs body() on threadCount threads while writer(stop) runs on one more; returns nanoseconds per iteration per thread.
+	template <typename Body, typename Writer>
+	double run_threads(size_t threadCount, Body body, Writer writer)
+	{
+		std::atomic<bool> go(false);
+		std::atomic<bool> stop(false);
+		std::vector<std::thread> threads;
+		for(size_t t = 0; t < threadCount; ++t)
+		{
+			threads.emplace_back([&]
+			{
+				while(!go.load())
+				{
+					std::this_thread::yield();
+				}
+				body();
+			});
+		}
+		std::thread writerThread([&] { writer(stop); });
+
+		const auto begin = std::chrono::steady_clock::now();
+		go.store(true);
+		for(std::thread& thread : threads)
+		{
+			thread.join();
+		}
+		const auto end = std::chrono::steady_clock::now();
+		stop.store(true);
+		writerThread.join();
+		return std::chrono::duration<double, std::nano>(end - begin).count() / (double)kIterations;
+	}
+
+}
+
+int main()
+{
+	std::printf("%8s %14s %14s\n", "threads", "atomic_load", "rcu_ptr");
+	for(size_t threadCount = 1; threadCount <= 64; threadCount *= 2)
+	{
+		rstl::shared_ptr<const routing_table> shared = rstl::make_shared<const routing_table>(0);
+		const double atomicLoad = run_threads(threadCount, [&]
+		{
+			uint64_t sum = 0;
+			for(size_t i = 0; i < kIterations; ++i)
+			{
+				sum += rstl::atomic_load(&shared)->mVersion;
+			}
+			rstl_bench::do_not_optimize(sum);
+		},
+		[&](std::atomic<bool>& stop)
+		{
+			for(uint64_t version = 1; !stop.load(); ++version)
+			{
+				rstl::atomic_store(&shared, rstl::shared_ptr<const routing_table>(rstl::make_shared<const routing_table>(version)));
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+			}
+		});
+
+		rstl::rcu_ptr<routing_table> rcu(routing_table(0));
+		const double rcuRead = run_threads(threadCount, [&]
+		{
+			uint64_t sum = 0;
+			for(size_t i = 0; i < kIterations; ++i)
+			{
+				sum += rcu.read()->mVersion;
+			}
+			rstl_bench::do_not_optimize(sum);
+		},
+		[&](std::atomic<bool>& stop)
+		{
+			for(uint64_t version = 1; !stop.load(); ++version)
+			{
+				rcu.emplace(version);
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+			}
+		});
+
+		std::printf("%8zu %11.2f ns %11.2f ns\n", threadCount, atomicLoad, rcuRead);
+	}
+	return 0;
+}
@@ -0,0 +1,140 @@
+#include "bench_common.h"
+
+#include "recycling_pool.h"
+#include "shared_ptr.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+/*
+ * Acquiring and releasing a parser with a zeroed 16KB buffer, from 1 to 16
+ * threads:
+ *  - make_shared:    construct and destroy a parser every time.
+ *  - recycling_pool: take an idle parser from the pool and reset it on release.
+ *  - handoff:        objects acquired on one thread and released on another, so
+ *                    every acquire has to steal from the releasing thread's shard.
+ * */
+
+namespace {
+
+	const size_t kIterations = 200000;
+
+	struct parser
+	{
+		char* mpBuffer;
+		size_t mUsed;
+
+		parser() : mpBuffer(new char[16384]()), mUsed(0) { }
+		~parser() { delete[] mpBuffer; }
+
+		parser(const parser&) = delete;
+		parser& operator=(const parser&) = delete;
+
+		void reset() noexcept
+		{
+			mUsed = 0;
+		}
+
+		void parse(size_t n) noexcept
+		{
+			mpBuffer[mUsed % 16384] = (char)n;
+			mUsed += n;
+		}
+	};
+
+	// Runs body(threadIndex) on threadCount threads and returns nanoseconds per iteration per thread.
+	template <typename Body>
+	double run_threads(size_t threadCount, Body body)
+	{
+		std::atomic<bool> go(false);
+		std::vector<std::thread> threads;
+		for(size_t t = 0; t < threadCount; ++t)
+		{
+			threads.emplace_back([&, t]
+			{
+				while(!go.load())
+				{
+					std::this_thread::yield();
+				}
+				body(t);
+			});
+		}
+
+		const auto begin = std::chrono::steady_clock::now();
+		go.store(true);
+		for(std::thread& thread : threads)
+		{
+			thread.join();
+		}
+		const auto end = std::chrono::steady_clock::now();
+		return std::chrono::duration<double, std::nano>(end - begin).count() / (double)kIterations;
+	}
+
+}
+
+int main()
+{
+	std::printf("%8s %14s %16s %14s\n", "threads", "make_shared", "recycling_pool", "handoff");
+	for(size_t threadCount = 1; threadCount <= 16; threadCount *= 2)
+	{
+		const double makeShared = run_threads(threadCount, [](size_t)
+		{
+			for(size_t i = 0; i < kIterations; ++i)
+			{
+				rstl::shared_ptr<parser> p = rstl::make_shared<parser>();
+				p->parse(i);
+			}
+		});
+
+		rstl::recycling_pool<parser> pool;
+		const double pooled = run_threads(threadCount, [&](size_t)
+		{
+			for(size_t i = 0; i < kIterations; ++i)
+			{
+				rstl::shared_ptr<parser> p = pool.acquire();
+				p->parse(i);
+			}
+		});
+
+		// Pairs of threads: even ones acquire a batch and pass it over, odd ones release it.
+		rstl::recycling_pool<parser> handoffPool;
+		const size_t pairCount = (threadCount + 1) / 2;
+		std::vector<std::atomic<std::vector<rstl::shared_ptr<parser>>*>> mailboxes(pairCount);
+		const double handoff = run_threads(pairCount * 2, [&](size_t t)
+		{
+			std::atomic<std::vector<rstl::shared_ptr<parser>>*>& mailbox = mailboxes[t / 2];
+			const size_t kBatch = 64;
+			for(size_t i = 0; i < kIterations; i += kBatch)
+			{
+				if((t % 2) == 0)
+				{
+					auto* const pBatch = new std::vector<rstl::shared_ptr<parser>>();
+					for(size_t j = 0; j < kBatch; ++j)
+					{
+						pBatch->push_back(handoffPool.acquire());
+					}
+					while(mailbox.load() != nullptr)
+					{
+						std::this_thread::yield();
+					}
+					mailbox.store(pBatch);
+				}
+				else
+				{
+					std::vector<rstl::shared_ptr<parser>>* pBatch;
+					while((pBatch = mailbox.exchange(nullptr)) == nullptr)
+					{
+						std::this_thread::yield();
+					}
+					delete pBatch;
+				}
+			}
+		});
+
+		std::printf("%8zu %11.2f ns %13.2f ns %11.2f ns   (pool created %zu, high water %zu)\n", threadCount, makeShared, pooled, handoff,
+			pool.created_count() + handoffPool.created_count(), pool.high_water_mark());
+	}
+	return 0;
+}
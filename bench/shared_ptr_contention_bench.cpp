@@ -0,0 +1,100 @@
+#include "bench_common.h"
+
+#include "shared_ptr.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+/*
+ * Cost of copying and destroying shared_ptr from 1 to 64 threads.
+ *  - shared:  every thread copies the same shared_ptr, so all threads hit one control block.
+ *  - private: every thread copies its own shared_ptr, which shows the uncontended cost.
+ *  - raw:     bare increment/decrement pairs with the legacy full-barrier __sync functions
+ *             and with the ordered atomics now used by ref_count_sp.
+ * */
+
+namespace {
+
+	const size_t kIterations = 1000000;
+
+	// Runs body(threadIndex) on threadCount threads and returns nanoseconds per iteration per thread.
+	template <typename Body>
+	double run_threads(size_t threadCount, Body body)
+	{
+		std::atomic<bool> go(false);
+		std::vector<std::thread> threads;
+		for(size_t t = 0; t < threadCount; ++t)
+		{
+			threads.emplace_back([&, t]
+			{
+				while(!go.load())
+				{
+					std::this_thread::yield();
+				}
+				body(t);
+			});
+		}
+
+		const auto begin = std::chrono::steady_clock::now();
+		go.store(true);
+		for(std::thread& thread : threads)
+		{
+			thread.join();
+		}
+		const auto end = std::chrono::steady_clock::now();
+		return std::chrono::duration<double, std::nano>(end - begin).count() / (double)kIterations;
+	}
+
+}
+
+int main()
+{
+	std::printf("%8s %14s %14s %14s %14s\n", "threads", "shared", "private", "raw __sync", "raw ordered");
+	for(size_t threadCount = 1; threadCount <= 64; threadCount *= 2)
+	{
+		rstl::shared_ptr<int> sharedValue(new int(1));
+		const double shared = run_threads(threadCount, [&](size_t)
+		{
+			for(size_t i = 0; i < kIterations; ++i)
+			{
+				rstl::shared_ptr<int> copy(sharedValue);
+				rstl_bench::do_not_optimize(copy.get());
+			}
+		});
+
+		const double privateCopies = run_threads(threadCount, [&](size_t)
+		{
+			rstl::shared_ptr<int> mine(new int(1));
+			for(size_t i = 0; i < kIterations; ++i)
+			{
+				rstl::shared_ptr<int> copy(mine);
+				rstl_bench::do_not_optimize(copy.get());
+			}
+		});
+
+		int32_t legacyCount = 1;
+		const double legacy = run_threads(threadCount, [&](size_t)
+		{
+			for(size_t i = 0; i < kIterations; ++i)
+			{
+				rstl::Thread_Support_Internal::atomic_increment(&legacyCount);
+				rstl::Thread_Support_Internal::atomic_decrement(&legacyCount);
+			}
+		});
+
+		std::atomic<int32_t> orderedCount(1);
+		const double ordered = run_threads(threadCount, [&](size_t)
+		{
+			for(size_t i = 0; i < kIterations; ++i)
+			{
+				rstl::Thread_Support_Internal::atomic_increment_relaxed(orderedCount);
+				rstl::Thread_Support_Internal::atomic_decrement_acq_rel(orderedCount);
+			}
+		});
+
+		std::printf("%8zu %11.2f ns %11.2f ns %11.2f ns %11.2f ns\n", threadCount, shared, privateCopies, legacy, ordered);
+	}
+	return 0;
+}
@@ -0,0 +1,83 @@
+#include "bench_common.h"
+
+#include "allocator.h"
+#include "thread_cache_allocator.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+/*
+ * Multi-threaded alloc/free throughput. Every thread repeatedly allocates a window of
+ * small blocks of mixed sizes and frees them again; the thread count doubles from 1
+ * up to the number of hardware threads.
+ * */
+
+namespace {
+
+	const size_t kWindow = 64;
+	const size_t kRounds = 20000;
+
+	template <typename Allocator>
+	void worker(Allocator allocator)
+	{
+		void* blocks[kWindow];
+		for(size_t round = 0; round < kRounds; ++round)
+		{
+			for(size_t i = 0; i < kWindow; ++i)
+			{
+				blocks[i] = allocator.allocate(16 + ((i * 40) % 240));
+			}
+			for(size_t i = 0; i < kWindow; ++i)
+			{
+				allocator.deallocate(blocks[i], 16 + ((i * 40) % 240));
+			}
+		}
+	}
+
+	// Returns millions of alloc/free pairs per second over all threads.
+	template <typename Allocator>
+	double throughput(size_t threadCount, const Allocator& allocator)
+	{
+		std::atomic<bool> go(false);
+		std::vector<std::thread> threads;
+		for(size_t t = 0; t < threadCount; ++t)
+		{
+			threads.emplace_back([&]
+			{
+				while(!go.load())
+				{
+					std::this_thread::yield();
+				}
+				worker(allocator);
+			});
+		}
+
+		const auto begin = std::chrono::steady_clock::now();
+		go.store(true);
+		for(std::thread& thread : threads)
+		{
+			thread.join();
+		}
+		const auto end = std::chrono::steady_clock::now();
+
+		const double seconds = std::chrono::duration<double>(end - begin).count();
+		return (double)(threadCount * kRounds * kWindow) / seconds / 1e6;
+	}
+
+}
+
+int main()
+{
+	const size_t maxThreads = std::thread::hardware_concurrency() ? std::thread::hardware_concurrency() : 4;
+
+	std::printf("%8s %22s %22s\n", "threads", "rstl::allocator", "thread_cache_allocator");
+	for(size_t threadCount = 1; threadCount <= maxThreads; threadCount *= 2)
+	{
+		const double heap = throughput(threadCount, rstl::allocator());
+		const double cached = throughput(threadCount, rstl::thread_cache_allocator());
+		std::printf("%8zu %16.2f Mop/s %16.2f Mop/s\n", threadCount, heap, cached);
+	}
+	return 0;
+}
@@ -0,0 +1,151 @@
+#include "bench_common.h"
+
+#include "thread_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+/*
+ * Scaling of thread_pool on fine-grained tasks, each a few hundred nanoseconds of
+ * arithmetic, for 1 to 16 workers:
+ *  - inject:     one outside thread post()s every task, so all of them go through the
+ *                injection queue.
+ *  - fork-join:  a recursive split that submit()s one half and recurses into the
+ *                other, so tasks are created on the workers and spread by stealing.
+ *  - parallel:   the same split with post() and a countdown instead of handles.
+ * Times are per task; speedup is against the same run on one worker. On a machine
+ * with fewer cores than workers the speedup flattens out at the core count.
+ * */
+
+namespace {
+
+	using clock_type = std::chrono::steady_clock;
+
+	const size_t kTaskCount = 1 << 18;
+	const uint32_t kWorkPerTask = 200;
+
+	// The fine-grained work itself: a short dependent chain the optimizer cannot fold.
+	uint64_t work(uint64_t seed)
+	{
+		uint64_t x = seed | 1;
+		for(uint32_t i = 0; i < kWorkPerTask; ++i)
+		{
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+		}
+		return x;
+	}
+
+	double elapsed_ns(clock_type::time_point begin)
+	{
+		return std::chrono::duration<double, std::nano>(clock_type::now() - begin).count();
+	}
+
+	void wait_for(const std::atomic<size_t>& done, size_t target)
+	{
+		while(done.load(std::memory_order_acquire) < target)
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	double bench_inject(rstl::thread_pool& pool)
+	{
+		std::atomic<size_t> done(0);
+		const auto begin = clock_type::now();
+		for(size_t i = 0; i < kTaskCount; ++i)
+		{
+			pool.post([&done, i]
+			{
+				rstl_bench::do_not_optimize(work(i));
+				done.fetch_add(1, std::memory_order_release);
+			});
+		}
+		wait_for(done, kTaskCount);
+		return elapsed_ns(begin) / (double)kTaskCount;
+	}
+
+	uint64_t fork_join(rstl::thread_pool& pool, size_t first, size_t last)
+	{
+		if(last - first == 1)
+		{
+			return work(first);
+		}
+		const size_t middle = first + (last - first) / 2;
+		rstl::task_handle<uint64_t> left = pool.submit([&pool, first, middle] { return fork_join(pool, first, middle); });
+		const uint64_t right = fork_join(pool, middle, last);
+		return left.get() ^ right;
+	}
+
+	double bench_fork_join(rstl::thread_pool& pool)
+	{
+		const auto begin = clock_type::now();
+		const uint64_t result = pool.submit([&pool] { return fork_join(pool, 0, kTaskCount); }).get();
+		rstl_bench::do_not_optimize(result);
+		return elapsed_ns(begin) / (double)kTaskCount;
+	}
+
+	void parallel_split(rstl::thread_pool& pool, std::atomic<size_t>& done, size_t first, size_t last)
+	{
+		while(last - first > 1)
+		{
+			const size_t middle = first + (last - first) / 2;
+			pool.post([&pool, &done, middle, last] { parallel_split(pool, done, middle, last); });
+			last = middle;
+		}
+		rstl_bench::do_not_optimize(work(first));
+		done.fetch_add(1, std::memory_order_release);
+	}
+
+	double bench_parallel(rstl::thread_pool& pool)
+	{
+		std::atomic<size_t> done(0);
+		const auto begin = clock_type::now();
+		pool.post([&pool, &done] { parallel_split(pool, done, 0, kTaskCount); });
+		wait_for(done, kTaskCount);
+		return elapsed_ns(begin) / (double)kTaskCount;
+	}
+
+}
+
+int main()
+{
+	const auto sequentialBegin = clock_type::now();
+	for(size_t i = 0; i < kTaskCount; ++i)
+	{
+		rstl_bench::do_not_optimize(work(i));
+	}
+	rstl_bench::report("sequential (no pool)", elapsed_ns(sequentialBegin) / (double)kTaskCount);
+
+	std::printf("%8s %14s %8s %14s %8s %14s %8s\n", "workers", "inject", "speedup", "fork-join", "speedup", "parallel", "speedup");
+	double inject1 = 0.0, forkJoin1 = 0.0, parallel1 = 0.0;
+	for(size_t workerCount = 1; workerCount <= 16; workerCount *= 2)
+	{
+		for(const bool pinned : { false, true })
+		{
+			rstl::thread_pool::options opts;
+			opts.mThreadCount = workerCount;
+			opts.mPinThreads = pinned;
+			rstl::thread_pool pool(opts);
+
+			bench_parallel(pool); // Warm up the workers' deques and task caches.
+			const double inject = bench_inject(pool);
+			const double forkJoin = bench_fork_join(pool);
+			const double parallel = bench_parallel(pool);
+			if((workerCount == 1) && !pinned)
+			{
+				inject1 = inject;
+				forkJoin1 = forkJoin;
+				parallel1 = parallel;
+			}
+
+			std::printf("%7zu%s %11.2f ns %7.2fx %11.2f ns %7.2fx %11.2f ns %7.2fx\n", workerCount, pinned ? "p" : " ",
+				inject, inject1 / inject, forkJoin, forkJoin1 / forkJoin, parallel, parallel1 / parallel);
+		}
+	}
+	std::printf("(p: workers pinned to CPUs)\n");
+	return 0;
+}
@@ -0,0 +1,114 @@
+#include "bench_common.h"
+
+#include "shared_ptr.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+/*
+ * weak_ptr::lock on one hot weak_ptr, as in a cache keyed by weak_ptr, from 1 to 64
+ * threads. A quarter of the threads are owners that keep copying and dropping the
+ * shared_ptr, so the strong count is never still.
+ *  - lock:     weak_ptr::lock plus dropping the result.
+ *  - cas loop: the same pattern on a bare counter with the compare-exchange loop
+ *              ref_count_sp::lock used before, for comparison.
+ * */
+
+namespace {
+
+	const size_t kIterations = 500000;
+
+	// Runs body(threadIndex) on threadCount threads and returns nanoseconds per iteration per thread.
+	template <typename Body>
+	double run_threads(size_t threadCount, Body body)
+	{
+		std::atomic<bool> go(false);
+		std::vector<std::thread> threads;
+		for(size_t t = 0; t < threadCount; ++t)
+		{
+			threads.emplace_back([&, t]
+			{
+				while(!go.load())
+				{
+					std::this_thread::yield();
+				}
+				body(t);
+			});
+		}
+
+		const auto begin = std::chrono::steady_clock::now();
+		go.store(true);
+		for(std::thread& thread : threads)
+		{
+			thread.join();
+		}
+		const auto end = std::chrono::steady_clock::now();
+		return std::chrono::duration<double, std::nano>(end - begin).count() / (double)kIterations;
+	}
+
+	bool is_owner(size_t threadIndex)
+	{
+		return (threadIndex % 4) == 3;
+	}
+
+	bool cas_loop_lock(std::atomic<int32_t>& count)
+	{
+		int32_t countTemp = count.load(std::memory_order_relaxed);
+		while(countTemp != 0)
+		{
+			if(count.compare_exchange_weak(countTemp, countTemp + 1, std::memory_order_acq_rel, std::memory_order_relaxed))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+}
+
+int main()
+{
+	std::printf("%8s %14s %14s\n", "threads", "lock", "cas loop");
+	for(size_t threadCount = 1; threadCount <= 64; threadCount *= 2)
+	{
+		rstl::shared_ptr<int> owner = rstl::make_shared<int>(1);
+		const rstl::weak_ptr<int> hot(owner);
+		const double lock = run_threads(threadCount, [&](size_t t)
+		{
+			for(size_t i = 0; i < kIterations; ++i)
+			{
+				if(is_owner(t))
+				{
+					rstl::shared_ptr<int> copy(owner);
+					rstl_bench::do_not_optimize(copy.get());
+				}
+				else
+				{
+					rstl::shared_ptr<int> locked(hot.lock());
+					rstl_bench::do_not_optimize(locked.get());
+				}
+			}
+		});
+
+		std::atomic<int32_t> count(1);
+		const double casLoop = run_threads(threadCount, [&](size_t t)
+		{
+			for(size_t i = 0; i < kIterations; ++i)
+			{
+				if(is_owner(t) || cas_loop_lock(count))
+				{
+					if(is_owner(t))
+					{
+						count.fetch_add(1, std::memory_order_relaxed);
+					}
+					count.fetch_sub(1, std::memory_order_acq_rel);
+				}
+			}
+		});
+
+		std::printf("%8zu %11.2f ns %11.2f ns\n", threadCount, lock, casLoop);
+	}
+	return 0;
+}
@@ -4,8 +4,23 @@
 #pragma once
 
 #include "internal/config.h"
+#include "internal/thread_support.h"
 
+#if RSTL_THREAD_CACHE_DEFAULT_ALLOCATOR
+#include "internal/thread_cache.h"
+#endif
+
+#if RSTL_ALLOCATOR_STATS
+#include "allocator_stats.h"
+#endif
+
+#if RSTL_ALLOCATOR_TRACE
+#include "allocator_trace.h"
+#endif
+
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
 
 
 RSTL_NAMESPACE_BEGIN
@@ -34,6 +49,9 @@ public:
 
 	// Debug name
 	const char* mpName;
+
+protected:
+	void* allocate_from_heap(size_t n, size_t alignment);
 };
 
 bool operator==(const allocator& a, const allocator& b);
@@ -79,8 +97,177 @@ inline bool operator==(const dummy_allocator&, const dummy_allocator&)
 	return true;
 }
 
+/*
+ * Defines a small-object pool allocator. Requests of up to kMaxPooledSize bytes are
+ * rounded up to a multiple of kAlignment and served from the free list of that size
+ * class. An empty free list is refilled by carving a whole chunk into blocks, so the
+ * general-purpose heap is only touched once per chunk. Larger requests are passed
+ * on to rstl::allocator.
+ *
+ * A pool_allocator is only a handle: copies share the same pool, which is what lets
+ * a copy stored inside a shared_ptr control block free back to the pool it came from.
+ * Pooled blocks are aligned to kAlignment. Pooled sizes with a larger alignment are
+ * not supported and return NULL, like dummy_allocator.
+ * */
+
+class pool_allocator
+{
+public:
+	static constexpr size_t kAlignment = 16;
+	static constexpr size_t kMaxPooledSize = 256;
+	static constexpr size_t kSizeClassCount = kMaxPooledSize / kAlignment;
+	static constexpr size_t kChunkSize = 16 * 1024;
+
+	class pool
+	{
+	public:
+		pool() noexcept;
+		~pool();
+
+		pool(const pool&) = delete;
+		pool& operator=(const pool&) = delete;
+
+		void* allocate(size_t n);
+		void deallocate(void* p, size_t n) noexcept;
+
+	protected:
+		struct free_block
+		{
+			free_block* mpNext;
+		};
+
+		struct chunk
+		{
+			chunk* mpNext;
+		};
+
+		struct size_class
+		{
+			std::mutex mMutex;
+			free_block* mpFreeList = nullptr;
+			chunk* mpChunkList = nullptr;
+		};
+
+		static size_t size_class_index(size_t n) noexcept;
+		bool refill(size_class& sizeClass, size_t blockSize);
+
+		size_class mSizeClasses[kSizeClassCount];
+	};
+
+	explicit pool_allocator(const char* pName = POOL_ALLOCATOR_DEFAULT_NAME);
+	explicit pool_allocator(pool& p, const char* pName = POOL_ALLOCATOR_DEFAULT_NAME);
+	pool_allocator(const pool_allocator& x);
+	pool_allocator(const pool_allocator& x, const char* pName);
+
+	pool_allocator& operator=(const pool_allocator& x);
+
+	void* allocate(size_t n, int flags = 0);
+	void* allocate(size_t n, size_t alignment, size_t offset, int flags = 0);
+	void deallocate(void* p, size_t n);
+
+	const char* get_name() const;
+	void set_name(const char* pName);
+
+	pool* get_pool() const;
+
+	// Returns the process-wide pool used by default constructed pool_allocators.
+	static pool* get_default_pool();
+
+	// Debug name
+	const char* mpName;
+
+protected:
+	pool* mpPool;
+};
+
+bool operator==(const pool_allocator& a, const pool_allocator& b);
+bool operator!=(const pool_allocator& a, const pool_allocator& b);
+
+/*
+ * memory_resource is the type-erased counterpart of the allocator interface. It takes
+ * the same (n, alignment, offset, flags) requests and sized deallocations, so every
+ * rstl allocator can be put behind one (see allocator_resource in memory_resource.h), and one
+ * polymorphic_allocator instantiation serves them all: the allocation strategy of a
+ * shared_ptr or container becomes a runtime choice instead of a template argument.
+ * */
+
+class memory_resource
+{
+public:
+	virtual ~memory_resource() { }
+
+	void* allocate(size_t n, size_t alignment = ALLOCATOR_DEFAULT_ALIGNMENT, size_t offset = 0, int flags = 0)
+	{
+		return do_allocate(n, alignment, offset, flags);
+	}
+
+	void deallocate(void* p, size_t n)
+	{
+		do_deallocate(p, n);
+	}
+
+	bool is_equal(const memory_resource& other) const noexcept
+	{
+		return (this == &other) || do_is_equal(other);
+	}
+
+protected:
+	virtual void* do_allocate(size_t n, size_t alignment, size_t offset, int flags) = 0;
+	virtual void do_deallocate(void* p, size_t n) = 0;
+	virtual bool do_is_equal(const memory_resource& other) const noexcept = 0;
+};
+
+inline bool operator==(const memory_resource& a, const memory_resource& b) noexcept
+{
+	return a.is_equal(b);
+}
+
+/*
+ * GetDefaultAllocator(), default_allocfreemethod and default constructed
+ * polymorphic_allocators allocate from the default memory_resource: the calling
+ * thread's override while a default_allocator_scope is active, otherwise the
+ * process-wide default set with SetDefaultAllocator, otherwise the heap. To send
+ * default allocations to an arena or a pool, put it behind a memory_resource, e.g.
+ * allocator_resource<arena_allocator> or monotonic_buffer_resource (memory_resource.h).
+ *
+ * Any other rstl::allocator, which includes every allocator the library uses for its
+ * own pools, caches and reclamation nodes, always allocates from the heap. Those blocks
+ * can outlive a scope or be freed on another thread, which an arena can't take.
+ *
+ * A block taken from a resource records the resource in a small header and goes back
+ * to it when freed, through any rstl::allocator and whatever the default is by then,
+ * so the resource must outlive its blocks. With RSTL_THREAD_CACHE_DEFAULT_ALLOCATOR,
+ * requests the per-thread caches serve stay with the caches.
+ *
+ * SetDefaultAllocator swaps the process-wide default with a single atomic exchange and
+ * returns the previous one; passing NULL restores the heap. Readers may still be using
+ * the previous resource after the swap, so it must stay alive for as long as they can.
+ */
+
+memory_resource* heap_resource() noexcept;
+memory_resource* get_default_resource() noexcept;
+memory_resource* SetDefaultAllocator(memory_resource* pResource) noexcept;
+
+// The process-wide rstl::allocator, the only one that allocates from the default resource.
 allocator* GetDefaultAllocator();
-allocator* SetDefaultAllocator(allocator* pAllocator);
+
+/*
+ * Makes pResource the calling thread's default resource until the scope ends. Scopes
+ * nest; each restores the override that was active when it was entered.
+ */
+
+class default_allocator_scope
+{
+public:
+	explicit default_allocator_scope(memory_resource* pResource) noexcept;
+	~default_allocator_scope();
+
+	default_allocator_scope(const default_allocator_scope&) = delete;
+	default_allocator_scope& operator=(const default_allocator_scope&) = delete;
+
+protected:
+	memory_resource* mpPrevious;
+};
 
 template <typename Allocator>
 Allocator* get_default_allocator(const Allocator*);
@@ -108,6 +295,125 @@ RSTL_NAMESPACE_END
 
 RSTL_NAMESPACE_BEGIN
 
+namespace Allocator_Internal {
+
+	inline std::atomic<memory_resource*> gpDefaultResource{nullptr};
+	inline thread_local memory_resource* tpThreadDefaultResource = nullptr;
+
+	// Set while a resource is being called, so that whatever it allocates through GetDefaultAllocator() comes from the heap.
+	inline thread_local bool tbInResource = false;
+
+	class in_resource_scope
+	{
+	public:
+		in_resource_scope() noexcept : mbPrevious(tbInResource)
+		{
+			tbInResource = true;
+		}
+
+		~in_resource_scope()
+		{
+			tbInResource = mbPrevious;
+		}
+
+		in_resource_scope(const in_resource_scope&) = delete;
+		in_resource_scope& operator=(const in_resource_scope&) = delete;
+
+	protected:
+		bool mbPrevious;
+	};
+
+	// The resource GetDefaultAllocator() takes an n byte block from, or null for the heap.
+	inline memory_resource* dispatch_resource(size_t n) noexcept
+	{
+#if RSTL_THREAD_CACHE_DEFAULT_ALLOCATOR
+		if(n <= Thread_Cache_Internal::kMaxCachedSize)
+		{
+			return nullptr; // deallocate hands these to the cache without looking for a header.
+		}
+#else
+		UNUSED(n);
+#endif
+		if(tbInResource)
+		{
+			return nullptr;
+		}
+		if(memory_resource* const pThreadResource = tpThreadDefaultResource)
+		{
+			return pThreadResource;
+		}
+		return gpDefaultResource.load(std::memory_order_acquire);
+	}
+
+	/*
+	 * A block from a resource follows a header of at least kResourceHeaderSize bytes
+	 * whose last two words are the header size and the resource, tagged with
+	 * kResourceTag. A heap block keeps its original allocation in that last word, which
+	 * is never tagged, so deallocate can tell the two apart.
+	 * */
+	static constexpr uintptr_t kResourceTag = 1;
+	static constexpr size_t kResourceHeaderSize = 16;
+
+	static_assert(kResourceHeaderSize >= 2 * sizeof(uintptr_t), "The resource header needs two words.");
+
+	inline void* allocate_from_resource(memory_resource* pResource, size_t n, size_t alignment, int flags)
+	{
+		const size_t headerSize = (alignment > kResourceHeaderSize) ? alignment : kResourceHeaderSize;
+		char* pBase;
+		{
+			in_resource_scope scope;
+			pBase = static_cast<char*>(pResource->allocate(n + headerSize, headerSize, 0, flags));
+		}
+		if(!pBase)
+		{
+			return NULL;
+		}
+
+		uintptr_t* const pHeaderEnd = reinterpret_cast<uintptr_t*>(pBase + headerSize);
+		pHeaderEnd[-2] = headerSize;
+		pHeaderEnd[-1] = reinterpret_cast<uintptr_t>(pResource) | kResourceTag;
+		return pHeaderEnd;
+	}
+
+	inline bool is_resource_block(const void* p) noexcept
+	{
+		return (static_cast<const uintptr_t*>(p)[-1] & kResourceTag) != 0;
+	}
+
+	inline void deallocate_to_resource(void* p, size_t n)
+	{
+		const uintptr_t* const pHeaderEnd = static_cast<const uintptr_t*>(p);
+		const size_t headerSize = pHeaderEnd[-2];
+		memory_resource* const pResource = reinterpret_cast<memory_resource*>(pHeaderEnd[-1] & ~kResourceTag);
+
+		in_resource_scope scope;
+		pResource->deallocate(static_cast<char*>(p) - headerSize, n + headerSize);
+	}
+
+	// The heap as a resource, through a local rstl::allocator that never dispatches.
+	class heap_memory_resource : public memory_resource
+	{
+	protected:
+		void* do_allocate(size_t n, size_t alignment, size_t offset, int flags) override
+		{
+			rstl::allocator allocator;
+			return allocator.allocate(n, alignment, offset, flags);
+		}
+
+		void do_deallocate(void* p, size_t n) override
+		{
+			rstl::allocator allocator;
+			allocator.deallocate(p, n);
+		}
+
+		bool do_is_equal(const memory_resource& other) const noexcept override
+		{
+			return dynamic_cast<const heap_memory_resource*>(&other) != nullptr;
+		}
+	};
+
+}
+
 inline allocator::allocator(const char *pName)
 {
 	mpName = pName;
@@ -141,13 +447,43 @@ inline void allocator::set_name(const char* pName)
 
 inline void* allocator::allocate(size_t n, int flags)
 {
-	return allocate(n, 16, 0, flags);
+	return allocate(n, ALLOCATOR_DEFAULT_ALIGNMENT, 0, flags);
 }
 
 inline void* allocator::allocate(size_t n, size_t alignment, size_t offset, int flags)
 {
 	UNUSED(offset);
-	UNUSED(flags);
+
+	memory_resource* const pResource = (this == GetDefaultAllocator()) ? Allocator_Internal::dispatch_resource(n) : nullptr;
+	void* const p = pResource ? Allocator_Internal::allocate_from_resource(pResource, n, alignment, flags) : allocate_from_heap(n, alignment);
+
+#if RSTL_ALLOCATOR_STATS
+	if(p != nullptr)
+	{
+		Allocator_Stats_Internal::record_allocate(mpName, n);
+	}
+#endif
+
+#if RSTL_ALLOCATOR_TRACE
+	Allocator_Trace_Internal::record_allocate(p, n, alignment, flags);
+#endif
+	return p;
+}
+
+inline void* allocator::allocate_from_heap(size_t n, size_t alignment)
+{
+#if RSTL_THREAD_CACHE_DEFAULT_ALLOCATOR
+	if(n <= Thread_Cache_Internal::kMaxCachedSize)
+	{
+		if(alignment <= Thread_Cache_Internal::kAlignment)
+		{
+			return Thread_Cache_Internal::cache_allocate(n);
+		}
+		// deallocate can't tell an over-aligned small block from a cached one, so it is taken
+		// from the heap with room for a whole size class and adopted by the cache when freed.
+		n = (n + Thread_Cache_Internal::kAlignment - 1) & ~(Thread_Cache_Internal::kAlignment - 1);
+	}
+#endif
 
 	size_t adjustedAlignment = (alignment > PLATFORM_PTR_SIZE) ? alignment : PLATFORM_PTR_SIZE;
 
@@ -161,10 +497,36 @@ inline void* allocator::allocate(size_t n, size_t alignment, size_t offset, int
 	return pAligned;
 }
 
-inline void allocator::deallocate(void *p, size_t)
+inline void allocator::deallocate(void *p, size_t n)
 {
+	UNUSED(n);
+
+#if RSTL_ALLOCATOR_STATS
+	if(p != nullptr)
+	{
+		Allocator_Stats_Internal::record_deallocate(mpName, n);
+	}
+#endif
+
+#if RSTL_ALLOCATOR_TRACE
+	Allocator_Trace_Internal::record_deallocate(p, n);
+#endif
+
+#if RSTL_THREAD_CACHE_DEFAULT_ALLOCATOR
+	if((p != nullptr) && (n <= Thread_Cache_Internal::kMaxCachedSize))
+	{
+		Thread_Cache_Internal::cache_deallocate(p, n);
+		return;
+	}
+#endif
+
 	if(p != nullptr)
 	{
+		if(Allocator_Internal::is_resource_block(p))
+		{
+			Allocator_Internal::deallocate_to_resource(p, n);
+			return;
+		}
 		void* pOriginalAllocation = *((void**)p - 1);
 		delete [](char*)pOriginalAllocation;
 	}
@@ -180,6 +542,237 @@ inline bool operator!=(const allocator&, const allocator&)
 	return false;
 }
 
+/*
+ * pool_allocator::pool
+ * */
+
+inline pool_allocator::pool::pool() noexcept
+{
+
+}
+
+inline pool_allocator::pool::~pool()
+{
+	rstl::allocator upstream(POOL_ALLOCATOR_DEFAULT_NAME);
+
+	for(size_class& sizeClass : mSizeClasses)
+	{
+		while(chunk* pChunk = sizeClass.mpChunkList)
+		{
+			sizeClass.mpChunkList = pChunk->mpNext;
+			CUSTOM_FREE(upstream, pChunk, kChunkSize);
+		}
+	}
+}
+
+inline size_t pool_allocator::pool::size_class_index(size_t n) noexcept
+{
+	return (n == 0) ? 0 : ((n - 1) / kAlignment);
+}
+
+inline bool pool_allocator::pool::refill(size_class& sizeClass, size_t blockSize)
+{
+	rstl::allocator upstream(POOL_ALLOCATOR_DEFAULT_NAME);
+
+	void* const pMemory = ALLOC_ALIGNED(upstream, kChunkSize, kAlignment, 0);
+	if(!pMemory)
+	{
+		return false;
+	}
+
+	// The chunk header takes the first kAlignment bytes so that every block stays aligned.
+	chunk* const pChunk = static_cast<chunk*>(pMemory);
+	pChunk->mpNext = sizeClass.mpChunkList;
+	sizeClass.mpChunkList = pChunk;
+
+	char* const pBegin = static_cast<char*>(pMemory) + kAlignment;
+	const size_t blockCount = (kChunkSize - kAlignment) / blockSize;
+
+	// Link the blocks back to front so that the free list hands them out in address order.
+	free_block* pHead = sizeClass.mpFreeList;
+	for(size_t i = blockCount; i > 0; --i)
+	{
+		free_block* const pBlock = reinterpret_cast<free_block*>(pBegin + ((i - 1) * blockSize));
+		pBlock->mpNext = pHead;
+		pHead = pBlock;
+	}
+	sizeClass.mpFreeList = pHead;
+	return true;
+}
+
+inline void* pool_allocator::pool::allocate(size_t n)
+{
+	const size_t index = size_class_index(n);
+	size_class& sizeClass = mSizeClasses[index];
+
+	Thread_Support_Internal::auto_mutex autoMutex(sizeClass.mMutex);
+
+	if(!sizeClass.mpFreeList && !refill(sizeClass, (index + 1) * kAlignment))
+	{
+		return NULL;
+	}
+
+	free_block* const pBlock = sizeClass.mpFreeList;
+	sizeClass.mpFreeList = pBlock->mpNext;
+	return pBlock;
+}
+
+inline void pool_allocator::pool::deallocate(void* p, size_t n) noexcept
+{
+	size_class& sizeClass = mSizeClasses[size_class_index(n)];
+
+	Thread_Support_Internal::auto_mutex autoMutex(sizeClass.mMutex);
+
+	free_block* const pBlock = static_cast<free_block*>(p);
+	pBlock->mpNext = sizeClass.mpFreeList;
+	sizeClass.mpFreeList = pBlock;
+}
+
+/*
+ * pool_allocator
+ * */
+
+inline pool_allocator::pool_allocator(const char* pName) : mpName(pName), mpPool(get_default_pool())
+{
+
+}
+
+inline pool_allocator::pool_allocator(pool& p, const char* pName) : mpName(pName), mpPool(&p)
+{
+
+}
+
+inline pool_allocator::pool_allocator(const pool_allocator& x) : mpName(x.mpName), mpPool(x.mpPool)
+{
+
+}
+
+inline pool_allocator::pool_allocator(const pool_allocator& x, const char* pName) : mpName(pName), mpPool(x.mpPool)
+{
+
+}
+
+inline pool_allocator& pool_allocator::operator=(const pool_allocator& x)
+{
+	mpName = x.mpName;
+	mpPool = x.mpPool;
+	return *this;
+}
+
+inline const char* pool_allocator::get_name() const
+{
+	return mpName;
+}
+
+inline void pool_allocator::set_name(const char* pName)
+{
+	mpName = pName;
+}
+
+inline pool_allocator::pool* pool_allocator::get_pool() const
+{
+	return mpPool;
+}
+
+inline pool_allocator::pool* pool_allocator::get_default_pool()
+{
+	static pool* const pDefaultPool = new pool();
+	return pDefaultPool;
+}
+
+inline void* pool_allocator::allocate(size_t n, int flags)
+{
+	return allocate(n, kAlignment, 0, flags);
+}
+
+inline void* pool_allocator::allocate(size_t n, size_t alignment, size_t offset, int flags)
+{
+	if(n > kMaxPooledSize)
+	{
+		rstl::allocator upstream(mpName);
+		return upstream.allocate(n, alignment, offset, flags);
+	}
+
+	if(alignment > kAlignment)
+	{
+		return NULL;
+	}
+
+	return mpPool->allocate(n);
+}
+
+inline void pool_allocator::deallocate(void* p, size_t n)
+{
+	if(p == nullptr)
+	{
+		return;
+	}
+
+	if(n > kMaxPooledSize)
+	{
+		rstl::allocator upstream(mpName);
+		upstream.deallocate(p, n);
+	}
+	else
+	{
+		mpPool->deallocate(p, n);
+	}
+}
+
+inline bool operator==(const pool_allocator& a, const pool_allocator& b)
+{
+	return (a.get_pool() == b.get_pool());
+}
+
+inline bool operator!=(const pool_allocator& a, const pool_allocator& b)
+{
+	return (a.get_pool() != b.get_pool());
+}
+
+inline memory_resource* heap_resource() noexcept
+{
+	static memory_resource* const pHeapResource = new Allocator_Internal::heap_memory_resource();
+	return pHeapResource;
+}
+
+inline memory_resource* get_default_resource() noexcept
+{
+	if(memory_resource* const pThreadResource = Allocator_Internal::tpThreadDefaultResource)
+	{
+		return pThreadResource;
+	}
+
+	memory_resource* const pResource = Allocator_Internal::gpDefaultResource.load(std::memory_order_acquire);
+	return pResource ? pResource : heap_resource();
+}
+
+inline memory_resource* SetDefaultAllocator(memory_resource* pResource) noexcept
+{
+	// The heap is stored as null, which keeps GetDefaultAllocator() off the resource path.
+	if(pResource == heap_resource())
+	{
+		pResource = nullptr;
+	}
+	memory_resource* const pPrevious = Allocator_Internal::gpDefaultResource.exchange(pResource, std::memory_order_acq_rel);
+	return pPrevious ? pPrevious : heap_resource();
+}
+
+inline allocator* GetDefaultAllocator()
+{
+	static allocator* const pDefaultAllocator = new allocator();
+	return pDefaultAllocator;
+}
+
+inline default_allocator_scope::default_allocator_scope(memory_resource* pResource) noexcept : mpPrevious(Allocator_Internal::tpThreadDefaultResource)
+{
+	Allocator_Internal::tpThreadDefaultResource = pResource;
+}
+
+inline default_allocator_scope::~default_allocator_scope()
+{
+	Allocator_Internal::tpThreadDefaultResource = mpPrevious;
+}
+
 template <typename Allocator>
 inline Allocator* get_default_allocator(const Allocator*)
 {
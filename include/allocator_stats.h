@@ -0,0 +1,451 @@
+#ifndef RSTL_ALLOCATOR_STATS_H
+#define RSTL_ALLOCATOR_STATS_H
+
+#pragma once
+
+#include "internal/config.h"
+#include "internal/thread_support.h"
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+RSTL_NAMESPACE_BEGIN
+
+/*
+ * Allocation statistics keyed by allocator name (allocator::get_name()).
+ *
+ * Recording is opt-in: wrap any allocator in tracked_allocator<>, or build with
+ * RSTL_ALLOCATOR_STATS set to 1 to have rstl::allocator record itself. Each thread
+ * counts into its own slots with plain relaxed stores, so recording never takes a lock
+ * or a locked instruction on the hot path; only live bytes are pushed to a shared
+ * counter, in steps of kFlushBytes, so that a peak can be kept. Peak bytes are
+ * therefore accurate to within kFlushBytes per thread.
+ *
+ * Names are compared by content and copied into the registry, so they need not outlive
+ * the allocator; names longer than kMaxNameLength - 1 characters are truncated. Once
+ * kMaxNames distinct names are in use, further names are counted under "(other)".
+ * */
+
+struct allocator_stats
+{
+	static constexpr size_t kHistogramBuckets = 16;
+
+	const char* mpName;
+	uint64_t mAllocations;
+	uint64_t mFrees;
+	uint64_t mAllocatedBytes;
+	uint64_t mFreedBytes;
+	int64_t mLiveBytes;
+	int64_t mPeakBytes;
+
+	// Bucket i counts allocations of up to 16 << i bytes; the last bucket counts the rest.
+	uint64_t mHistogram[kHistogramBuckets];
+};
+
+// Aggregates every thread's counters. Safe to call from any thread at any time.
+std::vector<allocator_stats> get_allocator_stats();
+
+// Writes get_allocator_stats() to pFile as text, one allocator per line.
+void dump_allocator_stats(FILE* pFile = stdout);
+
+namespace Allocator_Stats_Internal {
+
+	static constexpr size_t kMaxNames = 128;
+	static constexpr size_t kMaxNameLength = 64;
+	static constexpr size_t kOtherSlot = kMaxNames - 1;
+	static constexpr int64_t kFlushBytes = 64 * 1024;
+	static constexpr size_t kNameCacheSize = 16;
+
+	inline size_t histogram_bucket(size_t n) noexcept
+	{
+		const size_t bucket = (n <= 16) ? 0 : (size_t)std::bit_width((n - 1) >> 4);
+		return (bucket < allocator_stats::kHistogramBuckets) ? bucket : (allocator_stats::kHistogramBuckets - 1);
+	}
+
+	// Updates a counter only its owning thread writes; readers may load it concurrently.
+	inline void owner_add(std::atomic<uint64_t>& counter, uint64_t value) noexcept
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+
+	struct counters
+	{
+		std::atomic<uint64_t> mAllocations{0};
+		std::atomic<uint64_t> mFrees{0};
+		std::atomic<uint64_t> mAllocatedBytes{0};
+		std::atomic<uint64_t> mFreedBytes{0};
+		std::atomic<uint64_t> mHistogram[allocator_stats::kHistogramBuckets] = {};
+
+		void add_to(allocator_stats& stats) const noexcept
+		{
+			stats.mAllocations += mAllocations.load(std::memory_order_relaxed);
+			stats.mFrees += mFrees.load(std::memory_order_relaxed);
+			stats.mAllocatedBytes += mAllocatedBytes.load(std::memory_order_relaxed);
+			stats.mFreedBytes += mFreedBytes.load(std::memory_order_relaxed);
+			for(size_t i = 0; i < allocator_stats::kHistogramBuckets; ++i)
+			{
+				stats.mHistogram[i] += mHistogram[i].load(std::memory_order_relaxed);
+			}
+		}
+
+		void add_to(counters& c) const noexcept
+		{
+			c.mAllocations.fetch_add(mAllocations.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			c.mFrees.fetch_add(mFrees.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			c.mAllocatedBytes.fetch_add(mAllocatedBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			c.mFreedBytes.fetch_add(mFreedBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			for(size_t i = 0; i < allocator_stats::kHistogramBuckets; ++i)
+			{
+				c.mHistogram[i].fetch_add(mHistogram[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+			}
+		}
+	};
+
+	struct thread_stats;
+
+	/*
+	 * Owns the name table, the shared live/peak counters, the list of live thread_stats
+	 * and the totals of threads that have exited.
+	 * */
+	class registry
+	{
+	public:
+		registry() noexcept
+		{
+			copy_name(kOtherSlot, "(other)");
+		}
+
+		registry(const registry&) = delete;
+		registry& operator=(const registry&) = delete;
+
+		size_t find_or_add(const char* pName)
+		{
+			if(!pName)
+			{
+				pName = "";
+			}
+
+			Thread_Support_Internal::auto_mutex autoMutex(mMutex);
+			for(size_t i = 0; i < mNameCount; ++i)
+			{
+				if(name_matches(i, pName))
+				{
+					return i;
+				}
+			}
+			if(mNameCount == kOtherSlot)
+			{
+				return kOtherSlot;
+			}
+			copy_name(mNameCount, pName);
+			return mNameCount++;
+		}
+
+		// Slot names never change once added, so the owning thread may read them unlocked.
+		bool name_matches(size_t slot, const char* pName) const noexcept
+		{
+			return std::strncmp(mNames[slot], pName, kMaxNameLength - 1) == 0;
+		}
+
+		void add_live_bytes(size_t slot, int64_t delta) noexcept
+		{
+			const int64_t live = mLiveBytes[slot].fetch_add(delta, std::memory_order_relaxed) + delta;
+			int64_t peak = mPeakBytes[slot].load(std::memory_order_relaxed);
+			while((live > peak) && !mPeakBytes[slot].compare_exchange_weak(peak, live, std::memory_order_relaxed))
+			{
+
+			}
+		}
+
+		void register_thread(thread_stats* pThreadStats);
+		void unregister_thread(thread_stats* pThreadStats);
+
+		// Counts straight into the retired totals, for a thread whose thread_stats is gone.
+		void record_retired(const char* pName, size_t n, bool allocation);
+
+		std::vector<allocator_stats> snapshot();
+
+	protected:
+		void copy_name(size_t slot, const char* pName) noexcept
+		{
+			std::strncpy(mNames[slot], pName, kMaxNameLength - 1);
+			mNames[slot][kMaxNameLength - 1] = '\0';
+		}
+
+		std::mutex mMutex;
+		char mNames[kMaxNames][kMaxNameLength] = {};
+		size_t mNameCount = 0;
+		std::atomic<int64_t> mLiveBytes[kMaxNames] = {};
+		std::atomic<int64_t> mPeakBytes[kMaxNames] = {};
+		std::vector<thread_stats*> mThreads;
+		counters mRetired[kMaxNames];
+	};
+
+	inline registry& get_registry()
+	{
+		static registry* const pRegistry = new registry();
+		return *pRegistry;
+	}
+
+	// Set once the calling thread's stats have been destroyed. Other thread_local destructors
+	// that run later and allocate must not touch the dead stats, so they record into the registry.
+	inline thread_local bool tbThreadStatsDestroyed = false;
+
+	struct thread_stats
+	{
+		counters mCounters[kMaxNames];
+		int64_t mUnflushedBytes[kMaxNames] = {};
+
+		// Most names are string literals, so a pointer hit skips the registry lock. The
+		// name is still compared, in case the caller's string was freed and its address reused.
+		const char* mpCachedNames[kNameCacheSize] = {};
+		size_t mCachedSlots[kNameCacheSize] = {};
+		size_t mNextCacheEntry = 0;
+
+		thread_stats()
+		{
+			get_registry().register_thread(this);
+		}
+
+		~thread_stats()
+		{
+			tbThreadStatsDestroyed = true;
+
+			for(size_t slot = 0; slot < kMaxNames; ++slot)
+			{
+				if(mUnflushedBytes[slot])
+				{
+					get_registry().add_live_bytes(slot, mUnflushedBytes[slot]);
+				}
+			}
+			get_registry().unregister_thread(this);
+		}
+
+		thread_stats(const thread_stats&) = delete;
+		thread_stats& operator=(const thread_stats&) = delete;
+
+		size_t slot_of(const char* pName)
+		{
+			for(size_t i = 0; i < kNameCacheSize; ++i)
+			{
+				if(mpCachedNames[i] == pName && pName && get_registry().name_matches(mCachedSlots[i], pName))
+				{
+					return mCachedSlots[i];
+				}
+			}
+
+			const size_t slot = get_registry().find_or_add(pName);
+			mpCachedNames[mNextCacheEntry] = pName;
+			mCachedSlots[mNextCacheEntry] = slot;
+			mNextCacheEntry = (mNextCacheEntry + 1) % kNameCacheSize;
+			return slot;
+		}
+
+		void add_bytes(size_t slot, int64_t delta) noexcept
+		{
+			int64_t& unflushed = mUnflushedBytes[slot];
+			unflushed += delta;
+			if((unflushed >= kFlushBytes) || (unflushed <= -kFlushBytes))
+			{
+				get_registry().add_live_bytes(slot, unflushed);
+				unflushed = 0;
+			}
+		}
+	};
+
+	inline void registry::register_thread(thread_stats* pThreadStats)
+	{
+		Thread_Support_Internal::auto_mutex autoMutex(mMutex);
+		mThreads.push_back(pThreadStats);
+	}
+
+	inline void registry::unregister_thread(thread_stats* pThreadStats)
+	{
+		Thread_Support_Internal::auto_mutex autoMutex(mMutex);
+		for(size_t slot = 0; slot < kMaxNames; ++slot)
+		{
+			pThreadStats->mCounters[slot].add_to(mRetired[slot]);
+		}
+		for(size_t i = 0; i < mThreads.size(); ++i)
+		{
+			if(mThreads[i] == pThreadStats)
+			{
+				mThreads[i] = mThreads.back();
+				mThreads.pop_back();
+				break;
+			}
+		}
+	}
+
+	inline void registry::record_retired(const char* pName, size_t n, bool allocation)
+	{
+		const size_t slot = find_or_add(pName);
+		{
+			Thread_Support_Internal::auto_mutex autoMutex(mMutex);
+			counters& c = mRetired[slot];
+			if(allocation)
+			{
+				c.mAllocations.fetch_add(1, std::memory_order_relaxed);
+				c.mAllocatedBytes.fetch_add(n, std::memory_order_relaxed);
+				c.mHistogram[histogram_bucket(n)].fetch_add(1, std::memory_order_relaxed);
+			}
+			else
+			{
+				c.mFrees.fetch_add(1, std::memory_order_relaxed);
+				c.mFreedBytes.fetch_add(n, std::memory_order_relaxed);
+			}
+		}
+		add_live_bytes(slot, allocation ? (int64_t)n : -(int64_t)n);
+	}
+
+	inline std::vector<allocator_stats> registry::snapshot()
+	{
+		Thread_Support_Internal::auto_mutex autoMutex(mMutex);
+
+		std::vector<allocator_stats> result;
+		for(size_t slot = 0; slot < kMaxNames; ++slot)
+		{
+			if((slot >= mNameCount) && (slot != kOtherSlot))
+			{
+				continue;
+			}
+
+			allocator_stats stats = {};
+			stats.mpName = mNames[slot];
+			mRetired[slot].add_to(stats);
+			for(thread_stats* pThreadStats : mThreads)
+			{
+				pThreadStats->mCounters[slot].add_to(stats);
+			}
+
+			if(stats.mAllocations == 0 && stats.mFrees == 0)
+			{
+				continue;
+			}
+
+			stats.mLiveBytes = (int64_t)(stats.mAllocatedBytes - stats.mFreedBytes);
+			const int64_t peak = mPeakBytes[slot].load(std::memory_order_relaxed);
+			stats.mPeakBytes = (peak > stats.mLiveBytes) ? peak : stats.mLiveBytes;
+			result.push_back(stats);
+		}
+		return result;
+	}
+
+	inline thread_stats& get_thread_stats()
+	{
+		static thread_local thread_stats threadStats;
+		return threadStats;
+	}
+
+	inline void record_allocate(const char* pName, size_t n) noexcept
+	{
+		if(tbThreadStatsDestroyed)
+		{
+			get_registry().record_retired(pName, n, true);
+			return;
+		}
+
+		thread_stats& threadStats = get_thread_stats();
+		const size_t slot = threadStats.slot_of(pName);
+		counters& c = threadStats.mCounters[slot];
+
+		owner_add(c.mAllocations, 1);
+		owner_add(c.mAllocatedBytes, n);
+		owner_add(c.mHistogram[histogram_bucket(n)], 1);
+		threadStats.add_bytes(slot, (int64_t)n);
+	}
+
+	inline void record_deallocate(const char* pName, size_t n) noexcept
+	{
+		if(tbThreadStatsDestroyed)
+		{
+			get_registry().record_retired(pName, n, false);
+			return;
+		}
+
+		thread_stats& threadStats = get_thread_stats();
+		const size_t slot = threadStats.slot_of(pName);
+		counters& c = threadStats.mCounters[slot];
+
+		owner_add(c.mFrees, 1);
+		owner_add(c.mFreedBytes, n);
+		threadStats.add_bytes(slot, -(int64_t)n);
+	}
+
+}
+
+inline std::vector<allocator_stats> get_allocator_stats()
+{
+	return Allocator_Stats_Internal::get_registry().snapshot();
+}
+
+inline void dump_allocator_stats(FILE* pFile)
+{
+	for(const allocator_stats& stats : get_allocator_stats())
+	{
+		std::fprintf(pFile, "%-24s allocs=%llu frees=%llu live=%lld peak=%lld hist=",
+		             stats.mpName,
+		             (unsigned long long)stats.mAllocations,
+		             (unsigned long long)stats.mFrees,
+		             (long long)stats.mLiveBytes,
+		             (long long)stats.mPeakBytes);
+		for(size_t i = 0; i < allocator_stats::kHistogramBuckets; ++i)
+		{
+			std::fprintf(pFile, (i == 0) ? "%llu" : ",%llu", (unsigned long long)stats.mHistogram[i]);
+		}
+		std::fprintf(pFile, "\n");
+	}
+}
+
+/*
+ * Wraps any allocator with the rstl::allocator interface and records its traffic
+ * under its name.
+ * */
+
+template <typename Allocator>
+class tracked_allocator : public Allocator
+{
+public:
+	using Allocator::Allocator;
+
+	tracked_allocator() : Allocator() { }
+	tracked_allocator(const Allocator& x) : Allocator(x) { }
+
+	void* allocate(size_t n, int flags = 0)
+	{
+		void* const p = Allocator::allocate(n, flags);
+		if(p)
+		{
+			Allocator_Stats_Internal::record_allocate(this->get_name(), n);
+		}
+		return p;
+	}
+
+	void* allocate(size_t n, size_t alignment, size_t offset, int flags = 0)
+	{
+		void* const p = Allocator::allocate(n, alignment, offset, flags);
+		if(p)
+		{
+			Allocator_Stats_Internal::record_allocate(this->get_name(), n);
+		}
+		return p;
+	}
+
+	void deallocate(void* p, size_t n)
+	{
+		if(p)
+		{
+			Allocator_Stats_Internal::record_deallocate(this->get_name(), n);
+		}
+		Allocator::deallocate(p, n);
+	}
+};
+
+RSTL_NAMESPACE_END
+
+#endif //RSTL_ALLOCATOR_STATS_H
@@ -0,0 +1,289 @@
+#ifndef RSTL_ALLOCATOR_TRACE_H
+#define RSTL_ALLOCATOR_TRACE_H
+
+#pragma once
+
+#include "internal/config.h"
+#include "internal/thread_support.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+RSTL_NAMESPACE_BEGIN
+
+/*
+ * Allocation trace recording. While a trace is running, every recorded allocate and
+ * deallocate is appended to a binary file as a fixed 32 byte allocation_trace_record.
+ * The file starts with the 8 byte magic kAllocationTraceMagic. Records are buffered per
+ * thread and written in blocks, so recording costs a clock read and a few stores; records
+ * of different threads are therefore interleaved by block, not strictly by time.
+ *
+ * Recording is opt-in: wrap an allocator in traced_allocator<>, or build with
+ * RSTL_ALLOCATOR_TRACE set to 1 to have rstl::allocator record itself. A trace can be
+ * replayed against any allocator with bench/allocator_replay.
+ * */
+
+static constexpr char kAllocationTraceMagic[8] = {'R', 'S', 'T', 'L', 'T', 'R', 'C', '1'};
+
+// mAlignmentLog2 of an allocation made at the allocator's own default alignment; a replay uses its allocator's default.
+static constexpr uint8_t kTraceAlignmentUnspecified = 0xFF;
+
+enum allocation_trace_kind : uint8_t
+{
+	TRACE_ALLOCATE = 0,
+	TRACE_DEALLOCATE = 1
+};
+
+struct allocation_trace_record
+{
+	uint64_t mTimestamp;   // Nanoseconds since the trace was started.
+	uint64_t mAddress;     // Pairs a deallocation with its allocation.
+	uint64_t mSize;
+	uint32_t mThread;      // Small sequential id, in order of each thread's first record.
+	uint8_t mKind;         // allocation_trace_kind
+	uint8_t mAlignmentLog2; // Or kTraceAlignmentUnspecified.
+	uint16_t mFlags;
+};
+
+static_assert(sizeof(allocation_trace_record) == 32, "allocation_trace_record is a fixed 32 byte file format.");
+
+// Starts writing a trace to pPath, truncating it. Returns false if a trace is already running or the file can't be opened.
+bool start_allocation_trace(const char* pPath);
+
+// Writes out the calling thread's buffered records. Threads also flush when their buffer fills and when they exit.
+void flush_allocation_trace();
+
+// Flushes the calling thread and closes the file. Records other threads have not flushed by then are dropped.
+void stop_allocation_trace();
+
+bool is_allocation_trace_running() noexcept;
+
+namespace Allocator_Trace_Internal {
+
+	static constexpr size_t kBufferRecords = 1024;
+
+	class trace_writer
+	{
+	public:
+		trace_writer() noexcept { }
+
+		trace_writer(const trace_writer&) = delete;
+		trace_writer& operator=(const trace_writer&) = delete;
+
+		bool start(const char* pPath)
+		{
+			Thread_Support_Internal::auto_mutex autoMutex(mMutex);
+			if(mpFile)
+			{
+				return false;
+			}
+
+			mpFile = std::fopen(pPath, "wb");
+			if(!mpFile)
+			{
+				return false;
+			}
+
+			std::fwrite(kAllocationTraceMagic, 1, sizeof(kAllocationTraceMagic), mpFile);
+			mStart = std::chrono::steady_clock::now();
+			mGeneration.fetch_add(1, std::memory_order_relaxed);
+			mRunning.store(true, std::memory_order_release);
+			return true;
+		}
+
+		void stop()
+		{
+			mRunning.store(false, std::memory_order_release);
+
+			Thread_Support_Internal::auto_mutex autoMutex(mMutex);
+			if(mpFile)
+			{
+				std::fclose(mpFile);
+				mpFile = nullptr;
+			}
+		}
+
+		// Records buffered during an earlier trace are dropped rather than written into this one.
+		void write(const allocation_trace_record* pRecords, size_t count, uint64_t recordGeneration)
+		{
+			Thread_Support_Internal::auto_mutex autoMutex(mMutex);
+			if(mpFile && count && (recordGeneration == generation()))
+			{
+				std::fwrite(pRecords, sizeof(allocation_trace_record), count, mpFile);
+			}
+		}
+
+		bool running() const noexcept
+		{
+			return mRunning.load(std::memory_order_relaxed);
+		}
+
+		uint64_t generation() const noexcept
+		{
+			return mGeneration.load(std::memory_order_relaxed);
+		}
+
+		uint64_t now() const noexcept
+		{
+			return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - mStart).count();
+		}
+
+		uint32_t next_thread_id() noexcept
+		{
+			return mNextThreadId.fetch_add(1, std::memory_order_relaxed);
+		}
+
+	protected:
+		std::mutex mMutex;
+		FILE* mpFile = nullptr;
+		std::chrono::steady_clock::time_point mStart;
+		std::atomic<bool> mRunning{false};
+		std::atomic<uint64_t> mGeneration{0};
+		std::atomic<uint32_t> mNextThreadId{0};
+	};
+
+	inline trace_writer& get_trace_writer()
+	{
+		static trace_writer* const pWriter = new trace_writer();
+		return *pWriter;
+	}
+
+	struct thread_buffer
+	{
+		allocation_trace_record mRecords[kBufferRecords];
+		size_t mCount = 0;
+		uint32_t mThreadId;
+		uint64_t mGeneration = 0;
+
+		thread_buffer() : mThreadId(get_trace_writer().next_thread_id())
+		{
+
+		}
+
+		~thread_buffer()
+		{
+			flush();
+		}
+
+		thread_buffer(const thread_buffer&) = delete;
+		thread_buffer& operator=(const thread_buffer&) = delete;
+
+		void flush()
+		{
+			get_trace_writer().write(mRecords, mCount, mGeneration);
+			mCount = 0;
+		}
+
+		void record(uint8_t kind, const void* p, size_t n, size_t alignment, int flags)
+		{
+			trace_writer& writer = get_trace_writer();
+			if(mGeneration != writer.generation())
+			{
+				mGeneration = writer.generation();
+				mCount = 0;
+			}
+
+			allocation_trace_record& r = mRecords[mCount];
+			r.mTimestamp = writer.now();
+			r.mAddress = (uint64_t)(uintptr_t)p;
+			r.mSize = n;
+			r.mThread = mThreadId;
+			r.mKind = kind;
+			r.mAlignmentLog2 = (alignment == 0) ? kTraceAlignmentUnspecified : (uint8_t)(63 - __builtin_clzll((unsigned long long)alignment));
+			r.mFlags = (uint16_t)flags;
+
+			if(++mCount == kBufferRecords)
+			{
+				flush();
+			}
+		}
+	};
+
+	inline thread_buffer& get_thread_buffer()
+	{
+		static thread_local thread_buffer threadBuffer;
+		return threadBuffer;
+	}
+
+	inline void record_allocate(const void* p, size_t n, size_t alignment, int flags)
+	{
+		if(get_trace_writer().running() && p)
+		{
+			get_thread_buffer().record(TRACE_ALLOCATE, p, n, alignment, flags);
+		}
+	}
+
+	inline void record_deallocate(const void* p, size_t n)
+	{
+		if(get_trace_writer().running() && p)
+		{
+			get_thread_buffer().record(TRACE_DEALLOCATE, p, n, 0, 0);
+		}
+	}
+
+}
+
+inline bool start_allocation_trace(const char* pPath)
+{
+	return Allocator_Trace_Internal::get_trace_writer().start(pPath);
+}
+
+inline void flush_allocation_trace()
+{
+	Allocator_Trace_Internal::get_thread_buffer().flush();
+}
+
+inline void stop_allocation_trace()
+{
+	flush_allocation_trace();
+	Allocator_Trace_Internal::get_trace_writer().stop();
+}
+
+inline bool is_allocation_trace_running() noexcept
+{
+	return Allocator_Trace_Internal::get_trace_writer().running();
+}
+
+/*
+ * Wraps any allocator with the rstl::allocator interface and records its traffic
+ * while a trace is running.
+ * */
+
+template <typename Allocator>
+class traced_allocator : public Allocator
+{
+public:
+	using Allocator::Allocator;
+
+	traced_allocator() : Allocator() { }
+	traced_allocator(const Allocator& x) : Allocator(x) { }
+
+	// Wrapped allocators differ in their default alignment, so it is recorded as unspecified.
+	void* allocate(size_t n, int flags = 0)
+	{
+		void* const p = Allocator::allocate(n, flags);
+		Allocator_Trace_Internal::record_allocate(p, n, 0, flags);
+		return p;
+	}
+
+	void* allocate(size_t n, size_t alignment, size_t offset, int flags = 0)
+	{
+		void* const p = Allocator::allocate(n, alignment, offset, flags);
+		Allocator_Trace_Internal::record_allocate(p, n, alignment, flags);
+		return p;
+	}
+
+	void deallocate(void* p, size_t n)
+	{
+		Allocator_Trace_Internal::record_deallocate(p, n);
+		Allocator::deallocate(p, n);
+	}
+};
+
+RSTL_NAMESPACE_END
+
+#endif //RSTL_ALLOCATOR_TRACE_H
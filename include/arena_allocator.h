@@ -0,0 +1,384 @@
+#ifndef RSTL_ARENA_ALLOCATOR_H
+#define RSTL_ARENA_ALLOCATOR_H
+
+#pragma once
+
+#include "internal/config.h"
+#include "allocator.h"
+
+#include <cstddef>
+#include <cstdint>
+
+RSTL_NAMESPACE_BEGIN
+
+/*
+ * A monotonic bump-pointer region. Memory is handed out from a chain of blocks and
+ * is never freed one allocation at a time; instead a marker taken with get_marker()
+ * can later be passed to rewind() to release everything allocated since, in one
+ * pointer reset. Rewound blocks are kept and reused, so a steady-state request loop
+ * stops touching the heap altogether. An arena is not thread-safe.
+ * */
+
+class arena
+{
+public:
+	static constexpr size_t kDefaultBlockSize = 64 * 1024;
+
+	struct block;
+
+	struct marker
+	{
+		block* mpBlock;
+		size_t mOffset;
+	};
+
+	explicit arena(size_t blockSize = kDefaultBlockSize, const allocator& upstream = allocator(ARENA_ALLOCATOR_DEFAULT_NAME));
+	~arena();
+
+	arena(const arena&) = delete;
+	arena& operator=(const arena&) = delete;
+
+	void* allocate(size_t n, size_t alignment, size_t offset = 0);
+
+	// Gives back p if it is the most recent allocation, otherwise does nothing.
+	void deallocate(void* p, size_t n) noexcept;
+
+	bool owns(const void* p) const noexcept;
+
+	marker get_marker() const noexcept;
+	void rewind(const marker& m) noexcept;
+	void reset() noexcept;
+
+	// Bytes currently handed out, and bytes reserved from the upstream allocator.
+	size_t used() const noexcept;
+	size_t capacity() const noexcept;
+
+public:
+	struct block
+	{
+		block* mpNext;
+		size_t mSize; // Usable bytes following the header.
+
+		char* begin() noexcept
+		{
+			return reinterpret_cast<char*>(this) + kHeaderSize;
+		}
+	};
+
+	static constexpr size_t kHeaderSize = (sizeof(block) + 15) & ~size_t(15);
+
+protected:
+	block* new_block(size_t minSize);
+
+	allocator mUpstream;
+	size_t mBlockSize;
+	block* mpFirst;
+	block* mpCurrent;
+	size_t mOffset; // Offset of the next free byte in mpCurrent.
+};
+
+/*
+ * Rewinds the arena to where it was when the scope was entered. Use it to bracket the
+ * temporaries of one request.
+ * */
+
+class arena_rewind_scope
+{
+public:
+	explicit arena_rewind_scope(arena& a) noexcept : mpArena(&a), mMarker(a.get_marker()) { }
+
+	~arena_rewind_scope()
+	{
+		mpArena->rewind(mMarker);
+	}
+
+	arena_rewind_scope(const arena_rewind_scope&) = delete;
+	arena_rewind_scope& operator=(const arena_rewind_scope&) = delete;
+
+protected:
+	arena* mpArena;
+	arena::marker mMarker;
+};
+
+/*
+ * An rstl::allocator compatible handle which honours alloc_flags: MEN_TEMP requests
+ * are bump allocated from the arena and MEN_PERM requests go to the long-lived
+ * backing allocator. deallocate tells the two apart by address, so callers need not
+ * remember which flag they used.
+ * */
+
+class arena_allocator
+{
+public:
+	explicit arena_allocator(arena& a, const char* pName = ARENA_ALLOCATOR_DEFAULT_NAME);
+	arena_allocator(const arena_allocator& x);
+	arena_allocator(const arena_allocator& x, const char* pName);
+
+	arena_allocator& operator=(const arena_allocator& x);
+
+	void* allocate(size_t n, int flags = 0);
+	void* allocate(size_t n, size_t alignment, size_t offset, int flags = 0);
+	void deallocate(void* p, size_t n);
+
+	const char* get_name() const;
+	void set_name(const char* pName);
+
+	arena* get_arena() const;
+
+	// Debug name
+	const char* mpName;
+
+protected:
+	arena* mpArena;
+};
+
+bool operator==(const arena_allocator& a, const arena_allocator& b);
+bool operator!=(const arena_allocator& a, const arena_allocator& b);
+
+/*
+ * arena
+ * */
+
+inline arena::arena(size_t blockSize, const allocator& upstream) : mUpstream(upstream), mBlockSize(blockSize), mpFirst(nullptr), mpCurrent(nullptr), mOffset(0)
+{
+
+}
+
+inline arena::~arena()
+{
+	while(block* pBlock = mpFirst)
+	{
+		mpFirst = pBlock->mpNext;
+		CUSTOM_FREE(mUpstream, pBlock, kHeaderSize + pBlock->mSize);
+	}
+}
+
+inline arena::block* arena::new_block(size_t minSize)
+{
+	const size_t size = (minSize > mBlockSize) ? minSize : mBlockSize;
+
+	void* const pMemory = ALLOC_ALIGNED(mUpstream, kHeaderSize + size, 16, 0);
+	if(!pMemory)
+	{
+		return nullptr;
+	}
+
+	block* const pBlock = static_cast<block*>(pMemory);
+	pBlock->mpNext = nullptr;
+	pBlock->mSize = size;
+	return pBlock;
+}
+
+inline void* arena::allocate(size_t n, size_t alignment, size_t offset)
+{
+	if(alignment < ALLOCATOR_MIN_ALIGNMENT)
+	{
+		alignment = ALLOCATOR_MIN_ALIGNMENT;
+	}
+
+	// Aligns (p + offset) rather than p, as the allocate(n, alignment, offset) contract asks.
+	for(;;)
+	{
+		if(mpCurrent)
+		{
+			const uintptr_t base = (uintptr_t)mpCurrent->begin();
+			const uintptr_t aligned = ((base + mOffset + offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - offset;
+			const size_t end = (size_t)(aligned - base) + n;
+
+			if(end <= mpCurrent->mSize)
+			{
+				mOffset = end;
+				return (void*)aligned;
+			}
+
+			// Move on to a block kept from before a rewind, if it is big enough.
+			if(mpCurrent->mpNext && (mpCurrent->mpNext->mSize >= n + offset + alignment))
+			{
+				mpCurrent = mpCurrent->mpNext;
+				mOffset = 0;
+				continue;
+			}
+		}
+
+		block* const pBlock = new_block(n + offset + alignment);
+		if(!pBlock)
+		{
+			return nullptr;
+		}
+
+		if(mpCurrent)
+		{
+			pBlock->mpNext = mpCurrent->mpNext;
+			mpCurrent->mpNext = pBlock;
+		}
+		else
+		{
+			pBlock->mpNext = mpFirst;
+			mpFirst = pBlock;
+		}
+		mpCurrent = pBlock;
+		mOffset = 0;
+	}
+}
+
+inline void arena::deallocate(void* p, size_t n) noexcept
+{
+	if(mpCurrent && ((char*)p + n == mpCurrent->begin() + mOffset) && ((char*)p >= mpCurrent->begin()))
+	{
+		mOffset = (size_t)((char*)p - mpCurrent->begin());
+	}
+}
+
+inline bool arena::owns(const void* p) const noexcept
+{
+	// The current block is checked first since that is where recent allocations live.
+	if(mpCurrent && (p >= mpCurrent->begin()) && (p < mpCurrent->begin() + mpCurrent->mSize))
+	{
+		return true;
+	}
+
+	for(block* pBlock = mpFirst; pBlock; pBlock = pBlock->mpNext)
+	{
+		if((p >= pBlock->begin()) && (p < pBlock->begin() + pBlock->mSize))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+inline arena::marker arena::get_marker() const noexcept
+{
+	return marker{mpCurrent, mOffset};
+}
+
+inline void arena::rewind(const marker& m) noexcept
+{
+	if(m.mpBlock)
+	{
+		mpCurrent = m.mpBlock;
+		mOffset = m.mOffset;
+	}
+	else
+	{
+		reset();
+	}
+}
+
+inline void arena::reset() noexcept
+{
+	mpCurrent = mpFirst;
+	mOffset = 0;
+}
+
+inline size_t arena::used() const noexcept
+{
+	size_t total = 0;
+	for(block* pBlock = mpFirst; pBlock; pBlock = pBlock->mpNext)
+	{
+		if(pBlock == mpCurrent)
+		{
+			return total + mOffset;
+		}
+		total += pBlock->mSize;
+	}
+	return total;
+}
+
+inline size_t arena::capacity() const noexcept
+{
+	size_t total = 0;
+	for(block* pBlock = mpFirst; pBlock; pBlock = pBlock->mpNext)
+	{
+		total += pBlock->mSize;
+	}
+	return total;
+}
+
+/*
+ * arena_allocator
+ * */
+
+inline arena_allocator::arena_allocator(arena& a, const char* pName) : mpName(pName), mpArena(&a)
+{
+
+}
+
+inline arena_allocator::arena_allocator(const arena_allocator& x) : mpName(x.mpName), mpArena(x.mpArena)
+{
+
+}
+
+inline arena_allocator::arena_allocator(const arena_allocator& x, const char* pName) : mpName(pName), mpArena(x.mpArena)
+{
+
+}
+
+inline arena_allocator& arena_allocator::operator=(const arena_allocator& x)
+{
+	mpName = x.mpName;
+	mpArena = x.mpArena;
+	return *this;
+}
+
+inline const char* arena_allocator::get_name() const
+{
+	return mpName;
+}
+
+inline void arena_allocator::set_name(const char* pName)
+{
+	mpName = pName;
+}
+
+inline arena* arena_allocator::get_arena() const
+{
+	return mpArena;
+}
+
+inline void* arena_allocator::allocate(size_t n, int flags)
+{
+	return allocate(n, ALLOCATOR_DEFAULT_ALIGNMENT, 0, flags);
+}
+
+inline void* arena_allocator::allocate(size_t n, size_t alignment, size_t offset, int flags)
+{
+	if(flags & MEN_PERM)
+	{
+		rstl::allocator backing(mpName);
+		return backing.allocate(n, alignment, offset, flags);
+	}
+	return mpArena->allocate(n, alignment, offset);
+}
+
+inline void arena_allocator::deallocate(void* p, size_t n)
+{
+	if(p == nullptr)
+	{
+		return;
+	}
+
+	if(mpArena->owns(p))
+	{
+		mpArena->deallocate(p, n);
+	}
+	else
+	{
+		rstl::allocator backing(mpName);
+		backing.deallocate(p, n);
+	}
+}
+
+inline bool operator==(const arena_allocator& a, const arena_allocator& b)
+{
+	return (a.get_arena() == b.get_arena());
+}
+
+inline bool operator!=(const arena_allocator& a, const arena_allocator& b)
+{
+	return (a.get_arena() != b.get_arena());
+}
+
+RSTL_NAMESPACE_END
+
+#endif //RSTL_ARENA_ALLOCATOR_H
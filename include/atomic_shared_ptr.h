@@ -0,0 +1,301 @@
+#ifndef RSTL_ATOMIC_SHARED_PTR_H
+#define RSTL_ATOMIC_SHARED_PTR_H
+
+#pragma once
+
+#include "internal/config.h"
+#include "allocator.h"
+#include "shared_ptr.h"
+
+#include <atomic>
+#include <cstdint>
+
+RSTL_NAMESPACE_BEGIN
+
+namespace SmartPTR_Internal {
+
+	/*
+	 * atomic_ptr_slot holds a shared_ptr or weak_ptr that threads can load and replace
+	 * concurrently without a lock, using split reference counts.
+	 *
+	 * The stored pointer lives in a node, and the slot is one 64-bit word: the node
+	 * address in the low 48 bits and a count of borrowed references in the high 16.
+	 *  - A load borrows the node with one fetch_add on the word. It copies the node's
+	 *    pointer and gives the borrow back by decrementing the word again, as long as
+	 *    the word still names the same node.
+	 *  - A store exchanges the word for a new node. The count in the old word is the
+	 *    number of borrows still out, and it is added to the old node's own count.
+	 *    Each borrower that then finds the word changed decrements the node's count
+	 *    instead, and whoever brings that count to zero frees the node.
+	 * So readers never wait for writers, and a writer pays one node allocation.
+	 *
+	 * This needs 64-bit pointers with the top 16 bits clear, as user-space pointers are
+	 * on x86-64 and AArch64, and at most 65535 loads of one slot in flight at a time.
+	 * The memory_order arguments are accepted for compatibility with std::atomic;
+	 * every operation is at least an acquire load or an acq_rel read-modify-write.
+	 * */
+
+	template <typename T>
+	inline bool equivalent_ptr(const shared_ptr<T>& a, const shared_ptr<T>& b) noexcept
+	{
+		return (a.get() == b.get()) && !a.owner_before(b) && !b.owner_before(a);
+	}
+
+	template <typename T>
+	inline bool equivalent_ptr(const weak_ptr<T>& a, const weak_ptr<T>& b) noexcept
+	{
+		return !a.owner_before(b) && !b.owner_before(a);
+	}
+
+	template <typename Ptr>
+	class atomic_ptr_slot
+	{
+	public:
+		using value_type = Ptr;
+
+		static constexpr bool is_always_lock_free = true;
+
+		atomic_ptr_slot() noexcept : mWord(0) { }
+
+		atomic_ptr_slot(value_type desired) : mWord(reinterpret_cast<uintptr_t>(create_node(std::move(desired)))) { }
+
+		atomic_ptr_slot(const atomic_ptr_slot&) = delete;
+		atomic_ptr_slot& operator=(const atomic_ptr_slot&) = delete;
+
+		~atomic_ptr_slot()
+		{
+			retire(mWord.load(std::memory_order_acquire));
+		}
+
+		bool is_lock_free() const noexcept
+		{
+			return true;
+		}
+
+		value_type load(std::memory_order = std::memory_order_seq_cst) const
+		{
+			if(!get_node(mWord.load(std::memory_order_acquire)))
+			{
+				return value_type();
+			}
+
+			node* const pNode = get_node(mWord.fetch_add(kCountUnit, std::memory_order_acquire));
+			value_type ret = pNode ? pNode->mPtr : value_type();
+			return_borrow(pNode);
+			return ret;
+		}
+
+		operator value_type() const
+		{
+			return load();
+		}
+
+		void store(value_type desired, std::memory_order = std::memory_order_seq_cst)
+		{
+			exchange(std::move(desired));
+		}
+
+		void operator=(value_type desired)
+		{
+			exchange(std::move(desired));
+		}
+
+		value_type exchange(value_type desired, std::memory_order = std::memory_order_seq_cst)
+		{
+			node* const pNode = create_node(std::move(desired));
+			return retire(mWord.exchange(reinterpret_cast<uintptr_t>(pNode), std::memory_order_acq_rel));
+		}
+
+		/*
+		 * Replaces the stored pointer with desired if it is equivalent to expected (same
+		 * stored pointer and same ownership), otherwise copies it into expected.
+		 * */
+		bool compare_exchange_strong(value_type& expected, value_type desired, std::memory_order = std::memory_order_seq_cst, std::memory_order = std::memory_order_seq_cst)
+		{
+			node* pNewNode = nullptr;
+			bool newNodeCreated = false;
+
+			for(;;)
+			{
+				uint64_t word = mWord.fetch_add(kCountUnit, std::memory_order_acquire) + kCountUnit;
+				node* const pNode = get_node(word);
+
+				if(!equivalent_ptr(pNode ? pNode->mPtr : value_type(), expected))
+				{
+					expected = pNode ? pNode->mPtr : value_type();
+					return_borrow(pNode);
+					if(pNewNode)
+					{
+						destroy_node(pNewNode);
+					}
+					return false;
+				}
+
+				if(!newNodeCreated)
+				{
+					pNewNode = create_node(std::move(desired));
+					newNodeCreated = true;
+				}
+
+				// Readers move the count while we hold the borrow, so retry until the node changes.
+				while(get_node(word) == pNode)
+				{
+					if(mWord.compare_exchange_weak(word, reinterpret_cast<uintptr_t>(pNewNode), std::memory_order_acq_rel, std::memory_order_relaxed))
+					{
+						if(pNode)
+						{
+							// The swapped out count includes our own borrow, which we are done with.
+							release_node(pNode, (int32_t)get_count(word) - 1);
+						}
+						return true;
+					}
+				}
+
+				return_borrow(pNode);
+			}
+		}
+
+		bool compare_exchange_weak(value_type& expected, value_type desired, std::memory_order = std::memory_order_seq_cst, std::memory_order = std::memory_order_seq_cst)
+		{
+			return compare_exchange_strong(expected, std::move(desired));
+		}
+
+	protected:
+		struct node
+		{
+			std::atomic<int32_t> mRefCount; // Borrows folded in when swapped out, less those returned here.
+			value_type mPtr;
+
+			explicit node(value_type ptr) noexcept : mRefCount(0), mPtr(std::move(ptr)) { }
+		};
+
+		static constexpr int kCountShift = 48;
+		static constexpr uint64_t kCountUnit = uint64_t(1) << kCountShift;
+		static constexpr uint64_t kNodeMask = kCountUnit - 1;
+
+		static_assert(sizeof(void*) == 8, "atomic_ptr_slot packs a pointer and a count into 64 bits.");
+
+		mutable std::atomic<uint64_t> mWord;
+
+		static node* get_node(uint64_t word) noexcept
+		{
+			return reinterpret_cast<node*>(static_cast<uintptr_t>(word & kNodeMask));
+		}
+
+		static uint32_t get_count(uint64_t word) noexcept
+		{
+			return (uint32_t)(word >> kCountShift);
+		}
+
+		// An empty pointer is stored as a null node, so loading it needs no borrow.
+		static node* create_node(value_type ptr)
+		{
+			const value_type empty;
+			if(!ptr.owner_before(empty) && !empty.owner_before(ptr))
+			{
+				return nullptr;
+			}
+
+			rstl::allocator allocator;
+			void* const pMemory = CUSTOM_ALLOC(allocator, sizeof(node));
+			if(!pMemory)
+			{
+				throw std::bad_alloc();
+			}
+			return ::new(pMemory) node(std::move(ptr));
+		}
+
+		static void destroy_node(node* pNode) noexcept
+		{
+			rstl::allocator allocator;
+			pNode->~node();
+			CUSTOM_FREE(allocator, pNode, sizeof(node));
+		}
+
+		static void release_node(node* pNode, int32_t count) noexcept
+		{
+			if(pNode->mRefCount.fetch_add(count, std::memory_order_acq_rel) + count == 0)
+			{
+				destroy_node(pNode);
+			}
+		}
+
+		// The count of a word naming no node is never read, so a borrow of null is simply dropped.
+		void return_borrow(node* pNode) const noexcept
+		{
+			if(!pNode)
+			{
+				return;
+			}
+
+			uint64_t word = mWord.load(std::memory_order_relaxed);
+			while(get_node(word) == pNode)
+			{
+				if(mWord.compare_exchange_weak(word, word - kCountUnit, std::memory_order_release, std::memory_order_relaxed))
+				{
+					return;
+				}
+			}
+
+			// The node was swapped out with this borrow counted in it.
+			release_node(pNode, -1);
+		}
+
+		// Takes over a word that was swapped out of mWord and returns the pointer it held.
+		static value_type retire(uint64_t word)
+		{
+			node* const pNode = get_node(word);
+			if(!pNode)
+			{
+				return value_type();
+			}
+
+			const uint32_t count = get_count(word);
+			if(count == 0)
+			{
+				// No borrows are out and none can start, so the node is ours alone.
+				value_type ret(std::move(pNode->mPtr));
+				destroy_node(pNode);
+				return ret;
+			}
+
+			value_type ret(pNode->mPtr);
+			release_node(pNode, (int32_t)count);
+			return ret;
+		}
+	};
+
+}
+
+/*
+ * atomic_shared_ptr / atomic_weak_ptr
+ *
+ * Lock-free counterparts of std::atomic<std::shared_ptr<T>> and
+ * std::atomic<std::weak_ptr<T>>; see SmartPTR_Internal::atomic_ptr_slot for how
+ * they work. Prefer these to the free atomic_load/atomic_store functions, which
+ * take a mutex.
+ * */
+
+template <typename T>
+class atomic_shared_ptr : public SmartPTR_Internal::atomic_ptr_slot<shared_ptr<T>>
+{
+public:
+	using base_type = SmartPTR_Internal::atomic_ptr_slot<shared_ptr<T>>;
+	using base_type::base_type;
+	using base_type::operator=;
+
+	atomic_shared_ptr(std::nullptr_t) noexcept : base_type() { }
+};
+
+template <typename T>
+class atomic_weak_ptr : public SmartPTR_Internal::atomic_ptr_slot<weak_ptr<T>>
+{
+public:
+	using base_type = SmartPTR_Internal::atomic_ptr_slot<weak_ptr<T>>;
+	using base_type::base_type;
+	using base_type::operator=;
+};
+
+RSTL_NAMESPACE_END
+
+#endif //RSTL_ATOMIC_SHARED_PTR_H
@@ -0,0 +1,423 @@
+#ifndef RSTL_BIASED_SHARED_PTR_H
+#define RSTL_BIASED_SHARED_PTR_H
+
+#pragma once
+
+#include "internal/config.h"
+#include "allocator.h"
+#include "shared_ptr.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+RSTL_NAMESPACE_BEGIN
+
+/*
+ * Biased reference counting for objects that one thread creates and does most of the
+ * copying of. make_biased_shared<T>() returns an ordinary shared_ptr<T>; only its
+ * control block differs. The block splits the strong count in two:
+ *  - mBiasedCount belongs to the thread that created the object (the owner). Only the
+ *    owner changes it, without read-modify-write instructions.
+ *  - mRefCount holds the references taken and dropped by every other thread, updated
+ *    atomically. It can go negative when another thread drops a reference the owner
+ *    took, and is shifted left to make room for the kMerged and kQueued flags.
+ * The object is alive while the sum is positive. When the owner's count drops to zero
+ * the owner merges it into mRefCount and sets kMerged; from then on every thread uses
+ * mRefCount alone.
+ *
+ * A thread that takes mRefCount below zero before the merge may have dropped the last
+ * reference, but only the owner can read mBiasedCount. That thread sets kQueued and
+ * queues the block to the owner, which merges it at its next make_biased_shared call,
+ * when it calls merge_biased_shared(), or when it exits. After the owner has exited,
+ * the queueing thread merges the block itself.
+ * */
+
+namespace Biased_Ref_Count_Internal {
+
+	struct ref_count_sp_biased;
+
+	/*
+	 * Per-thread owner record. It is reference counted by its thread and by each
+	 * biased block it owns, so a queueing thread can always reach it.
+	 * */
+	struct biased_owner
+	{
+		std::mutex mMutex;
+		ref_count_sp_biased* mpQueue; // Guarded by mMutex.
+		bool mExited;                 // Guarded by mMutex.
+		std::atomic<bool> mHasQueued;
+		std::atomic<int32_t> mRefCount;
+
+		biased_owner() : mpQueue(nullptr), mExited(false), mHasQueued(false), mRefCount(1) { }
+
+		void addref() noexcept
+		{
+			Thread_Support_Internal::atomic_increment_relaxed(mRefCount);
+		}
+
+		void release() noexcept
+		{
+			if(Thread_Support_Internal::atomic_decrement_acq_rel(mRefCount) == 0)
+			{
+				delete this;
+			}
+		}
+
+		void merge_queued() noexcept;
+	};
+
+	// Marks the owner record exited and merges its queue when the thread ends.
+	struct biased_owner_holder
+	{
+		biased_owner* mpOwner = nullptr;
+
+		~biased_owner_holder();
+	};
+
+	// The calling thread's record, or null if it has not created a biased object. Kept
+	// apart from the holder so that reading it needs no thread_local initialization check.
+	inline thread_local biased_owner* tpCurrentOwner = nullptr;
+
+	inline biased_owner* find_current_owner() noexcept
+	{
+		return tpCurrentOwner;
+	}
+
+	inline biased_owner* get_current_owner()
+	{
+		if(!tpCurrentOwner)
+		{
+			static thread_local biased_owner_holder tHolder;
+			tHolder.mpOwner = new biased_owner();
+			tpCurrentOwner = tHolder.mpOwner;
+		}
+		return tpCurrentOwner;
+	}
+
+	struct ref_count_sp_biased : public ref_count_sp
+	{
+		static constexpr int32_t kMerged = 1;
+		static constexpr int32_t kQueued = 2;
+		static constexpr int32_t kCountUnit = 4;
+
+		biased_owner* mpOwner;
+		std::atomic<int32_t> mBiasedCount; // Written by the owner only, with plain loads and stores.
+		ref_count_sp_biased* mpNextQueued;
+
+		explicit ref_count_sp_biased(const ref_count_ops* pOps) noexcept
+			: ref_count_sp(pOps, 0, 1, true), mpOwner(get_current_owner()), mBiasedCount(1), mpNextQueued(nullptr)
+		{
+			mpOwner->addref();
+		}
+
+		static int32_t shared_count(int32_t word) noexcept
+		{
+			return word >> 2;
+		}
+
+		bool is_owner() const noexcept
+		{
+			return mpOwner == find_current_owner();
+		}
+
+		bool is_merged() const noexcept
+		{
+			return (mRefCount.load(std::memory_order_relaxed) & kMerged) != 0;
+		}
+
+		// The last strong reference is gone. A queued block leaves the joint weak reference to the queue.
+		void on_zero(int32_t word) noexcept
+		{
+			free_value();
+			if(!(word & kQueued))
+			{
+				weak_release();
+			}
+		}
+
+		// Folds mBiasedCount into mRefCount. Called by the owner, or by the queueing thread once the owner has exited.
+		void merge() noexcept
+		{
+			// mBiasedCount is left as is: kMerged makes every reader ignore it, while clearing it
+			// first would let biased_lock pair the old word with a zero count and fail.
+			const int32_t biasedCount = mBiasedCount.load(std::memory_order_relaxed);
+			const int32_t add = (biasedCount * kCountUnit) | kMerged;
+			const int32_t word = mRefCount.fetch_add(add, std::memory_order_acq_rel) + add;
+			if(shared_count(word) == 0)
+			{
+				on_zero(word);
+			}
+		}
+
+		// Called by whoever took the block off a queue, after merging it.
+		void finish_queued() noexcept
+		{
+			int32_t word = mRefCount.load(std::memory_order_acquire);
+			for(;;)
+			{
+				if(shared_count(word) == 0)
+				{
+					weak_release(); // Deferred by on_zero.
+					return;
+				}
+				if(mRefCount.compare_exchange_weak(word, word & ~kQueued, std::memory_order_acq_rel, std::memory_order_acquire))
+				{
+					return;
+				}
+			}
+		}
+
+		void enqueue() noexcept
+		{
+			biased_owner* const pOwner = mpOwner;
+			{
+				std::lock_guard<std::mutex> lock(pOwner->mMutex);
+				if(!pOwner->mExited)
+				{
+					mpNextQueued = pOwner->mpQueue;
+					pOwner->mpQueue = this;
+					pOwner->mHasQueued.store(true, std::memory_order_release);
+					return;
+				}
+			}
+			merge();
+			finish_queued();
+		}
+
+		void shared_release() noexcept
+		{
+			int32_t word = mRefCount.load(std::memory_order_relaxed);
+			int32_t newWord;
+			do
+			{
+				newWord = word - kCountUnit;
+				if(!(newWord & kMerged) && (shared_count(newWord) < 0))
+				{
+					newWord |= kQueued;
+				}
+			}
+			while(!mRefCount.compare_exchange_weak(word, newWord, std::memory_order_acq_rel, std::memory_order_relaxed));
+
+			if(newWord & kMerged)
+			{
+				if(shared_count(newWord) == 0)
+				{
+					on_zero(newWord);
+				}
+			}
+			else if((newWord & kQueued) && !(word & kQueued))
+			{
+				enqueue();
+			}
+		}
+
+		static void biased_addref(ref_count_sp* pRefCount) noexcept
+		{
+			ref_count_sp_biased* const pThis = static_cast<ref_count_sp_biased*>(pRefCount);
+			if(pThis->is_owner() && !pThis->is_merged())
+			{
+				pThis->mBiasedCount.store(pThis->mBiasedCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+				return;
+			}
+			pThis->mRefCount.fetch_add(kCountUnit, std::memory_order_relaxed);
+		}
+
+		static void biased_release(ref_count_sp* pRefCount) noexcept
+		{
+			ref_count_sp_biased* const pThis = static_cast<ref_count_sp_biased*>(pRefCount);
+			if(pThis->is_owner() && !pThis->is_merged())
+			{
+				const int32_t biasedCount = pThis->mBiasedCount.load(std::memory_order_relaxed) - 1;
+				pThis->mBiasedCount.store(biasedCount, std::memory_order_relaxed);
+				if(biasedCount == 0)
+				{
+					pThis->merge();
+				}
+				return;
+			}
+			pThis->shared_release();
+		}
+
+		static ref_count_sp* biased_lock(ref_count_sp* pRefCount) noexcept
+		{
+			ref_count_sp_biased* const pThis = static_cast<ref_count_sp_biased*>(pRefCount);
+			int32_t word = pThis->mRefCount.load(std::memory_order_relaxed);
+			for(;;)
+			{
+				int32_t total = shared_count(word);
+				if(!(word & kMerged))
+				{
+					total += pThis->mBiasedCount.load(std::memory_order_relaxed);
+				}
+				if(total <= 0)
+				{
+					return nullptr;
+				}
+				if(pThis->mRefCount.compare_exchange_weak(word, word + kCountUnit, std::memory_order_acq_rel, std::memory_order_relaxed))
+				{
+					return pThis;
+				}
+			}
+		}
+
+		// Exact on the owner thread; elsewhere it may miss references the owner is taking or dropping.
+		static int32_t biased_use_count(const ref_count_sp* pRefCount) noexcept
+		{
+			const ref_count_sp_biased* const pThis = static_cast<const ref_count_sp_biased*>(pRefCount);
+			const int32_t word = pThis->mRefCount.load(std::memory_order_acquire);
+			int32_t total = shared_count(word);
+			if(!(word & kMerged))
+			{
+				total += pThis->mBiasedCount.load(std::memory_order_relaxed);
+			}
+			return (total > 0) ? total : 0;
+		}
+	};
+
+	inline void biased_owner::merge_queued() noexcept
+	{
+		ref_count_sp_biased* pQueue;
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			pQueue = mpQueue;
+			mpQueue = nullptr;
+			mHasQueued.store(false, std::memory_order_relaxed);
+		}
+
+		while(pQueue)
+		{
+			ref_count_sp_biased* const pNext = pQueue->mpNextQueued;
+			if(!pQueue->is_merged())
+			{
+				pQueue->merge();
+			}
+			pQueue->finish_queued();
+			pQueue = pNext;
+		}
+	}
+
+	inline biased_owner_holder::~biased_owner_holder()
+	{
+		if(mpOwner)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mpOwner->mMutex);
+				mpOwner->mExited = true;
+			}
+			mpOwner->merge_queued();
+			tpCurrentOwner = nullptr;
+			mpOwner->release();
+		}
+	}
+
+	/*
+	 * The make_biased_shared control block, holding an instance of T.
+	 * */
+	template <typename T, typename Allocator>
+	class ref_count_sp_t_biased_inst : public ref_count_sp_biased
+	{
+	public:
+		using this_type = ref_count_sp_t_biased_inst<T, Allocator>;
+		using value_type = T;
+		using allocator_type = Allocator;
+		using storage_type = typename std::aligned_storage_t<sizeof(T), std::alignment_of_v<T>>;
+
+		compressed_pair<storage_type, allocator_type> mMemoryAllocator;
+
+		static constexpr ref_count_ops sOps = { &ref_count_ops_for<this_type>::free_value, &ref_count_ops_for<this_type>::free_ref_count_sp, &ref_count_ops_for<this_type>::get_deleter,
+			&ref_count_sp_biased::biased_addref, &ref_count_sp_biased::biased_release, &ref_count_sp_biased::biased_lock, &ref_count_sp_biased::biased_use_count };
+
+		value_type* GetValue()
+		{
+			return static_cast<value_type*>(static_cast<void*>(&mMemoryAllocator.first()));
+		}
+
+		template<typename... Args>
+		ref_count_sp_t_biased_inst(allocator_type allocator, Args&&... args) : ref_count_sp_biased(&sOps), mMemoryAllocator(allocator)
+		{
+			try
+			{
+				new(static_cast<void*>(&mMemoryAllocator.first()))value_type(std::forward<Args>(args)...);
+			}
+			catch(...)
+			{
+				mpOwner->release();
+				throw;
+			}
+		}
+
+		void free_value() noexcept
+		{
+			GetValue()->~value_type();
+		}
+
+		void free_ref_count_sp() noexcept
+		{
+			allocator_type allocator = mMemoryAllocator.second();
+			biased_owner* const pOwner = mpOwner;
+			this->~ref_count_sp_t_biased_inst();
+			CUSTOM_FREE(allocator, this, sizeof(*this));
+			pOwner->release();
+		}
+
+		void* get_deleter(const std::type_info&) const noexcept
+		{
+			return nullptr;
+		}
+	};
+
+}
+
+/*
+ * Merges the blocks that other threads have queued to the calling thread. A thread
+ * that creates biased objects but rarely calls make_biased_shared again (an event
+ * loop, say) should call this now and then so that objects freed elsewhere are
+ * destroyed promptly.
+ * */
+inline void merge_biased_shared()
+{
+	Biased_Ref_Count_Internal::biased_owner* const pOwner = Biased_Ref_Count_Internal::find_current_owner();
+	if(pOwner && pOwner->mHasQueued.load(std::memory_order_acquire))
+	{
+		pOwner->merge_queued();
+	}
+}
+
+template <typename T, typename Allocator, typename... Args>
+shared_ptr<T> allocate_biased_shared(const Allocator& allocator, Args&&... args)
+{
+	static_assert(!std::is_array_v<T>, "allocate_biased_shared does not support arrays.");
+
+	using ref_count_type = Biased_Ref_Count_Internal::ref_count_sp_t_biased_inst<T, Allocator>;
+
+	merge_biased_shared();
+
+	shared_ptr<T> ret;
+	void* const pMemory = allocate_memory(const_cast<Allocator&>(allocator), sizeof(ref_count_type), alignof(ref_count_type), 0);
+	if(pMemory)
+	{
+		ref_count_type* pRefCount;
+		try
+		{
+			pRefCount = ::new(pMemory) ref_count_type(allocator, std::forward<Args>(args)...);
+		}
+		catch(...)
+		{
+			CUSTOM_FREE(const_cast<Allocator&>(allocator), pMemory, sizeof(ref_count_type));
+			throw;
+		}
+		allocate_shared_helper(ret, pRefCount, pRefCount->GetValue());
+	}
+	return ret;
+}
+
+template <typename T, typename... Args>
+shared_ptr<T> make_biased_shared(Args&&... args)
+{
+	return rstl::allocate_biased_shared<T>(SmartPTR_Internal::default_ref_count_allocator(), std::forward<Args>(args)...);
+}
+
+RSTL_NAMESPACE_END
+
+#endif //RSTL_BIASED_SHARED_PTR_H
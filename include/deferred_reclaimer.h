@@ -0,0 +1,372 @@
+#ifndef RSTL_DEFERRED_RECLAIMER_H
+#define RSTL_DEFERRED_RECLAIMER_H
+
+#pragma once
+
+#include "internal/config.h"
+#include "internal/smart_ptr.h"
+#include "allocator.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+RSTL_NAMESPACE_BEGIN
+
+/*
+ * deferred_reclaimer runs destructors on a background thread, so that dropping the
+ * last reference to a large object tree does not stall the thread that dropped it.
+ *
+ * Work items are deferred_nodes pushed onto a lock-free stack; pushing never blocks
+ * and never allocates. The worker thread, started by the first push, takes the whole
+ * stack at once and reclaims it oldest first, mBatchSize items at a time, yielding
+ * between batches. When more than mMaxPending items are waiting, push reclaims inline
+ * instead, which bounds the memory held by the backlog.
+ *
+ * flush() waits until everything pushed before it has been reclaimed; drain() also
+ * stops the worker, after which pushes reclaim inline. Call drain() (or
+ * drain_deferred_destruction() for the default reclaimer) at shutdown.
+ * */
+
+struct deferred_node
+{
+	deferred_node* mpNext;
+	void (*mpReclaim)(deferred_node*) noexcept;
+};
+
+class deferred_reclaimer
+{
+public:
+	struct options
+	{
+		size_t mBatchSize = 64;
+		size_t mMaxPending = 65536;
+	};
+
+	deferred_reclaimer() : deferred_reclaimer(options()) { }
+	explicit deferred_reclaimer(const options& opts);
+	~deferred_reclaimer();
+
+	deferred_reclaimer(const deferred_reclaimer&) = delete;
+	deferred_reclaimer& operator=(const deferred_reclaimer&) = delete;
+
+	void push(deferred_node* pNode) noexcept;
+	void flush();
+	void drain();
+
+	size_t pending() const noexcept;
+
+protected:
+	enum state : uint32_t
+	{
+		kIdle,
+		kRunning,
+		kStopped
+	};
+
+	options mOptions;
+	std::atomic<deferred_node*> mpStack;
+	std::atomic<uint64_t> mPushed;
+	std::atomic<uint64_t> mReclaimed;
+	std::atomic<uint32_t> mState;
+	std::atomic<bool> mStopRequested;
+	deferred_node mStopNode; // Pushed by drain() to wake the worker for the last time.
+	std::mutex mLifecycleMutex; // Guards mWorker; only taken to start and to drain.
+	std::thread mWorker;
+
+	void link(deferred_node* pNode) noexcept;
+	void start_worker() noexcept;
+	void run() noexcept;
+	void reclaim_list(deferred_node* pList) noexcept;
+
+	static void reclaim_nothing(deferred_node*) noexcept { }
+
+	static deferred_reclaimer*& current_worker() noexcept
+	{
+		static thread_local deferred_reclaimer* tpReclaimer = nullptr;
+		return tpReclaimer;
+	}
+};
+
+inline deferred_reclaimer::deferred_reclaimer(const options& opts)
+	: mOptions(opts), mpStack(nullptr), mPushed(0), mReclaimed(0), mState(kIdle), mStopRequested(false), mStopNode{ nullptr, &reclaim_nothing }
+{
+	if(mOptions.mBatchSize == 0)
+	{
+		mOptions.mBatchSize = 1;
+	}
+}
+
+inline deferred_reclaimer::~deferred_reclaimer()
+{
+	drain();
+}
+
+inline size_t deferred_reclaimer::pending() const noexcept
+{
+	// A node is counted before it is linked, so mPushed never trails mReclaimed; read mReclaimed first.
+	const uint64_t reclaimed = mReclaimed.load(std::memory_order_acquire);
+	const uint64_t pushed = mPushed.load(std::memory_order_acquire);
+	return (size_t)(pushed - reclaimed);
+}
+
+inline void deferred_reclaimer::link(deferred_node* pNode) noexcept
+{
+	mPushed.fetch_add(1, std::memory_order_relaxed);
+
+	deferred_node* pHead = mpStack.load(std::memory_order_relaxed);
+	do
+	{
+		pNode->mpNext = pHead;
+	}
+	while(!mpStack.compare_exchange_weak(pHead, pNode, std::memory_order_seq_cst, std::memory_order_relaxed));
+}
+
+inline void deferred_reclaimer::push(deferred_node* pNode) noexcept
+{
+	if((mState.load(std::memory_order_acquire) == kStopped) || (pending() >= mOptions.mMaxPending))
+	{
+		pNode->mpReclaim(pNode);
+		return;
+	}
+
+	link(pNode);
+
+	switch(mState.load(std::memory_order_seq_cst))
+	{
+	case kIdle:
+		start_worker();
+		break;
+	case kStopped:
+		// Raced with drain(): it may already have emptied the stack, so take care of whatever is left.
+		reclaim_list(mpStack.exchange(nullptr, std::memory_order_acquire));
+		return;
+	default:
+		break;
+	}
+	mpStack.notify_one();
+}
+
+inline void deferred_reclaimer::start_worker() noexcept
+{
+	std::lock_guard<std::mutex> lock(mLifecycleMutex);
+	if(mState.load(std::memory_order_relaxed) != kIdle)
+	{
+		return;
+	}
+
+	try
+	{
+		mWorker = std::thread([this]
+		{
+			current_worker() = this;
+			run();
+		});
+		mState.store(kRunning, std::memory_order_release);
+	}
+	catch(...)
+	{
+		// No thread: reclaim what has been pushed so far and do everything inline from now on.
+		mState.store(kStopped, std::memory_order_seq_cst);
+		reclaim_list(mpStack.exchange(nullptr, std::memory_order_acquire));
+	}
+}
+
+inline void deferred_reclaimer::reclaim_list(deferred_node* pList) noexcept
+{
+	// The stack is newest first; reverse it so that objects are destroyed in the order they were released.
+	deferred_node* pOldestFirst = nullptr;
+	while(pList)
+	{
+		deferred_node* const pNext = pList->mpNext;
+		pList->mpNext = pOldestFirst;
+		pOldestFirst = pList;
+		pList = pNext;
+	}
+
+	while(pOldestFirst)
+	{
+		size_t batch = 0;
+		for(; pOldestFirst && (batch < mOptions.mBatchSize); ++batch)
+		{
+			deferred_node* const pNext = pOldestFirst->mpNext;
+			pOldestFirst->mpReclaim(pOldestFirst);
+			pOldestFirst = pNext;
+		}
+		mReclaimed.fetch_add(batch, std::memory_order_release);
+		mReclaimed.notify_all();
+		if(pOldestFirst)
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+inline void deferred_reclaimer::run() noexcept
+{
+	for(;;)
+	{
+		deferred_node* const pList = mpStack.exchange(nullptr, std::memory_order_acquire);
+		if(pList)
+		{
+			reclaim_list(pList);
+			continue;
+		}
+		if(mStopRequested.load(std::memory_order_acquire))
+		{
+			return;
+		}
+		mpStack.wait(nullptr, std::memory_order_acquire);
+	}
+}
+
+inline void deferred_reclaimer::flush()
+{
+	// The worker would wait for itself; destructors that release more deferred objects end up here.
+	if((mState.load(std::memory_order_acquire) != kRunning) || (current_worker() == this))
+	{
+		return;
+	}
+
+	// Every counted item is on its way onto the stack, or is reclaimed inline by a push that raced drain().
+	const uint64_t target = mPushed.load(std::memory_order_acquire);
+	uint64_t reclaimed = mReclaimed.load(std::memory_order_acquire);
+	while(reclaimed < target)
+	{
+		mReclaimed.wait(reclaimed, std::memory_order_acquire);
+		reclaimed = mReclaimed.load(std::memory_order_acquire);
+	}
+}
+
+inline void deferred_reclaimer::drain()
+{
+	if(current_worker() == this)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mLifecycleMutex);
+	if(mState.load(std::memory_order_acquire) != kRunning)
+	{
+		return;
+	}
+
+	flush();
+
+	// The stop node is reclaimed like any other item, so the counts stay balanced.
+	mStopRequested.store(true, std::memory_order_release);
+	link(&mStopNode);
+	mpStack.notify_one();
+	mWorker.join();
+
+	// Pushes that raced with the stop are reclaimed here; later ones run inline.
+	mState.store(kStopped, std::memory_order_seq_cst);
+	reclaim_list(mpStack.exchange(nullptr, std::memory_order_acquire));
+}
+
+/*
+ * The reclaimer used by deferred_delete and by make_shared for types tagged with
+ * defer_destruction. Like the default allocators it is never destroyed, so call
+ * drain_deferred_destruction() at shutdown to run the remaining destructors.
+ * */
+inline deferred_reclaimer& get_default_reclaimer()
+{
+	static deferred_reclaimer* const pReclaimer = new deferred_reclaimer();
+	return *pReclaimer;
+}
+
+inline void flush_deferred_destruction()
+{
+	get_default_reclaimer().flush();
+}
+
+inline void drain_deferred_destruction()
+{
+	get_default_reclaimer().drain();
+}
+
+/*
+ * Specialize defer_destruction<T> as std::true_type to make make_shared<T>,
+ * allocate_shared<T> and shared_ptr<T>(U*) destroy T on the default reclaimer.
+ * */
+template <typename T>
+struct defer_destruction : std::false_type
+{
+};
+
+template <typename T>
+inline constexpr bool defer_destruction_v = defer_destruction<std::remove_cv_t<T>>::value;
+
+/*
+ * deferred_delete is a deleter for shared_ptr(U*, Deleter) and unique_ptr that hands
+ * the pointer and the wrapped deleter to a reclaimer. It allocates a small node for
+ * them when called; if that fails, it deletes inline.
+ * */
+template <typename T, typename Deleter = default_delete<T>>
+struct deferred_delete
+{
+	using pointer = std::remove_extent_t<T>*;
+
+	Deleter mDeleter;
+	deferred_reclaimer* mpReclaimer; // Null for get_default_reclaimer().
+
+	deferred_delete() noexcept : mDeleter(), mpReclaimer(nullptr) { }
+
+	explicit deferred_delete(Deleter deleter, deferred_reclaimer* pReclaimer = nullptr) : mDeleter(std::move(deleter)), mpReclaimer(pReclaimer) { }
+
+	template <typename U, typename UDeleter>
+	deferred_delete(const deferred_delete<U, UDeleter>& other, std::enable_if_t<std::is_convertible_v<U*, T*> && std::is_convertible_v<UDeleter, Deleter>>* = 0)
+		: mDeleter(other.mDeleter), mpReclaimer(other.mpReclaimer) { }
+
+	void operator()(pointer p) const noexcept
+	{
+		if(!p)
+		{
+			return;
+		}
+
+		// rstl::allocator throws when out of memory, which must not escape a noexcept deleter.
+		rstl::allocator allocator;
+		void* pMemory = nullptr;
+		try
+		{
+			pMemory = CUSTOM_ALLOC(allocator, sizeof(node));
+		}
+		catch(...)
+		{
+
+		}
+		if(!pMemory)
+		{
+			mDeleter(p);
+			return;
+		}
+		node* const pNode = ::new(pMemory) node(p, mDeleter);
+		(mpReclaimer ? *mpReclaimer : get_default_reclaimer()).push(pNode);
+	}
+
+protected:
+	struct node : deferred_node
+	{
+		pointer mpValue;
+		Deleter mDeleter;
+
+		node(pointer pValue, const Deleter& deleter) : deferred_node{ nullptr, &reclaim }, mpValue(pValue), mDeleter(deleter) { }
+
+		static void reclaim(deferred_node* pNode) noexcept
+		{
+			node* const pThis = static_cast<node*>(pNode);
+			pThis->mDeleter(pThis->mpValue);
+			rstl::allocator allocator;
+			pThis->~node();
+			CUSTOM_FREE(allocator, pThis, sizeof(node));
+		}
+	};
+};
+
+RSTL_NAMESPACE_END
+
+#endif //RSTL_DEFERRED_RECLAIMER_H
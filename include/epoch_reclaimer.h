@@ -0,0 +1,415 @@
+#ifndef RSTL_EPOCH_RECLAIMER_H
+#define RSTL_EPOCH_RECLAIMER_H
+
+#pragma once
+
+#include "internal/config.h"
+#include "allocator.h"
+#include "internal/smart_ptr.h"
+#include "internal/compressed_pair.h"
+#include "internal/thread_records.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+RSTL_NAMESPACE_BEGIN
+
+/*
+ * Epoch-based reclamation for read-mostly structures. Readers pin the domain's global
+ * epoch for the duration of a read with an epoch_guard; writers retire what they
+ * unlink, stamped with the epoch current at the time. The global epoch only moves
+ * from e to e + 1 once every pinned thread has pinned e, so by the time it reaches
+ * e + 2 no reader can still hold anything retired at e, and it is freed.
+ *
+ * Pinning is a store of the epoch to the thread's own record followed by a fence;
+ * unpinning is a plain store. Unlike a shared_ptr copy, neither writes to a cache
+ * line any other thread writes to. Nested guards only count.
+ *
+ * The price is that one stalled reader holds back all reclamation in its domain, so
+ * keep guards short, and that retired memory is freed in batches: a thread tries to
+ * advance the epoch and frees what it can once its list reaches the scan threshold.
+ *
+ * As with hazard_pointer_domain, each thread gets one record per domain, records are
+ * reused but never freed while the domain lives, and an exiting thread leaves what it
+ * could not free on an orphan list for the next scan. A domain must outlive every
+ * thread that used it, other than the one destroying it. The default domain is never
+ * destroyed.
+ * */
+
+class epoch_domain;
+class epoch_guard;
+
+namespace Epoch_Internal {
+
+	static constexpr size_t kRecordAlignment = 64;
+	static constexpr size_t kDefaultScanThreshold = 128;
+	static constexpr uint64_t kQuiescent = 0; // A record's epoch while it is not pinned; the global epoch starts at 1.
+
+	struct retired_node
+	{
+		retired_node* mpNext;
+		uint64_t mEpoch;
+		void (*mpReclaim)(retired_node*) noexcept;
+	};
+
+	template <typename T, typename Deleter, typename Allocator>
+	struct retired_node_t : retired_node
+	{
+		T* mpValue;
+		compressed_pair<Deleter, Allocator> mDeleterAllocator;
+
+		retired_node_t(T* pValue, uint64_t epoch, Deleter deleter, const Allocator& allocator)
+			: retired_node{ nullptr, epoch, &reclaim }, mpValue(pValue), mDeleterAllocator(std::move(deleter), allocator) { }
+
+		static void reclaim(retired_node* pNode) noexcept
+		{
+			retired_node_t* const pThis = static_cast<retired_node_t*>(pNode);
+			pThis->mDeleterAllocator.first()(pThis->mpValue);
+			Allocator allocator = pThis->mDeleterAllocator.second();
+			pThis->~retired_node_t();
+			CUSTOM_FREE(allocator, pThis, sizeof(retired_node_t));
+		}
+	};
+
+	struct alignas(kRecordAlignment) epoch_record
+	{
+		std::atomic<uint64_t> mEpoch;
+		std::atomic<bool> mActive;
+		epoch_record* mpNext; // Set before the record is published and never changed.
+
+		// Only touched by the thread that holds the record.
+		uint32_t mPinDepth;
+		retired_node* mpRetired; // Newest first, so epochs never increase along the list.
+		size_t mRetiredCount;
+
+		epoch_record() noexcept : mEpoch(kQuiescent), mActive(true), mpNext(nullptr), mPinDepth(0), mpRetired(nullptr), mRetiredCount(0) { }
+	};
+
+	using thread_records = Thread_Records_Internal::thread_records<epoch_domain, epoch_record>;
+
+	inline thread_records& get_thread_records()
+	{
+		return Thread_Records_Internal::get_thread_records<epoch_domain, epoch_record>();
+	}
+
+}
+
+class epoch_domain
+{
+public:
+	explicit epoch_domain(size_t scanThreshold = Epoch_Internal::kDefaultScanThreshold) noexcept;
+	~epoch_domain();
+
+	epoch_domain(const epoch_domain&) = delete;
+	epoch_domain& operator=(const epoch_domain&) = delete;
+
+	/*
+	 * Hands p to the domain, which calls deleter(p) once every reader pinned at the time
+	 * has unpinned. The bookkeeping node comes from allocator; if that allocation fails,
+	 * retire waits for the epoch to move on and deletes p immediately, or throws
+	 * std::bad_alloc if the calling thread is itself inside an epoch_guard.
+	 * */
+	template <typename T, typename Deleter = default_delete<T>, typename Allocator = rstl::allocator>
+	void retire(T* p, Deleter deleter = Deleter(), const Allocator& allocator = Allocator());
+
+	// Tries to advance the epoch and frees everything this thread or exited threads retired that is now safe.
+	void reclaim() noexcept;
+
+	// Retired nodes not yet reclaimed, across all threads.
+	size_t retired_count() const noexcept;
+
+	uint64_t epoch() const noexcept
+	{
+		return mEpoch.load(std::memory_order_acquire);
+	}
+
+protected:
+	friend class epoch_guard;
+	friend Epoch_Internal::thread_records;
+
+	using epoch_record = Epoch_Internal::epoch_record;
+	using retired_node = Epoch_Internal::retired_node;
+
+	size_t mScanThreshold;
+	std::atomic<uint64_t> mEpoch;
+	Thread_Records_Internal::record_list<epoch_record, retired_node> mRecords;
+	std::atomic<size_t> mRetiredCount;
+
+	epoch_record* acquire_record()
+	{
+		return mRecords.acquire();
+	}
+
+	void release_record(epoch_record* pRecord) noexcept;
+	epoch_record* thread_record() noexcept;
+
+	void pin(epoch_record* pRecord) noexcept;
+	void unpin(epoch_record* pRecord) noexcept;
+
+	bool try_advance() noexcept;
+	void scan(epoch_record* pRecord) noexcept;
+	size_t free_expired(retired_node*& pList) noexcept;
+	void adopt_orphans() noexcept;
+};
+
+/*
+ * Pins the domain's current epoch for the guard's lifetime. Pointers read from the
+ * structure while a guard is alive stay valid until it is destroyed. Like
+ * hazard_pointer, a guard must be destroyed on the thread that made it.
+ * */
+class epoch_guard
+{
+public:
+	explicit epoch_guard(epoch_domain& domain);
+	~epoch_guard();
+
+	epoch_guard(const epoch_guard&) = delete;
+	epoch_guard& operator=(const epoch_guard&) = delete;
+
+protected:
+	epoch_domain* mpDomain;
+	Epoch_Internal::epoch_record* mpRecord;
+	bool mOwnsRecord; // Every cache entry was taken by another domain, so this holds a record of its own.
+};
+
+inline epoch_domain& get_default_epoch_domain()
+{
+	static epoch_domain* const pDomain = new epoch_domain();
+	return *pDomain;
+}
+
+template <typename T, typename Deleter = default_delete<T>, typename Allocator = rstl::allocator>
+inline void epoch_retire(T* p, Deleter deleter = Deleter(), const Allocator& allocator = Allocator())
+{
+	get_default_epoch_domain().retire(p, std::move(deleter), allocator);
+}
+
+inline epoch_domain::epoch_domain(size_t scanThreshold) noexcept
+	: mScanThreshold(scanThreshold ? scanThreshold : 1), mEpoch(1), mRecords(), mRetiredCount(0)
+{
+}
+
+inline epoch_domain::~epoch_domain()
+{
+	// mRecords frees the records, with whatever is still retired on them, once this returns.
+	Epoch_Internal::get_thread_records().forget(this);
+}
+
+inline size_t epoch_domain::retired_count() const noexcept
+{
+	return mRetiredCount.load(std::memory_order_relaxed);
+}
+
+inline void epoch_domain::release_record(epoch_record* pRecord) noexcept
+{
+	pRecord->mPinDepth = 0;
+	pRecord->mEpoch.store(Epoch_Internal::kQuiescent, std::memory_order_release);
+
+	if(pRecord->mpRetired)
+	{
+		scan(pRecord);
+	}
+	mRecords.abandon(pRecord);
+}
+
+inline Epoch_Internal::epoch_record* epoch_domain::thread_record() noexcept
+{
+	return Epoch_Internal::get_thread_records().find_or_acquire(this);
+}
+
+inline void epoch_domain::pin(epoch_record* pRecord) noexcept
+{
+	if(pRecord->mPinDepth++ == 0)
+	{
+		// The fence orders the store before every read the guard protects; see try_advance.
+		pRecord->mEpoch.store(mEpoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	}
+}
+
+inline void epoch_domain::unpin(epoch_record* pRecord) noexcept
+{
+	if(--pRecord->mPinDepth == 0)
+	{
+		pRecord->mEpoch.store(Epoch_Internal::kQuiescent, std::memory_order_release);
+	}
+}
+
+inline bool epoch_domain::try_advance() noexcept
+{
+	const uint64_t epoch = mEpoch.load(std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	for(epoch_record* pRecord = mRecords.head(); pRecord; pRecord = pRecord->mpNext)
+	{
+		// Acquire, so that a reader's accesses before unpinning happen before anything freed after this.
+		const uint64_t recordEpoch = pRecord->mEpoch.load(std::memory_order_acquire);
+		if((recordEpoch != Epoch_Internal::kQuiescent) && (recordEpoch != epoch))
+		{
+			return false;
+		}
+	}
+
+	uint64_t expected = epoch;
+	return mEpoch.compare_exchange_strong(expected, epoch + 1, std::memory_order_release, std::memory_order_relaxed) || (expected > epoch);
+}
+
+// Frees the nodes of a newest-first list retired at least two epochs ago; returns how many.
+inline size_t epoch_domain::free_expired(retired_node*& pList) noexcept
+{
+	const uint64_t epoch = mEpoch.load(std::memory_order_acquire);
+	if(epoch < 3)
+	{
+		return 0;
+	}
+
+	retired_node** ppCut = &pList;
+	while(*ppCut && ((*ppCut)->mEpoch + 2 > epoch))
+	{
+		ppCut = &(*ppCut)->mpNext;
+	}
+
+	retired_node* pExpired = *ppCut;
+	*ppCut = nullptr;
+	size_t count = 0;
+	while(pExpired)
+	{
+		retired_node* const pNext = pExpired->mpNext;
+		pExpired->mpReclaim(pExpired);
+		pExpired = pNext;
+		++count;
+	}
+	return count;
+}
+
+inline void epoch_domain::adopt_orphans() noexcept
+{
+	retired_node* pOrphans = mRecords.take_orphans();
+	if(!pOrphans)
+	{
+		return;
+	}
+
+	// Orphan lists from several threads are not ordered by epoch, so check each node.
+	const uint64_t epoch = mEpoch.load(std::memory_order_acquire);
+	retired_node* pKeepFirst = nullptr;
+	retired_node* pKeepLast = nullptr;
+	size_t reclaimed = 0;
+	while(pOrphans)
+	{
+		retired_node* const pNode = pOrphans;
+		pOrphans = pNode->mpNext;
+		if(pNode->mEpoch + 2 <= epoch)
+		{
+			pNode->mpReclaim(pNode);
+			++reclaimed;
+		}
+		else
+		{
+			pNode->mpNext = pKeepFirst;
+			pKeepFirst = pNode;
+			if(!pKeepLast)
+			{
+				pKeepLast = pNode;
+			}
+		}
+	}
+	mRetiredCount.fetch_sub(reclaimed, std::memory_order_relaxed);
+	if(pKeepFirst)
+	{
+		mRecords.push_orphans(pKeepFirst, pKeepLast);
+	}
+}
+
+inline void epoch_domain::scan(epoch_record* pRecord) noexcept
+{
+	try_advance();
+	const size_t reclaimed = free_expired(pRecord->mpRetired);
+	pRecord->mRetiredCount -= reclaimed;
+	mRetiredCount.fetch_sub(reclaimed, std::memory_order_relaxed);
+	adopt_orphans();
+}
+
+template <typename T, typename Deleter, typename Allocator>
+inline void epoch_domain::retire(T* p, Deleter deleter, const Allocator& allocator)
+{
+	using node_type = Epoch_Internal::retired_node_t<T, Deleter, Allocator>;
+
+	if(!p)
+	{
+		return;
+	}
+
+	// The fence orders the caller's unlinking of p before reading the epoch p is stamped with.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	const uint64_t epoch = mEpoch.load(std::memory_order_relaxed);
+
+	void* const pMemory = allocate_memory(const_cast<Allocator&>(allocator), sizeof(node_type), alignof(node_type), 0);
+	if(!pMemory)
+	{
+		// Waiting would never finish if this thread holds the epoch back itself.
+		const epoch_record* const pRecord = Epoch_Internal::get_thread_records().find(this);
+		if(pRecord && pRecord->mPinDepth)
+		{
+			throw std::bad_alloc();
+		}
+		while(mEpoch.load(std::memory_order_acquire) < epoch + 2)
+		{
+			try_advance();
+		}
+		deleter(p);
+		return;
+	}
+	retired_node* const pNode = ::new(pMemory) node_type(p, epoch, std::move(deleter), allocator);
+	mRetiredCount.fetch_add(1, std::memory_order_relaxed);
+
+	epoch_record* const pRecord = thread_record();
+	if(!pRecord)
+	{
+		mRecords.push_orphans(pNode, pNode);
+		return;
+	}
+
+	pNode->mpNext = pRecord->mpRetired;
+	pRecord->mpRetired = pNode;
+	if(++pRecord->mRetiredCount >= mScanThreshold)
+	{
+		scan(pRecord);
+	}
+}
+
+inline void epoch_domain::reclaim() noexcept
+{
+	if(epoch_record* const pRecord = thread_record())
+	{
+		scan(pRecord);
+		return;
+	}
+	try_advance();
+	adopt_orphans();
+}
+
+inline epoch_guard::epoch_guard(epoch_domain& domain) : mpDomain(&domain), mpRecord(domain.thread_record()), mOwnsRecord(false)
+{
+	if(!mpRecord)
+	{
+		mpRecord = domain.acquire_record();
+		mOwnsRecord = true;
+	}
+	domain.pin(mpRecord);
+}
+
+inline epoch_guard::~epoch_guard()
+{
+	mpDomain->unpin(mpRecord);
+	if(mOwnsRecord)
+	{
+		mpDomain->release_record(mpRecord);
+	}
+}
+
+RSTL_NAMESPACE_END
+
+#endif //RSTL_EPOCH_RECLAIMER_H
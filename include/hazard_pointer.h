@@ -0,0 +1,531 @@
+#ifndef RSTL_HAZARD_POINTER_H
+#define RSTL_HAZARD_POINTER_H
+
+#pragma once
+
+#include "internal/config.h"
+#include "allocator.h"
+#include "internal/smart_ptr.h"
+#include "internal/compressed_pair.h"
+#include "internal/thread_records.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+RSTL_NAMESPACE_BEGIN
+
+/*
+ * Hazard pointers make it safe to free nodes of lock-free structures. A reader
+ * publishes the pointer it is about to dereference in a hazard slot, then checks
+ * that the pointer is still reachable; a writer that unlinks a node retires it
+ * instead of freeing it, and retired nodes are only reclaimed once no slot holds
+ * them.
+ *
+ * Each thread gets a hazard_record per domain, holding kSlotsPerRecord slots and the
+ * thread's retired list. Retiring is a push onto that list; once the list reaches
+ * the scan threshold (at least twice the number of slots in the domain, so every
+ * scan frees at least half of what it looks at) the thread snapshots all slots,
+ * sorts them and reclaims every retired node not found among them.
+ *
+ * Records are never freed while the domain lives; an exiting thread scans one last
+ * time, hands what is still protected to the domain's orphan list for the next scan
+ * to adopt, and marks its record free for reuse. A domain must therefore outlive
+ * every thread that used it, other than the one destroying it. The default domain
+ * is never destroyed.
+ *
+ * A hazard slot compares addresses, so retire a node through the same pointer type
+ * readers protect it through.
+ * */
+
+class hazard_pointer_domain;
+class hazard_pointer;
+
+namespace Hazard_Pointer_Internal {
+
+	static constexpr size_t kSlotsPerRecord = 8;
+	static constexpr size_t kRecordAlignment = 64;
+	static constexpr size_t kDefaultScanThreshold = 64;
+	static constexpr size_t kStackHazards = 256;
+
+	struct retired_node
+	{
+		retired_node* mpNext;
+		const void* mpValue;
+		void (*mpReclaim)(retired_node*) noexcept;
+	};
+
+	template <typename T, typename Deleter, typename Allocator>
+	struct retired_node_t : retired_node
+	{
+		compressed_pair<Deleter, Allocator> mDeleterAllocator;
+
+		retired_node_t(T* pValue, Deleter deleter, const Allocator& allocator)
+			: retired_node{ nullptr, pValue, &reclaim }, mDeleterAllocator(std::move(deleter), allocator) { }
+
+		static void reclaim(retired_node* pNode) noexcept
+		{
+			retired_node_t* const pThis = static_cast<retired_node_t*>(pNode);
+			pThis->mDeleterAllocator.first()(const_cast<T*>(static_cast<const T*>(pThis->mpValue)));
+			Allocator allocator = pThis->mDeleterAllocator.second();
+			pThis->~retired_node_t();
+			CUSTOM_FREE(allocator, pThis, sizeof(retired_node_t));
+		}
+	};
+
+	struct alignas(kRecordAlignment) hazard_record
+	{
+		std::atomic<const void*> mpSlots[kSlotsPerRecord];
+		std::atomic<bool> mActive;
+		hazard_record* mpNext; // Set before the record is published and never changed.
+
+		// Only touched by the thread that holds the record.
+		uint32_t mFreeSlots;
+		retired_node* mpRetired;
+		size_t mRetiredCount;
+
+		hazard_record() noexcept : mActive(true), mpNext(nullptr), mFreeSlots((1u << kSlotsPerRecord) - 1), mpRetired(nullptr), mRetiredCount(0)
+		{
+			for(std::atomic<const void*>& slot : mpSlots)
+			{
+				slot.store(nullptr, std::memory_order_relaxed);
+			}
+		}
+	};
+
+	static_assert(kSlotsPerRecord <= 32, "mFreeSlots is a 32-bit mask.");
+
+	using thread_records = Thread_Records_Internal::thread_records<hazard_pointer_domain, hazard_record>;
+
+	inline thread_records& get_thread_records()
+	{
+		return Thread_Records_Internal::get_thread_records<hazard_pointer_domain, hazard_record>();
+	}
+
+}
+
+class hazard_pointer_domain
+{
+public:
+	explicit hazard_pointer_domain(size_t scanThreshold = Hazard_Pointer_Internal::kDefaultScanThreshold) noexcept;
+	~hazard_pointer_domain();
+
+	hazard_pointer_domain(const hazard_pointer_domain&) = delete;
+	hazard_pointer_domain& operator=(const hazard_pointer_domain&) = delete;
+
+	/*
+	 * Hands p to the domain, which calls deleter(p) once no hazard_pointer protects it.
+	 * The bookkeeping node comes from allocator; if that allocation fails, retire
+	 * waits for p to become unprotected and deletes it immediately.
+	 * */
+	template <typename T, typename Deleter = default_delete<T>, typename Allocator = rstl::allocator>
+	void retire(T* p, Deleter deleter = Deleter(), const Allocator& allocator = Allocator());
+
+	// Scans now and reclaims everything unprotected retired by this thread or orphaned.
+	void reclaim() noexcept;
+
+	// Retired nodes not yet reclaimed, across all threads.
+	size_t retired_count() const noexcept;
+
+protected:
+	friend class hazard_pointer;
+	friend Hazard_Pointer_Internal::thread_records;
+
+	using hazard_record = Hazard_Pointer_Internal::hazard_record;
+	using retired_node = Hazard_Pointer_Internal::retired_node;
+
+	size_t mScanThreshold;
+	Thread_Records_Internal::record_list<hazard_record, retired_node> mRecords;
+	std::atomic<size_t> mRetiredCount;
+
+	hazard_record* acquire_record()
+	{
+		return mRecords.acquire();
+	}
+
+	void release_record(hazard_record* pRecord) noexcept;
+	hazard_record* thread_record() noexcept;
+
+	void push_retired(retired_node* pNode) noexcept;
+	size_t scan_threshold() const noexcept;
+	void scan(hazard_record* pRecord) noexcept;
+	bool is_protected(const void* p) const noexcept;
+};
+
+/*
+ * A hazard_pointer owns one hazard slot. protect() loads a pointer from an atomic and
+ * publishes it in the slot, retrying until the published value is still current; the
+ * object it points to then cannot be reclaimed until the slot is reset or reused.
+ *
+ * Slots come from the creating thread's record, so a hazard_pointer must be used and
+ * destroyed on the thread that made it.
+ * */
+class hazard_pointer
+{
+public:
+	hazard_pointer() noexcept : mpDomain(nullptr), mpRecord(nullptr), mSlot(0), mOwnsRecord(false) { }
+	explicit hazard_pointer(hazard_pointer_domain& domain);
+	~hazard_pointer();
+
+	hazard_pointer(hazard_pointer&& other) noexcept;
+	hazard_pointer& operator=(hazard_pointer&& other) noexcept;
+
+	hazard_pointer(const hazard_pointer&) = delete;
+	hazard_pointer& operator=(const hazard_pointer&) = delete;
+
+	bool empty() const noexcept
+	{
+		return mpRecord == nullptr;
+	}
+
+	template <typename T>
+	T* protect(const std::atomic<T*>& source) noexcept
+	{
+		T* p = source.load(std::memory_order_relaxed);
+		while(!try_protect(p, source))
+		{
+		}
+		return p;
+	}
+
+	// Publishes p and checks that source still holds it; on failure p is updated to the current value.
+	template <typename T>
+	bool try_protect(T*& p, const std::atomic<T*>& source) noexcept
+	{
+		T* const pExpected = p;
+		reset_protection(pExpected);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		p = source.load(std::memory_order_acquire);
+		if(p != pExpected)
+		{
+			reset_protection();
+			return false;
+		}
+		return true;
+	}
+
+	template <typename T>
+	void reset_protection(const T* p) noexcept
+	{
+		slot().store(p, std::memory_order_release);
+	}
+
+	void reset_protection(std::nullptr_t = nullptr) noexcept
+	{
+		slot().store(nullptr, std::memory_order_release);
+	}
+
+	void swap(hazard_pointer& other) noexcept;
+
+protected:
+	hazard_pointer_domain* mpDomain;
+	Hazard_Pointer_Internal::hazard_record* mpRecord;
+	uint32_t mSlot;
+	bool mOwnsRecord; // The thread's record had no free slot, so this holds a record of its own.
+
+	std::atomic<const void*>& slot() noexcept
+	{
+		return mpRecord->mpSlots[mSlot];
+	}
+
+	void release() noexcept;
+};
+
+inline hazard_pointer_domain& get_default_hazard_pointer_domain()
+{
+	static hazard_pointer_domain* const pDomain = new hazard_pointer_domain();
+	return *pDomain;
+}
+
+inline hazard_pointer make_hazard_pointer(hazard_pointer_domain& domain = get_default_hazard_pointer_domain())
+{
+	return hazard_pointer(domain);
+}
+
+template <typename T, typename Deleter = default_delete<T>, typename Allocator = rstl::allocator>
+inline void hazard_retire(T* p, Deleter deleter = Deleter(), const Allocator& allocator = Allocator())
+{
+	get_default_hazard_pointer_domain().retire(p, std::move(deleter), allocator);
+}
+
+inline hazard_pointer_domain::hazard_pointer_domain(size_t scanThreshold) noexcept
+	: mScanThreshold(scanThreshold), mRecords(), mRetiredCount(0)
+{
+}
+
+inline hazard_pointer_domain::~hazard_pointer_domain()
+{
+	// mRecords frees the records, with whatever is still retired on them, once this returns.
+	Hazard_Pointer_Internal::get_thread_records().forget(this);
+}
+
+inline size_t hazard_pointer_domain::retired_count() const noexcept
+{
+	return mRetiredCount.load(std::memory_order_relaxed);
+}
+
+inline void hazard_pointer_domain::release_record(hazard_record* pRecord) noexcept
+{
+	for(std::atomic<const void*>& slot : pRecord->mpSlots)
+	{
+		slot.store(nullptr, std::memory_order_release);
+	}
+	pRecord->mFreeSlots = (1u << Hazard_Pointer_Internal::kSlotsPerRecord) - 1;
+
+	if(pRecord->mpRetired)
+	{
+		scan(pRecord);
+	}
+	mRecords.abandon(pRecord);
+}
+
+inline Hazard_Pointer_Internal::hazard_record* hazard_pointer_domain::thread_record() noexcept
+{
+	return Hazard_Pointer_Internal::get_thread_records().find_or_acquire(this);
+}
+
+inline size_t hazard_pointer_domain::scan_threshold() const noexcept
+{
+	const size_t slotCount = 2 * Hazard_Pointer_Internal::kSlotsPerRecord * mRecords.size();
+	return (mScanThreshold > slotCount) ? mScanThreshold : slotCount;
+}
+
+inline void hazard_pointer_domain::push_retired(retired_node* pNode) noexcept
+{
+	mRetiredCount.fetch_add(1, std::memory_order_relaxed);
+
+	hazard_record* const pRecord = thread_record();
+	if(!pRecord)
+	{
+		mRecords.push_orphans(pNode, pNode);
+		return;
+	}
+
+	pNode->mpNext = pRecord->mpRetired;
+	pRecord->mpRetired = pNode;
+	if(++pRecord->mRetiredCount >= scan_threshold())
+	{
+		scan(pRecord);
+	}
+}
+
+template <typename T, typename Deleter, typename Allocator>
+inline void hazard_pointer_domain::retire(T* p, Deleter deleter, const Allocator& allocator)
+{
+	using node_type = Hazard_Pointer_Internal::retired_node_t<T, Deleter, Allocator>;
+
+	if(!p)
+	{
+		return;
+	}
+
+	void* const pMemory = allocate_memory(const_cast<Allocator&>(allocator), sizeof(node_type), alignof(node_type), 0);
+	if(!pMemory)
+	{
+		while(is_protected(p))
+		{
+			std::this_thread::yield();
+		}
+		deleter(p);
+		return;
+	}
+	push_retired(::new(pMemory) node_type(p, std::move(deleter), allocator));
+}
+
+inline bool hazard_pointer_domain::is_protected(const void* p) const noexcept
+{
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	for(hazard_record* pRecord = mRecords.head(); pRecord; pRecord = pRecord->mpNext)
+	{
+		for(const std::atomic<const void*>& slot : pRecord->mpSlots)
+		{
+			if(slot.load(std::memory_order_acquire) == p)
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+inline void hazard_pointer_domain::scan(hazard_record* pRecord) noexcept
+{
+	// Adopt the orphans; whichever scan takes them owns them from here on.
+	retired_node* pList = pRecord->mpRetired;
+	if(retired_node* pOrphans = mRecords.take_orphans())
+	{
+		while(pOrphans)
+		{
+			retired_node* const pNext = pOrphans->mpNext;
+			pOrphans->mpNext = pList;
+			pList = pOrphans;
+			pOrphans = pNext;
+		}
+	}
+	pRecord->mpRetired = nullptr;
+	pRecord->mRetiredCount = 0;
+
+	// Pairs with the fence in try_protect: a reader whose slot we miss will see the node unlinked.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	hazard_record* const pRecords = mRecords.head();
+	const size_t capacity = Hazard_Pointer_Internal::kSlotsPerRecord * mRecords.size();
+
+	const void* stackHazards[Hazard_Pointer_Internal::kStackHazards];
+	const void** pHazards = stackHazards;
+	rstl::allocator allocator;
+	if(capacity > Hazard_Pointer_Internal::kStackHazards)
+	{
+		pHazards = static_cast<const void**>(allocate_memory(allocator, capacity * sizeof(const void*), alignof(const void*), 0));
+	}
+
+	size_t hazardCount = 0;
+	if(pHazards)
+	{
+		for(hazard_record* pOther = pRecords; pOther; pOther = pOther->mpNext)
+		{
+			for(const std::atomic<const void*>& slot : pOther->mpSlots)
+			{
+				if(const void* const p = slot.load(std::memory_order_acquire))
+				{
+					pHazards[hazardCount++] = p;
+				}
+			}
+		}
+		std::sort(pHazards, pHazards + hazardCount);
+	}
+
+	size_t reclaimed = 0;
+	while(pList)
+	{
+		retired_node* const pNode = pList;
+		pList = pNode->mpNext;
+
+		// Without room for a snapshot, fall back to checking each node against every slot.
+		const bool isProtected = pHazards ? std::binary_search(pHazards, pHazards + hazardCount, pNode->mpValue) : is_protected(pNode->mpValue);
+		if(isProtected)
+		{
+			pNode->mpNext = pRecord->mpRetired;
+			pRecord->mpRetired = pNode;
+			++pRecord->mRetiredCount;
+		}
+		else
+		{
+			pNode->mpReclaim(pNode);
+			++reclaimed;
+		}
+	}
+	mRetiredCount.fetch_sub(reclaimed, std::memory_order_relaxed);
+
+	if(pHazards && (pHazards != stackHazards))
+	{
+		CUSTOM_FREE(allocator, pHazards, capacity * sizeof(const void*));
+	}
+}
+
+inline void hazard_pointer_domain::reclaim() noexcept
+{
+	if(hazard_record* const pRecord = thread_record())
+	{
+		scan(pRecord);
+		return;
+	}
+
+	// No record to scan into: borrow one for the duration.
+	hazard_record* pRecord;
+	try
+	{
+		pRecord = acquire_record();
+	}
+	catch(...)
+	{
+		return;
+	}
+	scan(pRecord);
+	release_record(pRecord);
+}
+
+inline hazard_pointer::hazard_pointer(hazard_pointer_domain& domain) : mpDomain(&domain), mpRecord(domain.thread_record()), mSlot(0), mOwnsRecord(false)
+{
+	if(mpRecord && mpRecord->mFreeSlots)
+	{
+		mSlot = (uint32_t)__builtin_ctz(mpRecord->mFreeSlots);
+		mpRecord->mFreeSlots &= ~(1u << mSlot);
+		return;
+	}
+
+	mpRecord = domain.acquire_record();
+	mSlot = 0;
+	mOwnsRecord = true;
+}
+
+inline hazard_pointer::~hazard_pointer()
+{
+	release();
+}
+
+inline hazard_pointer::hazard_pointer(hazard_pointer&& other) noexcept
+	: mpDomain(other.mpDomain), mpRecord(other.mpRecord), mSlot(other.mSlot), mOwnsRecord(other.mOwnsRecord)
+{
+	other.mpDomain = nullptr;
+	other.mpRecord = nullptr;
+	other.mOwnsRecord = false;
+}
+
+inline hazard_pointer& hazard_pointer::operator=(hazard_pointer&& other) noexcept
+{
+	if(this != &other)
+	{
+		release();
+		mpDomain = other.mpDomain;
+		mpRecord = other.mpRecord;
+		mSlot = other.mSlot;
+		mOwnsRecord = other.mOwnsRecord;
+		other.mpDomain = nullptr;
+		other.mpRecord = nullptr;
+		other.mOwnsRecord = false;
+	}
+	return *this;
+}
+
+inline void hazard_pointer::swap(hazard_pointer& other) noexcept
+{
+	std::swap(mpDomain, other.mpDomain);
+	std::swap(mpRecord, other.mpRecord);
+	std::swap(mSlot, other.mSlot);
+	std::swap(mOwnsRecord, other.mOwnsRecord);
+}
+
+inline void hazard_pointer::release() noexcept
+{
+	if(!mpRecord)
+	{
+		return;
+	}
+
+	if(mOwnsRecord)
+	{
+		mpDomain->release_record(mpRecord);
+	}
+	else
+	{
+		reset_protection();
+		mpRecord->mFreeSlots |= (1u << mSlot);
+	}
+	mpRecord = nullptr;
+	mpDomain = nullptr;
+	mOwnsRecord = false;
+}
+
+inline void swap(hazard_pointer& a, hazard_pointer& b) noexcept
+{
+	a.swap(b);
+}
+
+RSTL_NAMESPACE_END
+
+#endif //RSTL_HAZARD_POINTER_H
@@ -34,10 +34,61 @@
 #  define ALLOCATOR_DEFAULT_NAME DEFAULT_NAME_PREFIX
 #endif
 
+#ifndef POOL_ALLOCATOR_DEFAULT_NAME
+#  define POOL_ALLOCATOR_DEFAULT_NAME DEFAULT_NAME_PREFIX " pool"
+#endif
+
+#ifndef ARENA_ALLOCATOR_DEFAULT_NAME
+#  define ARENA_ALLOCATOR_DEFAULT_NAME DEFAULT_NAME_PREFIX " arena"
+#endif
+
+#ifndef THREAD_CACHE_ALLOCATOR_DEFAULT_NAME
+#  define THREAD_CACHE_ALLOCATOR_DEFAULT_NAME DEFAULT_NAME_PREFIX " thread cache"
+#endif
+
+#ifndef PAGE_ALLOCATOR_DEFAULT_NAME
+#  define PAGE_ALLOCATOR_DEFAULT_NAME DEFAULT_NAME_PREFIX " page"
+#endif
+
+#ifndef POLYMORPHIC_ALLOCATOR_DEFAULT_NAME
+#  define POLYMORPHIC_ALLOCATOR_DEFAULT_NAME DEFAULT_NAME_PREFIX " polymorphic"
+#endif
+
+#ifndef MMAP_ALLOCATOR_DEFAULT_NAME
+#  define MMAP_ALLOCATOR_DEFAULT_NAME DEFAULT_NAME_PREFIX " mmap"
+#endif
+
+#ifndef OBJECT_POOL_DEFAULT_NAME
+#  define OBJECT_POOL_DEFAULT_NAME DEFAULT_NAME_PREFIX " object pool"
+#endif
+
+// When set to 1, rstl::allocator (and so GetDefaultAllocator()) serves small
+// requests from the per-thread caches in internal/thread_cache.h.
+#ifndef RSTL_THREAD_CACHE_DEFAULT_ALLOCATOR
+#  define RSTL_THREAD_CACHE_DEFAULT_ALLOCATOR 0
+#endif
+
+// When set to 1, rstl::allocator records its traffic in the registry declared in
+// allocator_stats.h, keyed by its debug name.
+#ifndef RSTL_ALLOCATOR_STATS
+#  define RSTL_ALLOCATOR_STATS 0
+#endif
+
+// When set to 1, rstl::allocator records its traffic into the allocation trace
+// started with start_allocation_trace (see allocator_trace.h).
+#ifndef RSTL_ALLOCATOR_TRACE
+#  define RSTL_ALLOCATOR_TRACE 0
+#endif
+
 #ifndef ALLOCATOR_MIN_ALIGNMENT
 #  define ALLOCATOR_MIN_ALIGNMENT 8
 #endif
 
+// The alignment allocate(n, flags) gives when the caller does not ask for one.
+#ifndef ALLOCATOR_DEFAULT_ALIGNMENT
+#  define ALLOCATOR_DEFAULT_ALIGNMENT 16
+#endif
+
 #ifndef PLATFORM_PTR_SIZE
 #  define PLATFORM_PTR_SIZE 8
 #endif
@@ -3,6 +3,7 @@
 
 #include "config.h"
 
+#include <memory>
 #include <type_traits>
 
 #pragma once
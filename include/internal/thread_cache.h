@@ -0,0 +1,292 @@
+#ifndef RSTL_THREAD_CACHE_H
+#define RSTL_THREAD_CACHE_H
+
+#pragma once
+
+#include "config.h"
+#include "thread_support.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+RSTL_NAMESPACE_BEGIN
+
+/*
+ * A tcmalloc style small-object cache. Each thread keeps a magazine (a free list plus a
+ * count) per size class and only talks to the shared central cache a batch at a time:
+ * an empty magazine takes a whole batch, an overfull one gives a whole batch back.
+ * Blocks carry no owner, so a block freed on another thread simply joins that thread's
+ * magazine and drifts back to the central cache in bulk with the next overflow.
+ *
+ * Everything here works on raw memory from ::operator new and never on rstl::allocator,
+ * so rstl::allocator itself may sit on top of it (see RSTL_THREAD_CACHE_DEFAULT_ALLOCATOR).
+ * */
+
+namespace Thread_Cache_Internal {
+
+	static constexpr size_t kAlignment = 16;
+	static constexpr size_t kMaxCachedSize = 256;
+	static constexpr size_t kSizeClassCount = kMaxCachedSize / kAlignment;
+	static constexpr size_t kBatchSize = 32;
+	static constexpr size_t kMaxMagazineSize = 2 * kBatchSize;
+	static constexpr size_t kChunkSize = 64 * 1024;
+
+	struct free_block
+	{
+		free_block* mpNext;
+	};
+
+	inline size_t size_class_index(size_t n) noexcept
+	{
+		return (n == 0) ? 0 : ((n - 1) / kAlignment);
+	}
+
+	inline size_t size_class_size(size_t index) noexcept
+	{
+		return (index + 1) * kAlignment;
+	}
+
+	/*
+	 * The central cache holds complete batches per size class. A batch is a null
+	 * terminated list of kBatchSize blocks; batches are chained through the second
+	 * word of their first block, so moving one is a constant-time operation.
+	 * */
+	class central_cache
+	{
+	public:
+		central_cache() noexcept { }
+
+		central_cache(const central_cache&) = delete;
+		central_cache& operator=(const central_cache&) = delete;
+
+		// Returns a list of exactly kBatchSize blocks, or nullptr if out of memory.
+		free_block* fetch_batch(size_t index)
+		{
+			size_class& sizeClass = mSizeClasses[index];
+			Thread_Support_Internal::auto_mutex autoMutex(sizeClass.mMutex);
+
+			if(!sizeClass.mpBatches && !refill(sizeClass, size_class_size(index)))
+			{
+				return nullptr;
+			}
+
+			free_block* const pBatch = sizeClass.mpBatches;
+			sizeClass.mpBatches = next_batch(pBatch);
+			return pBatch;
+		}
+
+		// Takes back a list of count blocks. Short lists, which only come from exiting
+		// threads, are collected block by block until they make up a whole batch.
+		void release_batch(size_t index, free_block* pBatch, size_t count) noexcept
+		{
+			size_class& sizeClass = mSizeClasses[index];
+			Thread_Support_Internal::auto_mutex autoMutex(sizeClass.mMutex);
+
+			if(count == kBatchSize)
+			{
+				next_batch(pBatch) = sizeClass.mpBatches;
+				sizeClass.mpBatches = pBatch;
+				return;
+			}
+
+			while(free_block* const pBlock = pBatch)
+			{
+				pBatch = pBlock->mpNext;
+				pBlock->mpNext = sizeClass.mpPartial;
+				sizeClass.mpPartial = pBlock;
+
+				if(++sizeClass.mPartialCount == kBatchSize)
+				{
+					next_batch(sizeClass.mpPartial) = sizeClass.mpBatches;
+					sizeClass.mpBatches = sizeClass.mpPartial;
+					sizeClass.mpPartial = nullptr;
+					sizeClass.mPartialCount = 0;
+				}
+			}
+		}
+
+	protected:
+		struct size_class
+		{
+			std::mutex mMutex;
+			free_block* mpBatches = nullptr;
+			free_block* mpPartial = nullptr;
+			size_t mPartialCount = 0;
+		};
+
+		static free_block*& next_batch(free_block* pBatch) noexcept
+		{
+			return reinterpret_cast<free_block**>(pBatch)[1];
+		}
+
+		bool refill(size_class& sizeClass, size_t blockSize)
+		{
+			char* const pChunk = static_cast<char*>(::operator new(kChunkSize, std::align_val_t(kAlignment), std::nothrow));
+			if(!pChunk)
+			{
+				return false;
+			}
+
+			// Chunks are never returned; the blocks cycle between caches for the life of the process.
+			const size_t blockCount = (kChunkSize / blockSize / kBatchSize) * kBatchSize;
+			for(size_t first = 0; first < blockCount; first += kBatchSize)
+			{
+				const size_t last = first + kBatchSize;
+
+				free_block* pHead = nullptr;
+				for(size_t i = last; i > first; --i)
+				{
+					free_block* const pBlock = reinterpret_cast<free_block*>(pChunk + ((i - 1) * blockSize));
+					pBlock->mpNext = pHead;
+					pHead = pBlock;
+				}
+
+				next_batch(pHead) = sizeClass.mpBatches;
+				sizeClass.mpBatches = pHead;
+			}
+			return true;
+		}
+
+		size_class mSizeClasses[kSizeClassCount];
+	};
+
+	inline central_cache& get_central_cache()
+	{
+		static central_cache* const pCentralCache = new central_cache();
+		return *pCentralCache;
+	}
+
+	// Set once the calling thread's cache has been destroyed. Other thread_local destructors
+	// that run later must not touch the dead cache, so they bypass it instead.
+	inline thread_local bool tbThreadCacheDestroyed = false;
+
+	class thread_cache
+	{
+	public:
+		thread_cache() noexcept { }
+
+		~thread_cache()
+		{
+			tbThreadCacheDestroyed = true;
+
+			central_cache& central = get_central_cache();
+			for(size_t index = 0; index < kSizeClassCount; ++index)
+			{
+				magazine& m = mMagazines[index];
+				while(m.mCount >= kBatchSize)
+				{
+					central.release_batch(index, split_batch(m), kBatchSize);
+				}
+				if(m.mpHead)
+				{
+					central.release_batch(index, m.mpHead, m.mCount);
+				}
+				m.mpHead = nullptr;
+				m.mCount = 0;
+			}
+		}
+
+		thread_cache(const thread_cache&) = delete;
+		thread_cache& operator=(const thread_cache&) = delete;
+
+		void* allocate(size_t index)
+		{
+			magazine& m = mMagazines[index];
+			if(!m.mpHead)
+			{
+				m.mpHead = get_central_cache().fetch_batch(index);
+				if(!m.mpHead)
+				{
+					return nullptr;
+				}
+				m.mCount = kBatchSize;
+			}
+
+			free_block* const pBlock = m.mpHead;
+			m.mpHead = pBlock->mpNext;
+			--m.mCount;
+			return pBlock;
+		}
+
+		void deallocate(void* p, size_t index) noexcept
+		{
+			magazine& m = mMagazines[index];
+			free_block* const pBlock = static_cast<free_block*>(p);
+			pBlock->mpNext = m.mpHead;
+			m.mpHead = pBlock;
+
+			if(++m.mCount == kMaxMagazineSize)
+			{
+				get_central_cache().release_batch(index, split_batch(m), kBatchSize);
+			}
+		}
+
+	protected:
+		struct magazine
+		{
+			free_block* mpHead = nullptr;
+			size_t mCount = 0;
+		};
+
+		// Splits off the newest kBatchSize blocks so they can be handed back in one go.
+		static free_block* split_batch(magazine& m) noexcept
+		{
+			free_block* pLast = m.mpHead;
+			for(size_t i = 1; i < kBatchSize; ++i)
+			{
+				pLast = pLast->mpNext;
+			}
+			free_block* const pBatch = m.mpHead;
+			m.mpHead = pLast->mpNext;
+			pLast->mpNext = nullptr;
+			m.mCount -= kBatchSize;
+			return pBatch;
+		}
+
+		magazine mMagazines[kSizeClassCount];
+	};
+
+	inline thread_cache& get_thread_cache()
+	{
+		static thread_local thread_cache threadCache;
+		return threadCache;
+	}
+
+	/*
+	 * Allocates n bytes aligned to kAlignment. n must not exceed kMaxCachedSize.
+	 * */
+	inline void* cache_allocate(size_t n)
+	{
+		const size_t index = size_class_index(n);
+		if(tbThreadCacheDestroyed)
+		{
+			// Taking a whole batch here would strand it, so fall back to a single heap block.
+			return ::operator new(size_class_size(index), std::align_val_t(kAlignment), std::nothrow);
+		}
+		return get_thread_cache().allocate(index);
+	}
+
+	/*
+	 * Frees a block of n bytes. Any block of at least round_up(n, kAlignment) bytes
+	 * aligned to kAlignment may be freed this way, even one that did not come from
+	 * the cache; it is simply adopted into its size class.
+	 * */
+	inline void cache_deallocate(void* p, size_t n) noexcept
+	{
+		const size_t index = size_class_index(n);
+		if(tbThreadCacheDestroyed)
+		{
+			free_block* const pBlock = static_cast<free_block*>(p);
+			pBlock->mpNext = nullptr;
+			get_central_cache().release_batch(index, pBlock, 1);
+			return;
+		}
+		get_thread_cache().deallocate(p, index);
+	}
+
+}
+
+RSTL_NAMESPACE_END
+
+#endif //RSTL_THREAD_CACHE_H
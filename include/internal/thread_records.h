@@ -0,0 +1,248 @@
+#ifndef RSTL_THREAD_RECORDS_H
+#define RSTL_THREAD_RECORDS_H
+
+#pragma once
+
+#include "config.h"
+#include "../allocator.h"
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+
+RSTL_NAMESPACE_BEGIN
+
+/*
+ * The per-thread record machinery shared by hazard_pointer_domain and epoch_domain.
+ *
+ * A domain keeps a record_list: every record ever handed to a thread, linked once and
+ * never unlinked while the domain lives, plus the orphan list that exiting threads
+ * leave their unreclaimed nodes on. A record is reused by whichever thread next wins
+ * the CAS on its mActive flag.
+ *
+ * Each thread caches the record it holds in up to kCachedDomains domains of a kind in
+ * a thread_records; its destructor hands the records back when the thread exits.
+ * Beyond that, callers take a record of their own for the duration of a guard and
+ * retired nodes go straight to the orphan list, which is slower but still correct.
+ *
+ * Record must provide mActive, mpNext, mpRetired and mRetiredCount, be default
+ * constructible into the active state, and RetiredNode must provide mpNext and
+ * mpReclaim. Domain must provide acquire_record() and release_record(Record*).
+ * */
+
+namespace Thread_Records_Internal {
+
+	static constexpr size_t kCachedDomains = 4;
+
+	template <typename Record, typename RetiredNode>
+	class record_list
+	{
+	public:
+		record_list() noexcept : mpRecords(nullptr), mRecordCount(0), mpOrphans(nullptr) { }
+		~record_list();
+
+		record_list(const record_list&) = delete;
+		record_list& operator=(const record_list&) = delete;
+
+		// Reuses an inactive record or links a new one. Throws std::bad_alloc if that fails.
+		Record* acquire();
+
+		// Moves what is left on pRecord's retired list to the orphans and frees the record for reuse.
+		void abandon(Record* pRecord) noexcept;
+
+		void push_orphans(RetiredNode* pFirst, RetiredNode* pLast) noexcept;
+
+		RetiredNode* take_orphans() noexcept
+		{
+			return mpOrphans.exchange(nullptr, std::memory_order_acquire);
+		}
+
+		Record* head() const noexcept
+		{
+			return mpRecords.load(std::memory_order_acquire);
+		}
+
+		// Never less than the number of records reachable from head().
+		size_t size() const noexcept
+		{
+			return mRecordCount.load(std::memory_order_relaxed);
+		}
+
+	protected:
+		std::atomic<Record*> mpRecords;
+		std::atomic<size_t> mRecordCount;
+		std::atomic<RetiredNode*> mpOrphans;
+
+		static void reclaim_all(RetiredNode* pList) noexcept
+		{
+			while(pList)
+			{
+				RetiredNode* const pNext = pList->mpNext;
+				pList->mpReclaim(pList);
+				pList = pNext;
+			}
+		}
+	};
+
+	template <typename Domain, typename Record>
+	struct thread_records
+	{
+		struct entry
+		{
+			Domain* mpDomain;
+			Record* mpRecord;
+		};
+
+		entry mEntries[kCachedDomains] = {};
+
+		~thread_records()
+		{
+			for(entry& e : mEntries)
+			{
+				if(e.mpDomain)
+				{
+					e.mpDomain->release_record(e.mpRecord);
+				}
+			}
+		}
+
+		Record* find(const Domain* pDomain) const noexcept
+		{
+			for(const entry& e : mEntries)
+			{
+				if(e.mpDomain == pDomain)
+				{
+					return e.mpRecord;
+				}
+			}
+			return nullptr;
+		}
+
+		// The thread's record in pDomain, acquiring one if a cache entry is free; null otherwise.
+		Record* find_or_acquire(Domain* pDomain) noexcept
+		{
+			if(Record* const pRecord = find(pDomain))
+			{
+				return pRecord;
+			}
+
+			for(entry& e : mEntries)
+			{
+				if(!e.mpDomain)
+				{
+					try
+					{
+						e.mpRecord = pDomain->acquire_record();
+					}
+					catch(...)
+					{
+						return nullptr;
+					}
+					e.mpDomain = pDomain;
+					return e.mpRecord;
+				}
+			}
+			return nullptr;
+		}
+
+		// Called by a dying domain, whose records are about to be freed.
+		void forget(const Domain* pDomain) noexcept
+		{
+			for(entry& e : mEntries)
+			{
+				if(e.mpDomain == pDomain)
+				{
+					e.mpDomain = nullptr;
+					e.mpRecord = nullptr;
+				}
+			}
+		}
+	};
+
+	template <typename Domain, typename Record>
+	inline thread_records<Domain, Record>& get_thread_records()
+	{
+		static thread_local thread_records<Domain, Record> threadRecords;
+		return threadRecords;
+	}
+
+	template <typename Record, typename RetiredNode>
+	inline record_list<Record, RetiredNode>::~record_list()
+	{
+		Record* pRecord = mpRecords.load(std::memory_order_acquire);
+		while(pRecord)
+		{
+			Record* const pNext = pRecord->mpNext;
+			reclaim_all(pRecord->mpRetired);
+			rstl::allocator allocator;
+			pRecord->~Record();
+			CUSTOM_FREE(allocator, pRecord, sizeof(Record));
+			pRecord = pNext;
+		}
+		reclaim_all(mpOrphans.load(std::memory_order_acquire));
+	}
+
+	template <typename Record, typename RetiredNode>
+	inline Record* record_list<Record, RetiredNode>::acquire()
+	{
+		for(Record* pRecord = mpRecords.load(std::memory_order_acquire); pRecord; pRecord = pRecord->mpNext)
+		{
+			bool active = false;
+			if(!pRecord->mActive.load(std::memory_order_relaxed) && pRecord->mActive.compare_exchange_strong(active, true, std::memory_order_acquire))
+			{
+				return pRecord;
+			}
+		}
+
+		rstl::allocator allocator;
+		void* const pMemory = allocate_memory(allocator, sizeof(Record), alignof(Record), 0);
+		if(!pMemory)
+		{
+			throw std::bad_alloc();
+		}
+		Record* const pRecord = ::new(pMemory) Record();
+
+		// Counted before it is linked, so a walk that finds n records has room for them.
+		mRecordCount.fetch_add(1, std::memory_order_relaxed);
+		Record* pHead = mpRecords.load(std::memory_order_relaxed);
+		do
+		{
+			pRecord->mpNext = pHead;
+		}
+		while(!mpRecords.compare_exchange_weak(pHead, pRecord, std::memory_order_release, std::memory_order_relaxed));
+		return pRecord;
+	}
+
+	template <typename Record, typename RetiredNode>
+	inline void record_list<Record, RetiredNode>::abandon(Record* pRecord) noexcept
+	{
+		if(RetiredNode* const pFirst = pRecord->mpRetired)
+		{
+			RetiredNode* pLast = pFirst;
+			while(pLast->mpNext)
+			{
+				pLast = pLast->mpNext;
+			}
+			push_orphans(pFirst, pLast);
+			pRecord->mpRetired = nullptr;
+			pRecord->mRetiredCount = 0;
+		}
+		pRecord->mActive.store(false, std::memory_order_release);
+	}
+
+	template <typename Record, typename RetiredNode>
+	inline void record_list<Record, RetiredNode>::push_orphans(RetiredNode* pFirst, RetiredNode* pLast) noexcept
+	{
+		RetiredNode* pHead = mpOrphans.load(std::memory_order_relaxed);
+		do
+		{
+			pLast->mpNext = pHead;
+		}
+		while(!mpOrphans.compare_exchange_weak(pHead, pFirst, std::memory_order_release, std::memory_order_relaxed));
+	}
+
+}
+
+RSTL_NAMESPACE_END
+
+#endif //RSTL_THREAD_RECORDS_H
@@ -3,6 +3,8 @@
 
 #pragma once
 
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
 #include <mutex>
 
@@ -27,6 +29,53 @@ namespace Thread_Support_Internal {
 		return __sync_bool_compare_and_swap(p32, condition, newValue);
 	}
 
+	/*
+	 * Reference counting atomics with explicit memory orders. The legacy functions above
+	 * are full barriers; a reference count needs much less:
+	 *  - Taking a reference publishes nothing, so the increment can be relaxed; the
+	 *    caller already holds a reference that keeps the object alive.
+	 *  - Dropping a reference must release this thread's writes to the object, and the
+	 *    thread that drops the last one must acquire everybody else's before destroying
+	 *    it, hence acq_rel.
+	 *  - Plain reads of a count (use_count, expired) are acquire loads.
+	 *  - Taking a reference through a weak reference (weak_ptr::lock) is an acquire
+	 *    increment, since the caller holds nothing that orders it after the object's
+	 *    construction.
+	 * Counts live in std::atomic so that they are never read non-atomically.
+	 */
+
+	template <typename T>
+	inline T atomic_increment_relaxed(std::atomic<T>& a) noexcept
+	{
+		return a.fetch_add(1, std::memory_order_relaxed) + 1;
+	}
+
+	// Returns the value before the increment, which weak_ptr::lock needs to detect a dead count.
+	template <typename T>
+	inline T atomic_fetch_increment_acquire(std::atomic<T>& a) noexcept
+	{
+		return a.fetch_add(1, std::memory_order_acquire);
+	}
+
+	template <typename T>
+	inline T atomic_decrement_acq_rel(std::atomic<T>& a) noexcept
+	{
+		return a.fetch_sub(1, std::memory_order_acq_rel) - 1;
+	}
+
+	template <typename T>
+	inline T atomic_load_acquire(const std::atomic<T>& a) noexcept
+	{
+		return a.load(std::memory_order_acquire);
+	}
+
+	// On failure, expected is updated with the current value, as with compare_exchange_weak.
+	template <typename T>
+	inline bool atomic_compare_exchange_acq_rel(std::atomic<T>& a, T& expected, T newValue) noexcept
+	{
+		return a.compare_exchange_weak(expected, newValue, std::memory_order_acq_rel, std::memory_order_relaxed);
+	}
+
 	class auto_mutex
 	{
 	public:
@@ -54,7 +103,21 @@ namespace Thread_Support_Internal {
 		void operator=(shared_ptr_auto_mutex&&) = delete;
 	};
 
+	/*
+	 * The free atomic_* functions for shared_ptr lock one of a fixed set of mutexes,
+	 * picked by the address of the shared_ptr. Unrelated shared_ptrs rarely share a
+	 * mutex, and no per-object state is needed. atomic_shared_ptr is the lock-free
+	 * alternative.
+	 * */
+	const size_t kSharedPtrMutexCount = 64;
+
+	inline std::mutex& get_shared_ptr_mutex(const void* pSharedPtr) noexcept
+	{
+		static std::mutex mutexes[kSharedPtrMutexCount];
+		return mutexes[(reinterpret_cast<uintptr_t>(pSharedPtr) >> 4) % kSharedPtrMutexCount];
+	}
 
+	inline shared_ptr_auto_mutex::shared_ptr_auto_mutex(const void* pSharedPtr) : auto_mutex(get_shared_ptr_mutex(pSharedPtr)) {}
 
 }
 
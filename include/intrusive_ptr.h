@@ -0,0 +1,353 @@
+#ifndef RSTL_INTRUSIVE_PTR_H
+#define RSTL_INTRUSIVE_PTR_H
+
+#pragma once
+
+#include "internal/config.h"
+#include "internal/thread_support.h"
+
+#include <atomic>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+RSTL_NAMESPACE_BEGIN
+
+/*
+ * intrusive_ptr<T> is a shared_ptr for objects that carry their own reference count,
+ * so there is no control block: no second allocation, no vtable and no extra cache
+ * line between the pointer and the object.
+ *
+ * intrusive_ptr finds the count through two functions, looked up by argument
+ * dependent lookup:
+ *     void intrusive_ptr_add_ref(T* p);
+ *     void intrusive_ptr_release(T* p);   // Destroys *p when the count reaches zero.
+ * Deriving from intrusive_ref_counter provides both.
+ * */
+
+/*
+ * Counter policies for intrusive_ref_counter.
+ * */
+
+struct intrusive_thread_safe_counter
+{
+	using type = std::atomic<int32_t>;
+
+	static int32_t load(const type& counter) noexcept
+	{
+		return Thread_Support_Internal::atomic_load_acquire(counter);
+	}
+
+	static void increment(type& counter) noexcept
+	{
+		Thread_Support_Internal::atomic_increment_relaxed(counter);
+	}
+
+	static int32_t decrement(type& counter) noexcept
+	{
+		return Thread_Support_Internal::atomic_decrement_acq_rel(counter);
+	}
+};
+
+struct intrusive_thread_unsafe_counter
+{
+	using type = int32_t;
+
+	static int32_t load(const type& counter) noexcept
+	{
+		return counter;
+	}
+
+	static void increment(type& counter) noexcept
+	{
+		++counter;
+	}
+
+	static int32_t decrement(type& counter) noexcept
+	{
+		return --counter;
+	}
+};
+
+/*
+ * intrusive_ref_counter<T, ThreadPolicy> is a base class that gives T a reference
+ * count. The object is deleted with delete when the last intrusive_ptr releases it.
+ * Copying an object does not copy its count.
+ * */
+
+template <typename T, typename ThreadPolicy = intrusive_thread_safe_counter>
+class intrusive_ref_counter
+{
+public:
+	using thread_policy = ThreadPolicy;
+
+	int32_t use_count() const noexcept
+	{
+		return thread_policy::load(mRefCount);
+	}
+
+protected:
+	constexpr intrusive_ref_counter() noexcept : mRefCount(0) { }
+
+	intrusive_ref_counter(const intrusive_ref_counter&) noexcept : mRefCount(0) { }
+
+	intrusive_ref_counter& operator=(const intrusive_ref_counter&) noexcept
+	{
+		return *this;
+	}
+
+	~intrusive_ref_counter() = default;
+
+	template <typename U, typename Policy>
+	friend void intrusive_ptr_add_ref(const intrusive_ref_counter<U, Policy>* p) noexcept;
+
+	template <typename U, typename Policy>
+	friend void intrusive_ptr_release(const intrusive_ref_counter<U, Policy>* p) noexcept;
+
+private:
+	mutable typename thread_policy::type mRefCount;
+};
+
+template <typename T, typename ThreadPolicy>
+inline void intrusive_ptr_add_ref(const intrusive_ref_counter<T, ThreadPolicy>* p) noexcept
+{
+	ThreadPolicy::increment(p->mRefCount);
+}
+
+template <typename T, typename ThreadPolicy>
+inline void intrusive_ptr_release(const intrusive_ref_counter<T, ThreadPolicy>* p) noexcept
+{
+	if(ThreadPolicy::decrement(p->mRefCount) == 0)
+	{
+		delete static_cast<const T*>(p);
+	}
+}
+
+/*
+ * intrusive_ptr
+ * */
+
+template <typename T>
+class intrusive_ptr
+{
+public:
+	using this_type = intrusive_ptr<T>;
+	using element_type = T;
+
+protected:
+	element_type* mpValue;
+
+public:
+	constexpr intrusive_ptr() noexcept : mpValue(nullptr) { }
+
+	constexpr intrusive_ptr(std::nullptr_t) noexcept : mpValue(nullptr) { }
+
+	// With addRef false, takes over a reference the caller already owns, e.g. one from detach().
+	intrusive_ptr(element_type* pValue, bool addRef = true) : mpValue(pValue)
+	{
+		if(mpValue && addRef)
+		{
+			intrusive_ptr_add_ref(mpValue);
+		}
+	}
+
+	intrusive_ptr(const intrusive_ptr& intrusivePtr) : mpValue(intrusivePtr.mpValue)
+	{
+		if(mpValue)
+		{
+			intrusive_ptr_add_ref(mpValue);
+		}
+	}
+
+	template <typename U>
+	intrusive_ptr(const intrusive_ptr<U>& intrusivePtr, std::enable_if_t<std::is_convertible_v<U*, T*>>* = 0) : mpValue(intrusivePtr.get())
+	{
+		if(mpValue)
+		{
+			intrusive_ptr_add_ref(mpValue);
+		}
+	}
+
+	intrusive_ptr(intrusive_ptr&& intrusivePtr) noexcept : mpValue(intrusivePtr.mpValue)
+	{
+		intrusivePtr.mpValue = nullptr;
+	}
+
+	template <typename U>
+	intrusive_ptr(intrusive_ptr<U>&& intrusivePtr, std::enable_if_t<std::is_convertible_v<U*, T*>>* = 0) noexcept : mpValue(intrusivePtr.detach())
+	{
+	}
+
+	~intrusive_ptr()
+	{
+		if(mpValue)
+		{
+			intrusive_ptr_release(mpValue);
+		}
+	}
+
+	intrusive_ptr& operator=(const intrusive_ptr& intrusivePtr)
+	{
+		this_type(intrusivePtr).swap(*this);
+		return *this;
+	}
+
+	template <typename U>
+	std::enable_if_t<std::is_convertible_v<U*, T*>, this_type&> operator=(const intrusive_ptr<U>& intrusivePtr)
+	{
+		this_type(intrusivePtr).swap(*this);
+		return *this;
+	}
+
+	intrusive_ptr& operator=(intrusive_ptr&& intrusivePtr) noexcept
+	{
+		this_type(std::move(intrusivePtr)).swap(*this);
+		return *this;
+	}
+
+	template <typename U>
+	std::enable_if_t<std::is_convertible_v<U*, T*>, this_type&> operator=(intrusive_ptr<U>&& intrusivePtr) noexcept
+	{
+		this_type(std::move(intrusivePtr)).swap(*this);
+		return *this;
+	}
+
+	intrusive_ptr& operator=(element_type* pValue)
+	{
+		this_type(pValue).swap(*this);
+		return *this;
+	}
+
+	void reset()
+	{
+		this_type().swap(*this);
+	}
+
+	void reset(element_type* pValue)
+	{
+		this_type(pValue).swap(*this);
+	}
+
+	void reset(element_type* pValue, bool addRef)
+	{
+		this_type(pValue, addRef).swap(*this);
+	}
+
+	// Gives up ownership without releasing; the caller now owns one reference.
+	element_type* detach() noexcept
+	{
+		element_type* const pValue = mpValue;
+		mpValue = nullptr;
+		return pValue;
+	}
+
+	void swap(this_type& intrusivePtr) noexcept
+	{
+		element_type* const pValue = intrusivePtr.mpValue;
+		intrusivePtr.mpValue = mpValue;
+		mpValue = pValue;
+	}
+
+	element_type& operator*() const noexcept
+	{
+		return *mpValue;
+	}
+
+	element_type* operator->() const noexcept
+	{
+		return mpValue;
+	}
+
+	element_type* get() const noexcept
+	{
+		return mpValue;
+	}
+
+	explicit operator bool() const noexcept
+	{
+		return (mpValue != nullptr);
+	}
+};
+
+template <typename T, typename... Args>
+intrusive_ptr<T> make_intrusive(Args&&... args)
+{
+	return intrusive_ptr<T>(new T(std::forward<Args>(args)...));
+}
+
+template <typename T>
+inline T* get_pointer(const intrusive_ptr<T>& intrusivePtr) noexcept
+{
+	return intrusivePtr.get();
+}
+
+template <typename T>
+inline void swap(intrusive_ptr<T>& a, intrusive_ptr<T>& b) noexcept
+{
+	a.swap(b);
+}
+
+template <typename T, typename U>
+inline bool operator==(const intrusive_ptr<T>& a, const intrusive_ptr<U>& b) noexcept
+{
+	return (a.get() == b.get());
+}
+
+template <typename T, typename U>
+std::strong_ordering operator<=>(const intrusive_ptr<T>& a, const intrusive_ptr<U>& b) noexcept
+{
+	return (a.get() <=> b.get());
+}
+
+template <typename T, typename U>
+inline bool operator==(const intrusive_ptr<T>& a, U* b) noexcept
+{
+	return (a.get() == b);
+}
+
+template <typename T, typename U>
+std::strong_ordering operator<=>(const intrusive_ptr<T>& a, U* b) noexcept
+{
+	return (a.get() <=> b);
+}
+
+template <typename T>
+inline bool operator==(const intrusive_ptr<T>& a, std::nullptr_t) noexcept
+{
+	return !a;
+}
+
+template <typename T>
+inline std::strong_ordering operator<=>(const intrusive_ptr<T>& a, std::nullptr_t) noexcept
+{
+	return a.get() <=> nullptr;
+}
+
+template <typename T, typename U>
+inline intrusive_ptr<T> reinterpret_pointer_cast(const intrusive_ptr<U>& intrusivePtr) noexcept
+{
+	return intrusive_ptr<T>(reinterpret_cast<T*>(intrusivePtr.get()));
+}
+
+template <typename T, typename U>
+inline intrusive_ptr<T> static_pointer_cast(const intrusive_ptr<U>& intrusivePtr) noexcept
+{
+	return intrusive_ptr<T>(static_cast<T*>(intrusivePtr.get()));
+}
+
+template <typename T, typename U>
+inline intrusive_ptr<T> const_pointer_cast(const intrusive_ptr<U>& intrusivePtr) noexcept
+{
+	return intrusive_ptr<T>(const_cast<T*>(intrusivePtr.get()));
+}
+
+template <typename T, typename U>
+inline intrusive_ptr<T> dynamic_pointer_cast(const intrusive_ptr<U>& intrusivePtr) noexcept
+{
+	return intrusive_ptr<T>(dynamic_cast<T*>(intrusivePtr.get()));
+}
+
+RSTL_NAMESPACE_END
+
+#endif //RSTL_INTRUSIVE_PTR_H
@@ -0,0 +1,487 @@
+#ifndef RSTL_LOCAL_SHARED_PTR_H
+#define RSTL_LOCAL_SHARED_PTR_H
+
+#pragma once
+
+#include "internal/config.h"
+#include "allocator.h"
+#include "shared_ptr.h"
+
+#include <exception>
+#include <thread>
+
+RSTL_NAMESPACE_BEGIN
+
+/*
+ * local_shared_ptr is a shared_ptr for objects that stay on one thread. Copies
+ * count themselves in a local_ref_count with plain increments; the local_ref_count
+ * in turn holds a single reference on an ordinary ref_count_sp. That reference is
+ * what lets an object escape the thread: converting to shared_ptr takes one more
+ * reference on the ref_count_sp, after which the object lives as long as either
+ * kind of owner.
+ *
+ * All local_shared_ptrs that share a local_ref_count must be used by the thread that
+ * created it. The conversion to shared_ptr checks this and throws
+ * bad_local_shared_ptr otherwise.
+ * */
+
+struct bad_local_shared_ptr : std::exception
+{
+	const char* what() const noexcept override
+	{
+		return "local_shared_ptr used outside its owning thread";
+	}
+};
+
+struct local_ref_count
+{
+	int32_t mLocalRefCount;
+	ref_count_sp* mpSharedRefCount; // One reference held jointly by all the local_shared_ptrs.
+	std::thread::id mOwnerThread;
+
+public:
+	explicit local_ref_count(ref_count_sp* pSharedRefCount) noexcept;
+	virtual ~local_ref_count() noexcept {}
+
+	int32_t local_use_count() const noexcept;
+	void local_addref() noexcept;
+	void local_release() noexcept;
+	bool is_owner_thread() const noexcept;
+
+	virtual void free_local_ref_count() noexcept = 0;
+};
+
+inline local_ref_count::local_ref_count(ref_count_sp* pSharedRefCount) noexcept
+	: mLocalRefCount(1), mpSharedRefCount(pSharedRefCount), mOwnerThread(std::this_thread::get_id()) {}
+
+inline int32_t local_ref_count::local_use_count() const noexcept
+{
+	return mLocalRefCount;
+}
+
+inline void local_ref_count::local_addref() noexcept
+{
+	++mLocalRefCount;
+}
+
+inline void local_ref_count::local_release() noexcept
+{
+	if(--mLocalRefCount == 0)
+	{
+		// free_local_ref_count may end the lifetime of this, so read the shared block first.
+		ref_count_sp* const pSharedRefCount = mpSharedRefCount;
+		free_local_ref_count();
+		pSharedRefCount->release();
+	}
+}
+
+inline bool local_ref_count::is_owner_thread() const noexcept
+{
+	return mOwnerThread == std::this_thread::get_id();
+}
+
+/*
+ * A local_ref_count allocated on its own, used when a local_shared_ptr adopts an
+ * existing shared_ptr or a raw pointer.
+ * */
+
+template <typename Allocator>
+class local_ref_count_t : public local_ref_count
+{
+public:
+	using allocator_type = Allocator;
+
+	allocator_type mAllocator;
+
+	local_ref_count_t(ref_count_sp* pSharedRefCount, allocator_type allocator) noexcept : local_ref_count(pSharedRefCount), mAllocator(std::move(allocator)) {}
+
+	void free_local_ref_count() noexcept
+	{
+		allocator_type allocator = mAllocator;
+		this->~local_ref_count_t();
+		CUSTOM_FREE(allocator, this, sizeof(*this));
+	}
+};
+
+/*
+ * The make_local_shared control block: both counts and the instance of T in a single
+ * allocation. The local_ref_count part is plain storage once the last local owner is
+ * gone; the memory is released through the ref_count_sp part like any other block.
+ * */
+
+template <typename T, typename Allocator>
+class ref_count_sp_t_local_inst : public ref_count_sp, public local_ref_count
+{
+public:
+	using this_type = ref_count_sp_t_local_inst<T, Allocator>;
+	using value_type = T;
+	using allocator_type = Allocator;
+	using storage_type = typename std::aligned_storage_t<sizeof(T), std::alignment_of_v<T>>;
+
+	compressed_pair<storage_type, allocator_type> mMemoryAllocator;
+
+	value_type* GetValue()
+	{
+		return static_cast<value_type*>(static_cast<void*>(&mMemoryAllocator.first()));
+	}
+
+	template<typename... Args>
+	ref_count_sp_t_local_inst(allocator_type allocator, Args&&... args)
+		: ref_count_sp(&ref_count_ops_for<this_type>::sOps), local_ref_count(this), mMemoryAllocator(allocator)
+	{
+		new(static_cast<void*>(&mMemoryAllocator.first()))value_type(std::forward<Args>(args)...);
+	}
+
+	void free_value() noexcept
+	{
+		GetValue()->~value_type();
+	}
+
+	void free_ref_count_sp() noexcept
+	{
+		allocator_type allocator = mMemoryAllocator.second();
+		this->~ref_count_sp_t_local_inst();
+		CUSTOM_FREE(allocator, this, sizeof(*this));
+	}
+
+	void free_local_ref_count() noexcept
+	{
+	}
+
+	void* get_deleter(const std::type_info&) const noexcept
+	{
+		return nullptr;
+	}
+};
+
+/*
+ * local_shared_ptr
+ * */
+
+template <typename T>
+class local_shared_ptr
+{
+public:
+	using this_type = local_shared_ptr<T>;
+	using element_type = std::remove_extent_t<T>;
+	using reference_type = typename shared_ptr_traits<element_type>::reference_type;
+	using default_allocator_type = SmartPTR_Internal::default_ref_count_allocator;
+
+protected:
+	element_type* mpValue;
+	local_ref_count* mpRefCount;
+
+public:
+	local_shared_ptr() noexcept : mpValue(nullptr), mpRefCount(nullptr) { }
+
+	local_shared_ptr(std::nullptr_t) noexcept : mpValue(nullptr), mpRefCount(nullptr) { }
+
+	template <typename U>
+	explicit local_shared_ptr(U* pValue, std::enable_if_t<std::is_convertible_v<U*, element_type*>>* = 0) : mpValue(nullptr), mpRefCount(nullptr)
+	{
+		adopt_internal(shared_ptr<T>(pValue));
+	}
+
+	template <typename U, typename Deleter>
+	local_shared_ptr(U* pValue, Deleter deleter, std::enable_if_t<std::is_convertible_v<U*, element_type*>>* = 0) : mpValue(nullptr), mpRefCount(nullptr)
+	{
+		adopt_internal(shared_ptr<T>(pValue, std::move(deleter)));
+	}
+
+	// Takes one reference on the shared_ptr's control block, which all copies of this share.
+	template <typename U>
+	local_shared_ptr(const shared_ptr<U>& sharedPtr, std::enable_if_t<std::is_convertible_v<U*, T*>>* = 0) : mpValue(nullptr), mpRefCount(nullptr)
+	{
+		adopt_internal(shared_ptr<T>(sharedPtr));
+	}
+
+	template <typename U>
+	local_shared_ptr(shared_ptr<U>&& sharedPtr, std::enable_if_t<std::is_convertible_v<U*, T*>>* = 0) : mpValue(nullptr), mpRefCount(nullptr)
+	{
+		adopt_internal(shared_ptr<T>(std::move(sharedPtr)));
+	}
+
+	local_shared_ptr(const local_shared_ptr& localPtr) noexcept : mpValue(localPtr.mpValue), mpRefCount(localPtr.mpRefCount)
+	{
+		if(mpRefCount)
+		{
+			mpRefCount->local_addref();
+		}
+	}
+
+	template <typename U>
+	local_shared_ptr(const local_shared_ptr<U>& localPtr, std::enable_if_t<std::is_convertible_v<U*, T*>>* = 0) noexcept : mpValue(localPtr.mpValue), mpRefCount(localPtr.mpRefCount)
+	{
+		if(mpRefCount)
+		{
+			mpRefCount->local_addref();
+		}
+	}
+
+	template <typename U>
+	local_shared_ptr(const local_shared_ptr<U>& localPtr, element_type* pValue) noexcept : mpValue(pValue), mpRefCount(localPtr.mpRefCount)
+	{
+		if(mpRefCount)
+		{
+			mpRefCount->local_addref();
+		}
+	}
+
+	local_shared_ptr(local_shared_ptr&& localPtr) noexcept : mpValue(localPtr.mpValue), mpRefCount(localPtr.mpRefCount)
+	{
+		localPtr.mpValue = nullptr;
+		localPtr.mpRefCount = nullptr;
+	}
+
+	template <typename U>
+	local_shared_ptr(local_shared_ptr<U>&& localPtr, std::enable_if_t<std::is_convertible_v<U*, T*>>* = 0) noexcept : mpValue(localPtr.mpValue), mpRefCount(localPtr.mpRefCount)
+	{
+		localPtr.mpValue = nullptr;
+		localPtr.mpRefCount = nullptr;
+	}
+
+	~local_shared_ptr()
+	{
+		if(mpRefCount)
+		{
+			mpRefCount->local_release();
+		}
+	}
+
+	local_shared_ptr& operator=(const local_shared_ptr& localPtr) noexcept
+	{
+		if(&localPtr != this)
+		{
+			this_type(localPtr).swap(*this);
+		}
+		return *this;
+	}
+
+	template <typename U>
+	std::enable_if_t<std::is_convertible_v<U*, T*>, this_type&> operator=(const local_shared_ptr<U>& localPtr) noexcept
+	{
+		this_type(localPtr).swap(*this);
+		return *this;
+	}
+
+	local_shared_ptr& operator=(local_shared_ptr&& localPtr) noexcept
+	{
+		if(&localPtr != this)
+		{
+			this_type(std::move(localPtr)).swap(*this);
+		}
+		return *this;
+	}
+
+	template <typename U>
+	std::enable_if_t<std::is_convertible_v<U*, T*>, this_type&> operator=(local_shared_ptr<U>&& localPtr) noexcept
+	{
+		this_type(std::move(localPtr)).swap(*this);
+		return *this;
+	}
+
+	/*
+	 * The checked escape hatch: returns a shared_ptr that keeps the object alive from
+	 * any thread. Throws bad_local_shared_ptr when called off the owning thread, since
+	 * by then the local counts may already have been raced on.
+	 * */
+	template <typename U>
+	explicit operator shared_ptr<U>() const
+	{
+		static_assert(std::is_convertible_v<T*, U*>, "local_shared_ptr<T> converts only to shared_ptr of a compatible type.");
+
+		shared_ptr<U> sharedPtr;
+		if(mpRefCount)
+		{
+			if(!mpRefCount->is_owner_thread())
+			{
+				throw bad_local_shared_ptr();
+			}
+			mpRefCount->mpSharedRefCount->addref();
+			sharedPtr.mpRefCount = mpRefCount->mpSharedRefCount;
+			sharedPtr.mpValue = mpValue;
+		}
+		return sharedPtr;
+	}
+
+	void reset() noexcept
+	{
+		this_type().swap(*this);
+	}
+
+	template <typename U>
+	std::enable_if_t<std::is_convertible_v<U*, element_type*>, void> reset(U* pValue)
+	{
+		this_type(pValue).swap(*this);
+	}
+
+	template <typename U, typename Deleter>
+	std::enable_if_t<std::is_convertible_v<U*, element_type*>, void> reset(U* pValue, Deleter deleter)
+	{
+		this_type(pValue, std::move(deleter)).swap(*this);
+	}
+
+	void swap(this_type& localPtr) noexcept
+	{
+		element_type* const pValue = localPtr.mpValue;
+		localPtr.mpValue = mpValue;
+		mpValue = pValue;
+
+		local_ref_count* const pRefCount = localPtr.mpRefCount;
+		localPtr.mpRefCount = mpRefCount;
+		mpRefCount = pRefCount;
+	}
+
+	reference_type operator*() const noexcept
+	{
+		return *mpValue;
+	}
+
+	element_type* operator->() const noexcept
+	{
+		return mpValue;
+	}
+
+	template <typename U = T>
+	std::enable_if_t<std::is_array_v<U>, element_type&> operator[](std::ptrdiff_t i) const noexcept
+	{
+		return mpValue[i];
+	}
+
+	element_type* get() const noexcept
+	{
+		return mpValue;
+	}
+
+	// The number of local_shared_ptrs sharing ownership; shared_ptrs made from them are not counted.
+	int local_use_count() const noexcept
+	{
+		return mpRefCount ? mpRefCount->local_use_count() : 0;
+	}
+
+	template <typename U>
+	bool owner_before(const local_shared_ptr<U>& localPtr) const noexcept
+	{
+		return (mpRefCount < localPtr.mpRefCount);
+	}
+
+	explicit operator bool() const noexcept
+	{
+		return (mpValue != nullptr);
+	}
+
+protected:
+	template <typename U>
+	friend class local_shared_ptr;
+
+	template <typename U, typename Allocator, typename... Args>
+	friend local_shared_ptr<U> allocate_local_shared(const Allocator& allocator, Args&&... args);
+
+	// Moves sharedPtr's reference into a newly allocated local_ref_count.
+	void adopt_internal(shared_ptr<T>&& sharedPtr)
+	{
+		using ref_count_type = local_ref_count_t<default_allocator_type>;
+		if(sharedPtr.mpRefCount)
+		{
+			default_allocator_type allocator;
+			void* const pMemory = CUSTOM_ALLOC(allocator, sizeof(ref_count_type));
+			if(!pMemory)
+			{
+				throw std::bad_alloc();
+			}
+			mpRefCount = ::new(pMemory) ref_count_type(sharedPtr.mpRefCount, allocator);
+			mpValue = sharedPtr.mpValue;
+			sharedPtr.mpRefCount = nullptr;
+			sharedPtr.mpValue = nullptr;
+		}
+	}
+};
+
+template <typename T, typename Allocator, typename... Args>
+local_shared_ptr<T> allocate_local_shared(const Allocator& allocator, Args&&... args)
+{
+	static_assert(!std::is_array_v<T>, "allocate_local_shared does not support arrays.");
+
+	using ref_count_type = ref_count_sp_t_local_inst<T, Allocator>;
+	local_shared_ptr<T> ret;
+	void* const pMemory = allocate_memory(const_cast<Allocator&>(allocator), sizeof(ref_count_type), alignof(ref_count_type), 0);
+	if(pMemory)
+	{
+		ref_count_type* pRefCount;
+		try
+		{
+			pRefCount = ::new(pMemory) ref_count_type(allocator, std::forward<Args>(args)...);
+		}
+		catch(...)
+		{
+			CUSTOM_FREE(const_cast<Allocator&>(allocator), pMemory, sizeof(ref_count_type));
+			throw;
+		}
+		ret.mpRefCount = pRefCount;
+		ret.mpValue = pRefCount->GetValue();
+		do_enable_shared_from_this(pRefCount, ret.mpValue, ret.mpValue);
+	}
+	return ret;
+}
+
+template <typename T, typename... Args>
+local_shared_ptr<T> make_local_shared(Args&&... args)
+{
+	return rstl::allocate_local_shared<T>(SmartPTR_Internal::default_ref_count_allocator(), std::forward<Args>(args)...);
+}
+
+template <typename T>
+inline void swap(local_shared_ptr<T>& a, local_shared_ptr<T>& b) noexcept
+{
+	a.swap(b);
+}
+
+template <typename T, typename U>
+inline bool operator==(const local_shared_ptr<T>& a, const local_shared_ptr<U>& b) noexcept
+{
+	return (a.get() == b.get());
+}
+
+template <typename T, typename U>
+std::strong_ordering operator<=>(const local_shared_ptr<T>& a, const local_shared_ptr<U>& b) noexcept
+{
+	return (a.get() <=> b.get());
+}
+
+template <typename T>
+inline bool operator==(const local_shared_ptr<T>& a, std::nullptr_t) noexcept
+{
+	return !a;
+}
+
+template <typename T>
+inline std::strong_ordering operator<=>(const local_shared_ptr<T>& a, std::nullptr_t) noexcept
+{
+	return a.get() <=> nullptr;
+}
+
+template <typename T, typename U>
+inline local_shared_ptr<T> static_pointer_cast(const local_shared_ptr<U>& localPtr) noexcept
+{
+	return local_shared_ptr<T>(localPtr, static_cast<T*>(localPtr.get()));
+}
+
+template <typename T, typename U>
+inline local_shared_ptr<T> const_pointer_cast(const local_shared_ptr<U>& localPtr) noexcept
+{
+	return local_shared_ptr<T>(localPtr, const_cast<T*>(localPtr.get()));
+}
+
+template <typename T, typename U>
+inline local_shared_ptr<T> dynamic_pointer_cast(const local_shared_ptr<U>& localPtr) noexcept
+{
+	if(T* p = dynamic_cast<T*>(localPtr.get()))
+	{
+		return local_shared_ptr<T>(localPtr, p);
+	}
+	return local_shared_ptr<T>();
+}
+
+RSTL_NAMESPACE_END
+
+#endif //RSTL_LOCAL_SHARED_PTR_H
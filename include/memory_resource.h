@@ -0,0 +1,402 @@
+#ifndef RSTL_MEMORY_RESOURCE_H
+#define RSTL_MEMORY_RESOURCE_H
+
+#pragma once
+
+#include "internal/config.h"
+#include "internal/thread_support.h"
+#include "allocator.h"
+#include "arena_allocator.h"
+
+#include <atomic>
+#include <cstddef>
+
+RSTL_NAMESPACE_BEGIN
+
+/*
+ * Puts any allocator with the rstl::allocator interface behind a memory_resource.
+ * */
+
+template <typename Allocator>
+class allocator_resource : public memory_resource
+{
+public:
+	using allocator_type = Allocator;
+
+	allocator_resource() : mAllocator() { }
+	explicit allocator_resource(const allocator_type& allocator) : mAllocator(allocator) { }
+
+	allocator_type& get_allocator() noexcept
+	{
+		return mAllocator;
+	}
+
+protected:
+	void* do_allocate(size_t n, size_t alignment, size_t offset, int flags) override
+	{
+		return mAllocator.allocate(n, alignment, offset, flags);
+	}
+
+	void do_deallocate(void* p, size_t n) override
+	{
+		mAllocator.deallocate(p, n);
+	}
+
+	bool do_is_equal(const memory_resource& other) const noexcept override
+	{
+		const allocator_resource* const pOther = dynamic_cast<const allocator_resource*>(&other);
+		return pOther && (pOther->mAllocator == mAllocator);
+	}
+
+	allocator_type mAllocator;
+};
+
+/*
+ * The default resource is the one GetDefaultAllocator() dispatches to; heap_resource,
+ * get_default_resource, SetDefaultAllocator and default_allocator_scope are declared
+ * with it in allocator.h. These are the same operations under their pmr names.
+ * */
+
+memory_resource* set_default_resource(memory_resource* pResource) noexcept;
+
+using default_resource_scope = default_allocator_scope;
+
+/*
+ * A bump-pointer resource on top of rstl::arena. deallocate only gives back the most
+ * recent allocation; release() rewinds everything at once and keeps the blocks.
+ * Not thread-safe.
+ * */
+
+class monotonic_buffer_resource : public memory_resource
+{
+public:
+	explicit monotonic_buffer_resource(size_t blockSize = arena::kDefaultBlockSize) : mArena(blockSize) { }
+
+	monotonic_buffer_resource(const monotonic_buffer_resource&) = delete;
+	monotonic_buffer_resource& operator=(const monotonic_buffer_resource&) = delete;
+
+	void release() noexcept
+	{
+		mArena.reset();
+	}
+
+	arena& get_arena() noexcept
+	{
+		return mArena;
+	}
+
+protected:
+	void* do_allocate(size_t n, size_t alignment, size_t offset, int) override
+	{
+		return mArena.allocate(n, alignment, offset);
+	}
+
+	void do_deallocate(void* p, size_t n) override
+	{
+		mArena.deallocate(p, n);
+	}
+
+	bool do_is_equal(const memory_resource&) const noexcept override
+	{
+		return false;
+	}
+
+	arena mArena;
+};
+
+/*
+ * A single-threaded small-object pool: the same size classes as pool_allocator, with
+ * chunks taken from an upstream resource and no locking. Requests above
+ * pool_allocator::kMaxPooledSize go to the upstream resource directly; pooled sizes
+ * with an alignment above pool_allocator::kAlignment return NULL.
+ * */
+
+class unsynchronized_pool_resource : public memory_resource
+{
+public:
+	explicit unsynchronized_pool_resource(memory_resource* pUpstream = get_default_resource()) noexcept;
+	~unsynchronized_pool_resource();
+
+	unsynchronized_pool_resource(const unsynchronized_pool_resource&) = delete;
+	unsynchronized_pool_resource& operator=(const unsynchronized_pool_resource&) = delete;
+
+	// Returns every chunk to the upstream resource. Outstanding blocks become invalid.
+	void release() noexcept;
+
+	memory_resource* upstream_resource() const noexcept
+	{
+		return mpUpstream;
+	}
+
+protected:
+	static constexpr size_t kAlignment = pool_allocator::kAlignment;
+	static constexpr size_t kMaxPooledSize = pool_allocator::kMaxPooledSize;
+	static constexpr size_t kSizeClassCount = pool_allocator::kSizeClassCount;
+	static constexpr size_t kChunkSize = pool_allocator::kChunkSize;
+
+	struct free_block
+	{
+		free_block* mpNext;
+	};
+
+	void* do_allocate(size_t n, size_t alignment, size_t offset, int flags) override;
+	void do_deallocate(void* p, size_t n) override;
+
+	bool do_is_equal(const memory_resource&) const noexcept override
+	{
+		return false;
+	}
+
+	bool refill(size_t index);
+
+	memory_resource* mpUpstream;
+	free_block* mpFreeLists[kSizeClassCount] = {};
+	free_block* mpChunks = nullptr;
+};
+
+/*
+ * The thread-safe pool: a pool_allocator::pool, which locks per size class, behind
+ * the memory_resource interface. Requests above pool_allocator::kMaxPooledSize go to
+ * rstl::allocator.
+ * */
+
+class synchronized_pool_resource : public memory_resource
+{
+public:
+	synchronized_pool_resource() : mAllocator(mPool) { }
+
+	synchronized_pool_resource(const synchronized_pool_resource&) = delete;
+	synchronized_pool_resource& operator=(const synchronized_pool_resource&) = delete;
+
+protected:
+	void* do_allocate(size_t n, size_t alignment, size_t offset, int flags) override
+	{
+		return mAllocator.allocate(n, alignment, offset, flags);
+	}
+
+	void do_deallocate(void* p, size_t n) override
+	{
+		mAllocator.deallocate(p, n);
+	}
+
+	bool do_is_equal(const memory_resource&) const noexcept override
+	{
+		return false;
+	}
+
+	pool_allocator::pool mPool;
+	pool_allocator mAllocator;
+};
+
+/*
+ * An allocator with the rstl::allocator interface which forwards to a memory_resource.
+ * Default constructed, it uses get_default_resource() at the time of construction.
+ * */
+
+class polymorphic_allocator
+{
+public:
+	explicit polymorphic_allocator(const char* pName = POLYMORPHIC_ALLOCATOR_DEFAULT_NAME) noexcept;
+	polymorphic_allocator(memory_resource* pResource, const char* pName = POLYMORPHIC_ALLOCATOR_DEFAULT_NAME) noexcept;
+	polymorphic_allocator(const polymorphic_allocator& x) noexcept;
+	polymorphic_allocator(const polymorphic_allocator& x, const char* pName) noexcept;
+
+	polymorphic_allocator& operator=(const polymorphic_allocator& x) noexcept;
+
+	void* allocate(size_t n, int flags = 0);
+	void* allocate(size_t n, size_t alignment, size_t offset, int flags = 0);
+	void deallocate(void* p, size_t n);
+
+	const char* get_name() const;
+	void set_name(const char* pName);
+
+	memory_resource* resource() const noexcept;
+
+	// Debug name
+	const char* mpName;
+
+protected:
+	memory_resource* mpResource;
+};
+
+bool operator==(const polymorphic_allocator& a, const polymorphic_allocator& b);
+bool operator!=(const polymorphic_allocator& a, const polymorphic_allocator& b);
+
+/*
+ * default resource
+ * */
+
+inline memory_resource* set_default_resource(memory_resource* pResource) noexcept
+{
+	return SetDefaultAllocator(pResource);
+}
+
+/*
+ * unsynchronized_pool_resource
+ * */
+
+inline unsynchronized_pool_resource::unsynchronized_pool_resource(memory_resource* pUpstream) noexcept : mpUpstream(pUpstream)
+{
+
+}
+
+inline unsynchronized_pool_resource::~unsynchronized_pool_resource()
+{
+	release();
+}
+
+inline void unsynchronized_pool_resource::release() noexcept
+{
+	while(free_block* pChunk = mpChunks)
+	{
+		mpChunks = pChunk->mpNext;
+		mpUpstream->deallocate(pChunk, kChunkSize);
+	}
+	for(free_block*& pFreeList : mpFreeLists)
+	{
+		pFreeList = nullptr;
+	}
+}
+
+inline bool unsynchronized_pool_resource::refill(size_t index)
+{
+	void* const pMemory = mpUpstream->allocate(kChunkSize, kAlignment, 0);
+	if(!pMemory)
+	{
+		return false;
+	}
+
+	// The chunk link takes the first kAlignment bytes so that every block stays aligned.
+	free_block* const pChunk = static_cast<free_block*>(pMemory);
+	pChunk->mpNext = mpChunks;
+	mpChunks = pChunk;
+
+	const size_t blockSize = (index + 1) * kAlignment;
+	char* const pBegin = static_cast<char*>(pMemory) + kAlignment;
+	free_block* pHead = mpFreeLists[index];
+	for(size_t i = (kChunkSize - kAlignment) / blockSize; i > 0; --i)
+	{
+		free_block* const pBlock = reinterpret_cast<free_block*>(pBegin + ((i - 1) * blockSize));
+		pBlock->mpNext = pHead;
+		pHead = pBlock;
+	}
+	mpFreeLists[index] = pHead;
+	return true;
+}
+
+inline void* unsynchronized_pool_resource::do_allocate(size_t n, size_t alignment, size_t offset, int flags)
+{
+	if(n > kMaxPooledSize)
+	{
+		return mpUpstream->allocate(n, alignment, offset, flags);
+	}
+
+	if(alignment > kAlignment)
+	{
+		return NULL;
+	}
+
+	const size_t index = (n == 0) ? 0 : ((n - 1) / kAlignment);
+	if(!mpFreeLists[index] && !refill(index))
+	{
+		return NULL;
+	}
+
+	free_block* const pBlock = mpFreeLists[index];
+	mpFreeLists[index] = pBlock->mpNext;
+	return pBlock;
+}
+
+inline void unsynchronized_pool_resource::do_deallocate(void* p, size_t n)
+{
+	if(p == nullptr)
+	{
+		return;
+	}
+
+	if(n > kMaxPooledSize)
+	{
+		mpUpstream->deallocate(p, n);
+		return;
+	}
+
+	const size_t index = (n == 0) ? 0 : ((n - 1) / kAlignment);
+	free_block* const pBlock = static_cast<free_block*>(p);
+	pBlock->mpNext = mpFreeLists[index];
+	mpFreeLists[index] = pBlock;
+}
+
+/*
+ * polymorphic_allocator
+ * */
+
+inline polymorphic_allocator::polymorphic_allocator(const char* pName) noexcept : mpName(pName), mpResource(get_default_resource())
+{
+
+}
+
+inline polymorphic_allocator::polymorphic_allocator(memory_resource* pResource, const char* pName) noexcept : mpName(pName), mpResource(pResource)
+{
+
+}
+
+inline polymorphic_allocator::polymorphic_allocator(const polymorphic_allocator& x) noexcept : mpName(x.mpName), mpResource(x.mpResource)
+{
+
+}
+
+inline polymorphic_allocator::polymorphic_allocator(const polymorphic_allocator& x, const char* pName) noexcept : mpName(pName), mpResource(x.mpResource)
+{
+
+}
+
+inline polymorphic_allocator& polymorphic_allocator::operator=(const polymorphic_allocator& x) noexcept
+{
+	mpName = x.mpName;
+	mpResource = x.mpResource;
+	return *this;
+}
+
+inline const char* polymorphic_allocator::get_name() const
+{
+	return mpName;
+}
+
+inline void polymorphic_allocator::set_name(const char* pName)
+{
+	mpName = pName;
+}
+
+inline memory_resource* polymorphic_allocator::resource() const noexcept
+{
+	return mpResource;
+}
+
+inline void* polymorphic_allocator::allocate(size_t n, int flags)
+{
+	return mpResource->allocate(n, ALLOCATOR_DEFAULT_ALIGNMENT, 0, flags);
+}
+
+inline void* polymorphic_allocator::allocate(size_t n, size_t alignment, size_t offset, int flags)
+{
+	return mpResource->allocate(n, alignment, offset, flags);
+}
+
+inline void polymorphic_allocator::deallocate(void* p, size_t n)
+{
+	mpResource->deallocate(p, n);
+}
+
+inline bool operator==(const polymorphic_allocator& a, const polymorphic_allocator& b)
+{
+	return a.resource()->is_equal(*b.resource());
+}
+
+inline bool operator!=(const polymorphic_allocator& a, const polymorphic_allocator& b)
+{
+	return !(a == b);
+}
+
+RSTL_NAMESPACE_END
+
+#endif //RSTL_MEMORY_RESOURCE_H
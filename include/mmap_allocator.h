@@ -0,0 +1,411 @@
+#ifndef RSTL_MMAP_ALLOCATOR_H
+#define RSTL_MMAP_ALLOCATOR_H
+
+#pragma once
+
+#include "internal/config.h"
+#include "internal/thread_support.h"
+#include "allocator.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__unix__) || defined(__APPLE__)
+#  include <sys/mman.h>
+#  include <unistd.h>
+#  define RSTL_HAS_MMAP 1
+#else
+#  define RSTL_HAS_MMAP 0
+#endif
+
+RSTL_NAMESPACE_BEGIN
+
+/*
+ * A large-object backend. Requests of at least mThreshold bytes are mapped directly
+ * with mmap and unmapped on free, so they never fragment the heap and their memory
+ * goes back to the OS; smaller requests are passed on to rstl::allocator. The choice
+ * depends on n alone, which is what lets deallocate(p, n) route a block back without
+ * a header: the mapping starts at the page containing p and its length follows from n.
+ *
+ * Options:
+ *  - mHugePages maps large regions 2MB aligned and asks for transparent huge pages,
+ *    which cuts TLB misses on big tables.
+ *  - mDontNeedOnFree releases a freed mapping's pages with MADV_DONTNEED before it is
+ *    cached, so the cache holds address space rather than memory.
+ *  - Up to kCacheSlots recently freed mappings are kept and reused (trimmed to size)
+ *    by later requests, saving the mmap call and page-table setup.
+ *
+ * On platforms without mmap every request goes to rstl::allocator.
+ * */
+
+class mmap_heap
+{
+public:
+	static constexpr size_t kDefaultThreshold = 1024 * 1024;
+	static constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+	static constexpr size_t kCacheSlots = 8;
+
+	struct options
+	{
+		size_t mThreshold = kDefaultThreshold;
+		bool mHugePages = false;
+		bool mDontNeedOnFree = true;
+		bool mCacheMappings = true;
+	};
+
+	mmap_heap() noexcept : mmap_heap(options()) { }
+	explicit mmap_heap(const options& opts) noexcept;
+	~mmap_heap();
+
+	mmap_heap(const mmap_heap&) = delete;
+	mmap_heap& operator=(const mmap_heap&) = delete;
+
+	void* allocate(size_t n, size_t alignment, size_t offset);
+	void deallocate(void* p, size_t n) noexcept;
+
+	bool is_mapped_size(size_t n) const noexcept
+	{
+		return RSTL_HAS_MMAP && (n >= mOptions.mThreshold);
+	}
+
+	// Drops every cached mapping.
+	void trim() noexcept;
+
+	const options& get_options() const noexcept
+	{
+		return mOptions;
+	}
+
+protected:
+	struct mapping
+	{
+		char* mpBase;
+		size_t mLength;
+	};
+
+	size_t round_to_pages(size_t n) const noexcept
+	{
+		return (n + mPageSize - 1) & ~(mPageSize - 1);
+	}
+
+	void* map(size_t length, size_t baseAlignment) noexcept;
+	void unmap(char* pBase, size_t length) noexcept;
+	bool take_cached(size_t length, char*& pBase) noexcept;
+
+	options mOptions;
+	size_t mPageSize;
+
+	std::mutex mCacheMutex;
+	mapping mCache[kCacheSlots] = {};
+	size_t mCacheCount = 0;
+};
+
+/*
+ * An rstl::allocator compatible handle onto an mmap_heap. Copies share the heap; a
+ * default constructed mmap_allocator uses a process-wide heap with default options.
+ * */
+
+class mmap_allocator
+{
+public:
+	explicit mmap_allocator(const char* pName = MMAP_ALLOCATOR_DEFAULT_NAME);
+	explicit mmap_allocator(mmap_heap& heap, const char* pName = MMAP_ALLOCATOR_DEFAULT_NAME);
+	mmap_allocator(const mmap_allocator& x);
+	mmap_allocator(const mmap_allocator& x, const char* pName);
+
+	mmap_allocator& operator=(const mmap_allocator& x);
+
+	void* allocate(size_t n, int flags = 0);
+	void* allocate(size_t n, size_t alignment, size_t offset, int flags = 0);
+	void deallocate(void* p, size_t n);
+
+	const char* get_name() const;
+	void set_name(const char* pName);
+
+	mmap_heap* get_heap() const;
+
+	static mmap_heap* get_default_heap();
+
+	// Debug name
+	const char* mpName;
+
+protected:
+	mmap_heap* mpHeap;
+};
+
+bool operator==(const mmap_allocator& a, const mmap_allocator& b);
+bool operator!=(const mmap_allocator& a, const mmap_allocator& b);
+
+/*
+ * mmap_heap
+ * */
+
+inline mmap_heap::mmap_heap(const options& opts) noexcept : mOptions(opts), mPageSize(4096)
+{
+#if RSTL_HAS_MMAP
+	const long pageSize = ::sysconf(_SC_PAGESIZE);
+	if(pageSize > 0)
+	{
+		mPageSize = (size_t)pageSize;
+	}
+#endif
+}
+
+inline mmap_heap::~mmap_heap()
+{
+	trim();
+}
+
+inline void* mmap_heap::map(size_t length, size_t baseAlignment) noexcept
+{
+#if RSTL_HAS_MMAP
+	// Over-map so an aligned base can be cut out; the ends are unmapped by the caller.
+	const size_t mappedLength = length + ((baseAlignment > mPageSize) ? baseAlignment : 0);
+	void* const pMapping = ::mmap(nullptr, mappedLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return (pMapping == MAP_FAILED) ? nullptr : pMapping;
+#else
+	UNUSED(length);
+	UNUSED(baseAlignment);
+	return nullptr;
+#endif
+}
+
+inline void mmap_heap::unmap(char* pBase, size_t length) noexcept
+{
+#if RSTL_HAS_MMAP
+	if(length)
+	{
+		::munmap(pBase, length);
+	}
+#else
+	UNUSED(pBase);
+	UNUSED(length);
+#endif
+}
+
+inline bool mmap_heap::take_cached(size_t length, char*& pBase) noexcept
+{
+	Thread_Support_Internal::auto_mutex autoMutex(mCacheMutex);
+
+	// Prefer the smallest mapping that fits, so big ones stay available for big requests.
+	size_t best = kCacheSlots;
+	for(size_t i = 0; i < mCacheCount; ++i)
+	{
+		if((mCache[i].mLength >= length) && ((best == kCacheSlots) || (mCache[i].mLength < mCache[best].mLength)))
+		{
+			best = i;
+		}
+	}
+	if(best == kCacheSlots)
+	{
+		return false;
+	}
+
+	const mapping found = mCache[best];
+	mCache[best] = mCache[--mCacheCount];
+
+	pBase = found.mpBase;
+	unmap(found.mpBase + length, found.mLength - length);
+	return true;
+}
+
+inline void* mmap_heap::allocate(size_t n, size_t alignment, size_t offset)
+{
+	if(!is_mapped_size(n))
+	{
+		rstl::allocator upstream(MMAP_ALLOCATOR_DEFAULT_NAME);
+		return upstream.allocate(n, alignment, offset);
+	}
+
+	if(alignment < ALLOCATOR_MIN_ALIGNMENT)
+	{
+		alignment = ALLOCATOR_MIN_ALIGNMENT;
+	}
+
+	// p is placed less than one page into its mapping when the alignment allows it, which is
+	// what deallocate relies on to find the base again. A cached mapping is page aligned,
+	// so it can only be reused for requests that fit that rule from any page boundary.
+	const size_t lead = ((alignment <= mPageSize) ? (((alignment - (offset % alignment)) % alignment)) : 0);
+	const size_t length = round_to_pages(lead + n);
+
+	char* pBase = nullptr;
+	if(mOptions.mCacheMappings && (alignment <= mPageSize) && take_cached(length, pBase))
+	{
+		return pBase + lead;
+	}
+
+	const bool huge = mOptions.mHugePages && (length >= kHugePageSize);
+	size_t baseAlignment = huge ? kHugePageSize : mPageSize;
+	if(alignment > baseAlignment)
+	{
+		baseAlignment = alignment;
+	}
+
+	// A large alignment with an odd offset can push p up to alignment bytes in, and the
+	// block then ends up to a page further on.
+	const size_t slack = (alignment > mPageSize) ? (alignment + mPageSize) : 0;
+	char* const pMapping = static_cast<char*>(map(length + slack, baseAlignment));
+	if(!pMapping)
+	{
+		return nullptr;
+	}
+
+	const size_t mappedLength = length + slack + ((baseAlignment > mPageSize) ? baseAlignment : 0);
+	char* const pAlignedBase = reinterpret_cast<char*>(((uintptr_t)pMapping + baseAlignment - 1) & ~(uintptr_t)(baseAlignment - 1));
+	char* const p = reinterpret_cast<char*>((((uintptr_t)pAlignedBase + offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - offset);
+
+	// Keep only the pages from the one containing p to the end of the block.
+	pBase = reinterpret_cast<char*>((uintptr_t)p & ~(uintptr_t)(mPageSize - 1));
+	char* const pEnd = pBase + round_to_pages((size_t)(p - pBase) + n);
+	unmap(pMapping, (size_t)(pBase - pMapping));
+	unmap(pEnd, (size_t)((pMapping + mappedLength) - pEnd));
+
+#if RSTL_HAS_MMAP && defined(MADV_HUGEPAGE)
+	if(huge)
+	{
+		::madvise(pBase, (size_t)(pEnd - pBase), MADV_HUGEPAGE);
+	}
+#endif
+
+	return p;
+}
+
+inline void mmap_heap::deallocate(void* p, size_t n) noexcept
+{
+	if(p == nullptr)
+	{
+		return;
+	}
+
+	if(!is_mapped_size(n))
+	{
+		rstl::allocator upstream(MMAP_ALLOCATOR_DEFAULT_NAME);
+		upstream.deallocate(p, n);
+		return;
+	}
+
+	char* const pBase = reinterpret_cast<char*>((uintptr_t)p & ~(uintptr_t)(mPageSize - 1));
+	const size_t length = round_to_pages((size_t)(static_cast<char*>(p) - pBase) + n);
+
+	if(!mOptions.mCacheMappings)
+	{
+		unmap(pBase, length);
+		return;
+	}
+
+#if RSTL_HAS_MMAP
+	if(mOptions.mDontNeedOnFree)
+	{
+		::madvise(pBase, length, MADV_DONTNEED);
+	}
+#endif
+
+	mapping evicted = {nullptr, 0};
+	{
+		Thread_Support_Internal::auto_mutex autoMutex(mCacheMutex);
+		if(mCacheCount == kCacheSlots)
+		{
+			// Evict the oldest mapping; slot 0 always holds it since new ones are appended.
+			evicted = mCache[0];
+			for(size_t i = 1; i < kCacheSlots; ++i)
+			{
+				mCache[i - 1] = mCache[i];
+			}
+			--mCacheCount;
+		}
+		mCache[mCacheCount++] = mapping{pBase, length};
+	}
+	unmap(evicted.mpBase, evicted.mLength);
+}
+
+inline void mmap_heap::trim() noexcept
+{
+	Thread_Support_Internal::auto_mutex autoMutex(mCacheMutex);
+	for(size_t i = 0; i < mCacheCount; ++i)
+	{
+		unmap(mCache[i].mpBase, mCache[i].mLength);
+	}
+	mCacheCount = 0;
+}
+
+/*
+ * mmap_allocator
+ * */
+
+inline mmap_allocator::mmap_allocator(const char* pName) : mpName(pName), mpHeap(get_default_heap())
+{
+
+}
+
+inline mmap_allocator::mmap_allocator(mmap_heap& heap, const char* pName) : mpName(pName), mpHeap(&heap)
+{
+
+}
+
+inline mmap_allocator::mmap_allocator(const mmap_allocator& x) : mpName(x.mpName), mpHeap(x.mpHeap)
+{
+
+}
+
+inline mmap_allocator::mmap_allocator(const mmap_allocator& x, const char* pName) : mpName(pName), mpHeap(x.mpHeap)
+{
+
+}
+
+inline mmap_allocator& mmap_allocator::operator=(const mmap_allocator& x)
+{
+	mpName = x.mpName;
+	mpHeap = x.mpHeap;
+	return *this;
+}
+
+inline const char* mmap_allocator::get_name() const
+{
+	return mpName;
+}
+
+inline void mmap_allocator::set_name(const char* pName)
+{
+	mpName = pName;
+}
+
+inline mmap_heap* mmap_allocator::get_heap() const
+{
+	return mpHeap;
+}
+
+inline mmap_heap* mmap_allocator::get_default_heap()
+{
+	static mmap_heap* const pDefaultHeap = new mmap_heap();
+	return pDefaultHeap;
+}
+
+inline void* mmap_allocator::allocate(size_t n, int flags)
+{
+	return allocate(n, ALLOCATOR_DEFAULT_ALIGNMENT, 0, flags);
+}
+
+inline void* mmap_allocator::allocate(size_t n, size_t alignment, size_t offset, int flags)
+{
+	UNUSED(flags);
+	return mpHeap->allocate(n, alignment, offset);
+}
+
+inline void mmap_allocator::deallocate(void* p, size_t n)
+{
+	mpHeap->deallocate(p, n);
+}
+
+inline bool operator==(const mmap_allocator& a, const mmap_allocator& b)
+{
+	return (a.get_heap() == b.get_heap());
+}
+
+inline bool operator!=(const mmap_allocator& a, const mmap_allocator& b)
+{
+	return (a.get_heap() != b.get_heap());
+}
+
+RSTL_NAMESPACE_END
+
+#endif //RSTL_MMAP_ALLOCATOR_H
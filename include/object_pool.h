@@ -0,0 +1,366 @@
+#ifndef RSTL_OBJECT_POOL_H
+#define RSTL_OBJECT_POOL_H
+
+#pragma once
+
+#include "internal/config.h"
+#include "allocator.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+RSTL_NAMESPACE_BEGIN
+
+/*
+ * slab_pool hands out fixed-size slots carved from slabs. Slot size and alignment are
+ * template parameters, so all layout arithmetic is done at compile time. Each slab is
+ * aligned to its own size and starts with a header, which makes finding a slot's
+ * slab a mask and freeing a slot O(1); free slots are linked through their own first
+ * word. A slab whose last slot is freed is released, except for one kept in reserve
+ * so that a create/destroy loop does not allocate a slab every time.
+ *
+ * A slab_pool is not thread-safe; use one per thread or guard it externally.
+ * */
+
+template <size_t SlotSize, size_t SlotAlignment>
+class slab_pool
+{
+public:
+	static constexpr size_t kSlotAlignment = (SlotAlignment > alignof(void*)) ? SlotAlignment : alignof(void*);
+	static constexpr size_t kSlotSize = (((SlotSize > sizeof(void*)) ? SlotSize : sizeof(void*)) + kSlotAlignment - 1) & ~(kSlotAlignment - 1);
+
+	static_assert((kSlotAlignment & (kSlotAlignment - 1)) == 0, "slab_pool slot alignment must be a power of two.");
+
+protected:
+	struct slab
+	{
+		slab* mpPrev;
+		slab* mpNext;
+		void* mpFreeList;
+		size_t mUsed;
+		size_t mBumpIndex;
+	};
+
+	static constexpr size_t constexpr_max(size_t a, size_t b)
+	{
+		return (a > b) ? a : b;
+	}
+
+	static constexpr size_t round_up_pow2(size_t n)
+	{
+		size_t result = 1;
+		while(result < n)
+		{
+			result <<= 1;
+		}
+		return result;
+	}
+
+public:
+	static constexpr size_t kHeaderSize = (sizeof(slab) + kSlotAlignment - 1) & ~(kSlotAlignment - 1);
+	static constexpr size_t kSlabSize = round_up_pow2(constexpr_max(16 * 1024, kHeaderSize + (64 * kSlotSize)));
+	static constexpr size_t kSlotsPerSlab = (kSlabSize - kHeaderSize) / kSlotSize;
+
+	slab_pool() noexcept : mpPartial(nullptr), mpReserve(nullptr), mSlabCount(0) { }
+	~slab_pool();
+
+	slab_pool(const slab_pool&) = delete;
+	slab_pool& operator=(const slab_pool&) = delete;
+
+	// Returns uninitialized storage for one slot, or nullptr if out of memory.
+	void* allocate();
+	void deallocate(void* p) noexcept;
+
+	size_t slab_count() const noexcept
+	{
+		return mSlabCount;
+	}
+
+protected:
+	static slab* slab_of(const void* p) noexcept
+	{
+		return reinterpret_cast<slab*>((uintptr_t)p & ~(uintptr_t)(kSlabSize - 1));
+	}
+
+	void link(slab* pSlab) noexcept
+	{
+		pSlab->mpPrev = nullptr;
+		pSlab->mpNext = mpPartial;
+		if(mpPartial)
+		{
+			mpPartial->mpPrev = pSlab;
+		}
+		mpPartial = pSlab;
+	}
+
+	void unlink(slab* pSlab) noexcept
+	{
+		if(pSlab->mpPrev)
+		{
+			pSlab->mpPrev->mpNext = pSlab->mpNext;
+		}
+		else
+		{
+			mpPartial = pSlab->mpNext;
+		}
+		if(pSlab->mpNext)
+		{
+			pSlab->mpNext->mpPrev = pSlab->mpPrev;
+		}
+	}
+
+	slab* mpPartial;  // Slabs with at least one free slot.
+	slab* mpReserve;  // One empty slab kept back from release.
+	size_t mSlabCount;
+};
+
+template <size_t SlotSize, size_t SlotAlignment>
+inline slab_pool<SlotSize, SlotAlignment>::~slab_pool()
+{
+	// Full slabs are not reachable from here; destroying a pool with live objects leaks them.
+	while(slab* pSlab = mpPartial)
+	{
+		unlink(pSlab);
+		::operator delete(pSlab, std::align_val_t(kSlabSize));
+	}
+	if(mpReserve)
+	{
+		::operator delete(mpReserve, std::align_val_t(kSlabSize));
+	}
+}
+
+template <size_t SlotSize, size_t SlotAlignment>
+inline void* slab_pool<SlotSize, SlotAlignment>::allocate()
+{
+	slab* pSlab = mpPartial;
+	if(!pSlab)
+	{
+		if(mpReserve)
+		{
+			pSlab = mpReserve;
+			mpReserve = nullptr;
+		}
+		else
+		{
+			pSlab = static_cast<slab*>(::operator new(kSlabSize, std::align_val_t(kSlabSize), std::nothrow));
+			if(!pSlab)
+			{
+				return nullptr;
+			}
+			++mSlabCount;
+		}
+		pSlab->mpFreeList = nullptr;
+		pSlab->mUsed = 0;
+		pSlab->mBumpIndex = 0;
+		link(pSlab);
+	}
+
+	void* pSlot;
+	if(pSlab->mpFreeList)
+	{
+		pSlot = pSlab->mpFreeList;
+		pSlab->mpFreeList = *static_cast<void**>(pSlot);
+	}
+	else
+	{
+		pSlot = reinterpret_cast<char*>(pSlab) + kHeaderSize + (pSlab->mBumpIndex++ * kSlotSize);
+	}
+
+	if(++pSlab->mUsed == kSlotsPerSlab)
+	{
+		unlink(pSlab);
+	}
+	return pSlot;
+}
+
+template <size_t SlotSize, size_t SlotAlignment>
+inline void slab_pool<SlotSize, SlotAlignment>::deallocate(void* p) noexcept
+{
+	if(p == nullptr)
+	{
+		return;
+	}
+
+	slab* const pSlab = slab_of(p);
+	*static_cast<void**>(p) = pSlab->mpFreeList;
+	pSlab->mpFreeList = p;
+
+	if(pSlab->mUsed-- == kSlotsPerSlab)
+	{
+		link(pSlab);
+	}
+
+	if(pSlab->mUsed == 0)
+	{
+		unlink(pSlab);
+		if(!mpReserve)
+		{
+			mpReserve = pSlab;
+		}
+		else
+		{
+			::operator delete(pSlab, std::align_val_t(kSlabSize));
+			--mSlabCount;
+		}
+	}
+}
+
+/*
+ * An rstl::allocator compatible adaptor onto a slab_pool, e.g. for the control blocks
+ * of shared_ptr(U*, Deleter, Allocator) or allocate_shared. Requests that fit a slot
+ * come from the pool; larger ones go to rstl::allocator, so a pool whose slots are too
+ * small for a given control block still works, just without pooling. Slot-sized
+ * requests aligned beyond the slot alignment return NULL.
+ * */
+
+template <size_t SlotSize, size_t SlotAlignment>
+class slab_pool_allocator
+{
+public:
+	using pool_type = slab_pool<SlotSize, SlotAlignment>;
+
+	explicit slab_pool_allocator(pool_type& pool, const char* pName = OBJECT_POOL_DEFAULT_NAME) : mpName(pName), mpPool(&pool) { }
+	slab_pool_allocator(const slab_pool_allocator& x) : mpName(x.mpName), mpPool(x.mpPool) { }
+	slab_pool_allocator(const slab_pool_allocator& x, const char* pName) : mpName(pName), mpPool(x.mpPool) { }
+
+	slab_pool_allocator& operator=(const slab_pool_allocator& x)
+	{
+		mpName = x.mpName;
+		mpPool = x.mpPool;
+		return *this;
+	}
+
+	void* allocate(size_t n, int flags = 0)
+	{
+		return allocate(n, pool_type::kSlotAlignment, 0, flags);
+	}
+
+	void* allocate(size_t n, size_t alignment, size_t offset, int flags = 0)
+	{
+		if(n > pool_type::kSlotSize)
+		{
+			rstl::allocator upstream(mpName);
+			return upstream.allocate(n, alignment, offset, flags);
+		}
+		return (alignment <= pool_type::kSlotAlignment) ? mpPool->allocate() : NULL;
+	}
+
+	void deallocate(void* p, size_t n)
+	{
+		if(n > pool_type::kSlotSize)
+		{
+			rstl::allocator upstream(mpName);
+			upstream.deallocate(p, n);
+		}
+		else
+		{
+			mpPool->deallocate(p);
+		}
+	}
+
+	const char* get_name() const
+	{
+		return mpName;
+	}
+
+	void set_name(const char* pName)
+	{
+		mpName = pName;
+	}
+
+	pool_type* get_pool() const
+	{
+		return mpPool;
+	}
+
+	// Debug name
+	const char* mpName;
+
+protected:
+	pool_type* mpPool;
+};
+
+template <size_t SlotSize, size_t SlotAlignment>
+inline bool operator==(const slab_pool_allocator<SlotSize, SlotAlignment>& a, const slab_pool_allocator<SlotSize, SlotAlignment>& b)
+{
+	return (a.get_pool() == b.get_pool());
+}
+
+template <size_t SlotSize, size_t SlotAlignment>
+inline bool operator!=(const slab_pool_allocator<SlotSize, SlotAlignment>& a, const slab_pool_allocator<SlotSize, SlotAlignment>& b)
+{
+	return (a.get_pool() != b.get_pool());
+}
+
+/*
+ * A typed slab_pool: slots are sizeof(T) bytes aligned to alignof(T). create()
+ * constructs in a free slot and destroy() destructs and recycles it in constant time.
+ * deleter destroys through the pool, for use with shared_ptr and unique_ptr.
+ * */
+
+template <typename T>
+class object_pool : public slab_pool<sizeof(T), alignof(T)>
+{
+public:
+	using base_type = slab_pool<sizeof(T), alignof(T)>;
+	using value_type = T;
+	using allocator_type = slab_pool_allocator<sizeof(T), alignof(T)>;
+
+	struct deleter
+	{
+		object_pool* mpPool;
+
+		void operator()(T* p) const noexcept
+		{
+			mpPool->destroy(p);
+		}
+	};
+
+	object_pool() noexcept { }
+
+	template <typename... Args>
+	T* create(Args&&... args)
+	{
+		void* const pSlot = base_type::allocate();
+		if(!pSlot)
+		{
+			throw std::bad_alloc();
+		}
+
+		try
+		{
+			return ::new(pSlot) T(std::forward<Args>(args)...);
+		}
+		catch(...)
+		{
+			base_type::deallocate(pSlot);
+			throw;
+		}
+	}
+
+	void destroy(T* p) noexcept
+	{
+		if(p)
+		{
+			p->~T();
+			base_type::deallocate(p);
+		}
+	}
+
+	deleter get_deleter() noexcept
+	{
+		return deleter{this};
+	}
+
+	allocator_type get_allocator(const char* pName = OBJECT_POOL_DEFAULT_NAME) noexcept
+	{
+		return allocator_type(*this, pName);
+	}
+};
+
+RSTL_NAMESPACE_END
+
+#endif //RSTL_OBJECT_POOL_H
@@ -0,0 +1,423 @@
+#ifndef RSTL_PAGE_ALLOCATOR_H
+#define RSTL_PAGE_ALLOCATOR_H
+
+#pragma once
+
+#include "internal/config.h"
+#include "internal/thread_support.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+RSTL_NAMESPACE_BEGIN
+
+/*
+ * A size-class page heap which keeps no per-block header. Memory is taken from the
+ * system in kPageSize pages aligned to kPageSize, and every allocation, small or
+ * large, starts inside the first page of its mapping. deallocate therefore finds the
+ * owning page by masking the pointer and reads the size class from the page header;
+ * the block a pointer belongs to is recovered from its distance to the page start,
+ * so an aligned pointer may sit anywhere inside its block.
+ *
+ * Small pages hold blocks of one size class and sit on their class's list of pages
+ * with free blocks while they have any; allocate and deallocate are O(1). A page that
+ * becomes empty is returned, unless it is the only one left in its class.
+ *
+ * allocate(n, alignment, offset) makes (p + offset) a multiple of alignment.
+ * Alignments up to kMaxAlignment are supported; larger ones return NULL.
+ * */
+
+class page_heap
+{
+public:
+	static constexpr size_t kPageSize = 64 * 1024;
+	static constexpr size_t kMinAlignment = 16;
+	static constexpr size_t kMaxSmallSize = 1024;
+	static constexpr size_t kSizeClassCount = kMaxSmallSize / kMinAlignment;
+	static constexpr size_t kMaxAlignment = kPageSize / 4;
+
+	page_heap() noexcept;
+	~page_heap();
+
+	page_heap(const page_heap&) = delete;
+	page_heap& operator=(const page_heap&) = delete;
+
+	void* allocate(size_t n, size_t alignment, size_t offset);
+
+	// p may be any pointer returned by allocate; n is not needed to find the block.
+	void deallocate(void* p) noexcept;
+
+	// Returns the usable size of the block p points into, counted from p.
+	size_t usable_size(const void* p) const noexcept;
+
+protected:
+	static constexpr uint32_t kLargeClass = UINT32_MAX;
+
+	struct page
+	{
+		uint32_t mClassIndex;  // kLargeClass for a large allocation.
+		uint32_t mUsed;
+		size_t mBlockSize;     // For a large allocation, the size of the whole mapping.
+		uint32_t mCapacity;
+		uint32_t mBumpIndex;   // Blocks past this index have never been handed out.
+		void* mpFreeList;
+		page* mpPrev;          // Links in the class's list of pages with free blocks.
+		page* mpNext;
+	};
+
+	static constexpr size_t kHeaderSize = (sizeof(page) + 63) & ~size_t(63);
+
+	struct size_class
+	{
+		std::mutex mMutex;
+		page* mpAvailable = nullptr;
+		size_t mPageCount = 0;
+	};
+
+	static page* page_of(const void* p) noexcept
+	{
+		return reinterpret_cast<page*>((uintptr_t)p & ~(uintptr_t)(kPageSize - 1));
+	}
+
+	static char* block_of(page* pPage, const void* p) noexcept
+	{
+		char* const pFirst = reinterpret_cast<char*>(pPage) + kHeaderSize;
+		return pFirst + (((size_t)((const char*)p - pFirst) / pPage->mBlockSize) * pPage->mBlockSize);
+	}
+
+	// Bytes a block must have so that an (alignment, offset) pointer followed by n bytes fits.
+	static size_t padded_size(size_t n, size_t alignment, size_t offset) noexcept;
+	static char* align_in(char* pBlock, size_t alignment, size_t offset) noexcept;
+
+	void* allocate_large(size_t n, size_t alignment, size_t offset);
+	page* new_page(size_t classIndex);
+
+	static void link(size_class& sizeClass, page* pPage) noexcept;
+	static void unlink(size_class& sizeClass, page* pPage) noexcept;
+
+	size_class mSizeClasses[kSizeClassCount];
+};
+
+/*
+ * An rstl::allocator compatible handle onto a page_heap. deallocate(p, n) is O(1) and
+ * ignores n. Copies share the heap; a default constructed page_allocator uses a
+ * process-wide one.
+ * */
+
+class page_allocator
+{
+public:
+	explicit page_allocator(const char* pName = PAGE_ALLOCATOR_DEFAULT_NAME);
+	explicit page_allocator(page_heap& heap, const char* pName = PAGE_ALLOCATOR_DEFAULT_NAME);
+	page_allocator(const page_allocator& x);
+	page_allocator(const page_allocator& x, const char* pName);
+
+	page_allocator& operator=(const page_allocator& x);
+
+	void* allocate(size_t n, int flags = 0);
+	void* allocate(size_t n, size_t alignment, size_t offset, int flags = 0);
+	void deallocate(void* p, size_t n);
+
+	const char* get_name() const;
+	void set_name(const char* pName);
+
+	page_heap* get_heap() const;
+
+	static page_heap* get_default_heap();
+
+	// Debug name
+	const char* mpName;
+
+protected:
+	page_heap* mpHeap;
+};
+
+bool operator==(const page_allocator& a, const page_allocator& b);
+bool operator!=(const page_allocator& a, const page_allocator& b);
+
+/*
+ * page_heap
+ * */
+
+inline page_heap::page_heap() noexcept
+{
+
+}
+
+inline page_heap::~page_heap()
+{
+	// Only pages on the available lists can be found; pages that are still completely
+	// full are leaked, as they would be by any heap destroyed with live allocations.
+	for(size_class& sizeClass : mSizeClasses)
+	{
+		while(page* pPage = sizeClass.mpAvailable)
+		{
+			unlink(sizeClass, pPage);
+			::operator delete(pPage, std::align_val_t(kPageSize));
+		}
+	}
+}
+
+inline size_t page_heap::padded_size(size_t n, size_t alignment, size_t offset) noexcept
+{
+	// Blocks start kMinAlignment aligned, so (alignment, offset) pairs that are already
+	// satisfied by that cost nothing; anything else may need up to alignment - 1 bytes.
+	if((alignment <= kMinAlignment) && ((offset % alignment) == 0))
+	{
+		return n;
+	}
+	return n + alignment - 1;
+}
+
+inline char* page_heap::align_in(char* pBlock, size_t alignment, size_t offset) noexcept
+{
+	const uintptr_t aligned = (((uintptr_t)pBlock + offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - offset;
+	return reinterpret_cast<char*>(aligned);
+}
+
+inline void page_heap::link(size_class& sizeClass, page* pPage) noexcept
+{
+	pPage->mpPrev = nullptr;
+	pPage->mpNext = sizeClass.mpAvailable;
+	if(sizeClass.mpAvailable)
+	{
+		sizeClass.mpAvailable->mpPrev = pPage;
+	}
+	sizeClass.mpAvailable = pPage;
+}
+
+inline void page_heap::unlink(size_class& sizeClass, page* pPage) noexcept
+{
+	if(pPage->mpPrev)
+	{
+		pPage->mpPrev->mpNext = pPage->mpNext;
+	}
+	else
+	{
+		sizeClass.mpAvailable = pPage->mpNext;
+	}
+	if(pPage->mpNext)
+	{
+		pPage->mpNext->mpPrev = pPage->mpPrev;
+	}
+	pPage->mpPrev = pPage->mpNext = nullptr;
+}
+
+inline page_heap::page* page_heap::new_page(size_t classIndex)
+{
+	void* const pMemory = ::operator new(kPageSize, std::align_val_t(kPageSize), std::nothrow);
+	if(!pMemory)
+	{
+		return nullptr;
+	}
+
+	page* const pPage = static_cast<page*>(pMemory);
+	pPage->mClassIndex = (uint32_t)classIndex;
+	pPage->mUsed = 0;
+	pPage->mBlockSize = (classIndex + 1) * kMinAlignment;
+	pPage->mCapacity = (uint32_t)((kPageSize - kHeaderSize) / pPage->mBlockSize);
+	pPage->mBumpIndex = 0;
+	pPage->mpFreeList = nullptr;
+	pPage->mpPrev = pPage->mpNext = nullptr;
+	return pPage;
+}
+
+inline void* page_heap::allocate_large(size_t n, size_t alignment, size_t offset)
+{
+	// The pointer must stay inside the first page so that page_of() finds the header.
+	const size_t total = (kHeaderSize + padded_size(n, alignment, offset) + kPageSize - 1) & ~(kPageSize - 1);
+
+	void* const pMemory = ::operator new(total, std::align_val_t(kPageSize), std::nothrow);
+	if(!pMemory)
+	{
+		return nullptr;
+	}
+
+	page* const pPage = static_cast<page*>(pMemory);
+	pPage->mClassIndex = kLargeClass;
+	pPage->mUsed = 1;
+	pPage->mBlockSize = total;
+	return align_in(reinterpret_cast<char*>(pPage) + kHeaderSize, alignment, offset);
+}
+
+inline void* page_heap::allocate(size_t n, size_t alignment, size_t offset)
+{
+	if((alignment < kMinAlignment) && ((offset % alignment) == 0))
+	{
+		// Every block start already satisfies this; smaller alignments with an odd offset are honoured exactly.
+		alignment = kMinAlignment;
+		offset = 0;
+	}
+	if(alignment > kMaxAlignment)
+	{
+		return NULL;
+	}
+
+	const size_t size = padded_size(n, alignment, offset);
+	if(size > kMaxSmallSize)
+	{
+		return allocate_large(n, alignment, offset);
+	}
+
+	const size_t classIndex = (size == 0) ? 0 : ((size - 1) / kMinAlignment);
+	size_class& sizeClass = mSizeClasses[classIndex];
+
+	Thread_Support_Internal::auto_mutex autoMutex(sizeClass.mMutex);
+
+	page* pPage = sizeClass.mpAvailable;
+	if(!pPage)
+	{
+		pPage = new_page(classIndex);
+		if(!pPage)
+		{
+			return NULL;
+		}
+		link(sizeClass, pPage);
+		++sizeClass.mPageCount;
+	}
+
+	char* pBlock;
+	if(pPage->mpFreeList)
+	{
+		pBlock = static_cast<char*>(pPage->mpFreeList);
+		pPage->mpFreeList = *reinterpret_cast<void**>(pBlock);
+	}
+	else
+	{
+		pBlock = reinterpret_cast<char*>(pPage) + kHeaderSize + ((size_t)pPage->mBumpIndex++ * pPage->mBlockSize);
+	}
+
+	if(++pPage->mUsed == pPage->mCapacity)
+	{
+		unlink(sizeClass, pPage);
+	}
+
+	return align_in(pBlock, alignment, offset);
+}
+
+inline void page_heap::deallocate(void* p) noexcept
+{
+	if(p == nullptr)
+	{
+		return;
+	}
+
+	page* const pPage = page_of(p);
+	if(pPage->mClassIndex == kLargeClass)
+	{
+		::operator delete(pPage, std::align_val_t(kPageSize));
+		return;
+	}
+
+	size_class& sizeClass = mSizeClasses[pPage->mClassIndex];
+	char* const pBlock = block_of(pPage, p);
+
+	Thread_Support_Internal::auto_mutex autoMutex(sizeClass.mMutex);
+
+	*reinterpret_cast<void**>(pBlock) = pPage->mpFreeList;
+	pPage->mpFreeList = pBlock;
+
+	if(pPage->mUsed-- == pPage->mCapacity)
+	{
+		link(sizeClass, pPage);
+	}
+	else if((pPage->mUsed == 0) && (sizeClass.mPageCount > 1))
+	{
+		unlink(sizeClass, pPage);
+		--sizeClass.mPageCount;
+		::operator delete(pPage, std::align_val_t(kPageSize));
+	}
+}
+
+inline size_t page_heap::usable_size(const void* p) const noexcept
+{
+	page* const pPage = page_of(p);
+	if(pPage->mClassIndex == kLargeClass)
+	{
+		return pPage->mBlockSize - (size_t)((const char*)p - (const char*)pPage);
+	}
+	return pPage->mBlockSize - (size_t)((const char*)p - block_of(pPage, p));
+}
+
+/*
+ * page_allocator
+ * */
+
+inline page_allocator::page_allocator(const char* pName) : mpName(pName), mpHeap(get_default_heap())
+{
+
+}
+
+inline page_allocator::page_allocator(page_heap& heap, const char* pName) : mpName(pName), mpHeap(&heap)
+{
+
+}
+
+inline page_allocator::page_allocator(const page_allocator& x) : mpName(x.mpName), mpHeap(x.mpHeap)
+{
+
+}
+
+inline page_allocator::page_allocator(const page_allocator& x, const char* pName) : mpName(pName), mpHeap(x.mpHeap)
+{
+
+}
+
+inline page_allocator& page_allocator::operator=(const page_allocator& x)
+{
+	mpName = x.mpName;
+	mpHeap = x.mpHeap;
+	return *this;
+}
+
+inline const char* page_allocator::get_name() const
+{
+	return mpName;
+}
+
+inline void page_allocator::set_name(const char* pName)
+{
+	mpName = pName;
+}
+
+inline page_heap* page_allocator::get_heap() const
+{
+	return mpHeap;
+}
+
+inline page_heap* page_allocator::get_default_heap()
+{
+	static page_heap* const pDefaultHeap = new page_heap();
+	return pDefaultHeap;
+}
+
+inline void* page_allocator::allocate(size_t n, int flags)
+{
+	return allocate(n, page_heap::kMinAlignment, 0, flags);
+}
+
+inline void* page_allocator::allocate(size_t n, size_t alignment, size_t offset, int flags)
+{
+	UNUSED(flags);
+	return mpHeap->allocate(n, alignment, offset);
+}
+
+inline void page_allocator::deallocate(void* p, size_t)
+{
+	mpHeap->deallocate(p);
+}
+
+inline bool operator==(const page_allocator& a, const page_allocator& b)
+{
+	return (a.get_heap() == b.get_heap());
+}
+
+inline bool operator!=(const page_allocator& a, const page_allocator& b)
+{
+	return (a.get_heap() != b.get_heap());
+}
+
+RSTL_NAMESPACE_END
+
+#endif //RSTL_PAGE_ALLOCATOR_H
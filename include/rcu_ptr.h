@@ -0,0 +1,220 @@
+#ifndef RSTL_RCU_PTR_H
+#define RSTL_RCU_PTR_H
+
+#pragma once
+
+#include "internal/config.h"
+#include "allocator.h"
+#include "epoch_reclaimer.h"
+
+#include <atomic>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+RSTL_NAMESPACE_BEGIN
+
+/*
+ * rcu_ptr<T> publishes immutable snapshots of a T, such as a configuration or a
+ * routing table, to many readers. A reader takes a read_guard, which pins an
+ * epoch_domain and loads the current snapshot: no reference count is touched and no
+ * lock is taken, so readers never write to a shared cache line. Writers swap in a
+ * new snapshot with update() or modify(); the old one is retired to the domain and
+ * destroyed once every read_guard that could have seen it is gone.
+ *
+ * Snapshots are allocated with Allocator and handed to readers as const T. Writers
+ * never block readers or each other: update() is an exchange, and modify() retries
+ * its copy-and-change if another writer got in first.
+ * */
+
+template <typename T, typename Allocator = rstl::allocator>
+class rcu_ptr
+{
+public:
+	using this_type = rcu_ptr<T, Allocator>;
+	using element_type = T;
+	using allocator_type = Allocator;
+
+	/*
+	 * The snapshot current when the guard was made, valid for the guard's lifetime even
+	 * if writers replace it meanwhile. Like epoch_guard, it must be destroyed on the
+	 * thread that made it; keep it short, since it holds back reclamation.
+	 * */
+	class read_guard
+	{
+	public:
+		read_guard(const read_guard&) = delete;
+		read_guard& operator=(const read_guard&) = delete;
+
+		const T* get() const noexcept
+		{
+			return mpValue;
+		}
+
+		const T& operator*() const noexcept
+		{
+			return *mpValue;
+		}
+
+		const T* operator->() const noexcept
+		{
+			return mpValue;
+		}
+
+		explicit operator bool() const noexcept
+		{
+			return mpValue != nullptr;
+		}
+
+	protected:
+		friend class rcu_ptr;
+
+		epoch_guard mGuard;
+		const T* mpValue;
+
+		explicit read_guard(const rcu_ptr& owner) : mGuard(*owner.mpDomain), mpValue(owner.mpValue.load(std::memory_order_acquire)) { }
+	};
+
+	explicit rcu_ptr(const allocator_type& allocator = allocator_type(), epoch_domain& domain = get_default_epoch_domain()) noexcept
+		: mpValue(nullptr), mAllocator(allocator), mpDomain(&domain) { }
+
+	explicit rcu_ptr(const T& value, const allocator_type& allocator = allocator_type(), epoch_domain& domain = get_default_epoch_domain())
+		: mpValue(nullptr), mAllocator(allocator), mpDomain(&domain)
+	{
+		mpValue.store(create(value), std::memory_order_relaxed);
+	}
+
+	explicit rcu_ptr(T&& value, const allocator_type& allocator = allocator_type(), epoch_domain& domain = get_default_epoch_domain())
+		: mpValue(nullptr), mAllocator(allocator), mpDomain(&domain)
+	{
+		mpValue.store(create(std::move(value)), std::memory_order_relaxed);
+	}
+
+	// Readers may still hold the last snapshot, so it is retired rather than destroyed.
+	~rcu_ptr()
+	{
+		retire(mpValue.load(std::memory_order_relaxed));
+	}
+
+	rcu_ptr(const rcu_ptr&) = delete;
+	rcu_ptr& operator=(const rcu_ptr&) = delete;
+
+	read_guard read() const
+	{
+		return read_guard(*this);
+	}
+
+	// Publishes a new snapshot built from args.
+	template <typename... Args>
+	void emplace(Args&&... args)
+	{
+		retire(mpValue.exchange(create(std::forward<Args>(args)...), std::memory_order_acq_rel));
+	}
+
+	void update(const T& value)
+	{
+		emplace(value);
+	}
+
+	void update(T&& value)
+	{
+		emplace(std::move(value));
+	}
+
+	// Publishes no snapshot; later readers see a null read_guard.
+	void reset()
+	{
+		retire(mpValue.exchange(nullptr, std::memory_order_acq_rel));
+	}
+
+	/*
+	 * Copies the current snapshot, applies f(T&) to the copy and publishes it, starting
+	 * over from the newer snapshot if another writer published one in the meantime.
+	 * There must be a current snapshot.
+	 * */
+	template <typename F>
+	void modify(F f)
+	{
+		const read_guard guard(*this);
+		T* pExpected = const_cast<T*>(guard.get());
+		for(;;)
+		{
+			T* const pDesired = create(*pExpected);
+			try
+			{
+				f(*pDesired);
+			}
+			catch(...)
+			{
+				destroy(pDesired);
+				throw;
+			}
+
+			if(mpValue.compare_exchange_strong(pExpected, pDesired, std::memory_order_acq_rel, std::memory_order_acquire))
+			{
+				retire(pExpected);
+				return;
+			}
+			destroy(pDesired);
+		}
+	}
+
+	epoch_domain& domain() const noexcept
+	{
+		return *mpDomain;
+	}
+
+protected:
+	// Destroys a snapshot and frees it with the allocator it came from.
+	struct snapshot_delete
+	{
+		allocator_type mAllocator;
+
+		void operator()(T* p) const noexcept
+		{
+			allocator_type allocator = mAllocator;
+			p->~T();
+			CUSTOM_FREE(allocator, p, sizeof(T));
+		}
+	};
+
+	std::atomic<T*> mpValue;
+	allocator_type mAllocator;
+	epoch_domain* mpDomain;
+
+	template <typename... Args>
+	T* create(Args&&... args)
+	{
+		void* const pMemory = allocate_memory(mAllocator, sizeof(T), alignof(T), 0);
+		if(!pMemory)
+		{
+			throw std::bad_alloc();
+		}
+		try
+		{
+			return ::new(pMemory) T(std::forward<Args>(args)...);
+		}
+		catch(...)
+		{
+			CUSTOM_FREE(mAllocator, pMemory, sizeof(T));
+			throw;
+		}
+	}
+
+	void destroy(T* p) noexcept
+	{
+		snapshot_delete{ mAllocator }(p);
+	}
+
+	void retire(T* p)
+	{
+		if(p)
+		{
+			mpDomain->retire(p, snapshot_delete{ mAllocator }, mAllocator);
+		}
+	}
+};
+
+RSTL_NAMESPACE_END
+
+#endif //RSTL_RCU_PTR_H
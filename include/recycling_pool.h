@@ -0,0 +1,626 @@
+#ifndef RSTL_RECYCLING_POOL_H
+#define RSTL_RECYCLING_POOL_H
+
+#pragma once
+
+#include "internal/config.h"
+#include "internal/thread_support.h"
+#include "allocator.h"
+#include "shared_ptr.h"
+#include "internal/enable_shared.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+RSTL_NAMESPACE_BEGIN
+
+/*
+ * recycling_pool<T> hands out shared_ptr<T> to objects that are expensive to construct
+ * (parsers, large buffers) and takes them back instead of destroying them. Each pooled
+ * object lives in a single allocation together with its control block, laid out as
+ * allocate_shared does. When the last shared_ptr goes away the object is reset, and
+ * once the last weak_ptr goes too the whole block goes back on a free list, so a
+ * steady-state acquire() allocates nothing.
+ *
+ * Free lists are sharded per thread: a thread takes from and returns to its own shard,
+ * whose mutex is uncontended but for the occasional thief, and an empty shard steals
+ * half of another's. Threads beyond kCachedPools pools per thread share an overflow
+ * shard.
+ *
+ * high_water_mark() reports the most objects ever checked out at once. Idle objects
+ * beyond options::mMaxIdle are destroyed as they come back, and trim() destroys idle
+ * objects on demand, e.g. down to what the high-water mark says is needed.
+ *
+ * Objects may be returned after the pool is destroyed; they are then destroyed. The
+ * pool's bookkeeping lives until the last object is gone and every other thread that
+ * used it has exited or reclaimed its slot, which a thread does the next time it needs
+ * a slot for another pool.
+ * */
+
+/*
+ * The default reset: calls x.reset() if T has it, and otherwise leaves the object as
+ * it was released. A reset must not throw.
+ * */
+struct recycling_pool_default_reset
+{
+	template <typename T>
+	void operator()(T& x) const noexcept
+	{
+		if constexpr(requires { x.reset(); })
+		{
+			x.reset();
+		}
+	}
+};
+
+namespace Recycling_Pool_Internal {
+
+	static constexpr size_t kCachedPools = 4;
+
+	struct idle_node
+	{
+		idle_node* mpNextIdle;
+	};
+
+	struct shard
+	{
+		std::mutex mMutex;
+		idle_node* mpHead = nullptr;
+		size_t mCount = 0;
+		std::atomic<bool> mOwned{ false };
+		shard* mpNext = nullptr; // Set before the shard is published and never changed.
+	};
+
+	/*
+	 * Everything about a pool that does not depend on T. Owned jointly by the pool, each
+	 * block in existence and each thread caching a shard, through mRefCount.
+	 * */
+	struct pool_core
+	{
+		std::atomic<int32_t> mRefCount{ 1 };
+		std::atomic<bool> mClosed{ false };
+		std::atomic<shard*> mpShards{ nullptr };
+		shard mOverflow;
+
+		size_t mMaxIdle;
+		std::atomic<size_t> mIdle{ 0 };
+		std::atomic<size_t> mOutstanding{ 0 };
+		std::atomic<size_t> mHighWater{ 0 };
+		std::atomic<size_t> mCreated{ 0 };
+
+		void (*mpDestroyNode)(pool_core*, idle_node*) noexcept;
+		void (*mpFreeCore)(pool_core*) noexcept;
+
+		pool_core(size_t maxIdle, void (*pDestroyNode)(pool_core*, idle_node*) noexcept, void (*pFreeCore)(pool_core*) noexcept) noexcept
+			: mMaxIdle(maxIdle), mpDestroyNode(pDestroyNode), mpFreeCore(pFreeCore) { }
+
+		void addref() noexcept
+		{
+			Thread_Support_Internal::atomic_increment_relaxed(mRefCount);
+		}
+
+		void release() noexcept
+		{
+			// Every block holds a reference, so none are left by now.
+			if(Thread_Support_Internal::atomic_decrement_acq_rel(mRefCount) == 0)
+			{
+				for(shard* pShard = mpShards.load(std::memory_order_acquire); pShard; )
+				{
+					shard* const pNext = pShard->mpNext;
+					rstl::allocator allocator;
+					pShard->~shard();
+					CUSTOM_FREE(allocator, pShard, sizeof(shard));
+					pShard = pNext;
+				}
+				mpFreeCore(this);
+			}
+		}
+
+		shard& local_shard() noexcept;
+		idle_node* pop() noexcept;
+		void push(idle_node* pNode) noexcept;
+		void make_idle(idle_node* pNode) noexcept;
+		void trim(size_t maxIdle) noexcept;
+
+		void checked_out() noexcept
+		{
+			const size_t outstanding = mOutstanding.fetch_add(1, std::memory_order_relaxed) + 1;
+			size_t highWater = mHighWater.load(std::memory_order_relaxed);
+			while((outstanding > highWater) && !mHighWater.compare_exchange_weak(highWater, outstanding, std::memory_order_relaxed))
+			{
+			}
+		}
+
+		shard* acquire_shard();
+		shard* next_shard(shard* pShard) noexcept;
+		idle_node* steal(shard& thief) noexcept;
+		void destroy_list(idle_node* pList) noexcept;
+	};
+
+	struct thread_shards
+	{
+		struct entry
+		{
+			pool_core* mpCore;
+			shard* mpShard;
+		};
+
+		entry mEntries[kCachedPools] = {};
+
+		~thread_shards()
+		{
+			for(entry& e : mEntries)
+			{
+				if(e.mpCore)
+				{
+					release(e);
+				}
+			}
+		}
+
+		// Called by a closing pool, so its entry is free for the next pool this thread uses.
+		void forget(const pool_core* pCore) noexcept
+		{
+			for(entry& e : mEntries)
+			{
+				if(e.mpCore == pCore)
+				{
+					release(e);
+				}
+			}
+		}
+
+		static void release(entry& e) noexcept
+		{
+			// The shard keeps its objects for other threads to steal or a later thread to adopt.
+			e.mpShard->mOwned.store(false, std::memory_order_release);
+			pool_core* const pCore = e.mpCore;
+			e.mpCore = nullptr;
+			e.mpShard = nullptr;
+			pCore->release();
+		}
+	};
+
+	inline thread_shards& get_thread_shards()
+	{
+		static thread_local thread_shards threadShards;
+		return threadShards;
+	}
+
+	inline shard* pool_core::acquire_shard()
+	{
+		for(shard* pShard = mpShards.load(std::memory_order_acquire); pShard; pShard = pShard->mpNext)
+		{
+			bool owned = false;
+			if(!pShard->mOwned.load(std::memory_order_relaxed) && pShard->mOwned.compare_exchange_strong(owned, true, std::memory_order_acquire))
+			{
+				return pShard;
+			}
+		}
+
+		rstl::allocator allocator;
+		void* const pMemory = allocate_memory(allocator, sizeof(shard), alignof(shard), 0);
+		if(!pMemory)
+		{
+			return nullptr;
+		}
+		shard* const pShard = ::new(pMemory) shard();
+		pShard->mOwned.store(true, std::memory_order_relaxed);
+
+		shard* pHead = mpShards.load(std::memory_order_relaxed);
+		do
+		{
+			pShard->mpNext = pHead;
+		}
+		while(!mpShards.compare_exchange_weak(pHead, pShard, std::memory_order_release, std::memory_order_relaxed));
+		return pShard;
+	}
+
+	inline shard& pool_core::local_shard() noexcept
+	{
+		thread_shards& threadShards = get_thread_shards();
+		for(const thread_shards::entry& e : threadShards.mEntries)
+		{
+			if(e.mpCore == this)
+			{
+				return *e.mpShard;
+			}
+		}
+
+		for(thread_shards::entry& e : threadShards.mEntries)
+		{
+			// Pools closed on another thread leave their entries here until this thread looks for a slot.
+			if(e.mpCore && e.mpCore->mClosed.load(std::memory_order_acquire))
+			{
+				thread_shards::release(e);
+			}
+			if(!e.mpCore)
+			{
+				shard* const pShard = acquire_shard();
+				if(!pShard)
+				{
+					break;
+				}
+				addref();
+				e.mpCore = this;
+				e.mpShard = pShard;
+				return *pShard;
+			}
+		}
+		return mOverflow;
+	}
+
+	inline shard* pool_core::next_shard(shard* pShard) noexcept
+	{
+		return (pShard == &mOverflow) ? mpShards.load(std::memory_order_acquire) : pShard->mpNext;
+	}
+
+	inline idle_node* pool_core::steal(shard& thief) noexcept
+	{
+		for(shard* pVictim = &mOverflow; pVictim; pVictim = next_shard(pVictim))
+		{
+			// A busy victim is skipped rather than waited for; there are others to try.
+			if((pVictim == &thief) || !pVictim->mMutex.try_lock())
+			{
+				continue;
+			}
+
+			// Take half, rounded up: one to hand out and the rest for the thief's shard.
+			const size_t take = (pVictim->mCount + 1) / 2;
+			idle_node* const pTaken = pVictim->mpHead;
+			idle_node* pLast = pTaken;
+			for(size_t i = 1; i < take; ++i)
+			{
+				pLast = pLast->mpNextIdle;
+			}
+			if(pTaken)
+			{
+				pVictim->mpHead = pLast->mpNextIdle;
+				pVictim->mCount -= take;
+			}
+			pVictim->mMutex.unlock();
+
+			if(!pTaken)
+			{
+				continue;
+			}
+			pLast->mpNextIdle = nullptr;
+			if(idle_node* const pRest = pTaken->mpNextIdle)
+			{
+				Thread_Support_Internal::auto_mutex autoMutex(thief.mMutex);
+				pLast->mpNextIdle = thief.mpHead;
+				thief.mpHead = pRest;
+				thief.mCount += take - 1;
+			}
+			return pTaken;
+		}
+		return nullptr;
+	}
+
+	inline idle_node* pool_core::pop() noexcept
+	{
+		shard& own = local_shard();
+		idle_node* pNode = nullptr;
+		{
+			Thread_Support_Internal::auto_mutex autoMutex(own.mMutex);
+			if((pNode = own.mpHead) != nullptr)
+			{
+				own.mpHead = pNode->mpNextIdle;
+				--own.mCount;
+			}
+		}
+
+		if(!pNode && mIdle.load(std::memory_order_relaxed))
+		{
+			pNode = steal(own);
+		}
+		if(pNode)
+		{
+			mIdle.fetch_sub(1, std::memory_order_relaxed);
+		}
+		return pNode;
+	}
+
+	inline void pool_core::push(idle_node* pNode) noexcept
+	{
+		mOutstanding.fetch_sub(1, std::memory_order_relaxed);
+		make_idle(pNode);
+	}
+
+	inline void pool_core::make_idle(idle_node* pNode) noexcept
+	{
+		if(mIdle.load(std::memory_order_relaxed) < mMaxIdle)
+		{
+			shard& own = local_shard();
+			Thread_Support_Internal::auto_mutex autoMutex(own.mMutex);
+
+			// Checked under the lock: a pool closing concurrently trims this shard after we let go of it.
+			if(!mClosed.load(std::memory_order_acquire))
+			{
+				mIdle.fetch_add(1, std::memory_order_relaxed);
+				pNode->mpNextIdle = own.mpHead;
+				own.mpHead = pNode;
+				++own.mCount;
+				return;
+			}
+		}
+		mpDestroyNode(this, pNode);
+	}
+
+	inline void pool_core::destroy_list(idle_node* pList) noexcept
+	{
+		while(pList)
+		{
+			idle_node* const pNext = pList->mpNextIdle;
+			mpDestroyNode(this, pList);
+			pList = pNext;
+		}
+	}
+
+	inline void pool_core::trim(size_t maxIdle) noexcept
+	{
+		for(shard* pShard = &mOverflow; pShard; pShard = next_shard(pShard))
+		{
+			idle_node* pTrimmed = nullptr;
+			{
+				Thread_Support_Internal::auto_mutex autoMutex(pShard->mMutex);
+				while(pShard->mpHead && (mIdle.load(std::memory_order_relaxed) > maxIdle))
+				{
+					idle_node* const pNode = pShard->mpHead;
+					pShard->mpHead = pNode->mpNextIdle;
+					--pShard->mCount;
+					mIdle.fetch_sub(1, std::memory_order_relaxed);
+					pNode->mpNextIdle = pTrimmed;
+					pTrimmed = pNode;
+				}
+			}
+			// Destroyed outside the lock, since destructors may be slow.
+			destroy_list(pTrimmed);
+		}
+	}
+
+}
+
+template <typename T, typename Reset, typename Allocator>
+class recycling_pool;
+
+/*
+ * The single allocation behind each pooled object: the control block, the free list
+ * link and the object. The object is constructed once and destroyed only when the
+ * block is trimmed or its pool is gone.
+ * */
+template <typename T, typename Reset, typename Allocator>
+class ref_count_sp_t_pooled : public ref_count_sp, public Recycling_Pool_Internal::idle_node
+{
+public:
+	using this_type = ref_count_sp_t_pooled<T, Reset, Allocator>;
+	using value_type = T;
+	using allocator_type = Allocator;
+	using storage_type = typename std::aligned_storage_t<sizeof(T), std::alignment_of_v<T>>;
+
+	Recycling_Pool_Internal::pool_core* mpCore;
+	compressed_pair<storage_type, compressed_pair<Reset, allocator_type>> mStorage;
+
+	template <typename... Args>
+	ref_count_sp_t_pooled(Recycling_Pool_Internal::pool_core* pCore, const Reset& reset, const allocator_type& allocator, Args&&... args)
+		: ref_count_sp(&ref_count_ops_for<this_type>::sOps), idle_node{ nullptr }, mpCore(pCore), mStorage(storage_type(), compressed_pair<Reset, allocator_type>(reset, allocator))
+	{
+		::new(static_cast<void*>(&mStorage.first())) value_type(std::forward<Args>(args)...);
+	}
+
+	value_type* GetValue()
+	{
+		return static_cast<value_type*>(static_cast<void*>(&mStorage.first()));
+	}
+
+	/*
+	 * The last shared_ptr is gone: reset the object, but keep it for the next owner. An
+	 * enable_shared_from_this base holds a weak reference to this block, which would
+	 * keep it from ever coming back, so it is dropped first; acquire() sets it again.
+	 * */
+	void free_value() noexcept
+	{
+		release_weak_this(GetValue());
+		mStorage.second().first()(*GetValue());
+	}
+
+	// The last weak_ptr is gone too: the block can be handed out again.
+	void free_ref_count_sp() noexcept
+	{
+		mRefCount.store(1, std::memory_order_relaxed);
+		mWeakRefCount.store(1, std::memory_order_relaxed);
+		mpCore->push(this);
+	}
+
+	void* get_deleter(const std::type_info&) const noexcept
+	{
+		return nullptr;
+	}
+
+	template <typename U>
+	static void release_weak_this(const enable_shared_from_this<U>* pValue) noexcept
+	{
+		pValue->mWeakPtr.reset();
+	}
+
+	static void release_weak_this(...) noexcept
+	{
+	}
+
+	static void destroy(Recycling_Pool_Internal::pool_core* pCore, Recycling_Pool_Internal::idle_node* pNode) noexcept
+	{
+		this_type* const pThis = static_cast<this_type*>(pNode);
+		pThis->GetValue()->~value_type();
+		allocator_type allocator = pThis->mStorage.second().second();
+		pThis->~ref_count_sp_t_pooled();
+		CUSTOM_FREE(allocator, pThis, sizeof(this_type));
+		pCore->release();
+	}
+};
+
+template <typename T, typename Reset = recycling_pool_default_reset, typename Allocator = rstl::allocator>
+class recycling_pool
+{
+public:
+	using this_type = recycling_pool<T, Reset, Allocator>;
+	using value_type = T;
+	using reset_type = Reset;
+	using allocator_type = Allocator;
+	using block_type = ref_count_sp_t_pooled<T, Reset, Allocator>;
+
+	struct options
+	{
+		size_t mMaxIdle = SIZE_MAX; // Idle objects beyond this are destroyed when returned.
+	};
+
+	explicit recycling_pool(const options& opts = options(), const Reset& reset = Reset(), const allocator_type& allocator = allocator_type());
+	~recycling_pool();
+
+	recycling_pool(const recycling_pool&) = delete;
+	recycling_pool& operator=(const recycling_pool&) = delete;
+
+	/*
+	 * Returns an idle object if there is one, and otherwise a new T(args...). Recycled
+	 * objects are as their last reset left them; args only apply to new ones.
+	 * */
+	template <typename... Args>
+	shared_ptr<T> acquire(Args&&... args);
+
+	// Constructs count objects ahead of time and makes them idle.
+	void reserve(size_t count);
+
+	// Destroys idle objects until at most maxIdle remain.
+	void trim(size_t maxIdle = 0) noexcept
+	{
+		mpCore->trim(maxIdle);
+	}
+
+	size_t idle_count() const noexcept
+	{
+		return mpCore->mIdle.load(std::memory_order_relaxed);
+	}
+
+	size_t outstanding_count() const noexcept
+	{
+		return mpCore->mOutstanding.load(std::memory_order_relaxed);
+	}
+
+	size_t high_water_mark() const noexcept
+	{
+		return mpCore->mHighWater.load(std::memory_order_relaxed);
+	}
+
+	void reset_high_water_mark() noexcept
+	{
+		mpCore->mHighWater.store(outstanding_count(), std::memory_order_relaxed);
+	}
+
+	// Objects constructed over the pool's lifetime; a steady state stops this growing.
+	size_t created_count() const noexcept
+	{
+		return mpCore->mCreated.load(std::memory_order_relaxed);
+	}
+
+protected:
+	struct core : Recycling_Pool_Internal::pool_core
+	{
+		Reset mReset;
+		allocator_type mAllocator;
+
+		core(const options& opts, const Reset& reset, const allocator_type& allocator)
+			: pool_core(opts.mMaxIdle, &block_type::destroy, &free_core), mReset(reset), mAllocator(allocator) { }
+
+		static void free_core(Recycling_Pool_Internal::pool_core* pCore) noexcept
+		{
+			core* const pThis = static_cast<core*>(pCore);
+			rstl::allocator allocator;
+			pThis->~core();
+			CUSTOM_FREE(allocator, pThis, sizeof(core));
+		}
+	};
+
+	core* mpCore;
+
+	template <typename... Args>
+	block_type* create_block(Args&&... args);
+};
+
+template <typename T, typename Reset, typename Allocator>
+inline recycling_pool<T, Reset, Allocator>::recycling_pool(const options& opts, const Reset& reset, const allocator_type& allocator)
+{
+	rstl::allocator coreAllocator;
+	void* const pMemory = allocate_memory(coreAllocator, sizeof(core), alignof(core), 0);
+	if(!pMemory)
+	{
+		throw std::bad_alloc();
+	}
+	mpCore = ::new(pMemory) core(opts, reset, allocator);
+}
+
+template <typename T, typename Reset, typename Allocator>
+inline recycling_pool<T, Reset, Allocator>::~recycling_pool()
+{
+	mpCore->mClosed.store(true, std::memory_order_release);
+	mpCore->trim(0);
+	Recycling_Pool_Internal::get_thread_shards().forget(mpCore);
+	mpCore->release();
+}
+
+template <typename T, typename Reset, typename Allocator>
+template <typename... Args>
+inline typename recycling_pool<T, Reset, Allocator>::block_type* recycling_pool<T, Reset, Allocator>::create_block(Args&&... args)
+{
+	void* const pMemory = allocate_memory(mpCore->mAllocator, sizeof(block_type), alignof(block_type), 0);
+	if(!pMemory)
+	{
+		throw std::bad_alloc();
+	}
+
+	block_type* pBlock;
+	try
+	{
+		pBlock = ::new(pMemory) block_type(mpCore, mpCore->mReset, mpCore->mAllocator, std::forward<Args>(args)...);
+	}
+	catch(...)
+	{
+		CUSTOM_FREE(mpCore->mAllocator, pMemory, sizeof(block_type));
+		throw;
+	}
+	mpCore->addref();
+	mpCore->mCreated.fetch_add(1, std::memory_order_relaxed);
+	return pBlock;
+}
+
+template <typename T, typename Reset, typename Allocator>
+template <typename... Args>
+inline shared_ptr<T> recycling_pool<T, Reset, Allocator>::acquire(Args&&... args)
+{
+	block_type* pBlock = static_cast<block_type*>(mpCore->pop());
+	if(!pBlock)
+	{
+		pBlock = create_block(std::forward<Args>(args)...);
+	}
+	mpCore->checked_out();
+
+	shared_ptr<T> ret;
+	allocate_shared_helper(ret, pBlock, pBlock->GetValue());
+	return ret;
+}
+
+template <typename T, typename Reset, typename Allocator>
+inline void recycling_pool<T, Reset, Allocator>::reserve(size_t count)
+{
+	for(size_t i = 0; i < count; ++i)
+	{
+		mpCore->make_idle(create_block());
+	}
+}
+
+RSTL_NAMESPACE_END
+
+#endif //RSTL_RECYCLING_POOL_H
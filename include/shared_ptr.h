@@ -7,6 +7,8 @@
 #include "internal/thread_support.h"
 #include "allocator.h"
 #include "internal/smart_ptr.h"
+#include "internal/compressed_pair.h"
+#include "deferred_reclaimer.h"
 
 #include <typeinfo>
 #include <exception>
@@ -23,6 +25,16 @@ class weak_ptr;
 template <typename T>
 class enable_shared_from_this;
 
+template <typename T>
+class local_shared_ptr;
+
+namespace SmartPTR_Internal {
+
+	// Selects default-initialization in the make_shared_for_overwrite family.
+	struct for_overwrite_t { };
+
+}
+
 struct bad_weak_ptr : std::exception
 {
 	const char* what() const noexcept override
@@ -31,17 +43,86 @@ struct bad_weak_ptr : std::exception
 	}
 };
 
+namespace SmartPTR_Internal {
+
+	/*
+	 * The allocator for control blocks of shared_ptrs created without one. Each call
+	 * goes to a default constructed rstl::allocator, so it is empty and takes no space
+	 * in the control block.
+	 * */
+	struct default_ref_count_allocator
+	{
+		void* allocate(size_t n, int flags = 0)
+		{
+			return rstl::allocator().allocate(n, flags);
+		}
+
+		void* allocate(size_t n, size_t alignment, size_t offset, int flags = 0)
+		{
+			return rstl::allocator().allocate(n, alignment, offset, flags);
+		}
+
+		void deallocate(void* p, size_t n)
+		{
+			rstl::allocator().deallocate(p, n);
+		}
+	};
+
+}
+
+struct ref_count_sp;
+
+/*
+ * The operations that differ between control block types. Each type has one static
+ * table (see ref_count_ops_for), so a control block carries a single pointer instead
+ * of a vptr and the calls cannot be overridden further.
+ *
+ * The strong count operations are used only by blocks that count strong references
+ * their own way (the biased blocks in biased_shared_ptr.h). Such blocks tag their
+ * table pointer with kCustomCountFlag; for all others the table entries are null and
+ * the counts are updated inline.
+ * */
+struct ref_count_ops
+{
+	void (*mpFreeValue)(ref_count_sp*) noexcept;
+	void (*mpFreeRefCount)(ref_count_sp*) noexcept;
+	void* (*mpGetDeleter)(const ref_count_sp*, const std::type_info&) noexcept;
+
+	void (*mpAddRef)(ref_count_sp*) noexcept;
+	void (*mpRelease)(ref_count_sp*) noexcept;
+	ref_count_sp* (*mpLock)(ref_count_sp*) noexcept;
+	int32_t (*mpUseCount)(const ref_count_sp*) noexcept;
+};
+
 /*
  * This is a utility class used by shared_ptr and weak_ptr.
+ *
+ * mWeakRefCount counts the weak_ptrs plus one reference held jointly by all the
+ * shared_ptrs. Copying or destroying a shared_ptr therefore touches mRefCount only;
+ * mWeakRefCount is decremented once, when the last shared_ptr goes away.
+ *
+ * The block is 16 bytes: the ops table pointer and the two counts. Derived blocks
+ * pass their table to the constructor and are never destroyed through this type.
+ *
+ * lock() is a single fetch_add rather than a compare-exchange loop, which spins when
+ * many threads lock the same weak_ptr. This works because the strong count is never
+ * zero: release() swaps the last reference, 1, directly for kDeadRefCount, and frees
+ * the value only if that swap succeeds. A lock that sees kDeadRefCount set has failed;
+ * one that gets in before the swap makes it fail, so release() retries as an ordinary
+ * decrement and the locker now holds the last reference. Failed locks leave the count
+ * above kDeadRefCount, which is never mistaken for a live count.
  * */
 struct ref_count_sp
 {
-	int32_t mRefCount;
-	int32_t mWeakRefCount;
+	static constexpr uintptr_t kCustomCountFlag = 1;
+	static constexpr int32_t kDeadRefCount = 0x40000000;
+
+	uintptr_t mOps; // The const ref_count_ops*, with kCustomCountFlag in its low bit.
+	std::atomic<int32_t> mRefCount;
+	std::atomic<int32_t> mWeakRefCount;
 
 public:
-	ref_count_sp(int32_t refCount =1, int32_t weakRefCount = 1) noexcept;
-	virtual ~ref_count_sp() noexcept {}
+	explicit ref_count_sp(const ref_count_ops* pOps, int32_t refCount = 1, int32_t weakRefCount = 1, bool customCount = false) noexcept;
 
 	int32_t use_count() const noexcept;
 	void addref() noexcept;
@@ -50,45 +131,85 @@ public:
 	void weak_release() noexcept;
 	ref_count_sp* lock() noexcept;
 
-	virtual void free_value() noexcept = 0;
-	virtual void free_ref_count_sp() noexcept = 0;
+	void free_value() noexcept;
+	void free_ref_count_sp() noexcept;
+	void* get_deleter(const std::type_info& type) const noexcept;
+
+	bool has_custom_count() const noexcept;
+	const ref_count_ops* get_ops() const noexcept;
 
-	virtual void* get_deleter(const std::type_info& type) const noexcept = 0;
+protected:
+	~ref_count_sp() = default;
 };
 
-inline ref_count_sp::ref_count_sp(int32_t refCount, int32_t weakRefCount) noexcept : mRefCount(refCount), mWeakRefCount(weakRefCount) {}
+static_assert(sizeof(ref_count_sp) == 16 || sizeof(void*) != 8, "ref_count_sp is expected to be 16 bytes on 64-bit platforms.");
+static_assert(alignof(ref_count_ops) > ref_count_sp::kCustomCountFlag, "ref_count_ops pointers need a free low bit.");
+
+inline ref_count_sp::ref_count_sp(const ref_count_ops* pOps, int32_t refCount, int32_t weakRefCount, bool customCount) noexcept
+	: mOps(reinterpret_cast<uintptr_t>(pOps) | (customCount ? kCustomCountFlag : 0)), mRefCount(refCount), mWeakRefCount(weakRefCount) {}
+
+inline bool ref_count_sp::has_custom_count() const noexcept
+{
+	return (mOps & kCustomCountFlag) != 0;
+}
+
+inline const ref_count_ops* ref_count_sp::get_ops() const noexcept
+{
+	return reinterpret_cast<const ref_count_ops*>(mOps & ~kCustomCountFlag);
+}
 
 inline int32_t ref_count_sp::use_count() const noexcept
 {
-	return mRefCount;
+	if(has_custom_count())
+	{
+		return get_ops()->mpUseCount(this);
+	}
+	const int32_t refCount = Thread_Support_Internal::atomic_load_acquire(mRefCount);
+	return (refCount & kDeadRefCount) ? 0 : refCount;
 }
 
 inline void ref_count_sp::addref() noexcept
 {
-	Thread_Support_Internal::atomic_increment(&mRefCount);
-	Thread_Support_Internal::atomic_increment(&mWeakRefCount);
+	if(has_custom_count())
+	{
+		get_ops()->mpAddRef(this);
+		return;
+	}
+	Thread_Support_Internal::atomic_increment_relaxed(mRefCount);
 }
 
 inline void ref_count_sp::release() noexcept
 {
-	if(Thread_Support_Internal::atomic_decrement(&mRefCount) == 0)
+	if(has_custom_count())
 	{
-		free_value();
+		get_ops()->mpRelease(this);
+		return;
 	}
-	if(Thread_Support_Internal::atomic_decrement(&mWeakRefCount) == 0)
+	// The last reference goes straight from 1 to kDeadRefCount; a lock() that gets in first makes the exchange retry.
+	int32_t refCount = mRefCount.load(std::memory_order_relaxed);
+	for(;;)
 	{
-		free_ref_count_sp();
+		const int32_t newRefCount = (refCount == 1) ? kDeadRefCount : (refCount - 1);
+		if(Thread_Support_Internal::atomic_compare_exchange_acq_rel(mRefCount, refCount, newRefCount))
+		{
+			break;
+		}
+	}
+	if(refCount == 1)
+	{
+		free_value();
+		weak_release(); // The shared_ptrs' joint weak reference.
 	}
 }
 
 inline void ref_count_sp::weak_addref() noexcept
 {
-	Thread_Support_Internal::atomic_increment(&mWeakRefCount);
+	Thread_Support_Internal::atomic_increment_relaxed(mWeakRefCount);
 }
 
 inline void ref_count_sp::weak_release() noexcept
 {
-	if(Thread_Support_Internal::atomic_decrement(&mWeakRefCount) == 0)
+	if(Thread_Support_Internal::atomic_decrement_acq_rel(mWeakRefCount) == 0)
 	{
 		free_ref_count_sp();
 	}
@@ -96,19 +217,68 @@ inline void ref_count_sp::weak_release() noexcept
 
 inline ref_count_sp* ref_count_sp::lock() noexcept
 {
-	for(int32_t refCountTemp = mRefCount; refCountTemp != 0; refCountTemp = mRefCount)
+	if(has_custom_count())
 	{
-		if(Thread_Support_Internal::atomic_compare_and_swap(&mRefCount, refCountTemp + 1, refCountTemp))
-		{
-			Thread_Support_Internal::atomic_increment(&mWeakRefCount);
-			return this;
-		}
+		return get_ops()->mpLock(this);
+	}
+	if(mRefCount.load(std::memory_order_relaxed) & kDeadRefCount)
+	{
+		return nullptr; // Keeps expired weak_ptrs from writing to a shared line.
+	}
+	if(Thread_Support_Internal::atomic_fetch_increment_acquire(mRefCount) & kDeadRefCount)
+	{
+		// Undo our increment and any racing ones, so failed locks can never overflow into a live count.
+		mRefCount.store(kDeadRefCount, std::memory_order_relaxed);
+		return nullptr;
 	}
-	return nullptr;
+	return this;
+}
+
+inline void ref_count_sp::free_value() noexcept
+{
+	get_ops()->mpFreeValue(this);
+}
+
+inline void ref_count_sp::free_ref_count_sp() noexcept
+{
+	get_ops()->mpFreeRefCount(this);
+}
+
+inline void* ref_count_sp::get_deleter(const std::type_info& type) const noexcept
+{
+	return get_ops()->mpGetDeleter(this, type);
 }
 
+/*
+ * ref_count_ops_for<RefCount>::sOps forwards to RefCount's own free_value,
+ * free_ref_count_sp and get_deleter members, which hide the ref_count_sp ones.
+ * */
+template <typename RefCount>
+struct ref_count_ops_for
+{
+	static void free_value(ref_count_sp* pRefCount) noexcept
+	{
+		static_cast<RefCount*>(pRefCount)->free_value();
+	}
+
+	static void free_ref_count_sp(ref_count_sp* pRefCount) noexcept
+	{
+		static_cast<RefCount*>(pRefCount)->free_ref_count_sp();
+	}
+
+	static void* get_deleter(const ref_count_sp* pRefCount, const std::type_info& type) noexcept
+	{
+		return static_cast<const RefCount*>(pRefCount)->get_deleter(type);
+	}
+
+	static constexpr ref_count_ops sOps = { &free_value, &free_ref_count_sp, &get_deleter, nullptr, nullptr, nullptr, nullptr };
+};
+
 /*
  * This is a version of ref_count_sp which is used to delete the contained pointer.
+ * The pointer, deleter and allocator are nested compressed_pairs, so empty deleters
+ * and allocators (default_delete, the default control block allocator) take no
+ * space and the common case is 24 bytes.
  * */
 
 template <typename T, typename Allocator, typename Deleter>
@@ -119,29 +289,29 @@ public:
 	using value_type = T;
 	using allocator_type = Allocator;
 	using deleter_type = Deleter;
+	using deleter_allocator_type = compressed_pair<deleter_type, allocator_type>;
 
-	value_type mValue; // This expected to be a pointer.
-	deleter_type mDeleter;
-	allocator_type mAllocator;
+	compressed_pair<value_type, deleter_allocator_type> mPair; // The value is expected to be a pointer.
 
-	ref_count_sp_t(value_type value, deleter_type deleter, allocator_type allocator) : ref_count_sp(), mValue(value), mDeleter(std::move(deleter)), mAllocator(std::move(allocator)) {}
+	ref_count_sp_t(value_type value, deleter_type deleter, allocator_type allocator)
+		: ref_count_sp(&ref_count_ops_for<this_type>::sOps), mPair(value, deleter_allocator_type(deleter, allocator)) {}
 
 	void free_value() noexcept
 	{
-		mDeleter(mValue);
-		mValue = nullptr;
+		mPair.second().first()(mPair.first());
+		mPair.first() = nullptr;
 	}
 
 	void free_ref_count_sp() noexcept
 	{
-		allocator_type allocator = mAllocator;
+		allocator_type allocator = mPair.second().second();
 		this->~ref_count_sp_t();
 		CUSTOM_FREE(allocator, this, sizeof(*this));
 	}
 
 	void* get_deleter(const std::type_info& type) const noexcept
 	{
-		return (type == typeid(deleter_type)) ? (void*)&mDeleter : nullptr;
+		return (type == typeid(deleter_type)) ? (void*)&mPair.second().first() : nullptr;
 	}
 
 };
@@ -161,18 +331,22 @@ public:
 	using allocator_type = Allocator;
 	using storage_type = typename std::aligned_storage_t<sizeof(T), std::alignment_of_v<T>>;
 
-	storage_type mMemory;
-	allocator_type mAllocator;
+	compressed_pair<storage_type, allocator_type> mMemoryAllocator;
 
 	value_type* GetValue()
 	{
-		return static_cast<value_type*>(static_cast<void*>(&mMemory));
+		return static_cast<value_type*>(static_cast<void*>(&mMemoryAllocator.first()));
 	}
 
 	template<typename... Args>
-	ref_count_sp_t_inst(allocator_type allocator, Args&&... args) : ref_count_sp(), mAllocator(std::move(allocator))
+	ref_count_sp_t_inst(allocator_type allocator, Args&&... args) : ref_count_sp(&ref_count_ops_for<this_type>::sOps), mMemoryAllocator(allocator)
+	{
+		new(static_cast<void*>(&mMemoryAllocator.first()))value_type(std::forward<Args>(args)...);
+	}
+
+	ref_count_sp_t_inst(allocator_type allocator, SmartPTR_Internal::for_overwrite_t) : ref_count_sp(&ref_count_ops_for<this_type>::sOps), mMemoryAllocator(allocator)
 	{
-		new(&mMemory)value_type(std::forward<Args>(args)...);
+		new(static_cast<void*>(&mMemoryAllocator.first()))value_type;
 	}
 
 	void free_value() noexcept
@@ -182,8 +356,150 @@ public:
 
 	void free_ref_count_sp() noexcept
 	{
-		allocator_type allocator = mAllocator;
+		allocator_type allocator = mMemoryAllocator.second();
 		this->~ref_count_sp_t_inst();
+		CUSTOM_FREE(allocator, this, sizeof(*this));
+	}
+
+	void* get_deleter(const std::type_info&) const noexcept
+	{
+		return nullptr;
+	}
+};
+
+/*
+ * This is a version of ref_count_sp_t_inst for types tagged with defer_destruction.
+ * When the last shared_ptr goes away the block queues itself on the default
+ * reclaimer, holding a weak reference so that it outlives the queue; the value is
+ * destroyed on the reclaimer thread, which then drops that reference.
+ * */
+
+template <typename T, typename Allocator>
+class ref_count_sp_t_deferred_inst : public ref_count_sp, public deferred_node
+{
+public:
+	using this_type = ref_count_sp_t_deferred_inst<T, Allocator>;
+	using value_type = T;
+	using allocator_type = Allocator;
+	using storage_type = typename std::aligned_storage_t<sizeof(T), std::alignment_of_v<T>>;
+
+	compressed_pair<storage_type, allocator_type> mMemoryAllocator;
+
+	value_type* GetValue()
+	{
+		return static_cast<value_type*>(static_cast<void*>(&mMemoryAllocator.first()));
+	}
+
+	template<typename... Args>
+	ref_count_sp_t_deferred_inst(allocator_type allocator, Args&&... args)
+		: ref_count_sp(&ref_count_ops_for<this_type>::sOps), deferred_node{ nullptr, &reclaim }, mMemoryAllocator(allocator)
+	{
+		new(static_cast<void*>(&mMemoryAllocator.first()))value_type(std::forward<Args>(args)...);
+	}
+
+	ref_count_sp_t_deferred_inst(allocator_type allocator, SmartPTR_Internal::for_overwrite_t)
+		: ref_count_sp(&ref_count_ops_for<this_type>::sOps), deferred_node{ nullptr, &reclaim }, mMemoryAllocator(allocator)
+	{
+		new(static_cast<void*>(&mMemoryAllocator.first()))value_type;
+	}
+
+	void free_value() noexcept
+	{
+		weak_addref();
+		get_default_reclaimer().push(this);
+	}
+
+	void free_ref_count_sp() noexcept
+	{
+		allocator_type allocator = mMemoryAllocator.second();
+		this->~ref_count_sp_t_deferred_inst();
+		CUSTOM_FREE(allocator, this, sizeof(*this));
+	}
+
+	void* get_deleter(const std::type_info&) const noexcept
+	{
+		return nullptr;
+	}
+
+	static void reclaim(deferred_node* pNode) noexcept
+	{
+		this_type* const pThis = static_cast<this_type*>(pNode);
+		pThis->GetValue()->~value_type();
+		pThis->weak_release();
+	}
+};
+
+/*
+ * This is a version of ref_count_sp_t_inst for arrays: the count of elements is kept
+ * in the control block and the elements themselves follow it in the same allocation,
+ * at the first offset suitably aligned for T.
+ * */
+
+template <typename T, typename Allocator>
+class ref_count_sp_t_array : public ref_count_sp
+{
+public:
+	using this_type = ref_count_sp_t_array<T, Allocator>;
+	using value_type = T;
+	using allocator_type = Allocator;
+
+	compressed_pair<size_t, allocator_type> mCountAllocator;
+
+	static constexpr size_t value_offset() noexcept
+	{
+		return (sizeof(this_type) + alignof(value_type) - 1) & ~(alignof(value_type) - 1);
+	}
+
+	static constexpr size_t allocation_alignment() noexcept
+	{
+		return (alignof(this_type) > alignof(value_type)) ? alignof(this_type) : alignof(value_type);
+	}
+
+	static size_t allocation_size(size_t count) noexcept
+	{
+		return value_offset() + (count * sizeof(value_type));
+	}
+
+	value_type* GetValue()
+	{
+		return reinterpret_cast<value_type*>(reinterpret_cast<char*>(this) + value_offset());
+	}
+
+	// Constructs the elements with init(void* pElement); if one throws, the ones before it are destroyed.
+	template <typename Init>
+	ref_count_sp_t_array(allocator_type allocator, size_t count, Init init) : ref_count_sp(&ref_count_ops_for<this_type>::sOps), mCountAllocator(0, allocator)
+	{
+		size_t& constructed = mCountAllocator.first();
+		try
+		{
+			// Through the raw storage, since value_type may be const.
+			for(char* pStorage = reinterpret_cast<char*>(this) + value_offset(); constructed < count; ++constructed)
+			{
+				init(static_cast<void*>(pStorage + constructed * sizeof(value_type)));
+			}
+		}
+		catch(...)
+		{
+			free_value();
+			throw;
+		}
+	}
+
+	void free_value() noexcept
+	{
+		value_type* const pValue = GetValue();
+		for(size_t i = mCountAllocator.first(); i > 0; --i)
+		{
+			pValue[i - 1].~value_type();
+		}
+	}
+
+	void free_ref_count_sp() noexcept
+	{
+		allocator_type allocator = mCountAllocator.second();
+		const size_t size = allocation_size(mCountAllocator.first());
+		this->~ref_count_sp_t_array();
+		CUSTOM_FREE(allocator, this, size);
 	}
 
 	void* get_deleter(const std::type_info&) const noexcept
@@ -255,9 +571,9 @@ class shared_ptr
 {
 public:
 	using this_type = shared_ptr<T>;
-	using element_type = T;
-	using reference_type = typename shared_ptr_traits<T>::reference_type;
-	using default_allocator_type = rstl::allocator;
+	using element_type = std::remove_extent_t<T>;
+	using reference_type = typename shared_ptr_traits<element_type>::reference_type;
+	using default_allocator_type = SmartPTR_Internal::default_ref_count_allocator;
 	using default_deleter_type = default_delete<T>;
 	using weak_type = weak_ptr<T>;
 
@@ -271,7 +587,9 @@ public:
 	template <typename U>
 	explicit shared_ptr(U* pValue, std::enable_if_t<std::is_convertible_v<U*, element_type*>>* = 0) : mpValue(nullptr), mpRefCount(nullptr)
 	{
-		alloc_internal(pValue, default_allocator_type(), default_delete<U>());
+		using default_deleter_type = std::conditional_t<std::is_array_v<T>, default_delete<T>, default_delete<U>>;
+		using deleter_type = std::conditional_t<defer_destruction_v<U>, deferred_delete<U, default_deleter_type>, default_deleter_type>;
+		alloc_internal(pValue, default_allocator_type(), deleter_type());
 	}
 
 	shared_ptr(std::nullptr_t) noexcept : mpValue(nullptr), mpRefCount(nullptr) { }
@@ -289,7 +607,7 @@ public:
 	}
 
 	template <typename U, typename Deleter, typename Allocator>
-	explicit shared_ptr(U* pValue, Deleter deleter, const Allocator& allocator, std::enable_if_t<std::is_convertible_v<U*, element_type*>>* = 0)
+	explicit shared_ptr(U* pValue, Deleter deleter, const Allocator& allocator, std::enable_if_t<std::is_convertible_v<U*, element_type*>>* = 0) : mpValue(nullptr), mpRefCount(nullptr)
 	{
 		alloc_internal(pValue, std::move(allocator), std::move(deleter));
 	}
@@ -309,7 +627,7 @@ public:
 	}
 
 	template<typename U>
-	shared_ptr(const shared_ptr<U>& sharedPtr, std::enable_if_t<std::is_convertible_v<U*, element_type*>>* = 0) noexcept : mpValue(sharedPtr.mpValue), mpRefCount(sharedPtr.mpRefCount)
+	shared_ptr(const shared_ptr<U>& sharedPtr, std::enable_if_t<std::is_convertible_v<U*, T*>>* = 0) noexcept : mpValue(sharedPtr.mpValue), mpRefCount(sharedPtr.mpRefCount)
 	{
 		if(mpRefCount)
 		{
@@ -333,7 +651,7 @@ public:
 	}
 
 	template <typename U>
-	shared_ptr(shared_ptr<U>&& sharedPtr, std::enable_if_t<std::is_convertible_v<U*, element_type*>>* = 0) noexcept : mpValue(sharedPtr.mpValue), mpRefCount(sharedPtr.mpRefCount)
+	shared_ptr(shared_ptr<U>&& sharedPtr, std::enable_if_t<std::is_convertible_v<U*, T*>>* = 0) noexcept : mpValue(sharedPtr.mpValue), mpRefCount(sharedPtr.mpRefCount)
 	{
 		sharedPtr.mpValue = nullptr;
 		sharedPtr.mpRefCount = nullptr;
@@ -352,12 +670,12 @@ public:
 	}
 
 	template <typename U>
-	explicit shared_ptr(const weak_ptr<U>& weakPtr, std::enable_if_t<std::is_convertible_v<U*, element_type*>>* = 0) : mpValue(weakPtr.mpValue), mpRefCount(weakPtr.mpRefCount ? weakPtr.mpRefCount->lock() : weakPtr.mpRefCount)
+	explicit shared_ptr(const weak_ptr<U>& weakPtr, std::enable_if_t<std::is_convertible_v<U*, T*>>* = 0) : mpValue(weakPtr.mpValue), mpRefCount(weakPtr.mpRefCount ? weakPtr.mpRefCount->lock() : weakPtr.mpRefCount)
 	{
 		if(!mpRefCount)
 		{
 			mpValue = nullptr;
-			throw std::bad_weak_ptr();
+			throw bad_weak_ptr();
 		}
 	}
 
@@ -379,7 +697,7 @@ public:
 	}
 
 	template <typename U>
-	std::enable_if_t<std::is_convertible_v<U*, element_type*>, this_type&> operator=(const shared_ptr<U>& sharedPtr) noexcept
+	std::enable_if_t<std::is_convertible_v<U*, T*>, this_type&> operator=(const shared_ptr<U>& sharedPtr) noexcept
 	{
 		if(!equivalent_ownership(sharedPtr))
 		{
@@ -398,7 +716,7 @@ public:
 	}
 
 	template <typename U>
-	std::enable_if_t<std::is_convertible_v<U*, element_type*>, this_type&> operator=(shared_ptr<U>&& sharedPtr) noexcept
+	std::enable_if_t<std::is_convertible_v<U*, T*>, this_type&> operator=(shared_ptr<U>&& sharedPtr) noexcept
 	{
 		if(!equivalent_ownership(sharedPtr))
 		{
@@ -458,6 +776,12 @@ public:
 		return mpValue;
 	}
 
+	template <typename U = T>
+	std::enable_if_t<std::is_array_v<U>, element_type&> operator[](std::ptrdiff_t i) const noexcept
+	{
+		return mpValue[i];
+	}
+
 	element_type* get() const noexcept
 	{
 		return mpValue;
@@ -465,12 +789,12 @@ public:
 
 	int use_count() const noexcept
 	{
-		return mpRefCount ? mpRefCount->mRefCount : 0;
+		return mpRefCount ? mpRefCount->use_count() : 0;
 	}
 
 	bool unique() const noexcept
 	{
-		return (mpRefCount && (mpRefCount->mRefCount == 1));
+		return (mpRefCount && (mpRefCount->use_count() == 1));
 	}
 
 	template <typename U>
@@ -510,7 +834,10 @@ protected:
 	friend class weak_ptr;
 
 	template<typename U>
-	friend void allocate_shared_helper(shared_ptr<U>*, ref_count_sp*, U*);
+	friend class local_shared_ptr;
+
+	template<typename U>
+	friend void allocate_shared_helper(shared_ptr<U>&, ref_count_sp*, std::remove_extent_t<U>*);
 
 	template <typename U, typename Allocator, typename Deleter>
 	void alloc_internal(U pValue, Allocator allocator, Deleter deleter)
@@ -633,35 +960,174 @@ inline std::enable_if_t<!std::is_array_v<T> && !std::is_array_v<U>, shared_ptr<T
 //};
 
 template<typename T>
-void allocate_shared_helper(rstl::shared_ptr<T>& sharedPtr, ref_count_sp* pRefCount, T* pValue)
+void allocate_shared_helper(rstl::shared_ptr<T>& sharedPtr, ref_count_sp* pRefCount, std::remove_extent_t<T>* pValue)
 {
 	sharedPtr.mpRefCount = pRefCount;
 	sharedPtr.mpValue = pValue;
 	do_enable_shared_from_this(pRefCount, pValue, pValue);
 }
 
-template <typename T, typename Allocator, typename... Args>
-shared_ptr<T> allocate_shared(const Allocator& allocator, Args&&... args)
-{
-	using ref_count_type = ref_count_sp_t_inst<T, Allocator>;
-	shared_ptr<T> ret;
-	void* const pMemory = CUSTOM_ALLOC(const_cast<Allocator&>(allocator), sizeof(ref_count_type));
-	if (pMemory)
+namespace SmartPTR_Internal {
+
+	template <typename T, typename Allocator, typename... Args>
+	shared_ptr<T> allocate_shared_inst(const Allocator& allocator, Args&&... args)
 	{
-		ref_count_type* pRefCount = ::new(pMemory) ref_count_type(allocator, std::forward<Args>(args)...);
-		allocate_shared_helper(ret, pRefCount, pRefCount->GetValue());
+		using ref_count_type = std::conditional_t<defer_destruction_v<T>, ref_count_sp_t_deferred_inst<T, Allocator>, ref_count_sp_t_inst<T, Allocator>>;
+		shared_ptr<T> ret;
+		void* const pMemory = allocate_memory(const_cast<Allocator&>(allocator), sizeof(ref_count_type), alignof(ref_count_type), 0);
+		if (pMemory)
+		{
+			ref_count_type* pRefCount;
+			try
+			{
+				pRefCount = ::new(pMemory) ref_count_type(allocator, std::forward<Args>(args)...);
+			}
+			catch(...)
+			{
+				CUSTOM_FREE(const_cast<Allocator&>(allocator), pMemory, sizeof(ref_count_type));
+				throw;
+			}
+			allocate_shared_helper(ret, pRefCount, pRefCount->GetValue());
+		}
+		return ret;
+	}
+
+	template <typename T, typename Allocator, typename Init>
+	shared_ptr<T> allocate_shared_array(const Allocator& allocator, size_t count, Init init)
+	{
+		using element_type = std::remove_extent_t<T>;
+		using ref_count_type = ref_count_sp_t_array<element_type, Allocator>;
+		static_assert(!std::is_array_v<element_type>, "allocate_shared supports one-dimensional arrays only.");
+
+		shared_ptr<T> ret;
+		const size_t size = ref_count_type::allocation_size(count);
+		void* const pMemory = allocate_memory(const_cast<Allocator&>(allocator), size, ref_count_type::allocation_alignment(), 0);
+		if (pMemory)
+		{
+			ref_count_type* pRefCount;
+			try
+			{
+				pRefCount = ::new(pMemory) ref_count_type(allocator, count, init);
+			}
+			catch(...)
+			{
+				CUSTOM_FREE(const_cast<Allocator&>(allocator), pMemory, size);
+				throw;
+			}
+			allocate_shared_helper(ret, pRefCount, pRefCount->GetValue());
+		}
+		return ret;
 	}
-	return ret;
+
+}
+
+template <typename T, typename Allocator, typename... Args>
+std::enable_if_t<!std::is_array_v<T>, shared_ptr<T>> allocate_shared(const Allocator& allocator, Args&&... args)
+{
+	return SmartPTR_Internal::allocate_shared_inst<T>(allocator, std::forward<Args>(args)...);
+}
+
+template <typename T, typename Allocator>
+std::enable_if_t<std::is_unbounded_array_v<T>, shared_ptr<T>> allocate_shared(const Allocator& allocator, size_t count)
+{
+	return SmartPTR_Internal::allocate_shared_array<T>(allocator, count, [](void* p) { ::new(p) std::remove_extent_t<T>(); });
+}
+
+template <typename T, typename Allocator>
+std::enable_if_t<std::is_unbounded_array_v<T>, shared_ptr<T>> allocate_shared(const Allocator& allocator, size_t count, const std::remove_extent_t<T>& value)
+{
+	return SmartPTR_Internal::allocate_shared_array<T>(allocator, count, [&value](void* p) { ::new(p) std::remove_extent_t<T>(value); });
+}
+
+template <typename T, typename Allocator>
+std::enable_if_t<std::is_bounded_array_v<T>, shared_ptr<T>> allocate_shared(const Allocator& allocator)
+{
+	return SmartPTR_Internal::allocate_shared_array<T>(allocator, std::extent_v<T>, [](void* p) { ::new(p) std::remove_extent_t<T>(); });
+}
+
+template <typename T, typename Allocator>
+std::enable_if_t<std::is_bounded_array_v<T>, shared_ptr<T>> allocate_shared(const Allocator& allocator, const std::remove_extent_t<T>& value)
+{
+	return SmartPTR_Internal::allocate_shared_array<T>(allocator, std::extent_v<T>, [&value](void* p) { ::new(p) std::remove_extent_t<T>(value); });
+}
+
+/*
+ * The _for_overwrite versions default-initialize instead of value-initialize, so a
+ * large buffer of trivial elements is left as it comes from the allocator instead of
+ * being zeroed first.
+ * */
+
+template <typename T, typename Allocator>
+std::enable_if_t<!std::is_array_v<T>, shared_ptr<T>> allocate_shared_for_overwrite(const Allocator& allocator)
+{
+	return SmartPTR_Internal::allocate_shared_inst<T>(allocator, SmartPTR_Internal::for_overwrite_t());
+}
+
+template <typename T, typename Allocator>
+std::enable_if_t<std::is_unbounded_array_v<T>, shared_ptr<T>> allocate_shared_for_overwrite(const Allocator& allocator, size_t count)
+{
+	return SmartPTR_Internal::allocate_shared_array<T>(allocator, count, [](void* p) { ::new(p) std::remove_extent_t<T>; });
+}
+
+template <typename T, typename Allocator>
+std::enable_if_t<std::is_bounded_array_v<T>, shared_ptr<T>> allocate_shared_for_overwrite(const Allocator& allocator)
+{
+	return SmartPTR_Internal::allocate_shared_array<T>(allocator, std::extent_v<T>, [](void* p) { ::new(p) std::remove_extent_t<T>; });
 }
 
 template <typename T, typename... Args>
-shared_ptr<T> make_shared(Args&&... args)
+std::enable_if_t<!std::is_array_v<T>, shared_ptr<T>> make_shared(Args&&... args)
+{
+	return rstl::allocate_shared<T>(SmartPTR_Internal::default_ref_count_allocator(), std::forward<Args>(args)...);
+}
+
+template <typename T>
+std::enable_if_t<std::is_unbounded_array_v<T>, shared_ptr<T>> make_shared(size_t count)
+{
+	return rstl::allocate_shared<T>(SmartPTR_Internal::default_ref_count_allocator(), count);
+}
+
+template <typename T>
+std::enable_if_t<std::is_unbounded_array_v<T>, shared_ptr<T>> make_shared(size_t count, const std::remove_extent_t<T>& value)
+{
+	return rstl::allocate_shared<T>(SmartPTR_Internal::default_ref_count_allocator(), count, value);
+}
+
+template <typename T>
+std::enable_if_t<std::is_bounded_array_v<T>, shared_ptr<T>> make_shared()
+{
+	return rstl::allocate_shared<T>(SmartPTR_Internal::default_ref_count_allocator());
+}
+
+template <typename T>
+std::enable_if_t<std::is_bounded_array_v<T>, shared_ptr<T>> make_shared(const std::remove_extent_t<T>& value)
+{
+	return rstl::allocate_shared<T>(SmartPTR_Internal::default_ref_count_allocator(), value);
+}
+
+template <typename T>
+std::enable_if_t<!std::is_array_v<T>, shared_ptr<T>> make_shared_for_overwrite()
+{
+	return rstl::allocate_shared_for_overwrite<T>(SmartPTR_Internal::default_ref_count_allocator());
+}
+
+template <typename T>
+std::enable_if_t<std::is_unbounded_array_v<T>, shared_ptr<T>> make_shared_for_overwrite(size_t count)
+{
+	return rstl::allocate_shared_for_overwrite<T>(SmartPTR_Internal::default_ref_count_allocator(), count);
+}
+
+template <typename T>
+std::enable_if_t<std::is_bounded_array_v<T>, shared_ptr<T>> make_shared_for_overwrite()
 {
-	return rstl::allocate_shared<T>(rstl::allocator(), std::forward<Args>(args)...);
+	return rstl::allocate_shared_for_overwrite<T>(SmartPTR_Internal::default_ref_count_allocator());
 }
 
 /*
  *  shared_ptr atomic access
+ *
+ *  These lock a mutex chosen by the shared_ptr's address (see shared_ptr_auto_mutex).
+ *  atomic_shared_ptr in atomic_shared_ptr.h is the lock-free alternative.
  * */
 
 template <typename T>
@@ -752,7 +1218,7 @@ class weak_ptr
 {
 public:
 	using this_type = weak_ptr<T>;
-	using element_type = T;
+	using element_type = std::remove_extent_t<T>;
 
 public:
 	weak_ptr() noexcept : mpValue(nullptr), mpRefCount(nullptr) { }
@@ -772,7 +1238,7 @@ public:
 	}
 
 	template <typename U>
-	weak_ptr(const weak_ptr<U>& weakPtr, std::enable_if_t<std::is_convertible_v<U*, element_type*>>* = 0) noexcept : mpValue(weakPtr.mpValue), mpRefCount(weakPtr.mpRefCount)
+	weak_ptr(const weak_ptr<U>& weakPtr, std::enable_if_t<std::is_convertible_v<U*, T*>>* = 0) noexcept : mpValue(weakPtr.mpValue), mpRefCount(weakPtr.mpRefCount)
 	{
 		if(mpRefCount)
 		{
@@ -781,14 +1247,14 @@ public:
 	}
 
 	template <typename U>
-	weak_ptr(weak_ptr<U>&& weakPtr,  std::enable_if_t<std::is_convertible_v<U*, element_type*>>* = 0) noexcept : mpValue(weakPtr.mpValue), mpRefCount(weakPtr.mpRefCount)
+	weak_ptr(weak_ptr<U>&& weakPtr,  std::enable_if_t<std::is_convertible_v<U*, T*>>* = 0) noexcept : mpValue(weakPtr.mpValue), mpRefCount(weakPtr.mpRefCount)
 	{
 		weakPtr.mpValue = nullptr;
 		weakPtr.mpRefCount = nullptr;
 	}
 
 	template <typename U>
-	weak_ptr(const shared_ptr<U>& sharedPtr, std::enable_if_t<std::is_convertible_v<U*, element_type*>>* = 0) noexcept : mpValue(sharedPtr.mpValue), mpRefCount(sharedPtr.mpRefCount)
+	weak_ptr(const shared_ptr<U>& sharedPtr, std::enable_if_t<std::is_convertible_v<U*, T*>>* = 0) noexcept : mpValue(sharedPtr.mpValue), mpRefCount(sharedPtr.mpRefCount)
 	{
 		if(mpRefCount)
 		{
@@ -817,21 +1283,21 @@ public:
 	}
 
 	template<typename U>
-	std::enable_if_t<std::is_convertible_v<U*, element_type*>, this_type&> operator=(const weak_ptr<U>& weakPtr) noexcept
+	std::enable_if_t<std::is_convertible_v<U*, T*>, this_type&> operator=(const weak_ptr<U>& weakPtr) noexcept
 	{
 		assign(weakPtr);
 		return *this;
 	}
 
 	template<typename U>
-	std::enable_if_t<std::is_convertible_v<U*, element_type*>, this_type&> operator=(weak_ptr<U>&& weakPtr) noexcept
+	std::enable_if_t<std::is_convertible_v<U*, T*>, this_type&> operator=(weak_ptr<U>&& weakPtr) noexcept
 	{
 		weak_ptr(std::move(weakPtr)).swap(*this);
 		return *this;
 	}
 
 	template<typename U>
-	std::enable_if_t<std::is_convertible_v<U*, element_type*>, this_type&> operator=(const shared_ptr<U>& sharedPtr) noexcept
+	std::enable_if_t<std::is_convertible_v<U*, T*>, this_type&> operator=(const shared_ptr<U>& sharedPtr) noexcept
 	{
 		if(mpRefCount != sharedPtr.mpRefCount)
 		{
@@ -862,12 +1328,12 @@ public:
 
 	int use_count() const noexcept
 	{
-		return mpRefCount ? mpRefCount->mRefCount : 0;
+		return mpRefCount ? mpRefCount->use_count() : 0;
 	}
 
 	bool expired() const noexcept
 	{
-		return (!mpRefCount || (mpRefCount->mRefCount == 0));
+		return (!mpRefCount || (mpRefCount->use_count() == 0));
 	}
 
 	void reset()
@@ -882,7 +1348,7 @@ public:
 
 	void swap(this_type& weakPtr)
 	{
-		T* const pValue = weakPtr.mpValue;
+		element_type* const pValue = weakPtr.mpValue;
 		weakPtr.mpValue = mpValue;
 		mpValue         = pValue;
 
@@ -892,7 +1358,7 @@ public:
 	}
 
 	template <typename U>
-	void assign(const weak_ptr<U>& weakPtr, std::enable_if_t<std::is_convertible_v<U*, element_type*>>* = 0) noexcept
+	void assign(const weak_ptr<U>& weakPtr, std::enable_if_t<std::is_convertible_v<U*, T*>>* = 0) noexcept
 	{
 		if(mpRefCount != weakPtr.mpRefCount)
 		{
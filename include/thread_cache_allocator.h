@@ -0,0 +1,126 @@
+#ifndef RSTL_THREAD_CACHE_ALLOCATOR_H
+#define RSTL_THREAD_CACHE_ALLOCATOR_H
+
+#pragma once
+
+#include "internal/config.h"
+#include "internal/thread_cache.h"
+#include "allocator.h"
+
+#include <cstddef>
+
+RSTL_NAMESPACE_BEGIN
+
+/*
+ * An rstl::allocator compatible allocator which serves requests of up to
+ * Thread_Cache_Internal::kMaxCachedSize bytes from per-thread size-class magazines,
+ * so the common case takes no lock and touches no shared cache line. Larger requests
+ * go to rstl::allocator. It is stateless; all copies share the same caches.
+ *
+ * To put the caches behind rstl::allocator and GetDefaultAllocator() instead, build
+ * with RSTL_THREAD_CACHE_DEFAULT_ALLOCATOR set to 1.
+ * */
+
+class thread_cache_allocator
+{
+public:
+	explicit thread_cache_allocator(const char* pName = THREAD_CACHE_ALLOCATOR_DEFAULT_NAME);
+	thread_cache_allocator(const thread_cache_allocator& x);
+	thread_cache_allocator(const thread_cache_allocator& x, const char* pName);
+
+	thread_cache_allocator& operator=(const thread_cache_allocator& x);
+
+	void* allocate(size_t n, int flags = 0);
+	void* allocate(size_t n, size_t alignment, size_t offset, int flags = 0);
+	void deallocate(void* p, size_t n);
+
+	const char* get_name() const;
+	void set_name(const char* pName);
+
+	// Debug name
+	const char* mpName;
+};
+
+inline thread_cache_allocator::thread_cache_allocator(const char* pName) : mpName(pName)
+{
+
+}
+
+inline thread_cache_allocator::thread_cache_allocator(const thread_cache_allocator& x) : mpName(x.mpName)
+{
+
+}
+
+inline thread_cache_allocator::thread_cache_allocator(const thread_cache_allocator&, const char* pName) : mpName(pName)
+{
+
+}
+
+inline thread_cache_allocator& thread_cache_allocator::operator=(const thread_cache_allocator& x)
+{
+	mpName = x.mpName;
+	return *this;
+}
+
+inline const char* thread_cache_allocator::get_name() const
+{
+	return mpName;
+}
+
+inline void thread_cache_allocator::set_name(const char* pName)
+{
+	mpName = pName;
+}
+
+inline void* thread_cache_allocator::allocate(size_t n, int flags)
+{
+	return allocate(n, Thread_Cache_Internal::kAlignment, 0, flags);
+}
+
+inline void* thread_cache_allocator::allocate(size_t n, size_t alignment, size_t offset, int flags)
+{
+	if(n <= Thread_Cache_Internal::kMaxCachedSize)
+	{
+		if(alignment <= Thread_Cache_Internal::kAlignment)
+		{
+			return Thread_Cache_Internal::cache_allocate(n);
+		}
+		// See rstl::allocator::allocate: over-aligned small blocks are adopted by the cache when freed.
+		n = (n + Thread_Cache_Internal::kAlignment - 1) & ~(Thread_Cache_Internal::kAlignment - 1);
+	}
+
+	rstl::allocator upstream(mpName);
+	return upstream.allocate(n, alignment, offset, flags);
+}
+
+inline void thread_cache_allocator::deallocate(void* p, size_t n)
+{
+	if(p == nullptr)
+	{
+		return;
+	}
+
+	if(n <= Thread_Cache_Internal::kMaxCachedSize)
+	{
+		Thread_Cache_Internal::cache_deallocate(p, n);
+	}
+	else
+	{
+		rstl::allocator upstream(mpName);
+		upstream.deallocate(p, n);
+	}
+}
+
+inline bool operator==(const thread_cache_allocator&, const thread_cache_allocator&)
+{
+	return true;
+}
+
+inline bool operator!=(const thread_cache_allocator&, const thread_cache_allocator&)
+{
+	return false;
+}
+
+RSTL_NAMESPACE_END
+
+#endif //RSTL_THREAD_CACHE_ALLOCATOR_H
@@ -0,0 +1,1035 @@
+#ifndef RSTL_THREAD_POOL_H
+#define RSTL_THREAD_POOL_H
+
+#pragma once
+
+#include "internal/config.h"
+#include "internal/thread_cache.h"
+#include "allocator.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#if defined(__linux__)
+#	include <pthread.h>
+#	include <sched.h>
+#endif
+
+RSTL_NAMESPACE_BEGIN
+
+/*
+ * thread_pool runs small tasks on a fixed set of worker threads. Each worker owns a
+ * work-stealing deque (Chase-Lev): tasks submitted from inside a task go onto the
+ * submitting worker's deque, which the worker pops newest first while idle workers
+ * steal oldest first from the other end. Tasks submitted from any other thread go
+ * onto a shared injection queue, from which a worker takes a batch at a time and
+ * spreads it through its own deque.
+ *
+ * An idle worker polls for work mSpinCount times, pausing and then yielding between
+ * polls, before it parks. A submission wakes a parked worker only if there is one, so
+ * a busy pool makes no system calls.
+ *
+ * submit() returns a task_handle, a move-only future that waits for and returns the
+ * task's result or rethrows its exception. Waiting on a worker thread runs other tasks
+ * meanwhile, so tasks may wait on tasks they submitted. post() is submit() without a
+ * result: it is cheaper, and a task that throws calls std::terminate.
+ *
+ * Task objects, handle state included, come from the per-thread small-object cache in
+ * internal/thread_cache.h, so steady-state submission does not reach the global heap;
+ * only tasks larger than its biggest size class fall back to rstl::allocator.
+ *
+ * The destructor runs every task submitted so far, including those they submit, and
+ * then joins the workers. Submitting from outside the pool once it is being destroyed
+ * is undefined.
+ * */
+
+namespace Thread_Pool_Internal {
+
+	static constexpr size_t kCacheLineSize = 64;
+	static constexpr size_t kMaxInjectionBatch = 32;
+
+	inline void cpu_relax() noexcept
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#elif defined(__aarch64__)
+		asm volatile("yield");
+#endif
+	}
+
+	/*
+	 * A task in a queue. mpRun runs the task and frees it; mpNext links the injection
+	 * queue.
+	 * */
+	struct task_node
+	{
+		task_node* mpNext;
+		void (*mpRun)(task_node*) noexcept;
+	};
+
+	inline void* allocate_task(size_t size, size_t alignment)
+	{
+		void* pMemory;
+		if((size <= Thread_Cache_Internal::kMaxCachedSize) && (alignment <= Thread_Cache_Internal::kAlignment))
+		{
+			pMemory = Thread_Cache_Internal::cache_allocate(size);
+		}
+		else
+		{
+			rstl::allocator allocator;
+			pMemory = allocate_memory(allocator, size, alignment, 0);
+		}
+		if(!pMemory)
+		{
+			throw std::bad_alloc();
+		}
+		return pMemory;
+	}
+
+	inline void free_task(void* p, size_t size, size_t alignment) noexcept
+	{
+		if((size <= Thread_Cache_Internal::kMaxCachedSize) && (alignment <= Thread_Cache_Internal::kAlignment))
+		{
+			Thread_Cache_Internal::cache_deallocate(p, size);
+		}
+		else
+		{
+			rstl::allocator allocator;
+			CUSTOM_FREE(allocator, p, size);
+		}
+	}
+
+	/*
+	 * The Chase-Lev deque, with the memory orders of Le et al., "Correct and Efficient
+	 * Work-Stealing for Weak Memory Models". Only the owner pushes and pops, at the
+	 * bottom; any thread steals at the top. Slots are written with release and read
+	 * with acquire, so that a thief synchronizes with the push of the task it takes.
+	 *
+	 * The ring doubles when full. Thieves may still be reading an outgrown ring, so
+	 * rings are kept until the deque is destroyed; together they hold at most twice
+	 * the largest ring.
+	 * */
+	class work_stealing_deque
+	{
+	public:
+		explicit work_stealing_deque(size_t capacity);
+		~work_stealing_deque();
+
+		work_stealing_deque(const work_stealing_deque&) = delete;
+		work_stealing_deque& operator=(const work_stealing_deque&) = delete;
+
+		void push(task_node* pTask);
+		task_node* pop() noexcept;
+		task_node* steal() noexcept;
+
+		bool empty() const noexcept
+		{
+			return mBottom.load(std::memory_order_acquire) <= mTop.load(std::memory_order_acquire);
+		}
+
+	protected:
+		struct ring
+		{
+			int64_t mMask;
+			ring* mpOutgrown;
+
+			std::atomic<task_node*>* slots() noexcept
+			{
+				return reinterpret_cast<std::atomic<task_node*>*>(this + 1);
+			}
+
+			static ring* create(int64_t capacity, ring* pOutgrown);
+			static void destroy(ring* pRing) noexcept;
+		};
+
+		alignas(kCacheLineSize) std::atomic<int64_t> mTop;
+		alignas(kCacheLineSize) std::atomic<int64_t> mBottom;
+		std::atomic<ring*> mpRing;
+	};
+
+	inline work_stealing_deque::ring* work_stealing_deque::ring::create(int64_t capacity, ring* pOutgrown)
+	{
+		rstl::allocator allocator;
+		void* const pMemory = allocate_memory(allocator, sizeof(ring) + (size_t)capacity * sizeof(std::atomic<task_node*>), alignof(ring), 0);
+		if(!pMemory)
+		{
+			throw std::bad_alloc();
+		}
+		ring* const pRing = ::new(pMemory) ring{ capacity - 1, pOutgrown };
+		for(int64_t i = 0; i < capacity; ++i)
+		{
+			::new(static_cast<void*>(pRing->slots() + i)) std::atomic<task_node*>(nullptr);
+		}
+		return pRing;
+	}
+
+	inline void work_stealing_deque::ring::destroy(ring* pRing) noexcept
+	{
+		rstl::allocator allocator;
+		while(pRing)
+		{
+			ring* const pOutgrown = pRing->mpOutgrown;
+			CUSTOM_FREE(allocator, pRing, sizeof(ring) + (size_t)(pRing->mMask + 1) * sizeof(std::atomic<task_node*>));
+			pRing = pOutgrown;
+		}
+	}
+
+	inline work_stealing_deque::work_stealing_deque(size_t capacity) : mTop(0), mBottom(0), mpRing(nullptr)
+	{
+		int64_t roundedCapacity = 2;
+		while((size_t)roundedCapacity < capacity)
+		{
+			roundedCapacity *= 2;
+		}
+		mpRing.store(ring::create(roundedCapacity, nullptr), std::memory_order_relaxed);
+	}
+
+	inline work_stealing_deque::~work_stealing_deque()
+	{
+		ring::destroy(mpRing.load(std::memory_order_relaxed));
+	}
+
+	inline void work_stealing_deque::push(task_node* pTask)
+	{
+		const int64_t bottom = mBottom.load(std::memory_order_relaxed);
+		const int64_t top = mTop.load(std::memory_order_acquire);
+		ring* pRing = mpRing.load(std::memory_order_relaxed);
+		if(bottom - top > pRing->mMask)
+		{
+			ring* const pGrown = ring::create(2 * (pRing->mMask + 1), pRing);
+			for(int64_t i = top; i < bottom; ++i)
+			{
+				pGrown->slots()[i & pGrown->mMask].store(pRing->slots()[i & pRing->mMask].load(std::memory_order_relaxed), std::memory_order_relaxed);
+			}
+			mpRing.store(pGrown, std::memory_order_release);
+			pRing = pGrown;
+		}
+		pRing->slots()[bottom & pRing->mMask].store(pTask, std::memory_order_release);
+		mBottom.store(bottom + 1, std::memory_order_release);
+	}
+
+	inline task_node* work_stealing_deque::pop() noexcept
+	{
+		const int64_t bottom = mBottom.load(std::memory_order_relaxed) - 1;
+		ring* const pRing = mpRing.load(std::memory_order_relaxed);
+		mBottom.store(bottom, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t top = mTop.load(std::memory_order_relaxed);
+
+		if(top > bottom)
+		{
+			mBottom.store(bottom + 1, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		task_node* pTask = pRing->slots()[bottom & pRing->mMask].load(std::memory_order_relaxed);
+		if(top == bottom)
+		{
+			// The last task: race the thieves for it.
+			if(!mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			{
+				pTask = nullptr;
+			}
+			mBottom.store(bottom + 1, std::memory_order_relaxed);
+		}
+		return pTask;
+	}
+
+	inline task_node* work_stealing_deque::steal() noexcept
+	{
+		int64_t top = mTop.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		const int64_t bottom = mBottom.load(std::memory_order_acquire);
+		if(top >= bottom)
+		{
+			return nullptr;
+		}
+
+		ring* const pRing = mpRing.load(std::memory_order_acquire);
+		task_node* const pTask = pRing->slots()[top & pRing->mMask].load(std::memory_order_acquire);
+		if(!mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		{
+			return nullptr; // Lost to the owner or another thief.
+		}
+		return pTask;
+	}
+
+	/*
+	 * The state a task shares with its task_handle: the result, and a count of two
+	 * references, one held by the task until it has run and one by the handle.
+	 * */
+	template <typename R>
+	struct task_state : task_node
+	{
+		std::atomic<uint32_t> mRefCount;
+		std::atomic<uint32_t> mReady;
+		std::exception_ptr mException;
+		void (*mpFree)(task_state*) noexcept;
+		alignas(R) unsigned char mValue[sizeof(R)];
+
+		task_state(void (*pRun)(task_node*) noexcept, void (*pFree)(task_state*) noexcept) noexcept
+			: task_node{ nullptr, pRun }, mRefCount(2), mReady(0), mpFree(pFree) { }
+
+		R& value() noexcept
+		{
+			return *std::launder(reinterpret_cast<R*>(mValue));
+		}
+
+		template <typename F>
+		void run(F& f) noexcept
+		{
+			try
+			{
+				::new(static_cast<void*>(mValue)) R(std::invoke(f));
+			}
+			catch(...)
+			{
+				mException = std::current_exception();
+			}
+		}
+
+		void destroy_value() noexcept
+		{
+			if(mReady.load(std::memory_order_relaxed) && !mException)
+			{
+				value().~R();
+			}
+		}
+
+		void release() noexcept
+		{
+			if(mRefCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{
+				destroy_value();
+				mpFree(this);
+			}
+		}
+	};
+
+	template <>
+	struct task_state<void> : task_node
+	{
+		std::atomic<uint32_t> mRefCount;
+		std::atomic<uint32_t> mReady;
+		std::exception_ptr mException;
+		void (*mpFree)(task_state*) noexcept;
+
+		task_state(void (*pRun)(task_node*) noexcept, void (*pFree)(task_state*) noexcept) noexcept
+			: task_node{ nullptr, pRun }, mRefCount(2), mReady(0), mpFree(pFree) { }
+
+		template <typename F>
+		void run(F& f) noexcept
+		{
+			try
+			{
+				std::invoke(f);
+			}
+			catch(...)
+			{
+				mException = std::current_exception();
+			}
+		}
+
+		void release() noexcept
+		{
+			if(mRefCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{
+				mpFree(this);
+			}
+		}
+	};
+
+	// A submit()ted task. The function is destroyed as soon as it has run.
+	template <typename F, typename R>
+	struct handle_task : task_state<R>
+	{
+		alignas(F) unsigned char mFunction[sizeof(F)];
+
+		template <typename G>
+		explicit handle_task(G&& f) : task_state<R>(&run_task, &free_task_state)
+		{
+			::new(static_cast<void*>(mFunction)) F(std::forward<G>(f));
+		}
+
+		F& function() noexcept
+		{
+			return *std::launder(reinterpret_cast<F*>(mFunction));
+		}
+
+		static void run_task(task_node* pNode) noexcept
+		{
+			handle_task* const pThis = static_cast<handle_task*>(pNode);
+			pThis->run(pThis->function());
+			pThis->function().~F();
+			pThis->mReady.store(1, std::memory_order_release);
+			pThis->mReady.notify_all();
+			pThis->release();
+		}
+
+		static void free_task_state(task_state<R>* pState) noexcept
+		{
+			handle_task* const pThis = static_cast<handle_task*>(pState);
+			pThis->~handle_task();
+			free_task(pThis, sizeof(handle_task), alignof(handle_task));
+		}
+	};
+
+	// A post()ed task.
+	template <typename F>
+	struct post_task : task_node
+	{
+		F mFunction;
+
+		template <typename G>
+		explicit post_task(G&& f) : task_node{ nullptr, &run_task }, mFunction(std::forward<G>(f)) { }
+
+		static void run_task(task_node* pNode) noexcept
+		{
+			post_task* const pThis = static_cast<post_task*>(pNode);
+			std::invoke(pThis->mFunction);
+			pThis->~post_task();
+			free_task(pThis, sizeof(post_task), alignof(post_task));
+		}
+	};
+
+	template <typename T, typename... Args>
+	T* create_task(Args&&... args)
+	{
+		void* const pMemory = allocate_task(sizeof(T), alignof(T));
+		try
+		{
+			return ::new(pMemory) T(std::forward<Args>(args)...);
+		}
+		catch(...)
+		{
+			free_task(pMemory, sizeof(T), alignof(T));
+			throw;
+		}
+	}
+
+	// Lets task_handle::wait on a worker thread run the pool's other tasks instead of blocking.
+	class thread_pool_base
+	{
+	public:
+		virtual bool run_one() noexcept = 0;
+
+	protected:
+		~thread_pool_base() = default;
+	};
+
+	struct worker_context
+	{
+		thread_pool_base* mpPool = nullptr;
+		size_t mIndex = 0;
+	};
+
+	inline worker_context& current_worker() noexcept
+	{
+		static thread_local worker_context tContext;
+		return tContext;
+	}
+
+}
+
+/*
+ * A future for a task submitted to a thread_pool. Like std::future it is move-only and
+ * get() may be called once; unlike it, waiting on a worker thread helps run the pool.
+ * */
+template <typename R>
+class task_handle
+{
+public:
+	using value_type = R;
+
+	task_handle() noexcept : mpState(nullptr) { }
+
+	task_handle(task_handle&& other) noexcept : mpState(other.mpState)
+	{
+		other.mpState = nullptr;
+	}
+
+	task_handle& operator=(task_handle&& other) noexcept
+	{
+		task_handle(std::move(other)).swap(*this);
+		return *this;
+	}
+
+	task_handle(const task_handle&) = delete;
+	task_handle& operator=(const task_handle&) = delete;
+
+	// Dropping a handle does not cancel or wait for its task.
+	~task_handle()
+	{
+		if(mpState)
+		{
+			mpState->release();
+		}
+	}
+
+	void swap(task_handle& other) noexcept
+	{
+		std::swap(mpState, other.mpState);
+	}
+
+	bool valid() const noexcept
+	{
+		return mpState != nullptr;
+	}
+
+	bool ready() const noexcept
+	{
+		return mpState->mReady.load(std::memory_order_acquire) != 0;
+	}
+
+	void wait() const noexcept;
+
+	// Waits for the task, then returns its result or rethrows its exception. The handle is then no longer valid.
+	R get();
+
+protected:
+	friend class thread_pool;
+
+	Thread_Pool_Internal::task_state<R>* mpState;
+
+	explicit task_handle(Thread_Pool_Internal::task_state<R>* pState) noexcept : mpState(pState) { }
+};
+
+template <typename R>
+inline void task_handle<R>::wait() const noexcept
+{
+	if(ready())
+	{
+		return;
+	}
+
+	if(Thread_Pool_Internal::thread_pool_base* const pPool = Thread_Pool_Internal::current_worker().mpPool)
+	{
+		// A worker must not block: the task may be sitting in its own deque.
+		while(!ready())
+		{
+			if(!pPool->run_one())
+			{
+				std::this_thread::yield();
+			}
+		}
+		return;
+	}
+
+	while(!ready())
+	{
+		mpState->mReady.wait(0, std::memory_order_acquire);
+	}
+}
+
+template <typename R>
+inline R task_handle<R>::get()
+{
+	wait();
+	task_handle handle(std::move(*this));
+	if(handle.mpState->mException)
+	{
+		std::rethrow_exception(handle.mpState->mException);
+	}
+	if constexpr(!std::is_void_v<R>)
+	{
+		return std::move(handle.mpState->value());
+	}
+}
+
+class thread_pool : protected Thread_Pool_Internal::thread_pool_base
+{
+public:
+	struct options
+	{
+		size_t mThreadCount = 0;      // 0 for std::thread::hardware_concurrency().
+		bool mPinThreads = false;     // Pins worker i to the i-th CPU this process may run on; Linux only.
+		uint32_t mSpinCount = 4096;   // Polls for work before an idle worker parks.
+		size_t mDequeCapacity = 256;  // Initial capacity of each worker's deque, which grows as needed.
+	};
+
+	thread_pool() : thread_pool(options()) { }
+	explicit thread_pool(const options& opts);
+	~thread_pool();
+
+	thread_pool(const thread_pool&) = delete;
+	thread_pool& operator=(const thread_pool&) = delete;
+
+	template <typename F>
+	auto submit(F&& f) -> task_handle<std::invoke_result_t<std::decay_t<F>&>>;
+
+	template <typename F>
+	void post(F&& f);
+
+	size_t thread_count() const noexcept
+	{
+		return mWorkerCount;
+	}
+
+	// The index of the calling worker of this pool, or -1 on any other thread.
+	ptrdiff_t current_worker_index() const noexcept
+	{
+		const Thread_Pool_Internal::worker_context& context = Thread_Pool_Internal::current_worker();
+		return (context.mpPool == this) ? (ptrdiff_t)context.mIndex : -1;
+	}
+
+protected:
+	using task_node = Thread_Pool_Internal::task_node;
+
+	struct alignas(Thread_Pool_Internal::kCacheLineSize) worker
+	{
+		Thread_Pool_Internal::work_stealing_deque mDeque;
+		std::thread mThread;
+		uint64_t mRandom; // Picks steal victims.
+		int mCpu;         // -1 if not pinned.
+
+		worker(size_t capacity, uint64_t seed) : mDeque(capacity), mRandom(seed), mCpu(-1) { }
+	};
+
+	options mOptions;
+	worker* mpWorkers;
+	size_t mWorkerCount;
+
+	std::mutex mInjectionMutex;
+	task_node* mpInjectionHead;
+	task_node* mpInjectionTail;
+	std::atomic<size_t> mInjectionSize;
+
+	alignas(Thread_Pool_Internal::kCacheLineSize) std::atomic<uint32_t> mSleepers;
+	std::atomic<uint32_t> mWakeups; // Bumped to wake parked workers, which wait on it.
+	std::atomic<bool> mStopping;
+
+	void schedule(task_node* pTask);
+	void inject(task_node* pTask);
+	void wake_one() noexcept;
+	bool run_one() noexcept override;
+	task_node* find_task(size_t index) noexcept;
+	task_node* take_injected(size_t index) noexcept;
+	bool has_work() const noexcept;
+	void park() noexcept;
+	void run(size_t index) noexcept;
+	void assign_cpus() noexcept;
+	void pin_current_thread(int cpu) noexcept;
+};
+
+inline thread_pool::thread_pool(const options& opts)
+	: mOptions(opts), mpWorkers(nullptr), mWorkerCount(0), mpInjectionHead(nullptr), mpInjectionTail(nullptr), mInjectionSize(0),
+	  mSleepers(0), mWakeups(0), mStopping(false)
+{
+	size_t count = mOptions.mThreadCount ? mOptions.mThreadCount : (size_t)std::thread::hardware_concurrency();
+	if(count == 0)
+	{
+		count = 1;
+	}
+
+	rstl::allocator allocator;
+	mpWorkers = static_cast<worker*>(allocate_memory(allocator, count * sizeof(worker), alignof(worker), 0));
+	if(!mpWorkers)
+	{
+		throw std::bad_alloc();
+	}
+	try
+	{
+		for(; mWorkerCount < count; ++mWorkerCount)
+		{
+			::new(static_cast<void*>(mpWorkers + mWorkerCount)) worker(mOptions.mDequeCapacity, 0x9E3779B97F4A7C15ull * (mWorkerCount + 1));
+		}
+	}
+	catch(...)
+	{
+		while(mWorkerCount)
+		{
+			mpWorkers[--mWorkerCount].~worker();
+		}
+		CUSTOM_FREE(allocator, mpWorkers, count * sizeof(worker));
+		throw;
+	}
+
+	if(mOptions.mPinThreads)
+	{
+		assign_cpus();
+	}
+
+	size_t started = 0;
+	try
+	{
+		for(; started < mWorkerCount; ++started)
+		{
+			mpWorkers[started].mThread = std::thread([this, started] { run(started); });
+		}
+	}
+	catch(...)
+	{
+		// The workers that did start see mStopping at once, since nothing has been submitted yet.
+		mStopping.store(true, std::memory_order_seq_cst);
+		mWakeups.fetch_add(1, std::memory_order_release);
+		mWakeups.notify_all();
+		for(size_t i = 0; i < started; ++i)
+		{
+			mpWorkers[i].mThread.join();
+		}
+		for(size_t i = 0; i < mWorkerCount; ++i)
+		{
+			mpWorkers[i].~worker();
+		}
+		CUSTOM_FREE(allocator, mpWorkers, count * sizeof(worker));
+		throw;
+	}
+}
+
+inline thread_pool::~thread_pool()
+{
+	mStopping.store(true, std::memory_order_seq_cst);
+	mWakeups.fetch_add(1, std::memory_order_release);
+	mWakeups.notify_all();
+	for(size_t i = 0; i < mWorkerCount; ++i)
+	{
+		mpWorkers[i].mThread.join();
+	}
+
+	rstl::allocator allocator;
+	for(size_t i = 0; i < mWorkerCount; ++i)
+	{
+		mpWorkers[i].~worker();
+	}
+	CUSTOM_FREE(allocator, mpWorkers, mWorkerCount * sizeof(worker));
+}
+
+template <typename F>
+inline auto thread_pool::submit(F&& f) -> task_handle<std::invoke_result_t<std::decay_t<F>&>>
+{
+	using function_type = std::decay_t<F>;
+	using result_type = std::invoke_result_t<function_type&>;
+	using task_type = Thread_Pool_Internal::handle_task<function_type, result_type>;
+	static_assert(!std::is_reference_v<result_type>, "thread_pool::submit: return a pointer or a std::reference_wrapper instead of a reference");
+
+	task_type* const pTask = Thread_Pool_Internal::create_task<task_type>(std::forward<F>(f));
+	task_handle<result_type> handle(pTask);
+	try
+	{
+		schedule(pTask);
+	}
+	catch(...)
+	{
+		// Never queued: drop the task's own reference along with the function.
+		pTask->function().~function_type();
+		pTask->release();
+		throw;
+	}
+	return handle;
+}
+
+template <typename F>
+inline void thread_pool::post(F&& f)
+{
+	using task_type = Thread_Pool_Internal::post_task<std::decay_t<F>>;
+
+	task_type* const pTask = Thread_Pool_Internal::create_task<task_type>(std::forward<F>(f));
+	try
+	{
+		schedule(pTask);
+	}
+	catch(...)
+	{
+		pTask->~task_type();
+		Thread_Pool_Internal::free_task(pTask, sizeof(task_type), alignof(task_type));
+		throw;
+	}
+}
+
+inline void thread_pool::schedule(task_node* pTask)
+{
+	const ptrdiff_t index = current_worker_index();
+	if(index >= 0)
+	{
+		mpWorkers[index].mDeque.push(pTask);
+	}
+	else
+	{
+		inject(pTask);
+	}
+	wake_one();
+}
+
+inline void thread_pool::inject(task_node* pTask)
+{
+	pTask->mpNext = nullptr;
+	std::lock_guard<std::mutex> lock(mInjectionMutex);
+	if(mpInjectionTail)
+	{
+		mpInjectionTail->mpNext = pTask;
+	}
+	else
+	{
+		mpInjectionHead = pTask;
+	}
+	mpInjectionTail = pTask;
+	mInjectionSize.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void thread_pool::wake_one() noexcept
+{
+	// Pairs with the fence in park(): either the worker sees the new task or this sees the worker.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if(mSleepers.load(std::memory_order_relaxed) != 0)
+	{
+		mWakeups.fetch_add(1, std::memory_order_release);
+		mWakeups.notify_one();
+	}
+}
+
+inline thread_pool::task_node* thread_pool::take_injected(size_t index) noexcept
+{
+	if(mInjectionSize.load(std::memory_order_relaxed) == 0)
+	{
+		return nullptr;
+	}
+
+	task_node* pBatch;
+	size_t count;
+	{
+		std::lock_guard<std::mutex> lock(mInjectionMutex);
+		const size_t size = mInjectionSize.load(std::memory_order_relaxed);
+		if(size == 0)
+		{
+			return nullptr;
+		}
+
+		// A fair share, so that one worker does not hoard a burst of submissions.
+		count = size / mWorkerCount + 1;
+		if(count > Thread_Pool_Internal::kMaxInjectionBatch)
+		{
+			count = Thread_Pool_Internal::kMaxInjectionBatch;
+		}
+		if(count > size)
+		{
+			count = size;
+		}
+
+		pBatch = mpInjectionHead;
+		task_node* pLast = pBatch;
+		for(size_t i = 1; i < count; ++i)
+		{
+			pLast = pLast->mpNext;
+		}
+		mpInjectionHead = pLast->mpNext;
+		if(!mpInjectionHead)
+		{
+			mpInjectionTail = nullptr;
+		}
+		mInjectionSize.store(size - count, std::memory_order_relaxed);
+	}
+
+	// Run the first; the rest go onto this worker's deque, where idle workers can steal them.
+	task_node* const pFirst = pBatch;
+	task_node* pRest = pBatch->mpNext;
+	for(size_t i = 1; i < count; ++i)
+	{
+		task_node* const pNext = pRest->mpNext;
+		try
+		{
+			mpWorkers[index].mDeque.push(pRest);
+		}
+		catch(...)
+		{
+			// No memory to grow the deque: put the remainder back at the front of the queue.
+			task_node* pTail = pRest;
+			for(size_t j = i + 1; j < count; ++j)
+			{
+				pTail = pTail->mpNext;
+			}
+			std::lock_guard<std::mutex> lock(mInjectionMutex);
+			pTail->mpNext = mpInjectionHead;
+			mpInjectionHead = pRest;
+			if(!mpInjectionTail)
+			{
+				mpInjectionTail = pTail;
+			}
+			mInjectionSize.fetch_add(count - i, std::memory_order_relaxed);
+			break;
+		}
+		pRest = pNext;
+	}
+	if(count > 1)
+	{
+		wake_one();
+	}
+	return pFirst;
+}
+
+inline thread_pool::task_node* thread_pool::find_task(size_t index) noexcept
+{
+	worker& self = mpWorkers[index];
+	if(task_node* const pTask = self.mDeque.pop())
+	{
+		return pTask;
+	}
+	if(task_node* const pTask = take_injected(index))
+	{
+		return pTask;
+	}
+
+	// Steal from each other worker once, starting at a random one.
+	if(mWorkerCount > 1)
+	{
+		self.mRandom ^= self.mRandom << 13;
+		self.mRandom ^= self.mRandom >> 7;
+		self.mRandom ^= self.mRandom << 17;
+		const size_t start = (size_t)(self.mRandom % mWorkerCount);
+		for(size_t i = 0; i < mWorkerCount; ++i)
+		{
+			const size_t victim = (start + i) % mWorkerCount;
+			if(victim == index)
+			{
+				continue;
+			}
+			if(task_node* const pTask = mpWorkers[victim].mDeque.steal())
+			{
+				return pTask;
+			}
+		}
+	}
+	return nullptr;
+}
+
+inline bool thread_pool::run_one() noexcept
+{
+	const ptrdiff_t index = current_worker_index();
+	if(index < 0)
+	{
+		return false;
+	}
+	task_node* const pTask = find_task((size_t)index);
+	if(!pTask)
+	{
+		return false;
+	}
+	pTask->mpRun(pTask);
+	return true;
+}
+
+inline bool thread_pool::has_work() const noexcept
+{
+	if(mInjectionSize.load(std::memory_order_relaxed) != 0)
+	{
+		return true;
+	}
+	for(size_t i = 0; i < mWorkerCount; ++i)
+	{
+		if(!mpWorkers[i].mDeque.empty())
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+inline void thread_pool::park() noexcept
+{
+	const uint32_t wakeups = mWakeups.load(std::memory_order_acquire);
+	mSleepers.fetch_add(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if(!has_work() && !mStopping.load(std::memory_order_relaxed))
+	{
+		mWakeups.wait(wakeups, std::memory_order_acquire);
+	}
+	mSleepers.fetch_sub(1, std::memory_order_relaxed);
+}
+
+inline void thread_pool::run(size_t index) noexcept
+{
+	Thread_Pool_Internal::worker_context& context = Thread_Pool_Internal::current_worker();
+	context.mpPool = this;
+	context.mIndex = index;
+	if(mpWorkers[index].mCpu >= 0)
+	{
+		pin_current_thread(mpWorkers[index].mCpu);
+	}
+
+	for(;;)
+	{
+		task_node* pTask = find_task(index);
+		for(uint32_t spin = 0; !pTask && (spin < mOptions.mSpinCount); ++spin)
+		{
+			// Yield for the second half, so that spinning workers give way on an oversubscribed machine.
+			if(spin < mOptions.mSpinCount / 2)
+			{
+				Thread_Pool_Internal::cpu_relax();
+			}
+			else
+			{
+				std::this_thread::yield();
+			}
+			pTask = find_task(index);
+		}
+
+		if(pTask)
+		{
+			pTask->mpRun(pTask);
+			continue;
+		}
+
+		// Stop only once nothing is left anywhere; a running task may still submit more, but only to its own worker.
+		if(mStopping.load(std::memory_order_acquire))
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if(!has_work())
+			{
+				break;
+			}
+			continue;
+		}
+		park();
+	}
+
+	context = Thread_Pool_Internal::worker_context();
+}
+
+inline void thread_pool::assign_cpus() noexcept
+{
+#if defined(__linux__)
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+	{
+		return;
+	}
+
+	int cpus[CPU_SETSIZE];
+	size_t cpuCount = 0;
+	for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+	{
+		if(CPU_ISSET(cpu, &allowed))
+		{
+			cpus[cpuCount++] = cpu;
+		}
+	}
+	for(size_t i = 0; cpuCount && (i < mWorkerCount); ++i)
+	{
+		mpWorkers[i].mCpu = cpus[i % cpuCount];
+	}
+#endif
+}
+
+inline void thread_pool::pin_current_thread(int cpu) noexcept
+{
+#if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set); // Best effort: an unpinned worker still works.
+#else
+	(void)cpu;
+#endif
+}
+
+RSTL_NAMESPACE_END
+
+#endif //RSTL_THREAD_POOL_H
@@ -0,0 +1,127 @@
+#include "test_common.h"
+
+#include "allocator_stats.h"
+
+#include <cstring>
+#include <string>
+#include <thread>
+
+/*
+ * The registry keeps its own copy of each name, so stats stay readable after the
+ * allocator's name string is gone and a reused address is not mistaken for it.
+ *
+ * Traffic recorded by thread_local destructors that run after the thread's stats are
+ * gone still counts.
+ * */
+
+namespace {
+
+	// Records nothing itself, so the counts below hold whatever RSTL_ALLOCATOR_STATS is.
+	class named_allocator
+	{
+	public:
+		explicit named_allocator(const char* pName) : mpName(pName) { }
+
+		void* allocate(size_t n, int = 0) { return ::operator new(n); }
+		void deallocate(void* p, size_t) { ::operator delete(p); }
+		const char* get_name() const { return mpName; }
+
+	protected:
+		const char* mpName;
+	};
+
+	using tracked_named_allocator = rstl::tracked_allocator<named_allocator>;
+
+	const rstl::allocator_stats* find_stats(const std::vector<rstl::allocator_stats>& stats, const char* pName)
+	{
+		for(const rstl::allocator_stats& entry : stats)
+		{
+			if(std::strcmp(entry.mpName, pName) == 0)
+			{
+				return &entry;
+			}
+		}
+		return nullptr;
+	}
+
+	void test_name_outlives_caller_string()
+	{
+		char* pName = new char[32];
+		std::strcpy(pName, "transient");
+		{
+			tracked_named_allocator a(named_allocator{pName});
+			a.deallocate(a.allocate(100), 100);
+		}
+
+		// Same address, different content: must land in a slot of its own.
+		std::strcpy(pName, "reused");
+		{
+			tracked_named_allocator a(named_allocator{pName});
+			a.deallocate(a.allocate(200), 200);
+			a.deallocate(a.allocate(200), 200);
+		}
+		std::memset(pName, 'x', 31);
+		delete[] pName;
+
+		const std::vector<rstl::allocator_stats> stats = rstl::get_allocator_stats();
+		const rstl::allocator_stats* const pTransient = find_stats(stats, "transient");
+		const rstl::allocator_stats* const pReused = find_stats(stats, "reused");
+		RSTL_TEST_CHECK(pTransient && pTransient->mAllocations == 1 && pTransient->mAllocatedBytes == 100);
+		RSTL_TEST_CHECK(pReused && pReused->mAllocations == 2 && pReused->mAllocatedBytes == 400);
+	}
+
+	struct late_user
+	{
+		bool mbActive = false;
+
+		// Constructed before the thread's stats, so destroyed after them.
+		~late_user()
+		{
+			if(mbActive)
+			{
+				tracked_named_allocator a(named_allocator{"late"});
+				a.deallocate(a.allocate(300), 300);
+			}
+		}
+	};
+
+	thread_local late_user tLateUser;
+
+	void test_use_after_thread_stats_destroyed()
+	{
+		std::thread worker([]
+		{
+			tLateUser.mbActive = true;
+			tracked_named_allocator a(named_allocator{"late"});
+			a.deallocate(a.allocate(100), 100);
+		});
+		worker.join();
+
+		const std::vector<rstl::allocator_stats> stats = rstl::get_allocator_stats();
+		const rstl::allocator_stats* const pLate = find_stats(stats, "late");
+		RSTL_TEST_CHECK(pLate && pLate->mAllocations == 2 && pLate->mFrees == 2);
+		RSTL_TEST_CHECK(pLate->mAllocatedBytes == 400 && pLate->mLiveBytes == 0);
+	}
+
+	void test_long_name_is_truncated()
+	{
+		const std::string longName(rstl::Allocator_Stats_Internal::kMaxNameLength * 2, 'n');
+		tracked_named_allocator a(named_allocator(longName.c_str()));
+		a.deallocate(a.allocate(16), 16);
+		a.deallocate(a.allocate(16), 16);
+
+		const std::string truncated = longName.substr(0, rstl::Allocator_Stats_Internal::kMaxNameLength - 1);
+		const std::vector<rstl::allocator_stats> stats = rstl::get_allocator_stats();
+		const rstl::allocator_stats* const pStats = find_stats(stats, truncated.c_str());
+		RSTL_TEST_CHECK(pStats && pStats->mAllocations == 2);
+	}
+
+}
+
+int main()
+{
+	test_name_outlives_caller_string();
+	test_long_name_is_truncated();
+	test_use_after_thread_stats_destroyed();
+	return 0;
+}
@@ -0,0 +1,86 @@
+#include "test_common.h"
+
+#include "allocator.h"
+#include "allocator_trace.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+/*
+ * A trace records an explicitly requested alignment as is, and an allocation at the
+ * wrapped allocator's own default as unspecified, since wrapped allocators differ in
+ * what that default is.
+ * */
+
+namespace {
+
+	const char* const kTracePath = "allocator_trace_test.trace";
+
+	// Doesn't record itself, so the trace only holds what traced_allocator saw.
+	class heap_allocator
+	{
+	public:
+		void* allocate(size_t n, int = 0) { return std::malloc(n); }
+		void* allocate(size_t n, size_t alignment, size_t, int = 0) { return std::aligned_alloc(alignment, (n + alignment - 1) & ~(alignment - 1)); }
+		void deallocate(void* p, size_t) { std::free(p); }
+	};
+
+	std::vector<rstl::allocation_trace_record> read_trace(const char* pPath)
+	{
+		std::vector<rstl::allocation_trace_record> records;
+		FILE* const pFile = std::fopen(pPath, "rb");
+		RSTL_TEST_CHECK(pFile != nullptr);
+
+		char magic[sizeof(rstl::kAllocationTraceMagic)];
+		RSTL_TEST_CHECK(std::fread(magic, sizeof(magic), 1, pFile) == 1);
+
+		rstl::allocation_trace_record record;
+		while(std::fread(&record, sizeof(record), 1, pFile) == 1)
+		{
+			records.push_back(record);
+		}
+		std::fclose(pFile);
+		return records;
+	}
+
+	void test_alignment_is_recorded()
+	{
+		RSTL_TEST_CHECK(rstl::start_allocation_trace(kTracePath));
+		{
+			rstl::traced_allocator<heap_allocator> allocator;
+			allocator.deallocate(allocator.allocate(24), 24);
+			allocator.deallocate(allocator.allocate(100, 64, 0), 100);
+		}
+		rstl::stop_allocation_trace();
+
+		size_t unspecifiedCount = 0;
+		size_t alignedCount = 0;
+		for(const rstl::allocation_trace_record& r : read_trace(kTracePath))
+		{
+			if(r.mKind != rstl::TRACE_ALLOCATE)
+			{
+				continue;
+			}
+			if(r.mSize == 24)
+			{
+				RSTL_TEST_CHECK(r.mAlignmentLog2 == rstl::kTraceAlignmentUnspecified);
+				++unspecifiedCount;
+			}
+			else if(r.mSize == 100)
+			{
+				RSTL_TEST_CHECK(((size_t)1 << r.mAlignmentLog2) == 64);
+				++alignedCount;
+			}
+		}
+		RSTL_TEST_CHECK(unspecifiedCount > 0 && alignedCount > 0);
+		std::remove(kTracePath);
+	}
+
+}
+
+int main()
+{
+	test_alignment_is_recorded();
+	return 0;
+}
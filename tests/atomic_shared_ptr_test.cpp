@@ -0,0 +1,152 @@
+#include "test_common.h"
+
+#include "atomic_shared_ptr.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/*
+ * Borrows counted in the slot's word are always handed back, whether the slot still
+ * names the node or a store swapped it out meanwhile: loads racing stores never see a
+ * destroyed value, every value is destroyed exactly once, and a quiet slot's value has
+ * exactly the owners it should. compare_exchange_strong loses no updates.
+ * */
+
+namespace {
+
+	constexpr int kThreadCount = 4;
+	constexpr int kRounds = 20000;
+	constexpr int kLiveMagic = 0x5eed;
+
+	std::atomic<int> gLiveValues(0);
+
+	struct value
+	{
+		int mMagic = kLiveMagic;
+		int mNumber;
+
+		explicit value(int number) : mNumber(number)
+		{
+			gLiveValues.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		~value()
+		{
+			mMagic = 0;
+			gLiveValues.fetch_sub(1, std::memory_order_relaxed);
+		}
+	};
+
+	void test_counts_settle()
+	{
+		rstl::atomic_shared_ptr<value> slot(rstl::make_shared<value>(0));
+		{
+			rstl::shared_ptr<value> a = slot.load();
+			rstl::shared_ptr<value> b = slot.load();
+			RSTL_TEST_CHECK(a.get() == b.get());
+			RSTL_TEST_CHECK(a.use_count() == 3);
+		}
+		RSTL_TEST_CHECK(slot.load().use_count() == 2);
+
+		rstl::shared_ptr<value> old = slot.exchange(rstl::make_shared<value>(1));
+		RSTL_TEST_CHECK(old->mNumber == 0 && old.use_count() == 1);
+		old.reset();
+		RSTL_TEST_CHECK(gLiveValues.load() == 1);
+
+		slot.store(nullptr);
+		RSTL_TEST_CHECK(!slot.load());
+		RSTL_TEST_CHECK(gLiveValues.load() == 0);
+	}
+
+	void test_loads_race_stores()
+	{
+		rstl::atomic_shared_ptr<value> slot(rstl::make_shared<value>(0));
+		std::atomic<bool> bFailed(false);
+		std::atomic<int> writersLeft(kThreadCount / 2);
+
+		std::vector<std::thread> threads;
+		for(int t = 0; t < kThreadCount / 2; ++t)
+		{
+			threads.emplace_back([&, t]
+			{
+				for(int round = 0; round < kRounds; ++round)
+				{
+					slot.store(rstl::make_shared<value>(t * kRounds + round));
+				}
+				writersLeft.fetch_sub(1, std::memory_order_release);
+			});
+			threads.emplace_back([&]
+			{
+				while(writersLeft.load(std::memory_order_acquire) > 0)
+				{
+					const rstl::shared_ptr<value> p = slot.load();
+					if(!p || p->mMagic != kLiveMagic)
+					{
+						bFailed.store(true);
+					}
+				}
+			});
+		}
+		for(std::thread& thread : threads)
+		{
+			thread.join();
+		}
+
+		RSTL_TEST_CHECK(!bFailed.load());
+		RSTL_TEST_CHECK(gLiveValues.load() == 1);
+		RSTL_TEST_CHECK(slot.load().use_count() == 2);
+		slot.store(nullptr);
+		RSTL_TEST_CHECK(gLiveValues.load() == 0);
+	}
+
+	void test_compare_exchange_loses_no_updates()
+	{
+		rstl::atomic_shared_ptr<value> slot(rstl::make_shared<value>(0));
+
+		std::vector<std::thread> threads;
+		for(int t = 0; t < kThreadCount; ++t)
+		{
+			threads.emplace_back([&]
+			{
+				for(int round = 0; round < kRounds / 4; ++round)
+				{
+					rstl::shared_ptr<value> expected = slot.load();
+					while(!slot.compare_exchange_strong(expected, rstl::make_shared<value>(expected->mNumber + 1)))
+					{
+
+					}
+				}
+			});
+		}
+		for(std::thread& thread : threads)
+		{
+			thread.join();
+		}
+
+		RSTL_TEST_CHECK(slot.load()->mNumber == kThreadCount * (kRounds / 4));
+		slot.store(nullptr);
+		RSTL_TEST_CHECK(gLiveValues.load() == 0);
+	}
+
+	void test_weak_slot_expires()
+	{
+		rstl::shared_ptr<value> strong = rstl::make_shared<value>(7);
+		rstl::atomic_weak_ptr<value> slot(strong);
+		RSTL_TEST_CHECK(slot.load().lock().get() == strong.get());
+
+		strong.reset();
+		RSTL_TEST_CHECK(gLiveValues.load() == 0);
+		RSTL_TEST_CHECK(slot.load().expired());
+	}
+
+}
+
+int main()
+{
+	test_counts_settle();
+	test_loads_race_stores();
+	test_compare_exchange_loses_no_updates();
+	test_weak_slot_expires();
+	return 0;
+}
@@ -0,0 +1,183 @@
+#include "test_common.h"
+
+#include "biased_shared_ptr.h"
+
+#include <atomic>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*
+ * Ownership passes correctly between the owner's biased count and the shared count:
+ * an object whose last reference is dropped off the owner thread is destroyed exactly
+ * once, by the merge on the owner, by the dropping thread once the owner has merged or
+ * exited, and never while a reference is still out.
+ * */
+
+namespace {
+
+	constexpr int kThreadCount = 4;
+	constexpr int kRounds = 2000;
+
+	std::atomic<int> gLiveValues(0);
+
+	struct value
+	{
+		int mNumber;
+
+		explicit value(int number) : mNumber(number)
+		{
+			gLiveValues.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		~value()
+		{
+			gLiveValues.fetch_sub(1, std::memory_order_relaxed);
+		}
+	};
+
+	void test_owner_only()
+	{
+		rstl::shared_ptr<value> p = rstl::make_biased_shared<value>(1);
+		{
+			rstl::shared_ptr<value> copy = p;
+			RSTL_TEST_CHECK(p.use_count() == 2);
+			rstl::weak_ptr<value> weak = p;
+			RSTL_TEST_CHECK(weak.lock().get() == p.get());
+		}
+		RSTL_TEST_CHECK(p.use_count() == 1);
+		p.reset();
+		RSTL_TEST_CHECK(gLiveValues.load() == 0);
+	}
+
+	void test_owner_lets_go_first()
+	{
+		rstl::shared_ptr<value> p = rstl::make_biased_shared<value>(2);
+		rstl::shared_ptr<value> held;
+		std::thread taker([&]
+		{
+			held = p;
+		});
+		taker.join();
+
+		// The biased count reaches zero and merges, so the other reference finishes alone.
+		p.reset();
+		RSTL_TEST_CHECK(gLiveValues.load() == 1);
+		std::thread releaser([&]
+		{
+			RSTL_TEST_CHECK(held.use_count() == 1);
+			held.reset();
+			RSTL_TEST_CHECK(gLiveValues.load() == 0);
+		});
+		releaser.join();
+	}
+
+	void test_release_elsewhere_is_merged_by_owner()
+	{
+		rstl::shared_ptr<value> p = rstl::make_biased_shared<value>(3);
+		rstl::shared_ptr<value> handed = p;
+
+		// Drops a reference the owner took, so the block is queued to the owner.
+		std::thread worker([&]
+		{
+			handed.reset();
+		});
+		worker.join();
+		RSTL_TEST_CHECK(gLiveValues.load() == 1);
+		RSTL_TEST_CHECK(p.use_count() == 1);
+
+		rstl::merge_biased_shared();
+		RSTL_TEST_CHECK(gLiveValues.load() == 1);
+		RSTL_TEST_CHECK(p.use_count() == 1);
+		p.reset();
+		RSTL_TEST_CHECK(gLiveValues.load() == 0);
+	}
+
+	void test_last_release_elsewhere_is_destroyed_by_merge()
+	{
+		rstl::shared_ptr<value> p = rstl::make_biased_shared<value>(4);
+		std::thread worker([handed = std::move(p)]() mutable
+		{
+			handed.reset();
+		});
+		worker.join();
+
+		rstl::merge_biased_shared();
+		RSTL_TEST_CHECK(gLiveValues.load() == 0);
+	}
+
+	void test_owner_exits_first()
+	{
+		rstl::shared_ptr<value> p;
+		std::thread owner([&]
+		{
+			p = rstl::make_biased_shared<value>(5);
+		});
+		owner.join();
+
+		RSTL_TEST_CHECK(p.use_count() == 1);
+		rstl::shared_ptr<value> copy = p;
+		p.reset();
+		RSTL_TEST_CHECK(gLiveValues.load() == 1);
+		copy.reset();
+		RSTL_TEST_CHECK(gLiveValues.load() == 0);
+	}
+
+	void test_copies_on_many_threads()
+	{
+		std::atomic<bool> bFailed(false);
+		for(int round = 0; round < kRounds / 20; ++round)
+		{
+			rstl::shared_ptr<value> p = rstl::make_biased_shared<value>(round);
+			rstl::weak_ptr<value> weak = p;
+
+			std::vector<std::thread> threads;
+			for(int t = 0; t < kThreadCount; ++t)
+			{
+				threads.emplace_back([&bFailed, &weak, handed = rstl::shared_ptr<value>(p), round]() mutable
+				{
+					for(int i = 0; i < kRounds / 20; ++i)
+					{
+						rstl::shared_ptr<value> copy = handed;
+						rstl::shared_ptr<value> locked = weak.lock();
+						if(!locked || locked->mNumber != round)
+						{
+							bFailed.store(true);
+						}
+					}
+					handed.reset();
+				});
+			}
+
+			// The owner keeps copying while the other threads drop the references it took.
+			for(int i = 0; i < kRounds / 20; ++i)
+			{
+				rstl::shared_ptr<value> copy = p;
+				rstl::merge_biased_shared();
+			}
+			for(std::thread& thread : threads)
+			{
+				thread.join();
+			}
+
+			RSTL_TEST_CHECK(gLiveValues.load() == 1);
+			p.reset();
+			rstl::merge_biased_shared();
+			RSTL_TEST_CHECK(gLiveValues.load() == 0);
+			RSTL_TEST_CHECK(weak.expired());
+		}
+		RSTL_TEST_CHECK(!bFailed.load());
+	}
+
+}
+
+int main()
+{
+	test_owner_only();
+	test_owner_lets_go_first();
+	test_release_elsewhere_is_merged_by_owner();
+	test_last_release_elsewhere_is_destroyed_by_merge();
+	test_owner_exits_first();
+	test_copies_on_many_threads();
+	return 0;
+}
@@ -0,0 +1,215 @@
+#include "test_common.h"
+
+#include "memory_resource.h"
+#include "shared_ptr.h"
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+/*
+ * GetDefaultAllocator(), default_allocfreemethod and polymorphic_allocator allocate
+ * from the default resource: a default_allocator_scope on this thread, otherwise
+ * SetDefaultAllocator's, otherwise the heap. Blocks go back to the resource they came
+ * from wherever they are freed. Every other rstl::allocator, and so everything the
+ * library allocates for itself, stays on the heap.
+ * */
+
+namespace {
+
+	// Larger than the thread cache serves, since with RSTL_THREAD_CACHE_DEFAULT_ALLOCATOR those requests stay with the caches.
+	const size_t kSize = 512;
+
+	struct payload
+	{
+		char mBytes[kSize];
+	};
+
+	// Forwards to the heap and counts what passes through.
+	class counting_resource : public rstl::memory_resource
+	{
+	public:
+		std::atomic<size_t> mAllocations{ 0 };
+		std::atomic<size_t> mDeallocations{ 0 };
+
+	protected:
+		void* do_allocate(size_t n, size_t alignment, size_t offset, int flags) override
+		{
+			mAllocations.fetch_add(1, std::memory_order_relaxed);
+			return rstl::heap_resource()->allocate(n, alignment, offset, flags);
+		}
+
+		void do_deallocate(void* p, size_t n) override
+		{
+			mDeallocations.fetch_add(1, std::memory_order_relaxed);
+			rstl::heap_resource()->deallocate(p, n);
+		}
+
+		bool do_is_equal(const rstl::memory_resource& other) const noexcept override
+		{
+			return this == &other;
+		}
+	};
+
+	void test_scope_allocates_from_arena()
+	{
+		rstl::monotonic_buffer_resource arenaResource;
+		rstl::arena& arena = arenaResource.get_arena();
+		rstl::allocator& allocator = *rstl::GetDefaultAllocator();
+
+		void* pOutside = allocator.allocate(kSize);
+		RSTL_TEST_CHECK(!arena.owns(pOutside));
+
+		void* pInside;
+		void* pAligned;
+		void* pFreeMethod;
+		{
+			rstl::default_allocator_scope scope(&arenaResource);
+			RSTL_TEST_CHECK(rstl::get_default_resource() == &arenaResource);
+
+			pInside = allocator.allocate(kSize);
+			RSTL_TEST_CHECK(arena.owns(pInside));
+
+			pAligned = allocator.allocate(kSize, 64, 0);
+			RSTL_TEST_CHECK(arena.owns(pAligned));
+			RSTL_TEST_CHECK(((uintptr_t)pAligned % 64) == 0);
+
+			pFreeMethod = rstl::default_allocfreemethod(kSize, nullptr, nullptr);
+			RSTL_TEST_CHECK(arena.owns(pFreeMethod));
+
+			rstl::shared_ptr<payload> sp = rstl::allocate_shared<payload>(rstl::polymorphic_allocator());
+			RSTL_TEST_CHECK(arena.owns(sp.get()));
+
+			// Nobody asked make_shared or a local rstl::allocator for the default resource.
+			rstl::shared_ptr<payload> spHeap = rstl::make_shared<payload>();
+			RSTL_TEST_CHECK(!arena.owns(spHeap.get()));
+			rstl::allocator local;
+			void* const pLocal = local.allocate(kSize);
+			RSTL_TEST_CHECK(!arena.owns(pLocal));
+			local.deallocate(pLocal, kSize);
+
+			// A block from before the scope still goes back to the heap.
+			allocator.deallocate(pOutside, kSize);
+		}
+		RSTL_TEST_CHECK(rstl::get_default_resource() == rstl::heap_resource());
+
+		// Blocks from the scope go back to the arena after it ends.
+		allocator.deallocate(pInside, kSize);
+		allocator.deallocate(pAligned, kSize);
+		rstl::default_allocfreemethod(kSize, pFreeMethod, nullptr);
+		void* const pAfter = allocator.allocate(kSize);
+		RSTL_TEST_CHECK(!arena.owns(pAfter));
+		allocator.deallocate(pAfter, kSize);
+	}
+
+	void test_arena_allocator_and_pool_behind_a_scope()
+	{
+		rstl::arena arena;
+		rstl::allocator_resource<rstl::arena_allocator> arenaResource{ rstl::arena_allocator(arena) };
+		{
+			rstl::default_allocator_scope scope(&arenaResource);
+			void* const p = rstl::GetDefaultAllocator()->allocate(kSize, rstl::MEN_TEMP);
+			RSTL_TEST_CHECK(arena.owns(p));
+			rstl::GetDefaultAllocator()->deallocate(p, kSize);
+		}
+
+		// pool_allocator takes its chunks from rstl::allocator, which must not come back to the pool.
+		rstl::pool_allocator::pool pool;
+		rstl::allocator_resource<rstl::pool_allocator> poolResource{ rstl::pool_allocator(pool) };
+		{
+			rstl::default_allocator_scope scope(&poolResource);
+			rstl::allocator& allocator = *rstl::GetDefaultAllocator();
+			void* const pSmall = allocator.allocate(32);
+			void* const pLarge = allocator.allocate(4096);
+			RSTL_TEST_CHECK(pSmall && pLarge);
+			allocator.deallocate(pSmall, 32);
+			allocator.deallocate(pLarge, 4096);
+		}
+	}
+
+	void test_scopes_nest_and_override_the_global_default()
+	{
+		counting_resource global;
+		counting_resource local;
+		rstl::memory_resource* const pPrevious = rstl::SetDefaultAllocator(&global);
+		RSTL_TEST_CHECK(pPrevious == rstl::heap_resource());
+
+		rstl::allocator& allocator = *rstl::GetDefaultAllocator();
+		void* const pGlobal = allocator.allocate(kSize);
+		RSTL_TEST_CHECK(global.mAllocations == 1);
+		{
+			rstl::default_allocator_scope outer(&local);
+			void* const pLocal = allocator.allocate(kSize);
+			{
+				rstl::default_allocator_scope inner(rstl::heap_resource());
+				allocator.deallocate(allocator.allocate(kSize), kSize);
+			}
+			RSTL_TEST_CHECK(local.mAllocations == 1);
+			allocator.deallocate(pLocal, kSize);
+			RSTL_TEST_CHECK(local.mDeallocations == 1);
+		}
+
+		// The process-wide default applies on every thread that has no scope of its own.
+		std::thread([&allocator] { allocator.deallocate(allocator.allocate(kSize), kSize); }).join();
+		RSTL_TEST_CHECK(global.mAllocations == 2);
+
+		RSTL_TEST_CHECK(rstl::SetDefaultAllocator(nullptr) == &global);
+		allocator.deallocate(pGlobal, kSize);
+		RSTL_TEST_CHECK(global.mDeallocations == 2);
+		RSTL_TEST_CHECK(rstl::get_default_resource() == rstl::heap_resource());
+	}
+
+	void test_pool_refilled_in_a_scope_outlives_it()
+	{
+		rstl::pool_allocator::pool pool;
+		rstl::pool_allocator poolAllocator(pool);
+		void* pBlock;
+		{
+			// The arena is gone by the time the pool hands out the rest of the chunk.
+			rstl::monotonic_buffer_resource arenaResource;
+			rstl::default_allocator_scope scope(&arenaResource);
+			pBlock = poolAllocator.allocate(32);
+			RSTL_TEST_CHECK(!arenaResource.get_arena().owns(pBlock));
+		}
+
+		void* blocks[64];
+		for(void*& p : blocks)
+		{
+			p = poolAllocator.allocate(32);
+			RSTL_TEST_CHECK(p != nullptr);
+			std::memset(p, 0xab, 32);
+		}
+		for(void* const p : blocks)
+		{
+			poolAllocator.deallocate(p, 32);
+		}
+		poolAllocator.deallocate(pBlock, 32);
+	}
+
+	void test_default_alignment_matches_allocator()
+	{
+		rstl::monotonic_buffer_resource arenaResource;
+		rstl::polymorphic_allocator polymorphic(&arenaResource);
+
+		// Leave the arena cursor 8 bytes past a 16-byte boundary.
+		arenaResource.allocate(8, 8);
+		void* const p = polymorphic.allocate(24);
+		RSTL_TEST_CHECK(p && ((uintptr_t)p % ALLOCATOR_DEFAULT_ALIGNMENT) == 0);
+
+		rstl::allocator allocator;
+		void* const q = allocator.allocate(24);
+		RSTL_TEST_CHECK(((uintptr_t)q % ALLOCATOR_DEFAULT_ALIGNMENT) == 0);
+		allocator.deallocate(q, 24);
+	}
+
+}
+
+int main()
+{
+	test_scope_allocates_from_arena();
+	test_arena_allocator_and_pool_behind_a_scope();
+	test_scopes_nest_and_override_the_global_default();
+	test_pool_refilled_in_a_scope_outlives_it();
+	test_default_alignment_matches_allocator();
+	return 0;
+}
@@ -0,0 +1,141 @@
+#include "test_common.h"
+
+#include "deferred_reclaimer.h"
+
+#include <atomic>
+#include <new>
+#include <thread>
+#include <vector>
+
+/*
+ * flush() returns only after everything pushed before it has been reclaimed, even
+ * while other threads keep pushing, and pending() never reports more than was pushed.
+ *
+ * deferred_delete deletes inline when it cannot allocate its node.
+ * */
+
+// rstl::allocator takes its heap blocks from new[]; this lets a test make it fail.
+thread_local bool tbFailArrayNew = false;
+
+void* operator new[](size_t n)
+{
+	if(tbFailArrayNew)
+	{
+		throw std::bad_alloc();
+	}
+	return ::operator new(n);
+}
+
+namespace {
+
+	constexpr int kThreadCount = 4;
+	constexpr int kRounds = 5000;
+
+	struct counted_node : rstl::deferred_node
+	{
+		std::atomic<bool>* mpReclaimed;
+
+		explicit counted_node(std::atomic<bool>* pReclaimed) : rstl::deferred_node{ nullptr, &reclaim }, mpReclaimed(pReclaimed) { }
+
+		static void reclaim(rstl::deferred_node* pNode) noexcept
+		{
+			static_cast<counted_node*>(pNode)->mpReclaimed->store(true, std::memory_order_release);
+		}
+	};
+
+	void test_flush_waits_for_earlier_pushes()
+	{
+		// Single-item batches let a miscounted push satisfy a flush one node too early.
+		rstl::deferred_reclaimer::options opts;
+		opts.mBatchSize = 1;
+		rstl::deferred_reclaimer reclaimer(opts);
+		std::atomic<bool> bFailed(false);
+
+		std::vector<std::thread> threads;
+		for(int t = 0; t < kThreadCount; ++t)
+		{
+			threads.emplace_back([&]
+			{
+				for(int round = 0; round < kRounds; ++round)
+				{
+					std::atomic<bool> bReclaimed(false);
+					counted_node node(&bReclaimed);
+					reclaimer.push(&node);
+					reclaimer.flush();
+					if(!bReclaimed.load(std::memory_order_acquire))
+					{
+						bFailed.store(true);
+						return;
+					}
+					if(reclaimer.pending() > (size_t)kThreadCount)
+					{
+						bFailed.store(true);
+						return;
+					}
+				}
+			});
+		}
+		for(std::thread& thread : threads)
+		{
+			thread.join();
+		}
+
+		RSTL_TEST_CHECK(!bFailed.load());
+		reclaimer.drain();
+		RSTL_TEST_CHECK(reclaimer.pending() == 0);
+	}
+
+	void test_push_after_drain_runs_inline()
+	{
+		rstl::deferred_reclaimer reclaimer;
+		std::atomic<bool> bFirst(false);
+		counted_node first(&bFirst);
+		reclaimer.push(&first);
+		reclaimer.drain();
+		RSTL_TEST_CHECK(bFirst.load());
+
+		std::atomic<bool> bSecond(false);
+		counted_node second(&bSecond);
+		reclaimer.push(&second);
+		RSTL_TEST_CHECK(bSecond.load());
+		RSTL_TEST_CHECK(reclaimer.pending() == 0);
+	}
+
+	struct counting_delete
+	{
+		int* mpDeleted;
+
+		void operator()(int* p) const noexcept
+		{
+			delete p;
+			++*mpDeleted;
+		}
+	};
+
+	void test_deferred_delete_out_of_memory_runs_inline()
+	{
+		rstl::deferred_reclaimer reclaimer;
+		int deleted = 0;
+		const rstl::deferred_delete<int, counting_delete> deleter(counting_delete{ &deleted }, &reclaimer);
+
+		int* const p = new int(1);
+		tbFailArrayNew = true;
+		deleter(p);
+		tbFailArrayNew = false;
+
+#if !RSTL_THREAD_CACHE_DEFAULT_ALLOCATOR // The thread cache may still have a block to hand out.
+		RSTL_TEST_CHECK(deleted == 1);
+#endif
+		reclaimer.drain();
+		RSTL_TEST_CHECK(deleted == 1);
+	}
+
+}
+
+int main()
+{
+	test_flush_waits_for_earlier_pushes();
+	test_push_after_drain_runs_inline();
+	test_deferred_delete_out_of_memory_runs_inline();
+	return 0;
+}
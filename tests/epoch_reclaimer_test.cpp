@@ -0,0 +1,142 @@
+#include "test_common.h"
+
+#include "epoch_reclaimer.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/*
+ * A pinned reader holds back reclamation in its domain, even after leaving a nested
+ * guard, and its node is freed within a few reclaims once it unpins. Readers racing
+ * writers never see a freed node, and every retired node is freed exactly once.
+ * */
+
+namespace {
+
+	constexpr int kThreadCount = 4;
+	constexpr int kRounds = 20000;
+	constexpr int kLiveMagic = 0x5eed;
+
+	std::atomic<int> gLiveNodes(0);
+
+	struct node
+	{
+		int mMagic = kLiveMagic;
+
+		node() { gLiveNodes.fetch_add(1, std::memory_order_relaxed); }
+		~node() { mMagic = 0; gLiveNodes.fetch_sub(1, std::memory_order_relaxed); }
+	};
+
+	void wait_for(const std::atomic<int>& phase, int value)
+	{
+		while(phase.load(std::memory_order_acquire) != value)
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	void reclaim_all(rstl::epoch_domain& domain)
+	{
+		for(int i = 0; (i < 4) && domain.retired_count(); ++i)
+		{
+			domain.reclaim();
+		}
+	}
+
+	void test_pinned_reader_holds_back_reclamation()
+	{
+		rstl::epoch_domain domain;
+		std::atomic<node*> source(new node());
+		std::atomic<int> phase(0);
+		uint64_t pinnedEpoch = 0;
+		bool bReadAfterRetire = false;
+
+		std::thread reader([&]
+		{
+			{
+				rstl::epoch_guard outer(domain);
+				pinnedEpoch = domain.epoch();
+				const node* const p = source.load(std::memory_order_acquire);
+				{
+					rstl::epoch_guard inner(domain);
+				}
+				phase.store(1, std::memory_order_release);
+				wait_for(phase, 2);
+				bReadAfterRetire = (p->mMagic == kLiveMagic);
+			}
+			phase.store(3, std::memory_order_release);
+			wait_for(phase, 4);
+		});
+
+		wait_for(phase, 1);
+		domain.retire(source.exchange(nullptr));
+		for(int i = 0; i < 8; ++i)
+		{
+			domain.reclaim();
+		}
+		RSTL_TEST_CHECK(gLiveNodes.load() == 1);
+		RSTL_TEST_CHECK(domain.epoch() <= pinnedEpoch + 1);
+		phase.store(2, std::memory_order_release);
+
+		wait_for(phase, 3);
+		reclaim_all(domain);
+		RSTL_TEST_CHECK(gLiveNodes.load() == 0);
+		RSTL_TEST_CHECK(domain.retired_count() == 0);
+		phase.store(4, std::memory_order_release);
+		reader.join();
+		RSTL_TEST_CHECK(bReadAfterRetire);
+	}
+
+	void test_readers_race_writers()
+	{
+		rstl::epoch_domain domain;
+		std::atomic<node*> source(new node());
+		std::atomic<int> writersLeft(kThreadCount / 2);
+		std::atomic<bool> bFailed(false);
+
+		std::vector<std::thread> threads;
+		for(int t = 0; t < kThreadCount / 2; ++t)
+		{
+			threads.emplace_back([&]
+			{
+				for(int round = 0; round < kRounds; ++round)
+				{
+					node* const pOld = source.exchange(new node(), std::memory_order_acq_rel);
+					domain.retire(pOld);
+				}
+				writersLeft.fetch_sub(1, std::memory_order_release);
+			});
+			threads.emplace_back([&]
+			{
+				while(writersLeft.load(std::memory_order_acquire) > 0)
+				{
+					rstl::epoch_guard guard(domain);
+					const node* const p = source.load(std::memory_order_acquire);
+					if(p->mMagic != kLiveMagic)
+					{
+						bFailed.store(true);
+					}
+				}
+			});
+		}
+		for(std::thread& thread : threads)
+		{
+			thread.join();
+		}
+
+		domain.retire(source.exchange(nullptr));
+		reclaim_all(domain);
+		RSTL_TEST_CHECK(!bFailed.load());
+		RSTL_TEST_CHECK(gLiveNodes.load() == 0);
+		RSTL_TEST_CHECK(domain.retired_count() == 0);
+	}
+
+}
+
+int main()
+{
+	test_pinned_reader_holds_back_reclamation();
+	test_readers_race_writers();
+	return 0;
+}
@@ -0,0 +1,148 @@
+#include "test_common.h"
+
+#include "hazard_pointer.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/*
+ * A retired node is reclaimed exactly once, and never while a hazard_pointer still
+ * protects it: not by its own thread's scans, not by other threads' scans while
+ * readers race writers, and not when a thread holds more hazard_pointers than its
+ * record has slots.
+ * */
+
+namespace {
+
+	constexpr int kThreadCount = 4;
+	constexpr int kRounds = 20000;
+	constexpr int kLiveMagic = 0x5eed;
+
+	std::atomic<int> gLiveNodes(0);
+
+	struct node
+	{
+		int mMagic = kLiveMagic;
+
+		node() { gLiveNodes.fetch_add(1, std::memory_order_relaxed); }
+		~node() { mMagic = 0; gLiveNodes.fetch_sub(1, std::memory_order_relaxed); }
+	};
+
+	struct counting_delete
+	{
+		std::atomic<int>* mpDeleted;
+
+		void operator()(node* p) const noexcept
+		{
+			delete p;
+			mpDeleted->fetch_add(1, std::memory_order_relaxed);
+		}
+	};
+
+	void test_protected_node_survives_scans()
+	{
+		rstl::hazard_pointer_domain domain(1);
+		std::atomic<node*> source(new node());
+		std::atomic<int> deleted(0);
+
+		rstl::hazard_pointer hazard(domain);
+		node* const pProtected = hazard.protect(source);
+		domain.retire(source.exchange(nullptr), counting_delete{ &deleted });
+
+		// A threshold of one scans on every retire.
+		for(int i = 0; i < 16; ++i)
+		{
+			domain.retire(new node(), counting_delete{ &deleted });
+		}
+		domain.reclaim();
+		RSTL_TEST_CHECK(deleted.load() == 16);
+		RSTL_TEST_CHECK(pProtected->mMagic == kLiveMagic);
+		RSTL_TEST_CHECK(domain.retired_count() == 1);
+
+		hazard.reset_protection();
+		domain.reclaim();
+		RSTL_TEST_CHECK(deleted.load() == 17);
+		RSTL_TEST_CHECK(domain.retired_count() == 0);
+	}
+
+	void test_more_hazards_than_slots()
+	{
+		constexpr size_t kNodeCount = 3 * rstl::Hazard_Pointer_Internal::kSlotsPerRecord;
+		rstl::hazard_pointer_domain domain;
+		std::vector<std::atomic<node*>> sources(kNodeCount);
+		std::vector<rstl::hazard_pointer> hazards;
+		for(std::atomic<node*>& source : sources)
+		{
+			source.store(new node());
+			hazards.emplace_back(domain);
+			hazards.back().protect(source);
+		}
+
+		for(std::atomic<node*>& source : sources)
+		{
+			domain.retire(source.exchange(nullptr));
+		}
+		domain.reclaim();
+		RSTL_TEST_CHECK(gLiveNodes.load() == (int)kNodeCount);
+
+		hazards.clear();
+		domain.reclaim();
+		RSTL_TEST_CHECK(gLiveNodes.load() == 0);
+	}
+
+	void test_readers_race_writers()
+	{
+		rstl::hazard_pointer_domain domain;
+		std::atomic<node*> source(new node());
+		std::atomic<int> deleted(0);
+		std::atomic<int> writersLeft(kThreadCount / 2);
+		std::atomic<bool> bFailed(false);
+
+		std::vector<std::thread> threads;
+		for(int t = 0; t < kThreadCount / 2; ++t)
+		{
+			threads.emplace_back([&]
+			{
+				for(int round = 0; round < kRounds; ++round)
+				{
+					domain.retire(source.exchange(new node()), counting_delete{ &deleted });
+				}
+				writersLeft.fetch_sub(1, std::memory_order_release);
+			});
+			threads.emplace_back([&]
+			{
+				rstl::hazard_pointer hazard(domain);
+				while(writersLeft.load(std::memory_order_acquire) > 0)
+				{
+					const node* const p = hazard.protect(source);
+					if(p->mMagic != kLiveMagic)
+					{
+						bFailed.store(true);
+					}
+					hazard.reset_protection();
+				}
+			});
+		}
+		for(std::thread& thread : threads)
+		{
+			thread.join();
+		}
+
+		domain.retire(source.exchange(nullptr), counting_delete{ &deleted });
+		domain.reclaim();
+		RSTL_TEST_CHECK(!bFailed.load());
+		RSTL_TEST_CHECK(deleted.load() == (kThreadCount / 2) * kRounds + 1);
+		RSTL_TEST_CHECK(gLiveNodes.load() == 0);
+		RSTL_TEST_CHECK(domain.retired_count() == 0);
+	}
+
+}
+
+int main()
+{
+	test_protected_node_survives_scans();
+	test_more_hazards_than_slots();
+	test_readers_race_writers();
+	return 0;
+}
@@ -0,0 +1,160 @@
+#include "test_common.h"
+
+#include "rcu_ptr.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/*
+ * A snapshot outlives its replacement for as long as a read_guard that saw it is
+ * alive, and is destroyed within a few reclaims after that. Readers racing writers
+ * only ever see whole snapshots, modify() loses no updates, and every snapshot is
+ * destroyed exactly once.
+ * */
+
+namespace {
+
+	constexpr int kThreadCount = 4;
+	constexpr int kRounds = 5000;
+
+	std::atomic<int> gLiveSnapshots(0);
+
+	struct config
+	{
+		int mVersion;
+		int mCheck; // Always -mVersion in a published snapshot.
+
+		explicit config(int version) : mVersion(version), mCheck(-version)
+		{
+			gLiveSnapshots.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		config(const config& other) : mVersion(other.mVersion), mCheck(other.mCheck)
+		{
+			gLiveSnapshots.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		~config()
+		{
+			mCheck = 0;
+			gLiveSnapshots.fetch_sub(1, std::memory_order_relaxed);
+		}
+	};
+
+	void wait_for(const std::atomic<int>& phase, int value)
+	{
+		while(phase.load(std::memory_order_acquire) != value)
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	void reclaim_all(rstl::epoch_domain& domain)
+	{
+		for(int i = 0; (i < 4) && domain.retired_count(); ++i)
+		{
+			domain.reclaim();
+		}
+	}
+
+	void test_guard_outlives_update()
+	{
+		rstl::epoch_domain domain;
+		rstl::rcu_ptr<config> ptr(config(1), rstl::allocator(), domain);
+		std::atomic<int> phase(0);
+		bool bOldStillValid = false;
+
+		std::thread reader([&]
+		{
+			{
+				const rstl::rcu_ptr<config>::read_guard guard = ptr.read();
+				phase.store(1, std::memory_order_release);
+				wait_for(phase, 2);
+				bOldStillValid = (guard->mVersion == 1) && (guard->mCheck == -1);
+			}
+			phase.store(3, std::memory_order_release);
+			wait_for(phase, 4);
+		});
+
+		wait_for(phase, 1);
+		ptr.update(config(2));
+		for(int i = 0; i < 8; ++i)
+		{
+			domain.reclaim();
+		}
+		RSTL_TEST_CHECK(gLiveSnapshots.load() == 2);
+		RSTL_TEST_CHECK(ptr.read()->mVersion == 2);
+		phase.store(2, std::memory_order_release);
+
+		wait_for(phase, 3);
+		reclaim_all(domain);
+		RSTL_TEST_CHECK(gLiveSnapshots.load() == 1);
+		phase.store(4, std::memory_order_release);
+		reader.join();
+		RSTL_TEST_CHECK(bOldStillValid);
+
+		ptr.reset();
+		RSTL_TEST_CHECK(!ptr.read());
+		reclaim_all(domain);
+		RSTL_TEST_CHECK(gLiveSnapshots.load() == 0);
+	}
+
+	void test_readers_race_modify()
+	{
+		rstl::epoch_domain domain;
+		{
+			rstl::rcu_ptr<config> ptr(config(0), rstl::allocator(), domain);
+			std::atomic<int> writersLeft(kThreadCount / 2);
+			std::atomic<bool> bFailed(false);
+
+			std::vector<std::thread> threads;
+			for(int t = 0; t < kThreadCount / 2; ++t)
+			{
+				threads.emplace_back([&]
+				{
+					for(int round = 0; round < kRounds; ++round)
+					{
+						ptr.modify([](config& c)
+						{
+							++c.mVersion;
+							c.mCheck = -c.mVersion;
+						});
+					}
+					writersLeft.fetch_sub(1, std::memory_order_release);
+				});
+				threads.emplace_back([&]
+				{
+					int lastVersion = 0;
+					while(writersLeft.load(std::memory_order_acquire) > 0)
+					{
+						const rstl::rcu_ptr<config>::read_guard guard = ptr.read();
+						if((guard->mCheck != -guard->mVersion) || (guard->mVersion < lastVersion))
+						{
+							bFailed.store(true);
+						}
+						lastVersion = guard->mVersion;
+					}
+				});
+			}
+			for(std::thread& thread : threads)
+			{
+				thread.join();
+			}
+
+			RSTL_TEST_CHECK(!bFailed.load());
+			RSTL_TEST_CHECK(ptr.read()->mVersion == (kThreadCount / 2) * kRounds);
+		}
+		reclaim_all(domain);
+		RSTL_TEST_CHECK(gLiveSnapshots.load() == 0);
+		RSTL_TEST_CHECK(domain.retired_count() == 0);
+	}
+
+}
+
+int main()
+{
+	test_guard_outlives_update();
+	test_readers_race_modify();
+	return 0;
+}
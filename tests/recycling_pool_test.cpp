@@ -0,0 +1,152 @@
+#include "test_common.h"
+
+#include "recycling_pool.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+/*
+ * A pooled type deriving from enable_shared_from_this holds a weak reference to its
+ * own block; it must still be recycled rather than leaked.
+ *
+ * A destroyed pool must give up the per-thread shard slots it held, both on the
+ * destroying thread and on other threads that used it, so later pools do not fall back
+ * to the shared overflow shard.
+ * */
+
+namespace {
+
+	struct self_aware : rstl::enable_shared_from_this<self_aware>
+	{
+		int mValue = 0;
+
+		void reset()
+		{
+			mValue = 0;
+		}
+	};
+
+	void test_enable_shared_from_this_is_recycled()
+	{
+		rstl::recycling_pool<self_aware> pool;
+		for(int i = 0; i < 5; ++i)
+		{
+			rstl::shared_ptr<self_aware> p = pool.acquire();
+			RSTL_TEST_CHECK(p->mValue == 0);
+			p->mValue = i + 1;
+			rstl::shared_ptr<self_aware> self = p->shared_from_this();
+			RSTL_TEST_CHECK(self.get() == p.get());
+			RSTL_TEST_CHECK(p.use_count() == 2);
+		}
+		RSTL_TEST_CHECK(pool.created_count() == 1);
+		RSTL_TEST_CHECK(pool.outstanding_count() == 0);
+		RSTL_TEST_CHECK(pool.idle_count() == 1);
+	}
+
+	void test_user_weak_ptr_delays_recycling()
+	{
+		rstl::recycling_pool<self_aware> pool;
+		rstl::weak_ptr<self_aware> weak;
+		{
+			rstl::shared_ptr<self_aware> p = pool.acquire();
+			weak = p->weak_from_this();
+		}
+		RSTL_TEST_CHECK(weak.expired());
+		RSTL_TEST_CHECK(pool.idle_count() == 0);
+
+		weak.reset();
+		RSTL_TEST_CHECK(pool.idle_count() == 1);
+
+		rstl::shared_ptr<self_aware> p = pool.acquire();
+		RSTL_TEST_CHECK(p->shared_from_this() == p);
+		RSTL_TEST_CHECK(pool.created_count() == 1);
+	}
+
+	// Exposes the number of idle objects parked on the shared overflow shard.
+	struct inspectable_pool : rstl::recycling_pool<int>
+	{
+		size_t overflow_count()
+		{
+			rstl::Thread_Support_Internal::auto_mutex lock(mpCore->mOverflow.mMutex);
+			return mpCore->mOverflow.mCount;
+		}
+	};
+
+	void use_once(rstl::recycling_pool<int>& pool)
+	{
+		rstl::shared_ptr<int> p = pool.acquire();
+	}
+
+	void test_destroyed_pools_free_their_slots()
+	{
+		for(size_t i = 0; i < rstl::Recycling_Pool_Internal::kCachedPools; ++i)
+		{
+			rstl::recycling_pool<int> pool;
+			use_once(pool);
+		}
+
+		inspectable_pool pool;
+		use_once(pool);
+		RSTL_TEST_CHECK(pool.idle_count() == 1);
+		RSTL_TEST_CHECK(pool.overflow_count() == 0);
+	}
+
+	void test_pools_destroyed_elsewhere_free_their_slots()
+	{
+		constexpr size_t kPools = rstl::Recycling_Pool_Internal::kCachedPools;
+		rstl::recycling_pool<int>* pools[kPools];
+		for(rstl::recycling_pool<int>*& pPool : pools)
+		{
+			pPool = new rstl::recycling_pool<int>();
+		}
+
+		inspectable_pool pool;
+		size_t overflow = ~size_t(0);
+		bool usedPools = false;
+		bool destroyedPools = false;
+		std::mutex mutex;
+		std::condition_variable changed;
+
+		std::thread worker([&]
+		{
+			for(rstl::recycling_pool<int>* pPool : pools)
+			{
+				use_once(*pPool);
+			}
+			std::unique_lock<std::mutex> lock(mutex);
+			usedPools = true;
+			changed.notify_all();
+			changed.wait(lock, [&] { return destroyedPools; });
+			lock.unlock();
+
+			use_once(pool);
+			overflow = pool.overflow_count();
+		});
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			changed.wait(lock, [&] { return usedPools; });
+			for(rstl::recycling_pool<int>* pPool : pools)
+			{
+				delete pPool;
+			}
+			destroyedPools = true;
+			changed.notify_all();
+		}
+		worker.join();
+
+		RSTL_TEST_CHECK(pool.idle_count() == 1);
+		RSTL_TEST_CHECK(overflow == 0);
+	}
+
+}
+
+int main()
+{
+	test_enable_shared_from_this_is_recycled();
+	test_user_weak_ptr_delays_recycling();
+	test_destroyed_pools_free_their_slots();
+	test_pools_destroyed_elsewhere_free_their_slots();
+	return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef RSTL_TEST_COMMON_H
+#define RSTL_TEST_COMMON_H
+
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+/*
+ * Checks a condition even in release builds, reporting the failing expression and
+ * exiting with a failure status so that ctest records it.
+ * */
+#define RSTL_TEST_CHECK(condition) \
+	do \
+	{ \
+		if(!(condition)) \
+		{ \
+			std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			std::exit(EXIT_FAILURE); \
+		} \
+	} \
+	while(0)
+
+#endif //RSTL_TEST_COMMON_H
@@ -0,0 +1,87 @@
+#include "test_common.h"
+
+#include "internal/thread_cache.h"
+
+#include <thread>
+
+/*
+ * Thread-local objects destroyed after the thread cache may still allocate and free
+ * through it; they must never be handed a block that was already given back.
+ * */
+
+namespace {
+
+	using namespace rstl::Thread_Cache_Internal;
+
+	constexpr size_t kSize = 64;
+	constexpr size_t kDrainCount = kBatchSize * 8;
+
+	void* gpLateBlock = nullptr;
+
+	struct late_user
+	{
+		bool mbActive = false;
+
+		// Constructed before the cache, so destroyed after it.
+		~late_user()
+		{
+			if(mbActive)
+			{
+				gpLateBlock = cache_allocate(kSize);
+			}
+		}
+	};
+
+	thread_local late_user tLateUser;
+
+	// Exits holding one block, so the thread cache hands back a short list on exit.
+	void* exit_with_short_magazine(bool bLateUser)
+	{
+		void* pHeld = nullptr;
+		std::thread worker([&]
+		{
+			tLateUser.mbActive = bLateUser;
+			pHeld = cache_allocate(kSize);
+		});
+		worker.join();
+		return pHeld;
+	}
+
+	void test_use_after_thread_cache_destroyed()
+	{
+		void* const pHeld1 = exit_with_short_magazine(true);
+		RSTL_TEST_CHECK(gpLateBlock != nullptr);
+
+		// A second short list completes a batch out of everything handed back so far.
+		void* const pHeld2 = exit_with_short_magazine(false);
+
+		bool bHandedOutTwice = false;
+		std::thread drainer([&]
+		{
+			void* blocks[kDrainCount];
+			for(void*& p : blocks)
+			{
+				p = cache_allocate(kSize);
+				bHandedOutTwice |= (p == gpLateBlock);
+			}
+			for(void* const p : blocks)
+			{
+				cache_deallocate(p, kSize);
+			}
+		});
+		drainer.join();
+		RSTL_TEST_CHECK(!bHandedOutTwice);
+
+		// Blocks freed after destruction go back to the central cache.
+		cache_deallocate(gpLateBlock, kSize);
+		cache_deallocate(pHeld1, kSize);
+		cache_deallocate(pHeld2, kSize);
+	}
+
+}
+
+int main()
+{
+	test_use_after_thread_cache_destroyed();
+	return 0;
+}
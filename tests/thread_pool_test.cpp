@@ -0,0 +1,154 @@
+#include "test_common.h"
+
+#include "thread_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Idle workers steal tasks from a busy worker's deque, the destructor runs every task
+ * submitted before it, including those they submit, and task_handle::get() returns a
+ * task's result or rethrows its exception, also when waited on from inside the pool.
+ * */
+
+namespace {
+
+	constexpr int kChildCount = 64;
+
+	rstl::thread_pool::options pool_options(size_t threadCount)
+	{
+		rstl::thread_pool::options opts;
+		opts.mThreadCount = threadCount;
+		opts.mSpinCount = 64;
+		return opts;
+	}
+
+	void test_idle_workers_steal()
+	{
+		rstl::thread_pool pool(pool_options(4));
+		std::atomic<int> done(0);
+		std::atomic<int> ranOnParent(0);
+
+		const ptrdiff_t parent = pool.submit([&]
+		{
+			const ptrdiff_t self = pool.current_worker_index();
+			for(int i = 0; i < kChildCount; ++i)
+			{
+				pool.post([&, self]
+				{
+					if(pool.current_worker_index() == self)
+					{
+						ranOnParent.fetch_add(1);
+					}
+					done.fetch_add(1);
+				});
+			}
+
+			// Busy without helping, so the children, all on this worker's deque, can only be stolen.
+			const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+			while((done.load() < kChildCount) && (std::chrono::steady_clock::now() < deadline))
+			{
+				std::this_thread::yield();
+			}
+			return self;
+		}).get();
+
+		RSTL_TEST_CHECK(parent >= 0);
+		RSTL_TEST_CHECK(done.load() == kChildCount);
+		RSTL_TEST_CHECK(ranOnParent.load() == 0);
+	}
+
+	void test_destructor_drains()
+	{
+		std::atomic<int> ran(0);
+		{
+			rstl::thread_pool pool(pool_options(2));
+			for(int i = 0; i < kChildCount; ++i)
+			{
+				pool.post([&]
+				{
+					for(int j = 0; j < 4; ++j)
+					{
+						pool.post([&]
+						{
+							std::this_thread::yield();
+							ran.fetch_add(1);
+						});
+					}
+					ran.fetch_add(1);
+				});
+			}
+		}
+		RSTL_TEST_CHECK(ran.load() == kChildCount * 5);
+	}
+
+	int fibonacci(rstl::thread_pool& pool, int n)
+	{
+		if(n < 2)
+		{
+			return n;
+		}
+		rstl::task_handle<int> a = pool.submit([&pool, n] { return fibonacci(pool, n - 1); });
+		const int b = fibonacci(pool, n - 2);
+		return a.get() + b;
+	}
+
+	void test_get_returns_results()
+	{
+		rstl::thread_pool pool(pool_options(2));
+		rstl::task_handle<int> handle = pool.submit([&pool] { return fibonacci(pool, 16); });
+		RSTL_TEST_CHECK(handle.valid());
+		RSTL_TEST_CHECK(handle.get() == 987);
+		RSTL_TEST_CHECK(!handle.valid());
+
+		rstl::task_handle<std::string> text = pool.submit([] { return std::string(100, 'x'); });
+		RSTL_TEST_CHECK(text.get() == std::string(100, 'x'));
+	}
+
+	void test_get_rethrows()
+	{
+		rstl::thread_pool pool(pool_options(2));
+
+		rstl::task_handle<void> handle = pool.submit([] { throw std::runtime_error("outer"); });
+		bool bCaught = false;
+		try
+		{
+			handle.get();
+		}
+		catch(const std::runtime_error& e)
+		{
+			bCaught = (std::string(e.what()) == "outer");
+		}
+		RSTL_TEST_CHECK(bCaught);
+		RSTL_TEST_CHECK(!handle.valid());
+
+		// A task waiting on a failed task sees the exception and may handle it.
+		rstl::task_handle<int> nested = pool.submit([&pool]
+		{
+			rstl::task_handle<int> inner = pool.submit([]() -> int { throw std::logic_error("inner"); });
+			try
+			{
+				return inner.get();
+			}
+			catch(const std::logic_error&)
+			{
+				return -1;
+			}
+		});
+		RSTL_TEST_CHECK(nested.get() == -1);
+	}
+
+}
+
+int main()
+{
+	test_idle_workers_steal();
+	test_destructor_drains();
+	test_get_returns_results();
+	test_get_rethrows();
+	return 0;
+}
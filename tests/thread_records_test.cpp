@@ -0,0 +1,108 @@
+#include "test_common.h"
+
+#include "epoch_reclaimer.h"
+#include "hazard_pointer.h"
+
+#include <atomic>
+#include <thread>
+
+/*
+ * Threads that exit with retired nodes still protected leave them on the domain's
+ * orphan list, and a later reclaim adopts and frees them once they are unprotected.
+ * */
+
+namespace {
+
+	constexpr int kThreadCount = 8;
+	constexpr int kNodesPerThread = 16;
+
+	std::atomic<int> gLiveNodes(0);
+
+	struct node
+	{
+		node() { gLiveNodes.fetch_add(1); }
+		~node() { gLiveNodes.fetch_sub(1); }
+	};
+
+	void test_hazard_orphans_are_adopted()
+	{
+		rstl::hazard_pointer_domain domain;
+		node* const pShared = new node();
+		std::atomic<node*> source(pShared);
+
+		rstl::hazard_pointer hazard(domain);
+		node* pProtected = source.load();
+		RSTL_TEST_CHECK(hazard.try_protect(pProtected, source));
+
+		std::thread retirer([&]
+		{
+			domain.retire(source.exchange(nullptr));
+		});
+		retirer.join();
+
+		// Sequential threads reuse the record the first one gave back.
+		for(int t = 0; t < kThreadCount; ++t)
+		{
+			std::thread([&]
+			{
+				for(int i = 0; i < kNodesPerThread; ++i)
+				{
+					domain.retire(new node());
+				}
+			}).join();
+		}
+
+		domain.reclaim();
+		RSTL_TEST_CHECK(gLiveNodes.load() == 1);
+
+		hazard.reset_protection();
+		domain.reclaim();
+		RSTL_TEST_CHECK(gLiveNodes.load() == 0);
+		RSTL_TEST_CHECK(domain.retired_count() == 0);
+	}
+
+	void test_epoch_orphans_are_adopted()
+	{
+		rstl::epoch_domain domain;
+		for(int t = 0; t < kThreadCount; ++t)
+		{
+			std::thread([&]
+			{
+				rstl::epoch_guard guard(domain);
+				for(int i = 0; i < kNodesPerThread; ++i)
+				{
+					domain.retire(new node());
+				}
+			}).join();
+		}
+
+		for(int i = 0; (i < 4) && domain.retired_count(); ++i)
+		{
+			domain.reclaim();
+		}
+		RSTL_TEST_CHECK(gLiveNodes.load() == 0);
+		RSTL_TEST_CHECK(domain.retired_count() == 0);
+	}
+
+	void test_domain_destroyed_before_thread_exit()
+	{
+		{
+			rstl::epoch_domain domain;
+			rstl::epoch_guard guard(domain);
+			domain.retire(new node());
+		}
+		// The thread's cache entry for the dead domain was dropped; a new domain may reuse the address.
+		rstl::epoch_domain domain;
+		rstl::epoch_guard guard(domain);
+		RSTL_TEST_CHECK(gLiveNodes.load() == 0);
+	}
+
+}
+
+int main()
+{
+	test_hazard_orphans_are_adopted();
+	test_epoch_orphans_are_adopted();
+	test_domain_destroyed_before_thread_exit();
+	return 0;
+}